@@ -0,0 +1,1209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "tinylisp.h"
+#include "parse.h"
+#include "eval.h"
+#include "writer.h"
+#include "image.h"
+#include "builtins.h"
+#include "resume.h"
+#include "stream.h"
+#include "stats.h"
+
+// Number of elements in the generated data literal
+#define BENCH_DATA_SIZE 200000
+// Number of rows in the generated table of records, and of distinct rows among them
+#define BENCH_TABLE_ROWS 50000
+#define BENCH_TABLE_DISTINCT 500
+// Number of definitions in the generated prelude
+#define BENCH_PRELUDE_SIZE 500
+// Where the prelude's image is saved for the startup benchmarks; the build sets this to a path in the
+// build directory, so that running the benchmarks leaves nothing in the working directory
+#ifndef BENCH_PRELUDE_IMAGE
+#define BENCH_PRELUDE_IMAGE "bench_prelude.tli"
+#endif
+// Second argument of each multiplication, and so the recursion depth; kept under the stack limit
+#define BENCH_MUL_DEPTH "100"
+// Argument of each Fibonacci call
+#define BENCH_FIB_N "22"
+// Evaluations run side by side by the resumable evaluation benchmarks, the form each runs and the steps
+// each is given at a time
+#define BENCH_TASKS 1000
+#define BENCH_TASK_FORM "(fib 15)"
+#define BENCH_TASK_SLICE 1000
+// Number of keys in the small and large lookup tables
+#define BENCH_TABLE_SMALL 10000
+#define BENCH_TABLE_LARGE 1000000
+// Number of elements sorted by the script level merge sort, whose merge recurses once per element and so
+// must stay under the stack limit, and by sort
+#define BENCH_SORT_SCRIPT_SIZE 96
+#define BENCH_SORT_SIZE 100000
+// Depth of the nested list parsed and printed, and length of the lists built and compared
+#define BENCH_NESTING_DEPTH 2000
+#define BENCH_LIST_SIZE "100000"
+// Records streamed through --map's function per iteration of the streaming benchmarks
+#define BENCH_STREAM_RECORDS 1000000
+// Records per second the small records must stream at
+#define BENCH_STREAM_TARGET 1000000
+// Percentage by which a benchmark may be slower than its baseline before it counts as a regression; the
+// median of several runs still moves by several percent between runs on a shared machine
+#define BENCH_THRESHOLD 15.0
+// Timed runs of each benchmark, of which the median is reported
+#define BENCH_REPEAT 5
+
+typedef void(*BenchFunc)(int iterations);
+
+struct bench_case_
+{
+	char* name;
+	BenchFunc run;
+	int iterations;
+};
+
+// The fewest records per second a benchmark must stream to pass
+struct bench_target_
+{
+	char* name;
+	double records_per_second;
+};
+
+// What was measured of a benchmark's timed run
+struct bench_result_
+{
+	double seconds;
+	double us_per_iteration;
+	double evaluations_per_second;
+	// source text parsed per second by the benchmarks which parse alone, otherwise 0
+	double mb_per_second;
+	// the most memory the parsed data held, for the benchmarks which measure it, otherwise 0
+	long held_kb;
+	// records streamed per second by the benchmarks which stream, otherwise 0
+	double records_per_second;
+	// the most resident memory at any point of the run, or of the whole process where that cannot be reset
+	long peak_rss_kb;
+};
+
+double bench_now()
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// A quoted list of BENCH_DATA_SIZE integers, symbols and small sublists, as it would appear in a script
+char* bench_data_text()
+{
+	static LispWriter text = NULL;
+	if (text != NULL)
+		return text->data;
+
+	text = lisp_writer_new(NULL, NULL);
+	lisp_writer_puts(text, "(q (");
+	for (int i = 0; i < BENCH_DATA_SIZE; ++i) {
+		switch (i % 4) {
+		case 0:
+			lisp_writer_integer(text, i * 7919);
+			break;
+		case 1:
+			lisp_writer_puts(text, "sym");
+			lisp_writer_integer(text, i % 97);
+			break;
+		case 2:
+			lisp_writer_puts(text, "(key");
+			lisp_writer_integer(text, i % 13);
+			lisp_writer_putc(text, ' ');
+			lisp_writer_integer(text, i);
+			lisp_writer_putc(text, ')');
+			break;
+		default:
+			lisp_writer_puts(text, "()");
+		}
+		lisp_writer_putc(text, ' ');
+	}
+	lisp_writer_puts(text, "))");
+	lisp_writer_putc(text, '\0');
+	return text->data;
+}
+
+// Bytes of source text parsed so far by the benchmarks which measure the parser alone
+long long bench_parsed_bytes = 0;
+// The most bytes held by the objects a benchmark built, for those which measure it
+long long bench_held_bytes = 0;
+// Records streamed so far by the benchmarks which stream
+long long bench_streamed_records = 0;
+
+// The evaluated data literal in the binary format of lisp_object_serialize
+LispWriter bench_data_binary()
+{
+	static LispWriter binary = NULL;
+	if (binary != NULL)
+		return binary;
+
+	TinyLisp lisp = lisp_new();
+	int pos = 0;
+	LispObject form = lisp_parse(lisp, bench_data_text(), &pos);
+	LispObject data = lisp_evaluate(lisp, form);
+	binary = lisp_writer_new(NULL, NULL);
+	lisp_object_serialize(binary, data);
+	lisp_object_free(data);
+	lisp_object_free(form);
+	lisp_free(lisp);
+	return binary;
+}
+
+// Parse and evaluate every form in text, discarding the results
+void bench_eval_text(TinyLisp lisp, char* text)
+{
+	int pos = 0;
+	for (;;) {
+		LispObject form = lisp_parse(lisp, text, &pos);
+		if (form == NULL)
+			break;
+		LispObject res = lisp_evaluate(lisp, form);
+		if (res != NULL)
+			lisp_object_free(res);
+		lisp_object_free(form);
+	}
+	lisp_clear_error(lisp);
+}
+
+// BENCH_PRELUDE_SIZE definitions of small functions and data tables
+char* bench_prelude_text()
+{
+	static LispWriter text = NULL;
+	if (text != NULL)
+		return text->data;
+
+	text = lisp_writer_new(NULL, NULL);
+	for (int i = 0; i < BENCH_PRELUDE_SIZE; ++i) {
+		if (i % 2 == 0) {
+			lisp_writer_puts(text, "(d fn");
+			lisp_writer_integer(text, i);
+			lisp_writer_puts(text, " (q ((a b) (i (l a b) (s b a) (s a (s 0 b))))))\n");
+		}
+		else {
+			lisp_writer_puts(text, "(d table");
+			lisp_writer_integer(text, i);
+			lisp_writer_puts(text, " (q (");
+			for (int j = 0; j < 16; ++j) {
+				lisp_writer_puts(text, "(k");
+				lisp_writer_integer(text, j);
+				lisp_writer_putc(text, ' ');
+				lisp_writer_integer(text, i * j);
+				lisp_writer_puts(text, ") ");
+			}
+			lisp_writer_puts(text, ")))\n");
+		}
+	}
+	lisp_writer_putc(text, '\0');
+
+	TinyLisp lisp = lisp_new();
+	bench_eval_text(lisp, text->data);
+	lisp_image_save(lisp, BENCH_PRELUDE_IMAGE);
+	lisp_free(lisp);
+	return text->data;
+}
+
+void bench_startup_prelude(int iterations)
+{
+	char* text = bench_prelude_text();
+	for (int i = 0; i < iterations; ++i) {
+		TinyLisp lisp = lisp_new();
+		bench_eval_text(lisp, text);
+		lisp_free(lisp);
+	}
+}
+
+void bench_startup_image(int iterations)
+{
+	bench_prelude_text();
+	for (int i = 0; i < iterations; ++i) {
+		TinyLisp lisp = lisp_new();
+		lisp_image_load(lisp, BENCH_PRELUDE_IMAGE);
+		lisp_free(lisp);
+	}
+}
+
+void bench_parse_data(int iterations)
+{
+	TinyLisp lisp = lisp_new();
+	char* text = bench_data_text();
+	for (int i = 0; i < iterations; ++i) {
+		int pos = 0;
+		LispObject form = lisp_parse(lisp, text, &pos);
+		LispObject data = lisp_evaluate(lisp, form);
+		lisp_object_free(data);
+		lisp_object_free(form);
+	}
+	lisp_free(lisp);
+}
+
+// Parse the data literal without evaluating it
+void bench_parse_throughput(int iterations)
+{
+	TinyLisp lisp = lisp_new();
+	char* text = bench_data_text();
+	for (int i = 0; i < iterations; ++i) {
+		int pos = 0;
+		LispObject form = lisp_parse(lisp, text, &pos);
+		if (form == NULL)
+			break;
+		lisp_object_free(form);
+		bench_parsed_bytes += pos;
+	}
+	lisp_free(lisp);
+}
+
+// Parse the definitions of the prelude, many short forms on lines of their own
+void bench_parse_prelude(int iterations)
+{
+	TinyLisp lisp = lisp_new();
+	char* text = bench_prelude_text();
+	for (int i = 0; i < iterations; ++i) {
+		int pos = 0;
+		for (;;) {
+			LispObject form = lisp_parse(lisp, text, &pos);
+			if (form == NULL)
+				break;
+			lisp_object_free(form);
+		}
+		lisp_clear_error(lisp);
+		bench_parsed_bytes += pos;
+	}
+	lisp_free(lisp);
+}
+
+// A quoted table of BENCH_TABLE_ROWS records, in which each of BENCH_TABLE_DISTINCT rows recurs and the rows
+// share most of their fields, as in generated data
+char* bench_table_text()
+{
+	static LispWriter text = NULL;
+	if (text != NULL)
+		return text->data;
+
+	text = lisp_writer_new(NULL, NULL);
+	lisp_writer_puts(text, "(q (");
+	for (int i = 0; i < BENCH_TABLE_ROWS; ++i) {
+		int row = i % BENCH_TABLE_DISTINCT;
+		lisp_writer_puts(text, "(record (id ");
+		lisp_writer_integer(text, row);
+		lisp_writer_puts(text, ") (city city");
+		lisp_writer_integer(text, row % 20);
+		lisp_writer_puts(text, ") (tags (new sale)) (point (x ");
+		lisp_writer_integer(text, row % 7);
+		lisp_writer_puts(text, ") (y ");
+		lisp_writer_integer(text, row % 11);
+		lisp_writer_puts(text, ")) (status active))\n");
+	}
+	lisp_writer_puts(text, "))");
+	lisp_writer_putc(text, '\0');
+	return text->data;
+}
+
+// Parse the table of records into an interpreter of its own, sharing equal objects if hash_cons is set, and
+// record the memory the parsed table holds
+void bench_parse_table(int iterations, int hash_cons)
+{
+	char* text = bench_table_text();
+	for (int i = 0; i < iterations; ++i) {
+		TinyLisp lisp = lisp_new();
+		lisp->hash_cons = hash_cons;
+		long long before = lisp_stats_live_bytes();
+		int pos = 0;
+		LispObject form = lisp_parse(lisp, text, &pos);
+		long long held = lisp_stats_live_bytes() - before;
+		if (held > bench_held_bytes)
+			bench_held_bytes = held;
+		if (form != NULL)
+			lisp_object_free(form);
+		lisp_free(lisp);
+		bench_parsed_bytes += pos;
+	}
+}
+
+void bench_parse_table_plain(int iterations)
+{
+	bench_parse_table(iterations, 0);
+}
+
+void bench_parse_table_hashcons(int iterations)
+{
+	bench_parse_table(iterations, 1);
+}
+
+// Compare two equal tables of records parsed separately, which share every row once hash-consed
+void bench_equal_table(int iterations, int hash_cons)
+{
+	TinyLisp lisp = lisp_new();
+	lisp->hash_cons = hash_cons;
+	int pos = 0;
+	LispObject lhs = lisp_parse(lisp, bench_table_text(), &pos);
+	pos = 0;
+	LispObject rhs = lisp_parse(lisp, bench_table_text(), &pos);
+	for (int i = 0; i < iterations && lhs != NULL && rhs != NULL; ++i)
+		lisp_object_equal(lhs, rhs);
+	if (lhs != NULL)
+		lisp_object_free(lhs);
+	if (rhs != NULL)
+		lisp_object_free(rhs);
+	lisp_free(lisp);
+}
+
+void bench_equal_table_plain(int iterations)
+{
+	bench_equal_table(iterations, 0);
+}
+
+void bench_equal_table_hashcons(int iterations)
+{
+	bench_equal_table(iterations, 1);
+}
+
+void bench_load_data(int iterations)
+{
+	LispWriter binary = bench_data_binary();
+	for (int i = 0; i < iterations; ++i) {
+		LispObject data;
+		lisp_object_deserialize((unsigned char*)binary->data, binary->size, &data);
+		lisp_object_free(data);
+	}
+}
+
+// The evaluated data literal, built once
+LispObject bench_data_list()
+{
+	static LispObject data = NULL;
+	if (data == NULL) {
+		LispWriter binary = bench_data_binary();
+		lisp_object_deserialize((unsigned char*)binary->data, binary->size, &data);
+	}
+	return data;
+}
+
+// Walk 1000 elements into the data list by taking the tail repeatedly, as a script reaching element k must
+void bench_tail_walk(int iterations)
+{
+	TinyLisp lisp = lisp_new();
+	LispObject data = bench_data_list();
+	for (int i = 0; i < iterations; ++i) {
+		LispObject list = lisp_object_create_reference(data);
+		for (int j = 0; j < 1000; ++j) {
+			LispObject rest = lisp_apply_tail(lisp, list);
+			lisp_object_free(list);
+			list = rest;
+		}
+		lisp_object_free(list);
+	}
+	lisp_free(lisp);
+}
+
+// Parse the single form in text once and evaluate it iterations times
+void bench_eval_repeat(TinyLisp lisp, char* text, int iterations)
+{
+	int pos = 0;
+	LispObject form = lisp_parse(lisp, text, &pos);
+	if (form == NULL)
+		return;
+	for (int i = 0; i < iterations; ++i) {
+		lisp_budget_start(lisp);
+		LispObject res = lisp_evaluate(lisp, form);
+		if (res != NULL)
+			lisp_object_free(res);
+	}
+	lisp_object_free(form);
+	lisp_clear_error(lisp);
+}
+
+#define BENCH_ARITHMETIC_PRELUDE \
+	"(d add (q ((a b) (s a (s 0 b)))))\n" \
+	"(d mul (q ((a b) (i b (add a (mul a (s b 1))) 0))))\n" \
+	"(d fib (q ((n) (i (l n 2) n (add (fib (s n 1)) (fib (s n 2)))))))\n" \
+	"(d sumrec (q ((k acc n) (i (l k n) (sumrec (add k 1) (add acc k) n) acc))))\n" \
+	"(d sumloop (q ((n) (loop ((k 0 (add k 1)) (acc 0 (add acc k))) (l k n) acc))))\n" \
+	"(d countrec (q ((k) (i k (countrec (s k 1)) 0))))\n" \
+	"(d countloop (q ((n) (loop ((k n (s k 1))) k 0))))\n" \
+	"(d ack (q ((m n) (i (e m 0) (add n 1) (i (e n 0) (ack (s m 1) 1) (ack (s m 1) (ack m (s n 1))))))))\n" \
+	"(d sumlist (q ((xs) (loop ((ys xs (t ys)) (acc 0 (add acc (h ys)))) ys acc))))\n"
+
+// Evaluate form iterations times after the arithmetic prelude with the given execution options
+void bench_arithmetic(int iterations, char* form, int optimize, int jit)
+{
+	TinyLisp lisp = lisp_new();
+	lisp->optimize = optimize;
+	lisp->jit = jit;
+	bench_eval_text(lisp, BENCH_ARITHMETIC_PRELUDE);
+	bench_eval_repeat(lisp, form, iterations);
+	lisp_free(lisp);
+}
+
+// Multiplication by repeated addition, recursing BENCH_MUL_DEPTH deep per call
+void bench_mul_unoptimized(int iterations)
+{
+	bench_arithmetic(iterations, "(mul 7 " BENCH_MUL_DEPTH ")", 0, 0);
+}
+
+void bench_mul_optimized(int iterations)
+{
+	bench_arithmetic(iterations, "(mul 7 " BENCH_MUL_DEPTH ")", 1, 0);
+}
+
+void bench_mul_jit(int iterations)
+{
+	bench_arithmetic(iterations, "(mul 7 " BENCH_MUL_DEPTH ")", 1, 1);
+}
+
+// Doubly recursive Fibonacci of BENCH_FIB_N
+void bench_fib_optimized(int iterations)
+{
+	bench_arithmetic(iterations, "(fib " BENCH_FIB_N ")", 1, 0);
+}
+
+void bench_fib_jit(int iterations)
+{
+	bench_arithmetic(iterations, "(fib " BENCH_FIB_N ")", 1, 1);
+}
+
+// fib_optimized under step, time and memory limits it never reaches, measuring the cost of checking them
+void bench_fib_budget(int iterations)
+{
+	TinyLisp lisp = lisp_new();
+	lisp->budget.max_steps = 1000000000000LL;
+	lisp->budget.max_ns = 60000000000LL;
+	lisp->budget.max_bytes = 1LL << 30;
+	bench_eval_text(lisp, BENCH_ARITHMETIC_PRELUDE);
+	bench_eval_repeat(lisp, "(fib " BENCH_FIB_N ")", iterations);
+	lisp_free(lisp);
+}
+
+// Ackermann's function of 3 and 3, which makes 2432 calls nesting at most 63 deep
+void bench_ackermann(int iterations)
+{
+	bench_arithmetic(iterations, "(ack 3 3)", 1, 0);
+}
+
+// Build a list of BENCH_LIST_SIZE integers and sum it
+void bench_list_build_sum(int iterations)
+{
+	bench_arithmetic(iterations, "(sumlist (collect (range 0 " BENCH_LIST_SIZE " 1)))", 1, 0);
+}
+
+// Compare two lists of BENCH_LIST_SIZE integers built separately, which are equal
+void bench_list_equal(int iterations)
+{
+	TinyLisp lisp = lisp_new();
+	bench_eval_text(lisp, "(d xs (collect (range 0 " BENCH_LIST_SIZE " 1)))\n(d ys (collect (range 0 " BENCH_LIST_SIZE " 1)))\n");
+	bench_eval_repeat(lisp, "(e xs ys)", iterations);
+	lisp_free(lisp);
+}
+
+// Parse a quoted list nested BENCH_NESTING_DEPTH deep, (q (0 (1 (2 ...)))), and print it back
+void bench_nested_parse_print(int iterations)
+{
+	LispWriter text = lisp_writer_new(NULL, NULL);
+	LispWriter out = lisp_writer_new(NULL, NULL);
+	lisp_writer_puts(text, "(q ");
+	for (int i = 0; i < BENCH_NESTING_DEPTH; ++i) {
+		lisp_writer_putc(text, '(');
+		lisp_writer_integer(text, i);
+		lisp_writer_putc(text, ' ');
+	}
+	for (int i = 0; i <= BENCH_NESTING_DEPTH; ++i)
+		lisp_writer_putc(text, ')');
+	lisp_writer_putc(text, '\0');
+	TinyLisp lisp = lisp_new();
+	for (int i = 0; i < iterations; ++i) {
+		int pos = 0;
+		LispObject form = lisp_parse(lisp, text->data, &pos);
+		if (form == NULL)
+			break;
+		LispObject data = lisp_evaluate(lisp, form);
+		if (data != NULL) {
+			lisp_object_write(out, data);
+			lisp_writer_clear(out);
+			lisp_object_free(data);
+		}
+		lisp_object_free(form);
+	}
+	lisp_free(lisp);
+	lisp_writer_free(out);
+	lisp_writer_free(text);
+}
+
+// Evaluate BENCH_TASK_FORM in each of BENCH_TASKS interpreters, either to the end one after another or
+// BENCH_TASK_SLICE steps at a time in turn
+void bench_tasks(int iterations, int interleave)
+{
+	TinyLisp* tasks = calloc(BENCH_TASKS, sizeof(TinyLisp));
+	LispObject* forms = calloc(BENCH_TASKS, sizeof(LispObject));
+	LispEval* evals = calloc(BENCH_TASKS, sizeof(LispEval));
+	int ready = tasks != NULL && forms != NULL && evals != NULL;
+	for (int i = 0; i < BENCH_TASKS && ready; ++i) {
+		int pos = 0;
+		tasks[i] = lisp_new();
+		ready = tasks[i] != NULL;
+		if (ready) {
+			bench_eval_text(tasks[i], BENCH_ARITHMETIC_PRELUDE);
+			forms[i] = lisp_parse(tasks[i], BENCH_TASK_FORM, &pos);
+			ready = forms[i] != NULL;
+		}
+	}
+	for (int iter = 0; iter < iterations && ready; ++iter) {
+		if (!interleave) {
+			for (int i = 0; i < BENCH_TASKS; ++i) {
+				lisp_budget_start(tasks[i]);
+				LispObject res = lisp_evaluate(tasks[i], forms[i]);
+				if (res != NULL)
+					lisp_object_free(res);
+			}
+			continue;
+		}
+		for (int i = 0; i < BENCH_TASKS; ++i)
+			evals[i] = lisp_eval_begin(tasks[i], forms[i]);
+		for (int running = BENCH_TASKS; running > 0;) {
+			running = 0;
+			for (int i = 0; i < BENCH_TASKS; ++i)
+				running += evals[i] != NULL && !lisp_eval_step(evals[i], BENCH_TASK_SLICE);
+		}
+		for (int i = 0; i < BENCH_TASKS; ++i) {
+			if (evals[i] == NULL)
+				continue;
+			LispObject res = lisp_eval_result(evals[i]);
+			if (res != NULL)
+				lisp_object_free(res);
+			lisp_eval_free(evals[i]);
+		}
+	}
+	for (int i = 0; i < BENCH_TASKS && tasks != NULL && forms != NULL; ++i) {
+		if (forms[i] != NULL)
+			lisp_object_free(forms[i]);
+		if (tasks[i] != NULL)
+			lisp_free(tasks[i]);
+	}
+	free(tasks);
+	free(forms);
+	free(evals);
+}
+
+void bench_tasks_sequential(int iterations)
+{
+	bench_tasks(iterations, 0);
+}
+
+void bench_tasks_interleaved(int iterations)
+{
+	bench_tasks(iterations, 1);
+}
+
+// Sum the integers below BENCH_MUL_DEPTH by recursion and with loop, and a loop too long to recurse through;
+// then count down from BENCH_MUL_DEPTH, which needs no calls of add
+void bench_sum_recursive(int iterations)
+{
+	bench_arithmetic(iterations, "(sumrec 0 0 " BENCH_MUL_DEPTH ")", 1, 0);
+}
+
+void bench_sum_loop(int iterations)
+{
+	bench_arithmetic(iterations, "(sumloop " BENCH_MUL_DEPTH ")", 1, 0);
+}
+
+void bench_sum_loop_1m(int iterations)
+{
+	bench_arithmetic(iterations, "(sumloop 1000000)", 1, 0);
+}
+
+void bench_count_recursive(int iterations)
+{
+	bench_arithmetic(iterations, "(countrec " BENCH_MUL_DEPTH ")", 1, 0);
+}
+
+void bench_count_loop(int iterations)
+{
+	bench_arithmetic(iterations, "(countloop " BENCH_MUL_DEPTH ")", 1, 0);
+}
+
+// Walk a million element pipeline of sequences with loop, holding one chunk of each stage at a time, and
+// collect the same pipeline into a list
+#define BENCH_SEQ_PIPELINE "(filter (q ((x) (l 0 x))) (map (q ((x) (add x x))) (range 0 1000000)))"
+
+void bench_seq_walk_1m(int iterations)
+{
+	bench_arithmetic(iterations, "(loop ((xs " BENCH_SEQ_PIPELINE " (t xs)) (n 0 (add n 1))) xs n)", 1, 0);
+}
+
+void bench_seq_collect_1m(int iterations)
+{
+	bench_arithmetic(iterations, "(len (collect " BENCH_SEQ_PIPELINE "))", 1, 0);
+}
+
+// One invocation of an expanding macro per iteration, with the options given
+void bench_macro(int iterations, char* options)
+{
+	TinyLisp lisp = lisp_new();
+	LispWriter text = lisp_writer_new(NULL, NULL);
+	lisp_writer_puts(text, "(d unless (q ((expand ");
+	lisp_writer_puts(text, options);
+	lisp_writer_puts(text, ") (p a b) (c (q i) (c p (c b (c a ())))))))\n");
+	lisp_writer_puts(text, "(d pick (q ((n) (unless n 7 (s n 1)))))\n");
+	lisp_writer_putc(text, '\0');
+	bench_eval_text(lisp, text->data);
+	bench_eval_repeat(lisp, "(pick 3)", iterations);
+	lisp_writer_free(text);
+	lisp_free(lisp);
+}
+
+void bench_macro_cached(int iterations)
+{
+	bench_macro(iterations, "");
+}
+
+void bench_macro_impure(int iterations)
+{
+	bench_macro(iterations, "impure");
+}
+
+// The symbol key<i>, the i-th key of a lookup table
+LispObject bench_table_key(int i)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "key%d", i);
+	return lisp_symbol_new(name);
+}
+
+// A map and an association list ((key0 0) (key1 1) ...) binding the same n keys, built once per size
+void bench_tables(int n, LispObject* map, LispObject* alist)
+{
+	static LispObject maps[2] = { NULL, NULL };
+	static LispObject alists[2] = { NULL, NULL };
+	int which = n == BENCH_TABLE_SMALL ? 0 : 1;
+	if (maps[which] == NULL) {
+		maps[which] = lisp_map_new();
+		alists[which] = lisp_list_new();
+		for (int i = 0; i < n; ++i) {
+			LispObject key = bench_table_key(i);
+			LispObject val = lisp_integer_new(i);
+			LispObject next = lisp_map_assoc(maps[which], key, val);
+			lisp_object_free(maps[which]);
+			maps[which] = next;
+			lisp_list_push(alists[which], lisp_list_new_from_args(2, key, val));
+		}
+	}
+	*map = maps[which];
+	*alist = alists[which];
+}
+
+// Look up a different key of a table of n keys on each iteration, in its map or by scanning its
+// association list as a script would with h, t and e
+void bench_lookup(int iterations, int n, int use_map)
+{
+	LispObject map, alist;
+	bench_tables(n, &map, &alist);
+	long long found = 0;
+	for (int i = 0; i < iterations; ++i) {
+		LispObject key = bench_table_key((int)((i * 7919LL) % n));
+		if (use_map) {
+			found += lisp_map_get(map, key) != NULL;
+		}
+		else {
+			for (int j = 0; j < lisp_list_size(alist); ++j) {
+				LispObject pair = lisp_list_at(alist, j);
+				if (lisp_object_equal(lisp_list_at(pair, 0), key)) {
+					++found;
+					break;
+				}
+			}
+		}
+		lisp_object_free(key);
+	}
+	if (found != iterations)
+		printf("lookup found %lld of %d keys\n", found, iterations);
+}
+
+void bench_map_get_10k(int iterations)
+{
+	bench_lookup(iterations, BENCH_TABLE_SMALL, 1);
+}
+
+void bench_alist_get_10k(int iterations)
+{
+	bench_lookup(iterations, BENCH_TABLE_SMALL, 0);
+}
+
+void bench_map_get_1m(int iterations)
+{
+	bench_lookup(iterations, BENCH_TABLE_LARGE, 1);
+}
+
+void bench_alist_get_1m(int iterations)
+{
+	bench_lookup(iterations, BENCH_TABLE_LARGE, 0);
+}
+
+// Bind a new key in the large map on each iteration, keeping the original unchanged
+void bench_map_assoc_1m(int iterations)
+{
+	LispObject map, alist;
+	bench_tables(BENCH_TABLE_LARGE, &map, &alist);
+	for (int i = 0; i < iterations; ++i) {
+		LispObject key = bench_table_key(BENCH_TABLE_LARGE + i);
+		LispObject next = lisp_map_assoc(map, key, key);
+		lisp_object_free(next);
+		lisp_object_free(key);
+	}
+}
+
+// The i-th of a sequence of pseudo random integers
+int bench_sort_value(int i)
+{
+	return (int)((i * 2654435761u) >> 8) % 1000000;
+}
+
+// A list of n pseudo random integers, or of symbols if symbols is set
+LispObject bench_sort_data(int n, int symbols)
+{
+	LispObject list = lisp_list_new();
+	for (int i = 0; i < n; ++i)
+		lisp_list_push(list, symbols ? bench_table_key(bench_sort_value(i)) : lisp_integer_new(bench_sort_value(i)));
+	return list;
+}
+
+#define BENCH_SORT_PRELUDE \
+	"(d add (q ((a b) (s a (s 0 b)))))\n" \
+	"(d half (q ((n) (i (l n 2) 0 (add 1 (half (s n 2)))))))\n" \
+	"(d merge (q ((a b) (i (e a ()) b (i (e b ()) a (i (l (h b) (h a)) (c (h b) (merge a (t b))) (c (h a) (merge (t a) b))))))))\n" \
+	"(d msort (q ((xs) (i (l (len xs) 2) xs (msplit xs (half (len xs)))))))\n" \
+	"(d msplit (q ((xs m) (merge (msort (slice xs 0 m)) (msort (slice xs m))))))\n"
+
+// Sort a global list of n integers with form, after the merge sort written in the language is defined
+void bench_sort_script(int iterations, int n, char* form)
+{
+	TinyLisp lisp = lisp_new();
+	bench_eval_text(lisp, BENCH_SORT_PRELUDE);
+	lisp_stack_setglobal(lisp->stack, "xs", bench_sort_data(n, 0));
+	bench_eval_repeat(lisp, form, iterations);
+	lisp_free(lisp);
+}
+
+void bench_sort_merge_script(int iterations)
+{
+	bench_sort_script(iterations, BENCH_SORT_SCRIPT_SIZE, "(msort xs)");
+}
+
+void bench_sort_builtin_96(int iterations)
+{
+	bench_sort_script(iterations, BENCH_SORT_SCRIPT_SIZE, "(sort xs)");
+}
+
+void bench_sort_lambda_96(int iterations)
+{
+	bench_sort_script(iterations, BENCH_SORT_SCRIPT_SIZE, "(sort xs (q ((a b) (l a b))))");
+}
+
+void bench_sort_lambda_100k(int iterations)
+{
+	bench_sort_script(iterations, BENCH_SORT_SIZE, "(sort xs (q ((a b) (l a b))))");
+}
+
+// Sort BENCH_SORT_SIZE integers or symbols in their natural order
+void bench_sort_natural(int iterations, int symbols)
+{
+	LispObject data = bench_sort_data(BENCH_SORT_SIZE, symbols);
+	for (int i = 0; i < iterations; ++i) {
+		LispObject sorted;
+		if (lisp_list_sort(data, NULL, NULL, &sorted) == E_SUCCESS)
+			lisp_object_free(sorted);
+	}
+	lisp_object_free(data);
+}
+
+void bench_sort_ints_100k(int iterations)
+{
+	bench_sort_natural(iterations, 0);
+}
+
+void bench_sort_symbols_100k(int iterations)
+{
+	bench_sort_natural(iterations, 1);
+}
+
+// A temporary file of BENCH_STREAM_RECORDS lines, each an integer if records is 0 and otherwise a small
+// record of the form (id name score), or NULL
+FILE* bench_stream_input(int records)
+{
+	static FILE* inputs[2] = { NULL, NULL };
+	if (inputs[records] != NULL)
+		return inputs[records];
+
+	FILE* input = tmpfile();
+	if (input == NULL)
+		return NULL;
+	for (int i = 0; i < BENCH_STREAM_RECORDS; ++i) {
+		if (records)
+			fprintf(input, "(%d item%d %d)\n", i, i % 1000, i % 977);
+		else
+			fprintf(input, "%d\n", i);
+	}
+	inputs[records] = input;
+	return input;
+}
+
+int bench_discard_sink(void* ctx, const char* data, int len)
+{
+	(void)ctx;
+	(void)data;
+	(void)len;
+	return 0;
+}
+
+// Stream the lines of the input through func as tinylisp --map does, discarding the output
+void bench_stream_map(int iterations, int records, char* func_text)
+{
+	FILE* input = bench_stream_input(records);
+	if (input == NULL)
+		return;
+	TinyLisp lisp = lisp_new();
+	int pos = 0;
+	LispObject form = lisp_parse(lisp, func_text, &pos);
+	LispObject func = lisp_evaluate(lisp, form);
+	LispWriter out = lisp_writer_new(bench_discard_sink, NULL);
+	for (int i = 0; i < iterations; ++i) {
+		rewind(input);
+		if (lisp_stream_map(lisp, func, input, out) != E_SUCCESS)
+			break;
+		bench_streamed_records += BENCH_STREAM_RECORDS;
+	}
+	lisp_writer_free(out);
+	lisp_object_free(func);
+	lisp_object_free(form);
+	lisp_free(lisp);
+}
+
+void bench_stream_map_ints_1m(int iterations)
+{
+	bench_stream_map(iterations, 0, "(q ((x) (s x 1)))");
+}
+
+// Take the difference of two fields of each record
+void bench_stream_map_records_1m(int iterations)
+{
+	bench_stream_map(iterations, 1, "(q ((r) (s (h (t (t r))) (h r))))");
+}
+
+struct bench_case_ benchmarks[] = {
+	{ "parse_data", bench_parse_data, 20 },
+	{ "parse_throughput", bench_parse_throughput, 20 },
+	{ "parse_prelude", bench_parse_prelude, 200 },
+	{ "parse_table_plain", bench_parse_table_plain, 10 },
+	{ "parse_table_hashcons", bench_parse_table_hashcons, 10 },
+	{ "equal_table_plain", bench_equal_table_plain, 100 },
+	{ "equal_table_hashcons", bench_equal_table_hashcons, 100 },
+	{ "load_data", bench_load_data, 20 },
+	{ "startup_prelude", bench_startup_prelude, 200 },
+	{ "startup_image", bench_startup_image, 200 },
+	{ "mul_unoptimized", bench_mul_unoptimized, 20000 },
+	{ "mul_optimized", bench_mul_optimized, 20000 },
+	{ "mul_jit", bench_mul_jit, 20000 },
+	{ "fib_optimized", bench_fib_optimized, 20 },
+	{ "fib_jit", bench_fib_jit, 20 },
+	{ "fib_budget", bench_fib_budget, 20 },
+	{ "ackermann", bench_ackermann, 200 },
+	{ "list_build_sum", bench_list_build_sum, 20 },
+	{ "list_equal", bench_list_equal, 200 },
+	{ "nested_parse_print", bench_nested_parse_print, 200 },
+	{ "tasks_sequential", bench_tasks_sequential, 5 },
+	{ "tasks_interleaved", bench_tasks_interleaved, 5 },
+	{ "sum_recursive", bench_sum_recursive, 20000 },
+	{ "sum_loop", bench_sum_loop, 20000 },
+	{ "sum_loop_1m", bench_sum_loop_1m, 5 },
+	{ "count_recursive", bench_count_recursive, 20000 },
+	{ "count_loop", bench_count_loop, 20000 },
+	{ "seq_walk_1m", bench_seq_walk_1m, 5 },
+	{ "seq_collect_1m", bench_seq_collect_1m, 5 },
+	{ "macro_cached", bench_macro_cached, 1000000 },
+	{ "macro_impure", bench_macro_impure, 1000000 },
+	{ "tail_walk", bench_tail_walk, 100 },
+	{ "map_get_10k", bench_map_get_10k, 1000000 },
+	{ "alist_get_10k", bench_alist_get_10k, 10000 },
+	{ "map_get_1m", bench_map_get_1m, 1000000 },
+	{ "alist_get_1m", bench_alist_get_1m, 100 },
+	{ "map_assoc_1m", bench_map_assoc_1m, 1000000 },
+	{ "sort_merge_script", bench_sort_merge_script, 1000 },
+	{ "sort_builtin_96", bench_sort_builtin_96, 100000 },
+	{ "sort_lambda_96", bench_sort_lambda_96, 10000 },
+	{ "sort_lambda_100k", bench_sort_lambda_100k, 5 },
+	{ "sort_ints_100k", bench_sort_ints_100k, 100 },
+	{ "sort_symbols_100k", bench_sort_symbols_100k, 20 },
+	{ "stream_map_ints_1m", bench_stream_map_ints_1m, 3 },
+	{ "stream_map_records_1m", bench_stream_map_records_1m, 3 }
+};
+
+struct bench_target_ targets[] = {
+	{ "stream_map_ints_1m", BENCH_STREAM_TARGET }
+};
+
+// The fewest records per second the benchmark name must stream, or 0 if it has no target
+double bench_target(char* name)
+{
+	for (int i = 0; i < (int)(sizeof(targets) / sizeof(targets[0])); ++i) {
+		if (strcmp(targets[i].name, name) == 0)
+			return targets[i].records_per_second;
+	}
+	return 0;
+}
+
+// Evaluations counted so far on this thread
+long long bench_evaluations()
+{
+	long long total = 0;
+	for (int i = 0; i < T_SIZE; ++i)
+		total += lisp_stats.evaluations[i];
+	return total;
+}
+
+// Forget the peak resident memory so far where the system allows it, so that the next reading is of what follows
+void bench_reset_peak_rss()
+{
+#ifdef __linux__
+	FILE* refs = NULL;
+	if (fopen_s(&refs, "/proc/self/clear_refs", "w") == 0) {
+		fputs("5", refs);
+		fclose(refs);
+	}
+#endif
+}
+
+// The most memory resident at once since the last reset, in kilobytes, or 0 if unknown
+long bench_peak_rss_kb()
+{
+#ifdef __linux__
+	FILE* status = NULL;
+	if (fopen_s(&status, "/proc/self/status", "r") == 0) {
+		char line[256];
+		long kb = -1;
+		while (kb < 0 && fgets(line, sizeof(line), status) != NULL)
+			sscanf(line, "VmHWM: %ld", &kb);
+		fclose(status);
+		if (kb >= 0)
+			return kb;
+	}
+#endif
+#ifndef _WIN32
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+#ifdef __APPLE__
+		return usage.ru_maxrss / 1024;
+#else
+		return usage.ru_maxrss;
+#endif
+#endif
+	return 0;
+}
+
+// Return the whole of the file as a malloced string, or NULL if it cannot be read
+char* bench_read_file(char* filename)
+{
+	FILE* input = NULL;
+	if (fopen_s(&input, filename, "r") != 0)
+		return NULL;
+	size_t size = 0, capacity = 1 << 16;
+	char* text = malloc(capacity + 1);
+	while (text != NULL) {
+		size += fread(text + size, 1, capacity - size, input);
+		if (size < capacity)
+			break;
+		capacity *= 2;
+		char* grown = realloc(text, capacity + 1);
+		if (grown == NULL)
+			free(text);
+		text = grown;
+	}
+	if (text != NULL && ferror(input)) {
+		free(text);
+		text = NULL;
+	}
+	fclose(input);
+	if (text != NULL)
+		text[size] = '\0';
+	return text;
+}
+
+// Return the time per iteration recorded for the benchmark name in JSON written by bench_write_json, or -1
+double bench_baseline_time(char* json, char* name)
+{
+	char key[128];
+	snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+	char* entry = strstr(json, key);
+	if (entry == NULL)
+		return -1;
+	char* field = strstr(entry, "\"us_per_iteration\":");
+	char* end = strchr(entry, '}');
+	if (field == NULL || (end != NULL && field > end))
+		return -1;
+	return strtod(field + strlen("\"us_per_iteration\":"), NULL);
+}
+
+// Write the results of the benchmarks which ran, those with iterations > 0, as JSON; returns 0 on success
+int bench_write_json(char* filename, struct bench_case_* cases, struct bench_result_* results, int ncases)
+{
+	FILE* output = NULL;
+	if (fopen_s(&output, filename, "w") != 0)
+		return -1;
+	fprintf(output, "{\n  \"benchmarks\": [");
+	int first = 1;
+	for (int i = 0; i < ncases; ++i) {
+		if (results[i].seconds <= 0)
+			continue;
+		fprintf(output, "%s\n    { \"name\": \"%s\", \"iterations\": %d, \"seconds\": %.6f, \"us_per_iteration\": %.3f, "
+			"\"evaluations_per_second\": %.0f, \"mb_per_second\": %.1f, \"held_kb\": %ld, \"records_per_second\": %.0f, "
+			"\"peak_rss_kb\": %ld }",
+			first ? "" : ",", cases[i].name, cases[i].iterations, results[i].seconds, results[i].us_per_iteration,
+			results[i].evaluations_per_second, results[i].mb_per_second, results[i].held_kb, results[i].records_per_second,
+			results[i].peak_rss_kb);
+		first = 0;
+	}
+	fprintf(output, "\n  ]\n}\n");
+	return fclose(output) == 0 ? 0 : -1;
+}
+
+// Run bench once with its iterations, timing it and recording what was measured in res
+void bench_measure(struct bench_case_* bench, struct bench_result_* res)
+{
+	bench_reset_peak_rss();
+	long long evaluations = bench_evaluations();
+	long long parsed = bench_parsed_bytes;
+	long long streamed = bench_streamed_records;
+	bench_held_bytes = 0;
+	double start = bench_now();
+	bench->run(bench->iterations);
+	double elapsed = bench_now() - start;
+	res->seconds = elapsed;
+	res->us_per_iteration = elapsed * 1e6 / bench->iterations;
+	res->evaluations_per_second = (bench_evaluations() - evaluations) / elapsed;
+	res->mb_per_second = (bench_parsed_bytes - parsed) / elapsed / 1e6;
+	res->held_kb = (long)(bench_held_bytes / 1024);
+	res->records_per_second = (bench_streamed_records - streamed) / elapsed;
+	res->peak_rss_kb = bench_peak_rss_kb();
+}
+
+int bench_compare_seconds(const void* lhs, const void* rhs)
+{
+	double l = ((const struct bench_result_*)lhs)->seconds, r = ((const struct bench_result_*)rhs)->seconds;
+	return l < r ? -1 : l > r ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	char* filter = NULL;
+	char* json = NULL;
+	char* baseline_file = NULL;
+	double threshold = BENCH_THRESHOLD;
+	int repeat = BENCH_REPEAT;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+			json = argv[++i];
+		}
+		else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+			baseline_file = argv[++i];
+		}
+		else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+			repeat = atoi(argv[++i]);
+			if (repeat < 1)
+				repeat = 1;
+		}
+		else if (argv[i][0] == '-') {
+			printf("usage: tinylisp_bench [--json file] [--baseline file] [--threshold percent] [--repeat n] [filter]\n");
+			printf("Runs the benchmarks whose names contain filter n times each, reporting the median run, optionally\n");
+			printf("writing the results to a JSON file and comparing them with a JSON file written earlier, failing if\n");
+			printf("any is more than percent slower\n");
+			return 1;
+		}
+		else {
+			filter = argv[i];
+		}
+	}
+	char* baseline = NULL;
+	if (baseline_file != NULL) {
+		baseline = bench_read_file(baseline_file);
+		if (baseline == NULL) {
+			printf("Could not read baseline %s\n", baseline_file);
+			return 1;
+		}
+	}
+
+	int ncases = sizeof(benchmarks) / sizeof(benchmarks[0]);
+	struct bench_result_* results = calloc(ncases, sizeof(struct bench_result_));
+	struct bench_result_* runs = calloc(repeat, sizeof(struct bench_result_));
+	if (results == NULL || runs == NULL) {
+		printf("Out of memory\n");
+		return 1;
+	}
+	int regressions = 0;
+	int missed = 0;
+	for (int i = 0; i < ncases; ++i) {
+		struct bench_case_* bench = &benchmarks[i];
+		if (filter != NULL && strstr(bench->name, filter) == NULL)
+			continue;
+		// Run once untimed so that lazily built inputs are not counted, then report the median timed run so
+		// that one run slowed or sped up by the rest of the machine does not decide the comparison
+		bench->run(1);
+		for (int r = 0; r < repeat; ++r)
+			bench_measure(bench, &runs[r]);
+		qsort(runs, repeat, sizeof(struct bench_result_), bench_compare_seconds);
+		struct bench_result_* res = &results[i];
+		*res = runs[repeat / 2];
+		printf("%-24s %8d iterations %12.3f us/iteration %14.0f evals/s %9ld kB", bench->name, bench->iterations,
+			res->us_per_iteration, res->evaluations_per_second, res->peak_rss_kb);
+		if (res->mb_per_second > 0)
+			printf(" %8.1f MB/s", res->mb_per_second);
+		if (res->held_kb > 0)
+			printf(" %9ld kB held", res->held_kb);
+		if (res->records_per_second > 0)
+			printf(" %10.0f records/s", res->records_per_second);
+		double target = bench_target(bench->name);
+		if (target > 0 && res->records_per_second < target) {
+			printf(" BELOW TARGET");
+			++missed;
+		}
+		if (baseline != NULL) {
+			double base = bench_baseline_time(baseline, bench->name);
+			if (base > 0) {
+				double change = (res->us_per_iteration / base - 1) * 100;
+				printf(" %+7.1f%%", change);
+				if (change > threshold) {
+					printf(" REGRESSION");
+					++regressions;
+				}
+			}
+			else {
+				printf("  no baseline");
+			}
+		}
+		printf("\n");
+	}
+
+	int status = 0;
+	if (json != NULL && bench_write_json(json, benchmarks, results, ncases) != 0) {
+		printf("Could not write %s\n", json);
+		status = 1;
+	}
+	if (missed > 0) {
+		printf("%d benchmarks below their target throughput\n", missed);
+		status = 1;
+	}
+	if (regressions > 0) {
+		printf("%d benchmarks more than %.1f%% slower than the baseline\n", regressions, threshold);
+		status = 1;
+	}
+	free(runs);
+	free(results);
+	free(baseline);
+	return status;
+}
@@ -0,0 +1,251 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "tinylisp.h"
+#include "server.h"
+
+// Attempts to connect, and the wait between them, while a server is still starting
+#define LOAD_CONNECT_ATTEMPTS 200
+#define LOAD_CONNECT_WAIT_NS 10000000L
+// Longest line sent as a request in client mode
+#define LOAD_LINE_SIZE 65536
+
+// A connection of the load generator, sending requests one after another on a thread of its own
+struct load_client_
+{
+	char* path;
+	char* request;
+	int requests;
+	// nanoseconds from sending each request to receiving all of its response
+	long long* latencies;
+	int completed;
+	pthread_t thread;
+};
+
+// Return a socket connected to path, retrying while the server is starting, or -1
+int load_connect(char* path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+	strcpy(addr.sun_path, path);
+	for (int attempt = 0; attempt < LOAD_CONNECT_ATTEMPTS; ++attempt) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+		if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+			return fd;
+		int err = errno;
+		close(fd);
+		if (err != ENOENT && err != ECONNREFUSED)
+			return -1;
+		struct timespec wait = { 0, LOAD_CONNECT_WAIT_NS };
+		nanosleep(&wait, NULL);
+	}
+	return -1;
+}
+
+int load_write_all(int fd, const char* data, int len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		data += n;
+		len -= (int)n;
+	}
+	return 0;
+}
+
+int load_read_all(int fd, char* data, int len)
+{
+	while (len > 0) {
+		ssize_t n = read(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		data += n;
+		len -= (int)n;
+	}
+	return 0;
+}
+
+int load_send(int fd, const char* request, int len)
+{
+	unsigned char header[4] = {
+		(unsigned char)(len >> 24), (unsigned char)(len >> 16), (unsigned char)(len >> 8), (unsigned char)len
+	};
+	if (load_write_all(fd, (char*)header, 4) != 0)
+		return -1;
+	return load_write_all(fd, request, len);
+}
+
+// Read a response into the buffer, growing it as needed; returns its length, or -1
+int load_receive(int fd, char** buffer, int* capacity)
+{
+	unsigned char header[4];
+	if (load_read_all(fd, (char*)header, 4) != 0)
+		return -1;
+	unsigned int len = ((unsigned int)header[0] << 24) | ((unsigned int)header[1] << 16)
+		| ((unsigned int)header[2] << 8) | header[3];
+	if (len > LISP_SERVER_MAX_FRAME)
+		return -1;
+	if ((int)len + 1 > *capacity) {
+		char* grown = realloc(*buffer, len + 1);
+		if (grown == NULL)
+			return -1;
+		*buffer = grown;
+		*capacity = len + 1;
+	}
+	if (load_read_all(fd, *buffer, len) != 0)
+		return -1;
+	(*buffer)[len] = '\0';
+	return (int)len;
+}
+
+void* load_client_run(void* arg)
+{
+	struct load_client_* client = arg;
+	int fd = load_connect(client->path);
+	if (fd < 0)
+		return NULL;
+	int len = (int)strlen(client->request);
+	int capacity = 0;
+	char* response = NULL;
+	for (int i = 0; i < client->requests; ++i) {
+		long long start = lisp_time_ns();
+		if (load_send(fd, client->request, len) != 0 || load_receive(fd, &response, &capacity) < 0)
+			break;
+		client->latencies[client->completed++] = lisp_time_ns() - start;
+	}
+	free(response);
+	close(fd);
+	return NULL;
+}
+
+int load_compare(const void* lhs, const void* rhs)
+{
+	long long a = *(const long long*)lhs, b = *(const long long*)rhs;
+	return a < b ? -1 : a > b;
+}
+
+// The latency below which the fraction p of the sorted latencies fall, in microseconds
+double load_percentile(long long* latencies, int n, double p)
+{
+	int i = (int)(p * n);
+	return (i < n ? latencies[i] : latencies[n - 1]) * 1e-3;
+}
+
+// Send request requests times on each of connections connections at once and report latency percentiles
+int load_run(char* path, char* request, int connections, int requests)
+{
+	struct load_client_* clients = calloc(connections, sizeof(struct load_client_));
+	long long* latencies = malloc(sizeof(long long) * connections * requests);
+	if (clients == NULL || latencies == NULL) {
+		printf("Out of memory\n");
+		return 1;
+	}
+	long long start = lisp_time_ns();
+	int started = 0;
+	for (; started < connections; ++started) {
+		struct load_client_* client = &clients[started];
+		client->path = path;
+		client->request = request;
+		client->requests = requests;
+		client->latencies = latencies + (long long)started * requests;
+		if (pthread_create(&client->thread, NULL, load_client_run, client) != 0)
+			break;
+	}
+	int total = 0;
+	for (int i = 0; i < started; ++i) {
+		pthread_join(clients[i].thread, NULL);
+		// Pack the latencies of every client together for sorting
+		memmove(latencies + total, clients[i].latencies, sizeof(long long) * clients[i].completed);
+		total += clients[i].completed;
+	}
+	double elapsed = (lisp_time_ns() - start) * 1e-9;
+	int res = 0;
+	if (total < connections * requests) {
+		printf("Only %d of %d requests completed\n", total, connections * requests);
+		res = 1;
+	}
+	if (total > 0) {
+		qsort(latencies, total, sizeof(long long), load_compare);
+		printf("%d connections %8d requests %12.0f requests/s\n", started, total, total / elapsed);
+		printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+			load_percentile(latencies, total, 0.5), load_percentile(latencies, total, 0.9),
+			load_percentile(latencies, total, 0.99), load_percentile(latencies, total, 0.999),
+			latencies[total - 1] * 1e-3);
+	}
+	free(latencies);
+	free(clients);
+	return res;
+}
+
+// Send each line of stdin as a request on one connection and print each response
+int load_interact(char* path)
+{
+	int fd = load_connect(path);
+	if (fd < 0) {
+		printf("Could not connect to %s\n", path);
+		return 1;
+	}
+	char* line = malloc(LOAD_LINE_SIZE);
+	int capacity = 0;
+	char* response = NULL;
+	int res = line == NULL;
+	while (res == 0 && fgets(line, LOAD_LINE_SIZE, stdin) != NULL) {
+		int len = (int)strcspn(line, "\r\n");
+		int received;
+		if (load_send(fd, line, len) != 0 || (received = load_receive(fd, &response, &capacity)) < 0) {
+			printf("Connection to %s lost\n", path);
+			res = 1;
+			break;
+		}
+		fwrite(response, 1, received, stdout);
+	}
+	free(response);
+	free(line);
+	close(fd);
+	return res;
+}
+
+int main(int argc, char** argv)
+{
+	int connections = 1;
+	int requests = 10000;
+	char* path = NULL;
+	char* request = NULL;
+	// A server closing a connection is reported as the connection being lost rather than ending the process
+	signal(SIGPIPE, SIG_IGN);
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			connections = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			requests = atoi(argv[++i]);
+		else if (path == NULL)
+			path = argv[i];
+		else
+			request = argv[i];
+	}
+	if (path == NULL || connections < 1 || requests < 1) {
+		printf("usage: tinylisp_load [-c connections] [-n requests] path [request]\n");
+		printf("Sends request to the tinylisp --serve socket at path requests times on each connection and reports\n");
+		printf("the latencies, or without a request sends each line of stdin and prints the responses\n");
+		return 1;
+	}
+	return request != NULL ? load_run(path, request, connections, requests) : load_interact(path);
+}
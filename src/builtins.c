@@ -1,12 +1,108 @@
 #include "builtins.h"
 #include "object.h"
 #include "eval.h"
+#include "stats.h"
+#include "optimize.h"
+#include "seq.h"
+#include "hashcons.h"
 #include <stdarg.h>
+#include <stdlib.h>
 
 #define ASSERT_ARGS(n) if (lisp_list_size(args) != n) { lisp_error_set(lisp, E_INDEX_ERROR, "Expected %d arguments, got %d", n, lisp_list_size(args)); return NULL;}
 #define FUNCARG(name, idx) LispObject name = lisp_evaluate(lisp, lisp_list_at(args, idx))
 #define MACROARG(name, idx) LispObject name = lisp_list_at(args, idx)
 
+LispObject lisp_apply_construct(TinyLisp lisp, LispObject lhs, LispObject rhs)
+{
+	if (rhs->type != T_LIST) {
+		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 2 required to be of type list");
+		return NULL;
+	}
+	LispObject head = lisp_hashcons(lisp, lisp_object_create_reference(lhs));
+	LispObject res = lisp_list_new_from_args(1, head);
+	if (res == NULL) {
+		lisp_object_free(head);
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	for (int i = 0; i < lisp_list_size(rhs); ++i)
+		lisp_list_push(res, lisp_object_create_reference(lisp_list_at(rhs, i)));
+	return lisp_hashcons(lisp, res);
+}
+
+LispObject lisp_apply_head(TinyLisp lisp, LispObject list)
+{
+	if (list->type == T_SEQ)
+		return lisp_object_create_reference(lisp_seq_head(list));
+	if (list->type != T_LIST) {
+		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 1 must be of type list");
+		return NULL;
+	}
+	if (lisp_list_size(list) == 0) {
+		lisp_error_set(lisp, E_INDEX_ERROR, "Argument 1 must not be empty");
+		return NULL;
+	}
+	return lisp_object_create_reference(lisp_list_at(list, 0));
+}
+
+LispObject lisp_apply_tail(TinyLisp lisp, LispObject list)
+{
+	if (list->type == T_SEQ)
+		return lisp_seq_tail(lisp, list);
+	if (list->type != T_LIST) {
+		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 1 must be of type list");
+		return NULL;
+	}
+	int len = lisp_list_size(list);
+	LispObject res = lisp_list_slice(list, len > 0 ? 1 : 0, len);
+	if (res == NULL)
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	return res;
+}
+
+int lisp_require_integer(TinyLisp lisp, LispObject val, int index)
+{
+	if (val->type == T_INTEGER)
+		return 1;
+	lisp_error_set(lisp, E_TYPE_ERROR, "Argument %d must be of type integer", index);
+	return 0;
+}
+
+int lisp_require_map(TinyLisp lisp, LispObject val, int index)
+{
+	if (val->type == T_MAP)
+		return 1;
+	lisp_error_set(lisp, E_TYPE_ERROR, "Argument %d must be of type map", index);
+	return 0;
+}
+
+int lisp_require_sequence(TinyLisp lisp, LispObject val, int index)
+{
+	if (val->type == T_LIST || val->type == T_SEQ)
+		return 1;
+	lisp_error_set(lisp, E_TYPE_ERROR, "Argument %d must be of type list or seq", index);
+	return 0;
+}
+
+LispObject lisp_apply_subtract(TinyLisp lisp, LispObject x, LispObject y)
+{
+	if (!lisp_require_integer(lisp, x, 1) || !lisp_require_integer(lisp, y, 2))
+		return NULL;
+	return lisp_integer_new(lisp_integer_get(x) - lisp_integer_get(y));
+}
+
+LispObject lisp_apply_lessthan(TinyLisp lisp, LispObject x, LispObject y)
+{
+	(void)lisp;
+	return lisp_integer_new(lisp_object_lessthan(x, y));
+}
+
+LispObject lisp_apply_equal(TinyLisp lisp, LispObject x, LispObject y)
+{
+	(void)lisp;
+	return lisp_integer_new(lisp_object_equal(x, y));
+}
+
 LISP_BUILTIN_DEF(construct)
 {
 	ASSERT_ARGS(2);
@@ -18,16 +114,7 @@ LISP_BUILTIN_DEF(construct)
 		lisp_object_free(lhs);
 		return NULL;
 	}
-	if (rhs->type != T_LIST) {
-		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 2 required to be of type list");
-		lisp_object_free(lhs);
-		lisp_object_free(rhs);
-		return NULL;
-	}
-
-	LispObject res = lisp_list_new_from_args(1, lisp_object_create_reference(lhs));
-	for (int i = 0; i < lisp_list_size(rhs); ++i)
-		lisp_list_push(res, lisp_object_create_reference(lisp_list_at(rhs, i)));
+	LispObject res = lisp_apply_construct(lisp, lhs, rhs);
 	lisp_object_free(lhs);
 	lisp_object_free(rhs);
 	return res;
@@ -40,13 +127,7 @@ LISP_BUILTIN_DEF(head)
 	FUNCARG(list, 0);
 	if (list == NULL)
 		return NULL;
-	if (list->type != T_LIST) {
-		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 1 must be of type list");
-		lisp_object_free(list);
-		return NULL;
-	}
-	LispObject res = lisp_list_at(list, 0);
-	res = lisp_object_create_reference(res);
+	LispObject res = lisp_apply_head(lisp, list);
 	lisp_object_free(list);
 	return res;
 }
@@ -57,14 +138,7 @@ LISP_BUILTIN_DEF(tail)
 	FUNCARG(list, 0);
 	if (list == NULL)
 		return NULL;
-	if (list->type != T_LIST) {
-		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 1 must be of type list");
-		lisp_object_free(list);
-		return NULL;
-	}
-	LispObject res = lisp_list_new();
-	for (int i = 1; i < lisp_list_size(list); ++i)
-		lisp_list_push(res, lisp_object_create_reference(lisp_list_at(list, i)));
+	LispObject res = lisp_apply_tail(lisp, list);
 	lisp_object_free(list);
 	return res;
 }
@@ -76,21 +150,17 @@ LISP_BUILTIN_DEF(subtract)
 	FUNCARG(x, 0);
 	if (x == NULL)
 		return NULL;
-	if (x->type != T_INTEGER) {
-		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 1 must be of type integer");
+	// The first argument is checked before the second is evaluated
+	if (!lisp_require_integer(lisp, x, 1)) {
 		lisp_object_free(x);
 		return NULL;
 	}
 	FUNCARG(y, 1);
-	if (y == NULL)
-		return NULL;
-	if (y->type != T_INTEGER) {
-		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 2 must be of type integer");
+	if (y == NULL) {
 		lisp_object_free(x);
-		lisp_object_free(y);
 		return NULL;
 	}
-	LispObject res = lisp_integer_new(lisp_integer_get(x) - lisp_integer_get(y));
+	LispObject res = lisp_apply_subtract(lisp, x, y);
 	lisp_object_free(x);
 	lisp_object_free(y);
 	return res;
@@ -108,7 +178,7 @@ LISP_BUILTIN_DEF(lessthan)
 		lisp_object_free(x);
 		return NULL;
 	}
-	LispObject res = lisp_integer_new(lisp_object_lessthan(x, y));
+	LispObject res = lisp_apply_lessthan(lisp, x, y);
 	lisp_object_free(x);
 	lisp_object_free(y);
 	return res;
@@ -126,7 +196,7 @@ LISP_BUILTIN_DEF(equal)
 		lisp_object_free(x);
 		return NULL;
 	}
-	LispObject res = lisp_integer_new(lisp_object_equal(x, y));
+	LispObject res = lisp_apply_equal(lisp, x, y);
 	lisp_object_free(x);
 	lisp_object_free(y);
 	return res;
@@ -158,7 +228,9 @@ LISP_BUILTIN_DEF(ternary)
 	if (pred == NULL)
 		return NULL;
 
-	if (lisp_object_is_nil(pred)) {
+	int is_nil = lisp_object_is_nil(pred);
+	lisp_object_free(pred);
+	if (is_nil) {
 		FUNCARG(res, 2);
 		return res;
 	}
@@ -181,7 +253,630 @@ LISP_BUILTIN_DEF(def)
 		lisp_object_free(val);
 		return NULL;
 	}
+	// Now that a recursive function can refer to itself, partially evaluate its body
+	if (val->type == T_LIST)
+		lisp_optimize_lambda(lisp, val);
 	lisp_object_free(val);
 	return lisp_object_create_reference(key);
 }
 
+LISP_BUILTIN_DEF(dump)
+{
+	ASSERT_ARGS(2);
+	FUNCARG(path, 0);
+	if (path == NULL)
+		return NULL;
+	if (path->type != T_SYMBOL) {
+		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 1 must be of type symbol");
+		lisp_object_free(path);
+		return NULL;
+	}
+	FUNCARG(val, 1);
+	if (val == NULL) {
+		lisp_object_free(path);
+		return NULL;
+	}
+	error_t err = lisp_object_dump_file(lisp_symbol_get(path), val);
+	lisp_object_free(val);
+	if (err != E_SUCCESS) {
+		lisp_error_set(lisp, err, "Could not write %s", lisp_symbol_get(path));
+		lisp_object_free(path);
+		return NULL;
+	}
+	return path;
+}
+
+LISP_BUILTIN_DEF(load)
+{
+	ASSERT_ARGS(1);
+	FUNCARG(path, 0);
+	if (path == NULL)
+		return NULL;
+	if (path->type != T_SYMBOL) {
+		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 1 must be of type symbol");
+		lisp_object_free(path);
+		return NULL;
+	}
+	LispObject res;
+	error_t err = lisp_object_load_file(lisp_symbol_get(path), &res);
+	if (err != E_SUCCESS) {
+		lisp_error_set(lisp, err, "Could not read %s", lisp_symbol_get(path));
+		lisp_object_free(path);
+		return NULL;
+	}
+	lisp_object_free(path);
+	return res;
+}
+
+LISP_BUILTIN_DEF(stats)
+{
+	ASSERT_ARGS(0);
+	LispObject res = lisp_stats_list();
+	if (res == NULL)
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	return res;
+}
+
+LISP_BUILTIN_DEF(hashmap)
+{
+	int nargs = lisp_list_size(args);
+	if (nargs % 2 != 0) {
+		lisp_error_set(lisp, E_INDEX_ERROR, "Expected an even number of arguments, got %d", nargs);
+		return NULL;
+	}
+	LispObject res = lisp_map_new();
+	if (res == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	for (int i = 0; i < nargs; i += 2) {
+		FUNCARG(key, i);
+		if (key == NULL) {
+			lisp_object_free(res);
+			return NULL;
+		}
+		FUNCARG(val, i + 1);
+		if (val == NULL) {
+			lisp_object_free(key);
+			lisp_object_free(res);
+			return NULL;
+		}
+		LispObject next = lisp_map_assoc(res, key, val);
+		lisp_object_free(key);
+		lisp_object_free(val);
+		lisp_object_free(res);
+		if (next == NULL) {
+			lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+			return NULL;
+		}
+		res = next;
+	}
+	return res;
+}
+
+LISP_BUILTIN_DEF(get)
+{
+	int nargs = lisp_list_size(args);
+	if (nargs != 2 && nargs != 3) {
+		lisp_error_set(lisp, E_INDEX_ERROR, "Expected 2 or 3 arguments, got %d", nargs);
+		return NULL;
+	}
+	FUNCARG(map, 0);
+	if (map == NULL)
+		return NULL;
+	if (!lisp_require_map(lisp, map, 1)) {
+		lisp_object_free(map);
+		return NULL;
+	}
+	FUNCARG(key, 1);
+	if (key == NULL) {
+		lisp_object_free(map);
+		return NULL;
+	}
+	LispObject val = lisp_map_get(map, key);
+	LispObject res;
+	if (val != NULL)
+		res = lisp_object_create_reference(val);
+	else if (nargs == 3)
+		res = lisp_evaluate(lisp, lisp_list_at(args, 2));
+	else if ((res = lisp_list_new()) == NULL)
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	lisp_object_free(key);
+	lisp_object_free(map);
+	return res;
+}
+
+LISP_BUILTIN_DEF(assoc)
+{
+	ASSERT_ARGS(3);
+	FUNCARG(map, 0);
+	if (map == NULL)
+		return NULL;
+	if (!lisp_require_map(lisp, map, 1)) {
+		lisp_object_free(map);
+		return NULL;
+	}
+	FUNCARG(key, 1);
+	if (key == NULL) {
+		lisp_object_free(map);
+		return NULL;
+	}
+	FUNCARG(val, 2);
+	if (val == NULL) {
+		lisp_object_free(key);
+		lisp_object_free(map);
+		return NULL;
+	}
+	LispObject res = lisp_map_assoc(map, key, val);
+	if (res == NULL)
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	lisp_object_free(val);
+	lisp_object_free(key);
+	lisp_object_free(map);
+	return res;
+}
+
+LISP_BUILTIN_DEF(dissoc)
+{
+	ASSERT_ARGS(2);
+	FUNCARG(map, 0);
+	if (map == NULL)
+		return NULL;
+	if (!lisp_require_map(lisp, map, 1)) {
+		lisp_object_free(map);
+		return NULL;
+	}
+	FUNCARG(key, 1);
+	if (key == NULL) {
+		lisp_object_free(map);
+		return NULL;
+	}
+	LispObject res = lisp_map_dissoc(map, key);
+	if (res == NULL)
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	lisp_object_free(key);
+	lisp_object_free(map);
+	return res;
+}
+
+LISP_BUILTIN_DEF(keys)
+{
+	ASSERT_ARGS(1);
+	FUNCARG(map, 0);
+	if (map == NULL)
+		return NULL;
+	if (!lisp_require_map(lisp, map, 1)) {
+		lisp_object_free(map);
+		return NULL;
+	}
+	LispObject res = lisp_map_keys(map);
+	if (res == NULL)
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	lisp_object_free(map);
+	return res;
+}
+
+LISP_BUILTIN_DEF(nth)
+{
+	ASSERT_ARGS(2);
+	FUNCARG(list, 0);
+	if (list == NULL)
+		return NULL;
+	if (list->type != T_LIST) {
+		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 1 must be of type list");
+		lisp_object_free(list);
+		return NULL;
+	}
+	FUNCARG(index, 1);
+	if (index == NULL) {
+		lisp_object_free(list);
+		return NULL;
+	}
+	LispObject res = NULL;
+	if (lisp_require_integer(lisp, index, 2)) {
+		int n = lisp_integer_get(index);
+		if (n < 0 || n >= lisp_list_size(list))
+			lisp_error_set(lisp, E_INDEX_ERROR, "Index %d out of range for a list of size %d", n, lisp_list_size(list));
+		else
+			res = lisp_object_create_reference(lisp_list_at(list, n));
+	}
+	lisp_object_free(index);
+	lisp_object_free(list);
+	return res;
+}
+
+LISP_BUILTIN_DEF(len)
+{
+	ASSERT_ARGS(1);
+	FUNCARG(obj, 0);
+	if (obj == NULL)
+		return NULL;
+	LispObject res = NULL;
+	if (obj->type == T_LIST)
+		res = lisp_integer_new(lisp_list_size(obj));
+	else if (obj->type == T_MAP)
+		res = lisp_integer_new(lisp_map_size(obj));
+	else
+		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 1 must be of type list or map");
+	lisp_object_free(obj);
+	return res;
+}
+
+LISP_BUILTIN_DEF(slice)
+{
+	int nargs = lisp_list_size(args);
+	if (nargs != 2 && nargs != 3) {
+		lisp_error_set(lisp, E_INDEX_ERROR, "Expected 2 or 3 arguments, got %d", nargs);
+		return NULL;
+	}
+	FUNCARG(list, 0);
+	if (list == NULL)
+		return NULL;
+	if (list->type != T_LIST) {
+		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 1 must be of type list");
+		lisp_object_free(list);
+		return NULL;
+	}
+	int bounds[2] = { 0, lisp_list_size(list) };
+	for (int i = 1; i < nargs; ++i) {
+		FUNCARG(bound, i);
+		if (bound == NULL) {
+			lisp_object_free(list);
+			return NULL;
+		}
+		int ok = lisp_require_integer(lisp, bound, i + 1);
+		if (ok)
+			bounds[i - 1] = lisp_integer_get(bound);
+		lisp_object_free(bound);
+		if (!ok) {
+			lisp_object_free(list);
+			return NULL;
+		}
+	}
+	LispObject res = NULL;
+	if (bounds[0] < 0 || bounds[0] > bounds[1] || bounds[1] > lisp_list_size(list)) {
+		lisp_error_set(lisp, E_INDEX_ERROR, "Slice %d to %d out of range for a list of size %d", bounds[0], bounds[1], lisp_list_size(list));
+	}
+	else {
+		res = lisp_list_slice(list, bounds[0], bounds[1]);
+		if (res == NULL)
+			lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	}
+	lisp_object_free(list);
+	return res;
+}
+
+int lisp_loop_bindings_valid(LispObject bindings)
+{
+	if (bindings->type != T_LIST)
+		return 0;
+	for (int i = 0; i < lisp_list_size(bindings); ++i) {
+		LispObject binding = lisp_list_at(bindings, i);
+		if (binding->type != T_LIST || lisp_list_size(binding) < 2 || lisp_list_size(binding) > 3)
+			return 0;
+		if (lisp_list_at(binding, 0)->type != T_SYMBOL)
+			return 0;
+	}
+	return 1;
+}
+
+// Push a frame binding each loop variable to its initial value, evaluated in the caller's frame, along with
+// the caller's own locals which are not shadowed, and fill in the slot of each variable in slots
+error_t lisp_loop_push_frame(TinyLisp lisp, LispObject bindings, int* slots)
+{
+	int nvars = lisp_list_size(bindings);
+	LispStackFrame frame = lisp_stackframe_new();
+	if (frame == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return E_MEMORY_ERROR;
+	}
+	for (int i = 0; i < nvars; ++i) {
+		LispObject binding = lisp_list_at(bindings, i);
+		LispObject val = lisp_evaluate(lisp, lisp_list_at(binding, 1));
+		if (val == NULL) {
+			lisp_stackframe_free(frame);
+			return E_EVALUATION_ERROR;
+		}
+		char* name = lisp_symbol_get(lisp_list_at(binding, 0));
+		error_t err = lisp_stackframe_set(frame, name, val);
+		if (err != E_SUCCESS) {
+			lisp_object_free(val);
+			lisp_stackframe_free(frame);
+			lisp_error_set(lisp, err, err == E_NAME_ALREADY_SET ? "Loop variable %s bound twice" : NULL, name);
+			return err;
+		}
+	}
+	LispStack stack = lisp->stack;
+	if (stack->nframes > 1) {
+		LispStackFrame outer = stack->frames[stack->nframes - 1];
+		for (int i = 0; i < outer->size; ++i) {
+			if (lisp_stackframe_find(frame, outer->keys[i]) != NULL)
+				continue;
+			error_t err = lisp_stackframe_set(frame, outer->keys[i], lisp_object_create_reference(outer->vals[i]));
+			if (err != E_SUCCESS) {
+				lisp_object_free(outer->vals[i]);
+				lisp_stackframe_free(frame);
+				lisp_error_set(lisp, err, NULL);
+				return err;
+			}
+		}
+	}
+	error_t err = lisp_stack_push(stack, frame);
+	if (err != E_SUCCESS) {
+		lisp_stackframe_free(frame);
+		lisp_error_set(lisp, err, NULL);
+		return err;
+	}
+	for (int i = 0; i < nvars; ++i)
+		slots[i] = lisp_stackframe_index(frame, lisp_symbol_get(lisp_list_at(lisp_list_at(bindings, i), 0)));
+	return E_SUCCESS;
+}
+
+LISP_BUILTIN_DEF(loop)
+{
+	ASSERT_ARGS(3);
+	MACROARG(bindings, 0);
+	MACROARG(cond, 1);
+	MACROARG(result, 2);
+	if (!lisp_loop_bindings_valid(bindings)) {
+		lisp_error_set(lisp, E_TYPE_ERROR, "Expected loop bindings of the form ((name init [step]) ...)");
+		return NULL;
+	}
+	int nvars = lisp_list_size(bindings);
+	// The slot of each variable and its next value, allocated once for the whole loop
+	int* slots = malloc(sizeof(int) * (nvars + 1));
+	LispObject* next = malloc(sizeof(LispObject) * (nvars + 1));
+	if (slots == NULL || next == NULL) {
+		free(slots);
+		free(next);
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	LispObject res = NULL;
+	if (lisp_loop_push_frame(lisp, bindings, slots) == E_SUCCESS) {
+		LispStackFrame frame = lisp->stack->frames[lisp->stack->nframes - 1];
+		for (;;) {
+			if (LISP_BUDGET_STEP(lisp))
+				break;
+			LispObject pred = lisp_evaluate(lisp, cond);
+			if (pred == NULL)
+				break;
+			int is_nil = lisp_object_is_nil(pred);
+			lisp_object_free(pred);
+			if (is_nil) {
+				res = lisp_evaluate(lisp, result);
+				break;
+			}
+			// Every step sees the values of the previous iteration, so none is stored until all are evaluated
+			int stepped = 0;
+			for (; stepped < nvars; ++stepped) {
+				LispObject binding = lisp_list_at(bindings, stepped);
+				next[stepped] = NULL;
+				if (lisp_list_size(binding) == 3 && (next[stepped] = lisp_evaluate(lisp, lisp_list_at(binding, 2))) == NULL)
+					break;
+			}
+			if (stepped < nvars) {
+				for (int i = 0; i < stepped; ++i) {
+					if (next[i] != NULL)
+						lisp_object_free(next[i]);
+				}
+				break;
+			}
+			for (int i = 0; i < nvars; ++i) {
+				if (next[i] == NULL)
+					continue;
+				lisp_object_free(frame->vals[slots[i]]);
+				frame->vals[slots[i]] = next[i];
+			}
+		}
+		lisp_stack_pop(lisp->stack);
+	}
+	free(slots);
+	free(next);
+	return res;
+}
+
+// The interpreter a sort's comparator runs in and a call of the comparator, reused for every comparison
+struct sort_context_
+{
+	TinyLisp lisp;
+	LispObject call;
+};
+
+int lisp_sort_compare(void* data, LispObject lhs, LispObject rhs)
+{
+	struct sort_context_* ctx = data;
+	LispObject vals[2] = { lhs, rhs };
+	LispObject res = lisp_evaluate_apply_values(ctx->lisp, ctx->call, vals);
+	if (res == NULL)
+		return -1;
+	int before = !lisp_object_is_nil(res);
+	lisp_object_free(res);
+	return before;
+}
+
+LISP_BUILTIN_DEF(sort)
+{
+	int nargs = lisp_list_size(args);
+	if (nargs != 1 && nargs != 2) {
+		lisp_error_set(lisp, E_INDEX_ERROR, "Expected 1 or 2 arguments, got %d", nargs);
+		return NULL;
+	}
+	FUNCARG(list, 0);
+	if (list == NULL)
+		return NULL;
+	if (list->type != T_LIST) {
+		lisp_error_set(lisp, E_TYPE_ERROR, "Argument 1 must be of type list");
+		lisp_object_free(list);
+		return NULL;
+	}
+	if (nargs == 1) {
+		LispObject res = NULL;
+		error_t err = lisp_list_sort(list, NULL, NULL, &res);
+		if (err != E_SUCCESS)
+			lisp_error_set(lisp, err, NULL);
+		lisp_object_free(list);
+		return res;
+	}
+
+	LispObject func = lisp_evaluate(lisp, lisp_list_at(args, 1));
+	if (func == NULL) {
+		lisp_object_free(list);
+		return NULL;
+	}
+	struct sort_context_ ctx = { lisp, lisp_evaluate_new_call(func, 2) };
+	LispObject res = NULL;
+	if (ctx.call == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	}
+	else {
+		error_t err = lisp_list_sort(list, lisp_sort_compare, &ctx, &res);
+		// A comparator which failed has already set the error
+		if (err == E_MEMORY_ERROR)
+			lisp_error_set(lisp, err, NULL);
+		lisp_object_free(ctx.call);
+	}
+	lisp_object_free(func);
+	lisp_object_free(list);
+	return res;
+}
+
+LISP_BUILTIN_DEF(range)
+{
+	int nargs = lisp_list_size(args);
+	if (nargs != 2 && nargs != 3) {
+		lisp_error_set(lisp, E_INDEX_ERROR, "Expected 2 or 3 arguments, got %d", nargs);
+		return NULL;
+	}
+	LispInteger bounds[3] = { 0, 0, 1 };
+	for (int i = 0; i < nargs; ++i) {
+		FUNCARG(bound, i);
+		if (bound == NULL)
+			return NULL;
+		int ok = lisp_require_integer(lisp, bound, i + 1);
+		if (ok)
+			bounds[i] = lisp_integer_get(bound);
+		lisp_object_free(bound);
+		if (!ok)
+			return NULL;
+	}
+	return lisp_seq_range(lisp, bounds[0], bounds[1], bounds[2]);
+}
+
+LISP_BUILTIN_DEF(iterate)
+{
+	ASSERT_ARGS(2);
+	FUNCARG(func, 0);
+	if (func == NULL)
+		return NULL;
+	FUNCARG(init, 1);
+	if (init == NULL) {
+		lisp_object_free(func);
+		return NULL;
+	}
+	LispObject res = lisp_seq_iterate(lisp, func, init);
+	lisp_object_free(func);
+	lisp_object_free(init);
+	return res;
+}
+
+// Evaluate the function and the list or sequence passed to map and filter, and build the sequence with make
+LispObject lisp_seq_builtin(TinyLisp lisp, LispObject args, LispObject(*make)(TinyLisp, LispObject, LispObject))
+{
+	ASSERT_ARGS(2);
+	FUNCARG(func, 0);
+	if (func == NULL)
+		return NULL;
+	FUNCARG(source, 1);
+	if (source == NULL) {
+		lisp_object_free(func);
+		return NULL;
+	}
+	LispObject res = lisp_require_sequence(lisp, source, 2) ? make(lisp, func, source) : NULL;
+	lisp_object_free(func);
+	lisp_object_free(source);
+	return res;
+}
+
+LISP_BUILTIN_DEF(map)
+{
+	return lisp_seq_builtin(lisp, args, lisp_seq_map);
+}
+
+LISP_BUILTIN_DEF(filter)
+{
+	return lisp_seq_builtin(lisp, args, lisp_seq_filter);
+}
+
+LISP_BUILTIN_DEF(take)
+{
+	ASSERT_ARGS(2);
+	FUNCARG(n, 0);
+	if (n == NULL)
+		return NULL;
+	if (!lisp_require_integer(lisp, n, 1)) {
+		lisp_object_free(n);
+		return NULL;
+	}
+	FUNCARG(source, 1);
+	if (source == NULL) {
+		lisp_object_free(n);
+		return NULL;
+	}
+	LispObject res = lisp_require_sequence(lisp, source, 2) ? lisp_seq_take(lisp, lisp_integer_get(n), source) : NULL;
+	lisp_object_free(n);
+	lisp_object_free(source);
+	return res;
+}
+
+LISP_BUILTIN_DEF(collect)
+{
+	ASSERT_ARGS(1);
+	FUNCARG(source, 0);
+	if (source == NULL)
+		return NULL;
+	LispObject res = lisp_require_sequence(lisp, source, 1) ? lisp_seq_collect(lisp, source) : NULL;
+	lisp_object_free(source);
+	return res;
+}
+
+struct builtin_desc_ builtindesc[B_SIZE] = {
+	{ B_CONSTRUCT, "c", construct, 1, 1 },
+	{ B_HEAD, "h", head, 1, 1 },
+	{ B_TAIL, "t", tail, 1, 1 },
+	{ B_SUBTRACT, "s", subtract, 1, 1 },
+	{ B_LESSTHAN, "l", lessthan, 1, 1 },
+	{ B_EQUAL, "e", equal, 1, 1 },
+	{ B_EVAL, "v", eval, 1, 0 },
+	{ B_QUOTE, "q", quote, 0, 1 },
+	{ B_TERNARY, "i", ternary, 1, 0 },
+	{ B_DEF, "d", def, 0, 0 },
+	{ B_DUMP, "dump", dump, 1, 0 },
+	{ B_LOAD, "load", load, 1, 0 },
+	{ B_STATS, "stats", stats, 1, 0 },
+	{ B_HASHMAP, "hash-map", hashmap, 1, 1 },
+	{ B_GET, "get", get, 1, 1 },
+	{ B_ASSOC, "assoc", assoc, 1, 1 },
+	{ B_DISSOC, "dissoc", dissoc, 1, 1 },
+	{ B_KEYS, "keys", keys, 1, 1 },
+	{ B_NTH, "nth", nth, 1, 1 },
+	{ B_LEN, "len", len, 1, 1 },
+	{ B_SLICE, "slice", slice, 1, 1 },
+	{ B_SORT, "sort", sort, 1, 0 },
+	{ B_LOOP, "loop", loop, 0, 0 },
+	{ B_RANGE, "range", range, 1, 0 },
+	{ B_ITERATE, "iterate", iterate, 1, 0 },
+	{ B_MAP, "map", map, 1, 0 },
+	{ B_FILTER, "filter", filter, 1, 0 },
+	{ B_TAKE, "take", take, 1, 0 },
+	{ B_COLLECT, "collect", collect, 1, 0 }
+};
+
+int lisp_builtin_id(LispBuiltin func)
+{
+	for (int i = 0; i < B_SIZE; ++i) {
+		if (builtindesc[i].func == func)
+			return i;
+	}
+	return -1;
+}
@@ -7,6 +7,74 @@
 
 #define LISP_BUILTIN_DEF(name) LispObject name(TinyLisp lisp, LispObject args)
 
+enum LispBuiltinId_
+{
+	B_CONSTRUCT,
+	B_HEAD,
+	B_TAIL,
+	B_SUBTRACT,
+	B_LESSTHAN,
+	B_EQUAL,
+	B_EVAL,
+	B_QUOTE,
+	B_TERNARY,
+	B_DEF,
+	B_DUMP,
+	B_LOAD,
+	B_STATS,
+	B_HASHMAP,
+	B_GET,
+	B_ASSOC,
+	B_DISSOC,
+	B_KEYS,
+	B_NTH,
+	B_LEN,
+	B_SLICE,
+	B_SORT,
+	B_LOOP,
+	B_RANGE,
+	B_ITERATE,
+	B_MAP,
+	B_FILTER,
+	B_TAKE,
+	B_COLLECT,
+	B_SIZE
+};
+
+struct builtin_desc_
+{
+	int code;
+	char* name;
+	LispBuiltin func;
+	// 1 if every argument is evaluated as an expression in the caller's frame before it is used
+	int eager;
+	// 1 if the result depends only on the values of the arguments, so calls with constant arguments can be folded
+	int pure;
+};
+
+// The builtins bound in the global namespace of every new stack, indexed by LispBuiltinId_
+extern struct builtin_desc_ builtindesc[B_SIZE];
+
+// Returns the LispBuiltinId_ of func, or -1 if it is not a registered builtin
+int lisp_builtin_id(LispBuiltin func);
+
+// The primitives behind the builtins of the same names, applied to arguments which have already been
+// evaluated. Arguments are borrowed; each returns a new reference, or NULL with an error set on lisp.
+LispObject lisp_apply_construct(TinyLisp lisp, LispObject lhs, LispObject rhs);
+LispObject lisp_apply_head(TinyLisp lisp, LispObject list);
+LispObject lisp_apply_tail(TinyLisp lisp, LispObject list);
+LispObject lisp_apply_subtract(TinyLisp lisp, LispObject x, LispObject y);
+LispObject lisp_apply_lessthan(TinyLisp lisp, LispObject x, LispObject y);
+LispObject lisp_apply_equal(TinyLisp lisp, LispObject x, LispObject y);
+// Returns 1 if val, argument index of a builtin, is an integer; otherwise sets a type error and returns 0
+int lisp_require_integer(TinyLisp lisp, LispObject val, int index);
+// Returns 1 if val, argument index of a builtin, is a map; otherwise sets a type error and returns 0
+int lisp_require_map(TinyLisp lisp, LispObject val, int index);
+// Returns 1 if val, argument index of a builtin, is a list or sequence; otherwise sets a type error and returns 0
+int lisp_require_sequence(TinyLisp lisp, LispObject val, int index);
+// Returns 1 if bindings is a list of loop bindings, each of the form (name init) or (name init step)
+int lisp_loop_bindings_valid(LispObject bindings);
+
 //Takes two arguments, a value and a list, and returns a new list obtained by adding the value at the front of the list.
 LISP_BUILTIN_DEF(construct);
 
@@ -47,4 +115,78 @@ LISP_BUILTIN_DEF(ternary);
 //evaluated: e.g., (d x (q (1 2 3))).
 LISP_BUILTIN_DEF(def);
 
+// Takes a symbol naming a file and a value. Writes the value to the file in the compact binary
+// format of lisp_object_serialize and returns the symbol.
+LISP_BUILTIN_DEF(dump);
+
+// Takes a symbol naming a file written by dump and returns the value stored in it.
+LISP_BUILTIN_DEF(load);
+
+// Takes no arguments and returns the interpreter's instrumentation counters as a list of (name value)
+// entries, with evaluations, builtin calls, allocations and frees broken down by type or builtin.
+LISP_BUILTIN_DEF(stats);
+
+// Takes any even number of arguments, alternately keys and values, and returns a map binding each key to
+// the value after it; a key given twice takes the later value. E.g. (hash-map (q a) 1 (q b) 2).
+LISP_BUILTIN_DEF(hashmap);
+
+// Takes a map, a key and optionally a default; returns the value bound to the key, or the default (nil if
+// none is given) if there is none. Keys are compared as by e.
+LISP_BUILTIN_DEF(get);
+
+// Takes a map, a key and a value, and returns a new map which also binds the key to the value.
+LISP_BUILTIN_DEF(assoc);
+
+// Takes a map and a key, and returns a new map without the key.
+LISP_BUILTIN_DEF(dissoc);
+
+// Takes a map and returns a list of its keys, in no particular order.
+LISP_BUILTIN_DEF(keys);
+
+// Takes a list and an integer k; returns the element at position k, counting from 0, in constant time.
+LISP_BUILTIN_DEF(nth);
+
+// Takes a list or a map and returns its number of elements or keys, in constant time.
+LISP_BUILTIN_DEF(len);
+
+// Takes a list, a start position and optionally an end position (the length of the list if omitted), and
+// returns the elements from start up to but not including end. The result shares the storage of the list
+// rather than copying it, as does the result of t.
+LISP_BUILTIN_DEF(slice);
+
+// Takes a list and optionally a function of two arguments returning true if the first comes before the
+// second, and returns a new list of the same elements in order, equal elements keeping their original order.
+// Without the function elements are ordered as by l (a list of nothing but integers is sorted by a radix sort).
+LISP_BUILTIN_DEF(sort);
+
+// Takes a list of bindings ((name init [step]) ...), a condition and a result, none of them evaluated first.
+// Binds each name to the value of its init; then, for as long as the condition is true, rebinds every name
+// which has a step to the value of its step, all of them computed before any is changed. Returns the value
+// of the result once the condition is false. The variables are updated in place in a single frame, so a
+// loop runs in constant stack however many times it goes round, and sees the locals of its caller.
+LISP_BUILTIN_DEF(loop);
+
+// The builtins below return lazy sequences, whose elements are computed a chunk at a time as h and t reach
+// them. A sequence is never empty: once there are no more elements the empty list is returned instead, so
+// the sequence ends just as a list would. Wherever a sequence is taken, a list can be given too.
+
+// Takes a start, an end and optionally a step (1 if omitted), all integers, and returns the sequence of the
+// integers from start up to but not including end, or down to it if the step is negative.
+LISP_BUILTIN_DEF(range);
+
+// Takes a function and a value x, and returns the endless sequence x, (f x), (f (f x)) ...
+LISP_BUILTIN_DEF(iterate);
+
+// Takes a function and a sequence, and returns the sequence of the function applied to each element.
+LISP_BUILTIN_DEF(map);
+
+// Takes a function and a sequence, and returns the sequence of the elements for which the function is true.
+LISP_BUILTIN_DEF(filter);
+
+// Takes an integer n and a sequence, and returns the sequence of its first n elements.
+LISP_BUILTIN_DEF(take);
+
+// Takes a sequence, which must end, and returns a list of all of its elements.
+LISP_BUILTIN_DEF(collect);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,772 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "emit.h"
+#include "parse.h"
+#include "builtins.h"
+
+// Largest number of temporaries alive at once in a generated function
+#define LISP_EMIT_MAX_LIVE 256
+
+// Support code at the top of every generated translation unit
+static const char* lisp_emit_prelude =
+	"// Generated by tinylisp --emit-c\n"
+	"#include <stdio.h>\n"
+	"#include <stdlib.h>\n"
+	"\n"
+	"#include \"tinylisp.h\"\n"
+	"#include \"eval.h\"\n"
+	"#include \"builtins.h\"\n"
+	"#include \"writer.h\"\n"
+	"\n"
+	"// Compiled calls in progress, which stand in for the interpreter's stack frames\n"
+	"int tl_depth = 0;\n"
+	"\n"
+	"// Return a new reference to the value bound to name in the global frame\n"
+	"LispObject tl_global(TinyLisp lisp, char* name)\n"
+	"{\n"
+	"\tLispObject res = lisp_stack_find(lisp->stack, name);\n"
+	"\tif (res == NULL) {\n"
+	"\t\tlisp_error_set(lisp, E_UNDEFINED_NAME, \"Symbol %s not in scope\", name);\n"
+	"\t\treturn NULL;\n"
+	"\t}\n"
+	"\treturn lisp_object_create_reference(res);\n"
+	"}\n"
+	"\n"
+	"// Decode a quoted constant or a form that was not compiled from the len bytes of data written for it\n"
+	"LispObject tl_decode(TinyLisp lisp, const unsigned char* data, int len)\n"
+	"{\n"
+	"\tLispObject res;\n"
+	"\terror_t err = lisp_object_deserialize(data, len, &res);\n"
+	"\tif (err != E_SUCCESS) {\n"
+	"\t\tlisp_error_set(lisp, err, NULL);\n"
+	"\t\treturn NULL;\n"
+	"\t}\n"
+	"\treturn res;\n"
+	"}\n"
+	"\n"
+	"// Print the result of a top level form as the interpreter does\n"
+	"void tl_print(TinyLisp lisp, LispWriter out, LispObject res)\n"
+	"{\n"
+	"\tif (res != NULL) {\n"
+	"\t\tlisp_object_write(out, res);\n"
+	"\t\tlisp_writer_putc(out, '\\n');\n"
+	"\t\tlisp_object_free(res);\n"
+	"\t}\n"
+	"\telse {\n"
+	"\t\tlisp_writer_flush(out);\n"
+	"\t\tlisp_print_error(lisp);\n"
+	"\t\tlisp_clear_error(lisp);\n"
+	"\t}\n"
+	"}\n"
+	"\n";
+
+typedef struct LispEmitter_ *LispEmitter;
+
+struct LispEmitter_
+{
+	TinyLisp lisp;
+	LispWriter out;
+	// the top level forms of the script and its text
+	LispObject forms;
+	char* text;
+	// for each form, the function it defines that is being compiled, or -1
+	int* form_fn;
+	// the candidate functions: the form defining each, its name, lambda, and whether it can be compiled
+	int nfns;
+	int* fn_form;
+	char** fn_name;
+	LispObject* fn_lambda;
+	int* fn_ok;
+	// objects that become static constants in the generated code
+	LispObject constants;
+	// state of the function being generated
+	LispLambda lambda;
+	int ntemps;
+	int indent;
+	int live[LISP_EMIT_MAX_LIVE];
+	int nlive;
+	int failed;
+};
+
+// Returns the index of the candidate function named name which can be compiled, or -1
+int lisp_emit_find_fn(LispEmitter e, char* name)
+{
+	for (int i = 0; i < e->nfns; ++i) {
+		if (e->fn_ok[i] && strcmp(e->fn_name[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+// Returns the position of sym in the parameters of lambda, or -1
+int lisp_emit_param(LispLambda lambda, LispObject sym)
+{
+	if (lambda == NULL)
+		return -1;
+	for (int i = 0; i < lambda->arity; ++i) {
+		if (lisp_symbol_equal(lisp_list_at(lambda->params, i), sym))
+			return i;
+	}
+	return -1;
+}
+
+// Returns the number of arguments the builtin with LispBuiltinId_ id is compiled for, or -1 if it is not
+int lisp_emit_builtin_arity(int id)
+{
+	switch (id) {
+	case B_HEAD:
+	case B_TAIL:
+	case B_QUOTE:
+		return 1;
+	case B_CONSTRUCT:
+	case B_SUBTRACT:
+	case B_LESSTHAN:
+	case B_EQUAL:
+		return 2;
+	case B_TERNARY:
+		return 3;
+	default:
+		return -1;
+	}
+}
+
+// Resolve head, a symbol at the head of a call outside any parameter, as the generated program will: to
+// the builtin bound to it in the global frame, setting *id to its LispBuiltinId_, or to the candidate
+// function it names, setting *fn. Returns 1 if that is a builtin or function which can be compiled.
+int lisp_emit_resolve(LispEmitter e, LispObject head, int* id, int* fn)
+{
+	char* name = lisp_symbol_get(head);
+	*id = *fn = -1;
+	LispObject val = lisp_stack_find(e->lisp->stack, name);
+	if (val != NULL) {
+		if (val->type == T_BUILTIN)
+			*id = lisp_builtin_id(lisp_builtin_get(val));
+		return lisp_emit_builtin_arity(*id) >= 0;
+	}
+	*fn = lisp_emit_find_fn(e, name);
+	return *fn >= 0;
+}
+
+// Returns 1 if expr, in the body of lambda (NULL at top level), can be translated
+int lisp_emit_check(LispEmitter e, LispLambda lambda, LispObject expr)
+{
+	if (expr->type == T_INTEGER || expr->type == T_SYMBOL)
+		return 1;
+	if (expr->type != T_LIST)
+		return 0;
+	if (lisp_list_size(expr) == 0)
+		return 1;
+
+	LispObject head = lisp_list_at(expr, 0);
+	int nargs = lisp_list_size(expr) - 1;
+	int id, fn;
+	if (head->type != T_SYMBOL || lisp_emit_param(lambda, head) >= 0 || !lisp_emit_resolve(e, head, &id, &fn))
+		return 0;
+	if (id == B_QUOTE)
+		return nargs == 1;
+	int arity = lisp_emit_builtin_arity(id);
+	if (fn >= 0) {
+		LispLambda callee;
+		lisp_list_decode_lambda(e->fn_lambda[fn], &callee);
+		arity = callee->arity;
+	}
+	if (arity != nargs)
+		return 0;
+	for (int i = 1; i <= nargs; ++i) {
+		if (!lisp_emit_check(e, lambda, lisp_list_at(expr, i)))
+			return 0;
+	}
+	return 1;
+}
+
+void lisp_emit_puts(LispEmitter e, const char* str)
+{
+	if (lisp_writer_puts(e->out, str) != E_SUCCESS)
+		e->failed = 1;
+}
+
+void lisp_emit_int(LispEmitter e, int val)
+{
+	if (lisp_writer_integer(e->out, val) != E_SUCCESS)
+		e->failed = 1;
+}
+
+// Start a new line at the current indentation
+void lisp_emit_line(LispEmitter e)
+{
+	for (int i = 0; i < e->indent; ++i)
+		lisp_emit_puts(e, "\t");
+}
+
+// Write str as the contents of a C string literal
+void lisp_emit_escaped(LispEmitter e, const char* str, int len)
+{
+	for (int i = 0; i < len; ++i) {
+		char c = str[i];
+		if (c == '"' || c == '\\') {
+			char escaped[3] = { '\\', c, '\0' };
+			lisp_emit_puts(e, escaped);
+		}
+		else if (c == '\n') {
+			lisp_emit_puts(e, "\\n");
+		}
+		else if (c == '\t') {
+			lisp_emit_puts(e, "\\t");
+		}
+		else if ((unsigned char)c < 0x20 || (unsigned char)c > 0x7e) {
+			char octal[5] = { '\\', (char)('0' + (((unsigned char)c >> 6) & 7)), (char)('0' + (((unsigned char)c >> 3) & 7)), (char)('0' + ((unsigned char)c & 7)), '\0' };
+			lisp_emit_puts(e, octal);
+		}
+		else {
+			char plain[2] = { c, '\0' };
+			lisp_emit_puts(e, plain);
+		}
+	}
+}
+
+// Write "LispObject t<n> = " for a new temporary and return n
+int lisp_emit_declare(LispEmitter e)
+{
+	int n = e->ntemps++;
+	lisp_emit_line(e);
+	lisp_emit_puts(e, "LispObject t");
+	lisp_emit_int(e, n);
+	lisp_emit_puts(e, " = ");
+	return n;
+}
+
+void lisp_emit_temp(LispEmitter e, int n)
+{
+	lisp_emit_puts(e, "t");
+	lisp_emit_int(e, n);
+}
+
+void lisp_emit_push_live(LispEmitter e, int n)
+{
+	if (e->nlive == LISP_EMIT_MAX_LIVE) {
+		e->failed = 1;
+		return;
+	}
+	e->live[e->nlive++] = n;
+}
+
+// Write the statements returning NULL after releasing every live temporary
+void lisp_emit_fail(LispEmitter e)
+{
+	for (int i = 0; i < e->nlive; ++i) {
+		lisp_emit_puts(e, "lisp_object_free(");
+		lisp_emit_temp(e, e->live[i]);
+		lisp_emit_puts(e, "); ");
+	}
+	if (e->lambda != NULL)
+		lisp_emit_puts(e, "--tl_depth; ");
+	lisp_emit_puts(e, "return NULL;");
+}
+
+// Write a check that temporary n is not NULL
+void lisp_emit_check_null(LispEmitter e, int n)
+{
+	lisp_emit_line(e);
+	lisp_emit_puts(e, "if (");
+	lisp_emit_temp(e, n);
+	lisp_emit_puts(e, " == NULL) { ");
+	lisp_emit_fail(e);
+	lisp_emit_puts(e, " }\n");
+}
+
+// Write "lisp_object_free(t<n>);" on its own line
+void lisp_emit_free(LispEmitter e, int n)
+{
+	lisp_emit_line(e);
+	lisp_emit_puts(e, "lisp_object_free(");
+	lisp_emit_temp(e, n);
+	lisp_emit_puts(e, ");\n");
+}
+
+// Returns the index of a static constant holding obj
+int lisp_emit_constant(LispEmitter e, LispObject obj)
+{
+	LispObject ref = lisp_object_create_reference(obj);
+	if (lisp_list_push(e->constants, ref) != E_SUCCESS) {
+		lisp_object_free(ref);
+		e->failed = 1;
+	}
+	return lisp_list_size(e->constants) - 1;
+}
+
+// Write statements computing expr into a new temporary holding a new reference and return its number
+int lisp_emit_expr(LispEmitter e, LispObject expr)
+{
+	if (expr->type == T_INTEGER || (expr->type == T_LIST && lisp_list_size(expr) == 0)) {
+		int c = lisp_emit_constant(e, expr);
+		int n = lisp_emit_declare(e);
+		lisp_emit_puts(e, "lisp_object_create_reference(tl_const_");
+		lisp_emit_int(e, c);
+		lisp_emit_puts(e, ");\n");
+		return n;
+	}
+	if (expr->type == T_SYMBOL) {
+		int param = lisp_emit_param(e->lambda, expr);
+		int n = lisp_emit_declare(e);
+		if (param >= 0) {
+			lisp_emit_puts(e, "lisp_object_create_reference(p");
+			lisp_emit_int(e, param);
+			lisp_emit_puts(e, ");\n");
+			return n;
+		}
+		char* name = lisp_symbol_get(expr);
+		lisp_emit_puts(e, "tl_global(lisp, \"");
+		lisp_emit_escaped(e, name, (int)strlen(name));
+		lisp_emit_puts(e, "\");\n");
+		lisp_emit_check_null(e, n);
+		return n;
+	}
+
+	int id, fn;
+	lisp_emit_resolve(e, lisp_list_at(expr, 0), &id, &fn);
+	int nargs = lisp_list_size(expr) - 1;
+	if (id == B_QUOTE) {
+		int c = lisp_emit_constant(e, lisp_list_at(expr, 1));
+		int n = lisp_emit_declare(e);
+		lisp_emit_puts(e, "lisp_object_create_reference(tl_const_");
+		lisp_emit_int(e, c);
+		lisp_emit_puts(e, ");\n");
+		return n;
+	}
+	if (id == B_TERNARY) {
+		// Only the branch selected by the condition is evaluated
+		int pred = lisp_emit_expr(e, lisp_list_at(expr, 1));
+		int n = e->ntemps++;
+		lisp_emit_line(e);
+		lisp_emit_puts(e, "int n");
+		lisp_emit_int(e, n);
+		lisp_emit_puts(e, " = lisp_object_is_nil(");
+		lisp_emit_temp(e, pred);
+		lisp_emit_puts(e, ");\n");
+		lisp_emit_free(e, pred);
+		lisp_emit_line(e);
+		lisp_emit_puts(e, "LispObject ");
+		lisp_emit_temp(e, n);
+		lisp_emit_puts(e, ";\n");
+		for (int branch = 2; branch <= 3; ++branch) {
+			lisp_emit_line(e);
+			lisp_emit_puts(e, branch == 2 ? "if (!n" : "else {\n");
+			if (branch == 2) {
+				lisp_emit_int(e, n);
+				lisp_emit_puts(e, ") {\n");
+			}
+			++e->indent;
+			int val = lisp_emit_expr(e, lisp_list_at(expr, branch));
+			lisp_emit_line(e);
+			lisp_emit_temp(e, n);
+			lisp_emit_puts(e, " = ");
+			lisp_emit_temp(e, val);
+			lisp_emit_puts(e, ";\n");
+			--e->indent;
+			lisp_emit_line(e);
+			lisp_emit_puts(e, "}\n");
+		}
+		return n;
+	}
+
+	// Arguments are evaluated from left to right, each staying live until the call is made
+	int args[3] = { -1, -1, -1 };
+	int* fn_args = NULL;
+	if (fn >= 0 && nargs > 0) {
+		fn_args = malloc(sizeof(int) * nargs);
+		if (fn_args == NULL) {
+			e->failed = 1;
+			return 0;
+		}
+	}
+	for (int i = 0; i < nargs; ++i) {
+		int arg = lisp_emit_expr(e, lisp_list_at(expr, i + 1));
+		if (fn_args != NULL)
+			fn_args[i] = arg;
+		else
+			args[i] = arg;
+		lisp_emit_push_live(e, arg);
+		// subtract checks its first argument before evaluating the second
+		if (i == 0 && id == B_SUBTRACT) {
+			lisp_emit_line(e);
+			lisp_emit_puts(e, "if (!lisp_require_integer(lisp, ");
+			lisp_emit_temp(e, arg);
+			lisp_emit_puts(e, ", 1)) { ");
+			lisp_emit_fail(e);
+			lisp_emit_puts(e, " }\n");
+		}
+	}
+
+	int n = lisp_emit_declare(e);
+	if (fn >= 0) {
+		lisp_emit_puts(e, "tl_fn_");
+		lisp_emit_int(e, fn);
+		lisp_emit_puts(e, "(lisp");
+		for (int i = 0; i < nargs; ++i) {
+			lisp_emit_puts(e, ", ");
+			lisp_emit_temp(e, fn_args[i]);
+		}
+	}
+	else {
+		static const struct { int id; const char* func; } names[] = {
+			{ B_CONSTRUCT, "lisp_apply_construct" }, { B_HEAD, "lisp_apply_head" }, { B_TAIL, "lisp_apply_tail" },
+			{ B_SUBTRACT, "lisp_apply_subtract" }, { B_LESSTHAN, "lisp_apply_lessthan" }, { B_EQUAL, "lisp_apply_equal" }
+		};
+		for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); ++i) {
+			if (id == names[i].id)
+				lisp_emit_puts(e, names[i].func);
+		}
+		lisp_emit_puts(e, "(lisp");
+		for (int i = 0; i < nargs; ++i) {
+			lisp_emit_puts(e, ", ");
+			lisp_emit_temp(e, args[i]);
+		}
+	}
+	lisp_emit_puts(e, ");\n");
+	for (int i = 0; i < nargs; ++i) {
+		--e->nlive;
+		lisp_emit_free(e, fn_args != NULL ? fn_args[i] : args[i]);
+	}
+	free(fn_args);
+	lisp_emit_check_null(e, n);
+	return n;
+}
+
+// Write the C function for candidate fn, or the top level expression in form if fn is -1
+void lisp_emit_function(LispEmitter e, int fn, int form)
+{
+	LispObject body;
+	if (fn >= 0) {
+		lisp_list_decode_lambda(e->fn_lambda[fn], &e->lambda);
+		body = e->lambda->source;
+		lisp_emit_puts(e, "// ");
+		lisp_emit_puts(e, e->fn_name[fn]);
+		lisp_emit_puts(e, "\nLispObject tl_fn_");
+		lisp_emit_int(e, fn);
+		lisp_emit_puts(e, "(TinyLisp lisp");
+		for (int i = 0; i < e->lambda->arity; ++i) {
+			lisp_emit_puts(e, ", LispObject p");
+			lisp_emit_int(e, i);
+		}
+		lisp_emit_puts(e, ")\n{\n");
+		lisp_emit_puts(e, "\tif (++tl_depth >= LISP_MAX_STACK_SIZE) {\n");
+		lisp_emit_puts(e, "\t\tlisp_error_set(lisp, E_STACK_OVERFLOW, NULL);\n");
+		lisp_emit_puts(e, "\t\t--tl_depth;\n");
+		lisp_emit_puts(e, "\t\treturn NULL;\n");
+		lisp_emit_puts(e, "\t}\n");
+	}
+	else {
+		e->lambda = NULL;
+		body = lisp_list_at(e->forms, form);
+		lisp_emit_puts(e, "LispObject tl_expr_");
+		lisp_emit_int(e, form);
+		lisp_emit_puts(e, "(TinyLisp lisp)\n{\n");
+		// A constant expression does not use the interpreter
+		lisp_emit_puts(e, "\t(void)lisp;\n");
+	}
+	e->ntemps = 0;
+	e->nlive = 0;
+	e->indent = 1;
+	int res = lisp_emit_expr(e, body);
+	if (fn >= 0)
+		lisp_emit_puts(e, "\t--tl_depth;\n");
+	lisp_emit_puts(e, "\treturn ");
+	lisp_emit_temp(e, res);
+	lisp_emit_puts(e, ";\n}\n\n");
+}
+
+// Write the bytes lisp_object_serialize writes for constant i as the static array tl_data_<i>
+void lisp_emit_data(LispEmitter e, int i)
+{
+	LispWriter data = lisp_writer_new(NULL, NULL);
+	if (data == NULL || lisp_object_serialize(data, lisp_list_at(e->constants, i)) != E_SUCCESS) {
+		e->failed = 1;
+		if (data != NULL)
+			lisp_writer_free(data);
+		return;
+	}
+	lisp_emit_puts(e, "static const unsigned char tl_data_");
+	lisp_emit_int(e, i);
+	lisp_emit_puts(e, "[] = {");
+	for (int j = 0; j < data->size; ++j) {
+		lisp_emit_puts(e, j % 16 == 0 ? "\n\t" : " ");
+		lisp_emit_int(e, (unsigned char)data->data[j]);
+		lisp_emit_puts(e, ",");
+	}
+	lisp_emit_puts(e, "\n};\n");
+	lisp_writer_free(data);
+}
+
+// Read the whole file at filename into a nul-terminated buffer
+error_t lisp_emit_read(char* filename, char** res)
+{
+	FILE* input = NULL;
+	if (fopen_s(&input, filename, "rb") != 0)
+		return E_IO_ERROR;
+	int size = 0, capacity = 4096;
+	char* text = malloc(capacity);
+	while (text != NULL) {
+		size += (int)fread(text + size, 1, capacity - size - 1, input);
+		if (size < capacity - 1)
+			break;
+		capacity *= 2;
+		char* grown = realloc(text, capacity);
+		if (grown == NULL)
+			free(text);
+		text = grown;
+	}
+	fclose(input);
+	if (text == NULL)
+		return E_MEMORY_ERROR;
+	text[size] = '\0';
+	*res = text;
+	return E_SUCCESS;
+}
+
+// Parse every top level form in e->text
+error_t lisp_emit_parse(LispEmitter e)
+{
+	int pos = 0;
+	for (;;) {
+		LispObject form = lisp_parse(e->lisp, e->text, &pos);
+		if (form == NULL) {
+			// A form left unfinished at the end of the file is ignored, as by the interpreter
+			error_t err = e->lisp->err_code;
+			if (err == E_NO_INPUT || err == E_UNEXPECTED_EOF) {
+				lisp_clear_error(e->lisp);
+				return E_SUCCESS;
+			}
+			return err;
+		}
+		if (lisp_list_push(e->forms, form) != E_SUCCESS) {
+			lisp_object_free(form);
+			return E_MEMORY_ERROR;
+		}
+	}
+}
+
+// Returns 1 if sym is bound to the builtin with LispBuiltinId_ id in the global frame
+int lisp_emit_is_builtin(LispEmitter e, LispObject sym, int id)
+{
+	if (sym->type != T_SYMBOL)
+		return 0;
+	LispObject val = lisp_stack_find(e->lisp->stack, lisp_symbol_get(sym));
+	return val != NULL && val->type == T_BUILTIN && lisp_builtin_id(lisp_builtin_get(val)) == id;
+}
+
+// Returns the lambda defined by form if it has the shape (d name (q (params body))), otherwise NULL
+LispObject lisp_emit_definition(LispEmitter e, LispObject form)
+{
+	if (form->type != T_LIST || lisp_list_size(form) != 3)
+		return NULL;
+	LispObject head = lisp_list_at(form, 0);
+	LispObject name = lisp_list_at(form, 1);
+	LispObject value = lisp_list_at(form, 2);
+	if (!lisp_emit_is_builtin(e, head, B_DEF) || name->type != T_SYMBOL)
+		return NULL;
+	if (value->type != T_LIST || lisp_list_size(value) != 2)
+		return NULL;
+	LispObject quote_head = lisp_list_at(value, 0);
+	LispObject lambda = lisp_list_at(value, 1);
+	if (!lisp_emit_is_builtin(e, quote_head, B_QUOTE) || lambda->type != T_LIST)
+		return NULL;
+	LispLambda decoded;
+	if (lisp_list_decode_lambda(lambda, &decoded) != E_SUCCESS || decoded->is_macro || decoded->arity < 0)
+		return NULL;
+	return lambda;
+}
+
+// Find the functions which can be compiled and write the translation unit
+error_t lisp_emit_translate(LispEmitter e)
+{
+	int nforms = lisp_list_size(e->forms);
+	e->form_fn = malloc(sizeof(int) * (nforms + 1));
+	e->fn_form = malloc(sizeof(int) * (nforms + 1));
+	e->fn_name = malloc(sizeof(char*) * (nforms + 1));
+	e->fn_lambda = malloc(sizeof(LispObject) * (nforms + 1));
+	e->fn_ok = malloc(sizeof(int) * (nforms + 1));
+	if (e->form_fn == NULL || e->fn_form == NULL || e->fn_name == NULL || e->fn_lambda == NULL || e->fn_ok == NULL)
+		return E_MEMORY_ERROR;
+
+	// Candidates are the first definition of each name, other than those of builtins which d rejects
+	for (int i = 0; i < nforms; ++i) {
+		e->form_fn[i] = -1;
+		LispObject form = lisp_list_at(e->forms, i);
+		LispObject lambda = lisp_emit_definition(e, form);
+		if (lambda == NULL)
+			continue;
+		char* name = lisp_symbol_get(lisp_list_at(form, 1));
+		int known = lisp_stack_find(e->lisp->stack, name) != NULL;
+		for (int j = 0; j < e->nfns && !known; ++j)
+			known = strcmp(e->fn_name[j], name) == 0;
+		if (known)
+			continue;
+		e->form_fn[i] = e->nfns;
+		e->fn_form[e->nfns] = i;
+		e->fn_name[e->nfns] = name;
+		e->fn_lambda[e->nfns] = lambda;
+		e->fn_ok[e->nfns] = 1;
+		++e->nfns;
+	}
+	// Drop candidates which use something untranslatable, directly or through another candidate
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (int i = 0; i < e->nfns; ++i) {
+			LispLambda lambda;
+			lisp_list_decode_lambda(e->fn_lambda[i], &lambda);
+			if (e->fn_ok[i] && !lisp_emit_check(e, lambda, lambda->source)) {
+				e->fn_ok[i] = 0;
+				changed = 1;
+			}
+		}
+	}
+
+	// Generate the functions into a scratch writer first, as they create the constants
+	LispWriter out = e->out;
+	LispWriter body = lisp_writer_new(NULL, NULL);
+	if (body == NULL)
+		return E_MEMORY_ERROR;
+	e->out = body;
+	// for each form, the constant holding it if it is not compiled, otherwise -1
+	int* interpreted = malloc(sizeof(int) * (nforms + 1));
+	if (interpreted == NULL) {
+		lisp_writer_free(body);
+		e->out = out;
+		return E_MEMORY_ERROR;
+	}
+	for (int i = 0; i < e->nfns; ++i) {
+		if (e->fn_ok[i])
+			lisp_emit_function(e, i, -1);
+	}
+	for (int i = 0; i < nforms; ++i) {
+		// d forms are never compiled, as d is not among the builtins lisp_emit_check accepts
+		LispObject form = lisp_list_at(e->forms, i);
+		interpreted[i] = -1;
+		if (lisp_emit_check(e, NULL, form))
+			lisp_emit_function(e, -1, i);
+		else
+			interpreted[i] = lisp_emit_constant(e, form);
+	}
+	e->out = out;
+
+	lisp_emit_puts(e, lisp_emit_prelude);
+	int nconstants = lisp_list_size(e->constants);
+	for (int i = 0; i < nconstants; ++i) {
+		lisp_emit_puts(e, "static LispObject tl_const_");
+		lisp_emit_int(e, i);
+		lisp_emit_puts(e, " = NULL;\n");
+	}
+	for (int i = 0; i < nconstants; ++i) {
+		if (lisp_list_at(e->constants, i)->type != T_INTEGER)
+			lisp_emit_data(e, i);
+	}
+	lisp_emit_puts(e, "\n");
+	for (int i = 0; i < e->nfns; ++i) {
+		if (!e->fn_ok[i])
+			continue;
+		lisp_emit_puts(e, "LispObject tl_fn_");
+		lisp_emit_int(e, i);
+		lisp_emit_puts(e, "(TinyLisp lisp");
+		LispLambda lambda;
+		lisp_list_decode_lambda(e->fn_lambda[i], &lambda);
+		for (int j = 0; j < lambda->arity; ++j)
+			lisp_emit_puts(e, ", LispObject");
+		lisp_emit_puts(e, ");\n");
+	}
+	lisp_emit_puts(e, "\n");
+	if (lisp_writer_write(out, body->data, body->size) != E_SUCCESS)
+		e->failed = 1;
+	lisp_writer_free(body);
+
+	// main builds the constants, then runs the forms in order
+	lisp_emit_puts(e, "int main(void)\n{\n");
+	lisp_emit_puts(e, "\tTinyLisp lisp = lisp_new();\n");
+	lisp_emit_puts(e, "\tLispWriter out = lisp_writer_new_file(stdout);\n");
+	lisp_emit_puts(e, "\tif (lisp == NULL || out == NULL) {\n");
+	lisp_emit_puts(e, "\t\tprintf(\"Could not allocate interpreter\\n\");\n");
+	lisp_emit_puts(e, "\t\treturn E_MEMORY_ERROR;\n");
+	lisp_emit_puts(e, "\t}\n");
+	for (int i = 0; i < nconstants; ++i) {
+		LispObject constant = lisp_list_at(e->constants, i);
+		lisp_emit_puts(e, "\ttl_const_");
+		lisp_emit_int(e, i);
+		if (constant->type == T_INTEGER) {
+			lisp_emit_puts(e, " = lisp_integer_new(");
+			lisp_emit_int(e, lisp_integer_get(constant));
+			lisp_emit_puts(e, ");\n");
+		}
+		else {
+			lisp_emit_puts(e, " = tl_decode(lisp, tl_data_");
+			lisp_emit_int(e, i);
+			lisp_emit_puts(e, ", (int)sizeof(tl_data_");
+			lisp_emit_int(e, i);
+			lisp_emit_puts(e, "));\n");
+		}
+		lisp_emit_puts(e, "\tif (tl_const_");
+		lisp_emit_int(e, i);
+		lisp_emit_puts(e, " == NULL) {\n\t\tlisp_print_error(lisp);\n\t\treturn E_MEMORY_ERROR;\n\t}\n");
+	}
+	for (int i = 0; i < nforms; ++i) {
+		lisp_emit_puts(e, "\ttl_print(lisp, out, ");
+		if (interpreted[i] < 0) {
+			lisp_emit_puts(e, "tl_expr_");
+			lisp_emit_int(e, i);
+			lisp_emit_puts(e, "(lisp)");
+		}
+		else {
+			lisp_emit_puts(e, "lisp_evaluate(lisp, tl_const_");
+			lisp_emit_int(e, interpreted[i]);
+			lisp_emit_puts(e, ")");
+		}
+		lisp_emit_puts(e, ");\n");
+	}
+	free(interpreted);
+	lisp_emit_puts(e, "\tlisp_writer_free(out);\n");
+	for (int i = 0; i < nconstants; ++i) {
+		lisp_emit_puts(e, "\tlisp_object_free(tl_const_");
+		lisp_emit_int(e, i);
+		lisp_emit_puts(e, ");\n");
+	}
+	lisp_emit_puts(e, "\tlisp_free(lisp);\n");
+	lisp_emit_puts(e, "\treturn 0;\n}\n");
+	return e->failed ? E_MEMORY_ERROR : E_SUCCESS;
+}
+
+error_t lisp_emit_c(TinyLisp lisp, char* filename, LispWriter out)
+{
+	struct LispEmitter_ e;
+	memset(&e, 0, sizeof(e));
+	e.lisp = lisp;
+	e.out = out;
+	error_t err = lisp_emit_read(filename, &e.text);
+	if (err != E_SUCCESS) {
+		lisp_error_set(lisp, err, "Could not read %s", filename);
+		return err;
+	}
+	e.forms = lisp_list_new();
+	e.constants = lisp_list_new();
+	if (e.forms == NULL || e.constants == NULL)
+		err = E_MEMORY_ERROR;
+	if (err == E_SUCCESS)
+		err = lisp_emit_parse(&e);
+	if (err == E_SUCCESS)
+		err = lisp_emit_translate(&e);
+	if (err == E_SUCCESS)
+		err = lisp_writer_flush(out);
+	else if (lisp->err_code == E_SUCCESS)
+		lisp_error_set(lisp, err, NULL);
+
+	if (e.forms != NULL)
+		lisp_object_free(e.forms);
+	if (e.constants != NULL)
+		lisp_object_free(e.constants);
+	free(e.text);
+	free(e.form_fn);
+	free(e.fn_form);
+	free(e.fn_name);
+	free(e.fn_lambda);
+	free(e.fn_ok);
+	return err;
+}
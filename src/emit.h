@@ -0,0 +1,17 @@
+#ifndef TINYLISP_EMIT_H
+#define TINYLISP_EMIT_H
+
+#include "tinylisp.h"
+#include "writer.h"
+
+// Translate the script in the file at filename into a C translation unit written to out, whose main
+// prints what the interpreter would for each top level form. Functions bound with (d name (q (params
+// body))) whose bodies only use integers, quoted constants, globals, their parameters, the builtins c,
+// h, t, s, l, e, i and q, and calls of other such functions become C functions taking their parameters
+// as arguments; so do top level expressions of the same kind. Call heads are resolved as the program
+// will resolve them, so only names bound to those builtins in lisp's global frame are compiled as them.
+// Everything else, including the d forms themselves, is embedded in its binary serialized form and
+// handed to the interpreter at run time. The result is built by linking against tinylisp_core.
+error_t lisp_emit_c(TinyLisp lisp, char* filename, LispWriter out);
+
+#endif
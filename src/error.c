@@ -11,5 +11,8 @@ struct error_desc_ errordesc[E_SIZE] = {
 	{ E_EVALUATION_ERROR, "Evaluation error" },
 	{ E_TYPE_ERROR, "Type error"},
 	{ E_NO_INPUT, "No input received" },
-	{ E_INDEX_ERROR, "List index out of range" }
+	{ E_INDEX_ERROR, "List index out of range" },
+	{ E_IO_ERROR, "Input/output error" },
+	{ E_FORMAT_ERROR, "Malformed binary data" },
+	{ E_BUDGET_EXCEEDED, "Evaluation budget exceeded" }
 };
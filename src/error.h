@@ -14,6 +14,9 @@ enum error_t_
 	E_TYPE_ERROR,
 	E_NO_INPUT,
 	E_INDEX_ERROR,
+	E_IO_ERROR,
+	E_FORMAT_ERROR,
+	E_BUDGET_EXCEEDED,
 	E_SIZE
 };
 
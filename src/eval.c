@@ -1,7 +1,13 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "stack.h"
 #include "eval.h"
+#include "builtins.h"
+#include "optimize.h"
+#include "jit.h"
+#include "profile.h"
+#include "stats.h"
 
 //#define DEBUG
 #ifdef DEBUG
@@ -12,6 +18,349 @@ int tabsize = 0;
 #endif
 
 
+// Return a new reference to the arguments of the call obj as written, shared between calls from site
+LispObject lisp_evaluate_site_args(LispCallSite site, LispObject obj)
+{
+	if (site->args == NULL || lisp_list_size(site->args) != lisp_list_size(obj) - 1) {
+		LispObject args = lisp_list_tail(obj);
+		if (args == NULL)
+			return NULL;
+		if (site->args != NULL)
+			lisp_object_free(site->args);
+		site->args = args;
+	}
+	return lisp_object_create_reference(site->args);
+}
+
+// Set *res to the value of arg, operand idx of a call from site, if it is an integer literal or a symbol
+// bound to an integer, without evaluating it; returns 0 if it is neither
+int lisp_evaluate_integer_operand(TinyLisp lisp, LispCallSite site, int idx, LispObject arg, int* res)
+{
+	LispObject val = arg;
+	if (arg->type == T_SYMBOL) {
+		// The slot the symbol was found in last time is checked before searching the frame again
+		char* key = lisp_symbol_get(arg);
+		LispStack stack = lisp->stack;
+		val = NULL;
+		if (stack->nframes > 1) {
+			LispStackFrame frame = stack->frames[stack->nframes - 1];
+			int slot = site->operand_slots[idx];
+			if (slot < 0 || slot >= frame->size || strcmp(frame->keys[slot], key) != 0) {
+				slot = lisp_stackframe_index(frame, key);
+				site->operand_slots[idx] = slot;
+			}
+			if (slot >= 0)
+				val = frame->vals[slot];
+		}
+		if (val == NULL)
+			val = lisp_stackframe_find(stack->frames[0], key);
+		if (val == NULL)
+			return 0;
+	}
+	if (val->type != T_INTEGER)
+		return 0;
+	*res = lisp_integer_get(val);
+	return 1;
+}
+
+// Compute obj, a call of s, l or e from site, without evaluating its operands or dispatching on their
+// types if both are integers, setting *res to the result or NULL on error; returns 0 if they are not,
+// leaving the call to the builtin
+int lisp_evaluate_integer_call(TinyLisp lisp, LispObject obj, LispCallSite site, LispObject* res)
+{
+	int x, y;
+	if (lisp_list_size(obj) != 3
+		|| !lisp_evaluate_integer_operand(lisp, site, 0, lisp_list_at(obj, 1), &x)
+		|| !lisp_evaluate_integer_operand(lisp, site, 1, lisp_list_at(obj, 2), &y)) {
+		++site->int_misses;
+		++lisp_stats.int_misses;
+		return 0;
+	}
+	++lisp_stats.int_inline;
+	if (site->builtin_id == B_SUBTRACT)
+		*res = lisp_integer_new(x - y);
+	else if (site->builtin_id == B_LESSTHAN)
+		*res = lisp_integer_new(x < y);
+	else
+		*res = lisp_integer_new(x == y);
+	if (*res == NULL)
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	return 1;
+}
+
+// Bind the arguments of the call obj to the parameters of the lambda or macro func in a new frame
+LispStackFrame lisp_evaluate_bind(TinyLisp lisp, LispObject obj, LispCallSite site, LispLambda lambda)
+{
+	int nargs = lisp_list_size(obj) - 1;
+	if (lambda->arity >= 0 && nargs != lambda->arity) {
+		lisp_error_set(lisp, E_INDEX_ERROR, "Expected %d arguments, got %d", lambda->arity, nargs);
+		return NULL;
+	}
+	LispStackFrame frame = lisp_stackframe_new_shared(lambda->arity < 0 ? 1 : lambda->arity, lambda->keys);
+	if (frame == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+
+	if (lambda->arity < 0) {
+		// A single symbol is bound to all of the arguments, evaluated unless func is a macro
+		LispObject arglist;
+		if (lambda->is_macro) {
+			arglist = lisp_evaluate_site_args(site, obj);
+		}
+		else {
+			arglist = lisp_list_new();
+			for (int i = 0; arglist != NULL && i < nargs; ++i) {
+				LispObject val = lisp_evaluate(lisp, lisp_list_at(obj, i + 1));
+				if (val == NULL) {
+					lisp_object_free(arglist);
+					lisp_stackframe_free(frame);
+					return NULL;
+				}
+				if (lisp_list_push(arglist, val) != E_SUCCESS) {
+					lisp_object_free(val);
+					lisp_object_free(arglist);
+					arglist = NULL;
+				}
+			}
+		}
+		if (arglist == NULL) {
+			lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+			lisp_stackframe_free(frame);
+			return NULL;
+		}
+		frame->vals[0] = arglist;
+		return frame;
+	}
+
+	for (int i = 0; i < nargs; ++i) {
+		LispObject arg = lisp_list_at(obj, i + 1);
+		LispObject val = lambda->is_macro ? lisp_object_create_reference(arg) : lisp_evaluate(lisp, arg);
+		if (val == NULL) {
+			lisp_stackframe_free(frame);
+			return NULL;
+		}
+		frame->vals[lambda->slots[i]] = val;
+	}
+	return frame;
+}
+
+// Evaluate what a macro expanded to in the caller's frame, releasing the reference to expansion
+LispObject lisp_evaluate_expansion(TinyLisp lisp, LispObject expansion)
+{
+	LispObject res = lisp_evaluate(lisp, expansion);
+	lisp_object_free(expansion);
+	DEBUGPRINT(res);
+	return res;
+}
+
+// Call func, the evaluated head of obj, with the remaining elements of obj as arguments
+LispObject lisp_evaluate_call(TinyLisp lisp, LispObject obj, LispCallSite site, LispObject func)
+{
+	if (LISP_BUDGET_STEP(lisp)) {
+		DEBUGPRINT(NULL);
+		return NULL;
+	}
+	if (func->type == T_BUILTIN) {
+		// For builtins, deference the function pointer
+		int id = site->builtin_id;
+		if (id >= 0)
+			++lisp_stats.builtin_calls[id];
+		if ((id == B_SUBTRACT || id == B_LESSTHAN || id == B_EQUAL) && site->int_misses < LISP_INT_FEEDBACK_LIMIT) {
+			LispObject res;
+			if (lisp_evaluate_integer_call(lisp, obj, site, &res)) {
+				DEBUGPRINT(res);
+				return res;
+			}
+		}
+		LispObject args = lisp_evaluate_site_args(site, obj);
+		if (args == NULL) {
+			lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+			DEBUGPRINT(NULL);
+			return NULL;
+		}
+		LispObject res = lisp_builtin_get(func)(lisp, args);
+		lisp_object_free(args);
+		DEBUGPRINT(res);
+		return res;
+	}
+	else if (func->type == T_LIST) {
+		LispLambda lambda;
+		error_t err = lisp_list_decode_lambda(func, &lambda);
+		if (err != E_SUCCESS) {
+			lisp_error_set(lisp, err, err == E_TYPE_ERROR ? "Expected a function of the form ([(options)] params body)" : NULL);
+			DEBUGPRINT(NULL);
+			return NULL;
+		}
+		if (lambda->expands && !lambda->impure && site->expansion != NULL && site->callee == func) {
+			++lisp_stats.expansion_hits;
+			return lisp_evaluate_expansion(lisp, lisp_object_create_reference(site->expansion));
+		}
+		LispStackFrame frame = lisp_evaluate_bind(lisp, obj, site, lambda);
+		if (frame == NULL) {
+			DEBUGPRINT(NULL);
+			return NULL;
+		}
+		// Compiled code does not count its steps, so it is not run under a step or time limit or in slices
+		if (lisp->jit && lisp->optimize && !lisp_profile_enabled && lisp->budget.max_steps == 0 && lisp->budget.max_ns == 0
+			&& lisp->budget.slice_end == 0) {
+			LispObject res;
+			if (lisp_jit_run(lisp, func, frame, &res)) {
+				lisp_stackframe_free(frame);
+				DEBUGPRINT(res);
+				return res;
+			}
+		}
+		err = lisp_stack_push(lisp->stack, frame);
+		if (err != E_SUCCESS) {
+			lisp_error_set(lisp, err, NULL);
+			lisp_stackframe_free(frame);
+			DEBUGPRINT(NULL);
+			return NULL;
+		}
+		if (lisp_profile_enabled)
+			lisp_profile_enter(func);
+		LispObject res = lisp_evaluate(lisp, lisp_lambda_body(lisp, func));
+		if (lisp_profile_enabled)
+			lisp_profile_leave();
+		lisp_stack_pop(lisp->stack);
+		if (lambda->expands && res != NULL) {
+			++lisp_stats.expansions;
+			// Remember the expansion unless another callee has been cached at this site in the meantime
+			if (!lambda->impure && site->callee == func) {
+				if (site->expansion != NULL)
+					lisp_object_free(site->expansion);
+				site->expansion = lisp_object_create_reference(res);
+			}
+			return lisp_evaluate_expansion(lisp, res);
+		}
+		DEBUGPRINT(res);
+		return res;
+	}
+	else {
+		lisp_error_set(lisp, E_TYPE_ERROR, "Expected a callable type, got %s", typedesc[func->type].name);
+		DEBUGPRINT(NULL);
+		return NULL;
+	}
+}
+
+// Make func the callee remembered by site, forgetting what was cached about any other. Only builtins and
+// globals are held: a local lambda may contain the site in its body, and holding it there would keep both
+// alive for good, so for those the site remembers nothing.
+void lisp_evaluate_remember_callee(LispCallSite site, LispObject func, int global)
+{
+	if (func == site->callee)
+		return;
+	if (site->callee != NULL)
+		lisp_object_free(site->callee);
+	if (site->expansion != NULL) {
+		lisp_object_free(site->expansion);
+		site->expansion = NULL;
+	}
+	site->global = global;
+	if (!global && func->type != T_BUILTIN) {
+		site->callee = NULL;
+		site->builtin_id = -1;
+		return;
+	}
+	site->callee = lisp_object_create_reference(func);
+	site->builtin_id = func->type == T_BUILTIN ? lisp_builtin_id(lisp_builtin_get(func)) : -1;
+}
+
+// Return a new reference to the function the head of obj evaluates to, reusing the one remembered by site
+// when the head names a global that the current frame does not shadow
+LispObject lisp_evaluate_callee(TinyLisp lisp, LispObject obj, LispCallSite site)
+{
+	LispObject head = lisp_list_at(obj, 0);
+	LispObject func;
+	int global = 0;
+	if (head->type == T_BUILTIN) {
+		func = lisp_object_create_reference(head);
+	}
+	else if (head->type == T_SYMBOL) {
+		// Globals cannot be rebound, so the global a site resolved stays valid until a local shadows it
+		++lisp_stats.evaluations[T_SYMBOL];
+		char* key = lisp_symbol_get(head);
+		LispStack stack = lisp->stack;
+		LispObject val = stack->nframes > 1 ? lisp_stackframe_find(stack->frames[stack->nframes - 1], key) : NULL;
+		if (val == NULL) {
+			if (site->global)
+				return lisp_object_create_reference(site->callee);
+			val = lisp_stackframe_find(stack->frames[0], key);
+			if (val == NULL) {
+				lisp_error_set(lisp, E_UNDEFINED_NAME, "Symbol %s not in scope", key);
+				return NULL;
+			}
+			global = 1;
+		}
+		func = lisp_object_create_reference(val);
+	}
+	else {
+		func = lisp_evaluate(lisp, head);
+		if (func == NULL)
+			return NULL;
+	}
+
+	lisp_evaluate_remember_callee(site, func, global);
+	return func;
+}
+
+LispObject lisp_evaluate_apply(TinyLisp lisp, LispObject func, LispObject call)
+{
+	LispCallSite site = lisp_list_callsite(call);
+	if (site == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	lisp_evaluate_remember_callee(site, func, 0);
+	return lisp_evaluate_call(lisp, call, site, func);
+}
+
+LispObject lisp_evaluate_new_call(LispObject func, int nargs)
+{
+	LispObject call = lisp_list_new_from_args(1, lisp_object_create_reference(func));
+	if (call == NULL)
+		return NULL;
+	for (int i = 0; i < nargs; ++i) {
+		LispObject quote_builtin = lisp_builtin_new(quote);
+		LispObject nil = lisp_list_new();
+		LispObject arg = NULL;
+		if (quote_builtin != NULL && nil != NULL)
+			arg = lisp_list_new_from_args(2, quote_builtin, nil);
+		if (arg == NULL || lisp_list_push(call, arg) != E_SUCCESS) {
+			if (arg != NULL) {
+				lisp_object_free(arg);
+			}
+			else {
+				if (quote_builtin != NULL)
+					lisp_object_free(quote_builtin);
+				if (nil != NULL)
+					lisp_object_free(nil);
+			}
+			lisp_object_free(call);
+			return NULL;
+		}
+	}
+	return call;
+}
+
+LispObject lisp_evaluate_apply_values(TinyLisp lisp, LispObject call, LispObject* vals)
+{
+	// Each argument is a call of quote whose quoted value is replaced
+	for (int i = 1; i < lisp_list_size(call); ++i) {
+		LispObject* slot = &lisp_list_at(call, i)->data.l->data[1];
+		lisp_object_free(*slot);
+		*slot = lisp_object_create_reference(vals[i - 1]);
+	}
+	// so anything remembered about the previous arguments, such as a macro's expansion, no longer applies
+	LispCallSite site = call->data.l->site;
+	if (site != NULL && site->expansion != NULL) {
+		lisp_object_free(site->expansion);
+		site->expansion = NULL;
+	}
+	return lisp_evaluate_apply(lisp, lisp_list_at(call, 0), call);
+}
+
 LispObject lisp_evaluate(TinyLisp lisp, LispObject obj)
 {
 #ifdef DEBUG
@@ -24,6 +373,7 @@ LispObject lisp_evaluate(TinyLisp lisp, LispObject obj)
 	}
 	printf("\n");
 #endif
+	++lisp_stats.evaluations[obj->type];
 	if (obj->type == T_INTEGER) {
 		// Integer evaluates to itself
 		LispObject res = lisp_object_create_reference(obj);
@@ -38,8 +388,8 @@ LispObject lisp_evaluate(TinyLisp lisp, LispObject obj)
 		DEBUGPRINT(res);
 		return lisp_object_create_reference(res);
 	}
-	else if (obj->type == T_BUILTIN) {
-		// Builtin evaluates to itself
+	else if (obj->type == T_BUILTIN || obj->type == T_MAP || obj->type == T_SEQ) {
+		// Builtins, maps and sequences evaluate to themselves
 		LispObject res = lisp_object_create_reference(obj);
 		DEBUGPRINT(res);
 		return res;
@@ -52,111 +402,31 @@ LispObject lisp_evaluate(TinyLisp lisp, LispObject obj)
 			return res;
 		}
 
-		// Treats head as function called with tail as arguments
-		LispObject func;
-		func = lisp_evaluate(lisp, lisp_list_at(obj, 0));
-		if (func == NULL) {
-			DEBUGPRINT(func);
-			return NULL;
-		}
-
-		if (func->type == T_BUILTIN) {
-			// For builtins, deference the function pointer
-			LispObject res = lisp_builtin_get(func)(lisp, lisp_list_tail(obj));
+		// Constants left behind by the optimizer are the commonest call, so skip the argument list
+		LispObject head = lisp_list_at(obj, 0);
+		if (head->type == T_BUILTIN && lisp_builtin_get(head) == quote && lisp_list_size(obj) == 2) {
+			++lisp_stats.builtin_calls[B_QUOTE];
+			LispObject res = lisp_object_create_reference(lisp_list_at(obj, 1));
 			DEBUGPRINT(res);
 			return res;
 		}
-		else if (func->type == T_LIST) {
-			// For lists, there is an optional empty list as the first element to signify a macro,
-			// then a list of parameter names (or a symbol which will get assigned all the paramters
-			// in a list) followed by the body. 
-			int is_macro = (lisp_list_at(func, 0)->type == T_LIST && lisp_list_size(lisp_list_at(func, 0)) == 0);
-			if (is_macro) {
-				// Associate the arguments with the list of parameter names
-				LispStackFrame frame = lisp_stackframe_new();
-				LispObject arg_keys = lisp_list_at(func, 1);
-				if (arg_keys->type == T_LIST) {
-					int len = lisp_list_size(arg_keys);
-					for (int i = 0; i < len; ++i) {
-						error_t err = lisp_stackframe_set(frame, lisp_symbol_get(lisp_list_at(arg_keys, i)), lisp_list_at(obj, i + 1));
-						if (err != E_SUCCESS) {
-							lisp_error_set(lisp, err, NULL);
-							lisp_stackframe_free(frame);
-							DEBUGPRINT(NULL);
-							return NULL;
-						}
-					}
-				}
-				else {
-					error_t err = lisp_stackframe_set(frame, lisp_symbol_get(arg_keys), lisp_list_tail(obj));
-					if (err != E_SUCCESS) {
-						lisp_error_set(lisp, err, NULL);
-						lisp_stackframe_free(frame);
-						DEBUGPRINT(NULL);
-						return NULL;
-					}
-				}
-				lisp_stack_push(lisp->stack, frame);
-				LispObject res = lisp_evaluate(lisp, lisp_list_at(func, 2));
-				lisp_stack_pop(lisp->stack);
-				DEBUGPRINT(NULL);
-				return res;
-			}
-			else {
-				// Associate the evaluated arguments with the list of parameter names
-				LispStackFrame frame = lisp_stackframe_new();
-				LispObject arg_keys = lisp_list_at(func, 0);
-				if (arg_keys->type == T_LIST) {
-					int len = lisp_list_size(arg_keys);
-					for (int i = 0; i < len; ++i) {
-						LispObject val = lisp_evaluate(lisp, lisp_list_at(obj, i + 1));
-						if (val == NULL) {
-							lisp_stackframe_free(frame);
-							DEBUGPRINT(NULL);
-							return NULL;
-						}
-						error_t err = lisp_stackframe_set(frame, lisp_symbol_get(lisp_list_at(arg_keys, i)), val);
-						if (err != E_SUCCESS) {
-							lisp_error_set(lisp, err, NULL);
-							lisp_stackframe_free(frame);
-							DEBUGPRINT(NULL);
-							return NULL;
-						}
-					}
-				}
-				else {
-					LispObject arglist = lisp_list_new();
-					int len = lisp_list_size(obj);
-					for (int i = 1; i < len; ++i) {
-						LispObject val = lisp_evaluate(lisp, lisp_list_at(obj, i));
-						if (val == NULL) {
-							lisp_stackframe_free(frame);
-							DEBUGPRINT(NULL);
-							return NULL;
-						}
-						lisp_list_push(arglist, val);
-					}
-					error_t err = lisp_stackframe_set(frame, lisp_symbol_get(arg_keys), arglist);
-					if (err != E_SUCCESS) {
-						lisp_error_set(lisp, err, NULL);
-						lisp_stackframe_free(frame);
-						lisp_object_free(arglist);
-						DEBUGPRINT(NULL);
-						return NULL;
-					}
-				}
-				lisp_stack_push(lisp->stack, frame);
-				LispObject res = lisp_evaluate(lisp, lisp_list_at(func, 1));
-				lisp_stack_pop(lisp->stack);
-				DEBUGPRINT(res);
-				return res;
-			}
-		}
-		else {
-			lisp_error_set(lisp, E_TYPE_ERROR, "Expected a callable type, got %s", typedesc[func->type].name);
+
+		// Treats head as function called with tail as arguments
+		LispCallSite site = lisp_list_callsite(obj);
+		if (site == NULL) {
+			lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
 			DEBUGPRINT(NULL);
 			return NULL;
 		}
+		LispObject func = lisp_evaluate_callee(lisp, obj, site);
+		if (func == NULL) {
+			DEBUGPRINT(func);
+			return NULL;
+		}
+
+		LispObject res = lisp_evaluate_call(lisp, obj, site, func);
+		lisp_object_free(func);
+		return res;
 	}
 	else {
 		lisp_error_set(lisp, E_EVALUATION_ERROR, "Received unknown type %d", obj->type);
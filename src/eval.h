@@ -3,6 +3,19 @@
 
 #include "tinylisp.h"
 
+// Number of calls of s, l or e from a site with operands that are not both integer literals or symbols
+// bound to integers, after which the site stops trying to compute them inline
+#define LISP_INT_FEEDBACK_LIMIT 8
+
 LispObject lisp_evaluate(TinyLisp lisp, LispObject object);
+// Call func, a function value, with the elements of call after the first as its argument expressions, as
+// if call had been evaluated with func at its head. What is cached about the call is kept on call, so
+// reusing it for repeated calls of func from C saves the interpreter looking func up each time
+LispObject lisp_evaluate_apply(TinyLisp lisp, LispObject func, LispObject call);
+// Return a new call of func with nargs arguments for lisp_evaluate_apply_values, or NULL on error
+LispObject lisp_evaluate_new_call(LispObject func, int nargs);
+// Call the function of call, built by lisp_evaluate_new_call, with the values vals as its arguments without
+// evaluating them again. The same call can be reused for any number of calls
+LispObject lisp_evaluate_apply_values(TinyLisp lisp, LispObject call, LispObject* vals);
 
 #endif
\ No newline at end of file
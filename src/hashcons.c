@@ -0,0 +1,220 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hashcons.h"
+#include "stats.h"
+
+// An entry of the table, with the hash of its object so that probing and growing need not recompute it
+struct LispConsSlot_
+{
+	LispObject obj;
+	unsigned int hash;
+};
+
+struct LispConses_
+{
+	// open addressed with linear probing; obj is NULL in a free slot and LISP_CONSES_REMOVED in one whose
+	// object has been released
+	struct LispConsSlot_* slots;
+	int capacity;
+	// slots holding an object, and slots holding LISP_CONSES_REMOVED
+	int count, removed;
+	// the weight of the objects held, and of those added since the last sweep
+	long long weight, added;
+	// the weight to be added before the next sweep
+	long long sweep_at;
+};
+
+struct LispObject_ lisp_conses_removed;
+#define LISP_CONSES_REMOVED (&lisp_conses_removed)
+
+LispConses lisp_conses_new()
+{
+	LispConses conses = calloc(1, sizeof(struct LispConses_));
+	if (conses == NULL)
+		return NULL;
+	conses->slots = calloc(LISP_CONSES_INITIAL, sizeof(struct LispConsSlot_));
+	if (conses->slots == NULL) {
+		free(conses);
+		return NULL;
+	}
+	conses->capacity = LISP_CONSES_INITIAL;
+	conses->sweep_at = LISP_CONSES_SWEEP;
+	lisp_stats.data_bytes += sizeof(struct LispConsSlot_) * LISP_CONSES_INITIAL;
+	return conses;
+}
+
+void lisp_conses_free(LispConses conses)
+{
+	for (int i = 0; i < conses->capacity; ++i) {
+		LispObject obj = conses->slots[i].obj;
+		if (obj != NULL && obj != LISP_CONSES_REMOVED)
+			lisp_object_free(obj);
+	}
+	lisp_stats.data_bytes -= sizeof(struct LispConsSlot_) * conses->capacity;
+	free(conses->slots);
+	free(conses);
+}
+
+// Hash of obj consistent with lisp_conses_same: that of the identities of a list's elements, which are
+// shared objects if obj is, and that of the value of an atom
+unsigned int lisp_conses_hash(LispObject obj)
+{
+	if (obj->type != T_LIST)
+		return lisp_object_hash(obj);
+	unsigned int hash = (unsigned int)lisp_list_size(obj);
+	for (int i = 0; i < lisp_list_size(obj); ++i)
+		hash = hash * 31u + (unsigned int)((uintptr_t)lisp_list_at(obj, i) >> 4);
+	return lisp_hash_mix(hash ^ T_LIST);
+}
+
+int lisp_conses_same(LispObject lhs, LispObject rhs)
+{
+	if (lhs->type != rhs->type)
+		return 0;
+	if (lhs->type != T_LIST)
+		return lisp_object_equal(lhs, rhs);
+	int len = lisp_list_size(lhs);
+	if (len != lisp_list_size(rhs))
+		return 0;
+	for (int i = 0; i < len; ++i) {
+		if (lisp_list_at(lhs, i) != lisp_list_at(rhs, i))
+			return 0;
+	}
+	return 1;
+}
+
+long long lisp_conses_weight(LispObject obj)
+{
+	return obj->type == T_LIST ? 1 + (long long)lisp_list_size(obj) : 1;
+}
+
+// Position of the slot holding an object the same as obj, or -1
+int lisp_conses_find(LispConses conses, LispObject obj, unsigned int hash)
+{
+	int mask = conses->capacity - 1;
+	for (int i = (int)(hash & mask); conses->slots[i].obj != NULL; i = (i + 1) & mask) {
+		struct LispConsSlot_* slot = &conses->slots[i];
+		if (slot->obj != LISP_CONSES_REMOVED && slot->hash == hash && (slot->obj == obj || lisp_conses_same(slot->obj, obj)))
+			return i;
+	}
+	return -1;
+}
+
+// Put obj in the first free or released slot of its probe sequence, taking over a reference to it
+void lisp_conses_put(LispConses conses, LispObject obj, unsigned int hash)
+{
+	int mask = conses->capacity - 1;
+	int i = (int)(hash & mask);
+	while (conses->slots[i].obj != NULL && conses->slots[i].obj != LISP_CONSES_REMOVED)
+		i = (i + 1) & mask;
+	if (conses->slots[i].obj == LISP_CONSES_REMOVED)
+		--conses->removed;
+	conses->slots[i].obj = obj;
+	conses->slots[i].hash = hash;
+	++conses->count;
+	conses->weight += lisp_conses_weight(obj);
+	conses->added += lisp_conses_weight(obj);
+}
+
+// Release the table's reference to the object in slot i, of which pending other references are also about
+// to be released. If that leaves nothing holding it, the same is done first for each element held only by
+// it and the table, so that a whole structure goes in one sweep.
+void lisp_conses_release(LispConses conses, int i, int pending)
+{
+	LispObject obj = conses->slots[i].obj;
+	conses->slots[i].obj = LISP_CONSES_REMOVED;
+	--conses->count;
+	++conses->removed;
+	conses->weight -= lisp_conses_weight(obj);
+	// A slice's elements are held by the list it was taken from rather than by the slice
+	if (obj->refcount == 1 + pending && obj->type == T_LIST && obj->data.l->owner == NULL) {
+		for (int j = 0; j < lisp_list_size(obj); ++j) {
+			LispObject elem = lisp_list_at(obj, j);
+			if (elem->refcount != 2)
+				continue;
+			unsigned int hash = lisp_conses_hash(elem);
+			int mask = conses->capacity - 1;
+			for (int k = (int)(hash & mask); conses->slots[k].obj != NULL; k = (k + 1) & mask) {
+				if (conses->slots[k].obj == elem) {
+					lisp_conses_release(conses, k, 1);
+					break;
+				}
+			}
+		}
+	}
+	lisp_object_free(obj);
+}
+
+// Release every object which only the table holds
+void lisp_conses_sweep(LispConses conses)
+{
+	for (int i = 0; i < conses->capacity; ++i) {
+		LispObject obj = conses->slots[i].obj;
+		if (obj != NULL && obj != LISP_CONSES_REMOVED && obj->refcount == 1)
+			lisp_conses_release(conses, i, 0);
+	}
+	conses->added = 0;
+	conses->sweep_at = conses->weight > LISP_CONSES_SWEEP ? conses->weight : LISP_CONSES_SWEEP;
+}
+
+// Make room for one more object, growing the table once three quarters of its slots are in use
+error_t lisp_conses_reserve(LispConses conses)
+{
+	if ((conses->count + conses->removed + 1) * 4 <= conses->capacity * 3)
+		return E_SUCCESS;
+	int capacity = conses->capacity;
+	// Dropping the released slots may be enough
+	if ((conses->count + 1) * 2 > capacity)
+		capacity *= 2;
+	struct LispConsSlot_* slots = calloc(capacity, sizeof(struct LispConsSlot_));
+	if (slots == NULL)
+		return E_MEMORY_ERROR;
+	struct LispConsSlot_* old = conses->slots;
+	int old_capacity = conses->capacity;
+	conses->slots = slots;
+	conses->capacity = capacity;
+	conses->count = conses->removed = 0;
+	for (int i = 0; i < old_capacity; ++i) {
+		if (old[i].obj != NULL && old[i].obj != LISP_CONSES_REMOVED) {
+			int mask = capacity - 1;
+			int j = (int)(old[i].hash & mask);
+			while (slots[j].obj != NULL)
+				j = (j + 1) & mask;
+			slots[j] = old[i];
+			++conses->count;
+		}
+	}
+	lisp_stats.data_bytes += sizeof(struct LispConsSlot_) * ((long long)capacity - old_capacity);
+	free(old);
+	return E_SUCCESS;
+}
+
+LispObject lisp_hashcons(TinyLisp lisp, LispObject obj)
+{
+	if (!lisp->hash_cons || (obj->type != T_LIST && obj->type != T_INTEGER && obj->type != T_SYMBOL))
+		return obj;
+	if (lisp->conses == NULL) {
+		lisp->conses = lisp_conses_new();
+		if (lisp->conses == NULL)
+			return obj;
+	}
+	LispConses conses = lisp->conses;
+	unsigned int hash = lisp_conses_hash(obj);
+	int i = lisp_conses_find(conses, obj, hash);
+	if (i >= 0) {
+		LispObject shared = conses->slots[i].obj;
+		if (shared != obj) {
+			++lisp_stats.hashcons_hits;
+			shared = lisp_object_create_reference(shared);
+			lisp_object_free(obj);
+		}
+		return shared;
+	}
+	if (conses->added >= conses->sweep_at)
+		lisp_conses_sweep(conses);
+	if (lisp_conses_reserve(conses) != E_SUCCESS)
+		return obj;
+	lisp_conses_put(conses, lisp_object_create_reference(obj), hash);
+	return obj;
+}
@@ -0,0 +1,22 @@
+#ifndef TINYLISP_HASHCONS_H
+#define TINYLISP_HASHCONS_H
+
+#include "tinylisp.h"
+
+// Slots in a new table of shared objects; a power of 2
+#define LISP_CONSES_INITIAL 256
+// Weight, one for each object and each list element, added to a table before it is first swept
+#define LISP_CONSES_SWEEP 4096
+
+// With lisp->hash_cons set, return a reference to the object of lisp's table which is the same as obj,
+// taking over the reference to obj, or add obj to the table and return it if there is none. Lists are the
+// same if their elements are the same objects, so lists whose elements were shared this way are shared if
+// they are equal; integers and symbols are the same if equal. Other objects, and every object when the mode
+// is off or the table cannot grow, are returned as they are.
+// The table is weak: once an object is only held by the table it is released at the next sweep, which comes
+// after as much has been added as was left held by the table at the last one.
+LispObject lisp_hashcons(TinyLisp lisp, LispObject obj);
+// Release the table and its references
+void lisp_conses_free(LispConses conses);
+
+#endif
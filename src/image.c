@@ -0,0 +1,71 @@
+#include <string.h>
+
+#include "image.h"
+#include "builtins.h"
+
+// Returns 1 if val is the builtin that lisp_stack_new binds to key
+int lisp_image_is_default(char* key, LispObject val)
+{
+	if (val->type != T_BUILTIN)
+		return 0;
+	int id = lisp_builtin_id(lisp_builtin_get(val));
+	return id >= 0 && strcmp(builtindesc[id].name, key) == 0;
+}
+
+error_t lisp_image_save(TinyLisp lisp, char* filename)
+{
+	LispStackFrame globals = lisp->stack->frames[0];
+	LispObject image = lisp_list_new();
+	if (image == NULL)
+		return E_MEMORY_ERROR;
+
+	error_t err = E_SUCCESS;
+	for (int i = 0; i < globals->size && err == E_SUCCESS; ++i) {
+		if (lisp_image_is_default(globals->keys[i], globals->vals[i]))
+			continue;
+		LispObject key = lisp_symbol_new(globals->keys[i]);
+		if (key == NULL) {
+			err = E_MEMORY_ERROR;
+			break;
+		}
+		LispObject pair = lisp_list_new_from_args(2, key, lisp_object_create_reference(globals->vals[i]));
+		if (pair == NULL) {
+			lisp_object_free(key);
+			lisp_object_free(globals->vals[i]);
+			err = E_MEMORY_ERROR;
+			break;
+		}
+		err = lisp_list_push(image, pair);
+		if (err != E_SUCCESS)
+			lisp_object_free(pair);
+	}
+
+	if (err == E_SUCCESS)
+		err = lisp_object_dump_file(filename, image);
+	lisp_object_free(image);
+	return err;
+}
+
+error_t lisp_image_load(TinyLisp lisp, char* filename)
+{
+	LispObject image;
+	error_t err = lisp_object_load_file(filename, &image);
+	if (err != E_SUCCESS)
+		return err;
+	if (image->type != T_LIST) {
+		lisp_object_free(image);
+		return E_FORMAT_ERROR;
+	}
+
+	int len = lisp_list_size(image);
+	for (int i = 0; i < len && err == E_SUCCESS; ++i) {
+		LispObject pair = lisp_list_at(image, i);
+		if (pair->type != T_LIST || lisp_list_size(pair) != 2 || lisp_list_at(pair, 0)->type != T_SYMBOL) {
+			err = E_FORMAT_ERROR;
+			break;
+		}
+		err = lisp_stack_setglobal(lisp->stack, lisp_symbol_get(lisp_list_at(pair, 0)), lisp_list_at(pair, 1));
+	}
+	lisp_object_free(image);
+	return err;
+}
@@ -0,0 +1,12 @@
+#ifndef TINYLISP_IMAGE_H
+#define TINYLISP_IMAGE_H
+
+#include "tinylisp.h"
+
+// Write every global binding of lisp, other than the builtins bound under their own names, to filename.
+// The image is a list of (name value) pairs in the binary format of lisp_object_serialize.
+error_t lisp_image_save(TinyLisp lisp, char* filename);
+// Map an image written by lisp_image_save and bind each of its names in the global frame of lisp
+error_t lisp_image_load(TinyLisp lisp, char* filename);
+
+#endif
@@ -0,0 +1,434 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "builtins.h"
+#include "optimize.h"
+#include "stats.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define LISP_JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Compiled lambdas only ever see integers: their parameters are checked on the way in, the only constants
+// they may contain are integers, and they may only call s, l, e, i and other compiled lambdas, all of
+// which return integers. So no type checks are needed in the native code itself.
+
+#ifdef LISP_JIT_X86_64
+
+const int lisp_jit_supported = 1;
+
+// Largest number of lambdas compiled together because they call each other
+#define LISP_JIT_MAX_GROUP 64
+
+// Shared by every native frame of a single call from the interpreter. The offsets are used by the
+// generated code
+struct LispJitContext_
+{
+	// set to 1 to unwind back to the interpreter
+	int bail;
+	// native frames entered and the most allowed before the interpreter's stack would overflow
+	int depth, limit;
+};
+
+// int f(long long* args, struct LispJitContext_* ctx), where args[i] holds the i-th parameter
+typedef int(*LispJitFunc)(long long*, struct LispJitContext_*);
+
+// The lambdas found to be compilable, in the order they were reached
+struct LispJitGroup_
+{
+	int size;
+	LispLambda lambdas[LISP_JIT_MAX_GROUP];
+	LispObject bodies[LISP_JIT_MAX_GROUP];
+};
+
+struct LispJitBuffer_
+{
+	unsigned char* data;
+	int size, capacity;
+	// 8-byte pushes outstanding since the prologue, to keep calls 16-byte aligned
+	int pushed;
+	// positions of the rel32 operands of jumps to the bail-out block
+	int* bails;
+	int nbails, bails_capacity;
+	int failed;
+};
+
+// Returns the index of lambda in group, or -1
+int lisp_jit_group_find(struct LispJitGroup_* group, LispLambda lambda)
+{
+	for (int i = 0; i < group->size; ++i) {
+		if (group->lambdas[i] == lambda)
+			return i;
+	}
+	return -1;
+}
+
+// Returns the position of sym in the parameter list of lambda, or -1
+int lisp_jit_param(LispLambda lambda, LispObject sym)
+{
+	for (int i = 0; i < lambda->arity; ++i) {
+		if (lisp_symbol_equal(lisp_list_at(lambda->params, i), sym))
+			return i;
+	}
+	return -1;
+}
+
+// Returns the lambda of the list a call head refers to if it is a constant left by the optimizer
+LispObject lisp_jit_callee(LispObject head)
+{
+	if (head->type != T_LIST || lisp_list_size(head) != 2)
+		return NULL;
+	LispObject quote_builtin = lisp_list_at(head, 0);
+	if (quote_builtin->type != T_BUILTIN || lisp_builtin_get(quote_builtin) != quote)
+		return NULL;
+	LispObject callee = lisp_list_at(head, 1);
+	return callee->type == T_LIST ? callee : NULL;
+}
+
+int lisp_jit_check_lambda(TinyLisp lisp, struct LispJitGroup_* group, LispObject func);
+
+// Returns 1 if expr, from the body of lambda, uses only what the code generator supports, adding any
+// lambdas it calls to group
+int lisp_jit_check(TinyLisp lisp, struct LispJitGroup_* group, LispLambda lambda, LispObject expr)
+{
+	if (expr->type == T_INTEGER)
+		return 1;
+	if (expr->type == T_SYMBOL)
+		return lisp_jit_param(lambda, expr) >= 0;
+	if (expr->type != T_LIST || lisp_list_size(expr) == 0)
+		return 0;
+
+	LispObject head = lisp_list_at(expr, 0);
+	int nargs = lisp_list_size(expr) - 1;
+	if (head->type == T_BUILTIN) {
+		int id = lisp_builtin_id(lisp_builtin_get(head));
+		if (!((id == B_SUBTRACT || id == B_LESSTHAN || id == B_EQUAL) && nargs == 2) && !(id == B_TERNARY && nargs == 3))
+			return 0;
+	}
+	else {
+		LispObject callee = lisp_jit_callee(head);
+		LispLambda callee_lambda;
+		if (callee == NULL || lisp_list_decode_lambda(callee, &callee_lambda) != E_SUCCESS)
+			return 0;
+		if (callee_lambda->arity != nargs || !lisp_jit_check_lambda(lisp, group, callee))
+			return 0;
+	}
+	for (int i = 1; i <= nargs; ++i) {
+		if (!lisp_jit_check(lisp, group, lambda, lisp_list_at(expr, i)))
+			return 0;
+	}
+	return 1;
+}
+
+// Returns 1 if func is already compiled or can be compiled along with the rest of group
+int lisp_jit_check_lambda(TinyLisp lisp, struct LispJitGroup_* group, LispObject func)
+{
+	LispLambda lambda;
+	if (lisp_list_decode_lambda(func, &lambda) != E_SUCCESS)
+		return 0;
+	if (lambda->jit_code != NULL || lisp_jit_group_find(group, lambda) >= 0)
+		return 1;
+	if (lambda->jit_calls < 0 || lambda->is_macro || lambda->arity < 0 || lambda->arity > LISP_JIT_MAX_ARGS)
+		return 0;
+	if (group->size == LISP_JIT_MAX_GROUP)
+		return 0;
+	// Added before the body is checked so that recursive calls are accepted
+	LispObject body = lisp_lambda_body(lisp, func);
+	group->lambdas[group->size] = lambda;
+	group->bodies[group->size] = body;
+	++group->size;
+	return lisp_jit_check(lisp, group, lambda, body);
+}
+
+void lisp_jit_emit(struct LispJitBuffer_* buf, const unsigned char* bytes, int len)
+{
+	if (buf->failed)
+		return;
+	if (buf->size + len > buf->capacity) {
+		int capacity = buf->capacity == 0 ? 256 : buf->capacity * 2;
+		while (capacity < buf->size + len)
+			capacity *= 2;
+		unsigned char* data = realloc(buf->data, capacity);
+		if (data == NULL) {
+			buf->failed = 1;
+			return;
+		}
+		buf->data = data;
+		buf->capacity = capacity;
+	}
+	memcpy(buf->data + buf->size, bytes, len);
+	buf->size += len;
+}
+
+#define EMIT(buf, ...) do { const unsigned char bytes_[] = { __VA_ARGS__ }; lisp_jit_emit(buf, bytes_, sizeof(bytes_)); } while (0)
+
+void lisp_jit_emit32(struct LispJitBuffer_* buf, int val)
+{
+	unsigned char bytes[4];
+	memcpy(bytes, &val, 4);
+	lisp_jit_emit(buf, bytes, 4);
+}
+
+void lisp_jit_patch32(struct LispJitBuffer_* buf, int pos, int val)
+{
+	if (!buf->failed)
+		memcpy(buf->data + pos, &val, 4);
+}
+
+// Emit the rel32 operand of a jump to the bail-out block, to be patched once it has been placed
+void lisp_jit_emit_bail_target(struct LispJitBuffer_* buf)
+{
+	if (buf->nbails == buf->bails_capacity) {
+		int capacity = buf->bails_capacity == 0 ? 16 : buf->bails_capacity * 2;
+		int* bails = realloc(buf->bails, sizeof(int) * capacity);
+		if (bails == NULL) {
+			buf->failed = 1;
+			return;
+		}
+		buf->bails = bails;
+		buf->bails_capacity = capacity;
+	}
+	buf->bails[buf->nbails++] = buf->size;
+	lisp_jit_emit32(buf, 0);
+}
+
+void lisp_jit_push(struct LispJitBuffer_* buf)
+{
+	EMIT(buf, 0x50);                                  // push rax
+	++buf->pushed;
+}
+
+void lisp_jit_pop_rcx(struct LispJitBuffer_* buf)
+{
+	EMIT(buf, 0x59);                                  // pop rcx
+	--buf->pushed;
+}
+
+// Emit code leaving the value of expr in eax; rbx points to the arguments and r12 to the context
+void lisp_jit_compile(struct LispJitBuffer_* buf, LispLambda lambda, LispObject expr)
+{
+	if (expr->type == T_INTEGER) {
+		EMIT(buf, 0xb8);                              // mov eax, imm32
+		lisp_jit_emit32(buf, lisp_integer_get(expr));
+		return;
+	}
+	if (expr->type == T_SYMBOL) {
+		EMIT(buf, 0x8b, 0x83);                        // mov eax, [rbx + disp32]
+		lisp_jit_emit32(buf, 8 * lisp_jit_param(lambda, expr));
+		return;
+	}
+
+	LispObject head = lisp_list_at(expr, 0);
+	int nargs = lisp_list_size(expr) - 1;
+	if (head->type == T_BUILTIN) {
+		int id = lisp_builtin_id(lisp_builtin_get(head));
+		if (id == B_TERNARY) {
+			lisp_jit_compile(buf, lambda, lisp_list_at(expr, 1));
+			EMIT(buf, 0x85, 0xc0);                    // test eax, eax
+			EMIT(buf, 0x0f, 0x84);                    // jz else
+			int jz = buf->size;
+			lisp_jit_emit32(buf, 0);
+			lisp_jit_compile(buf, lambda, lisp_list_at(expr, 2));
+			EMIT(buf, 0xe9);                          // jmp end
+			int jmp = buf->size;
+			lisp_jit_emit32(buf, 0);
+			lisp_jit_patch32(buf, jz, buf->size - (jz + 4));
+			lisp_jit_compile(buf, lambda, lisp_list_at(expr, 3));
+			lisp_jit_patch32(buf, jmp, buf->size - (jmp + 4));
+			return;
+		}
+		// Binary operators: the second operand goes in ecx and the first in eax
+		lisp_jit_compile(buf, lambda, lisp_list_at(expr, 2));
+		lisp_jit_push(buf);
+		lisp_jit_compile(buf, lambda, lisp_list_at(expr, 1));
+		lisp_jit_pop_rcx(buf);
+		if (id == B_SUBTRACT) {
+			EMIT(buf, 0x29, 0xc8);                    // sub eax, ecx
+		}
+		else {
+			EMIT(buf, 0x39, 0xc8);                    // cmp eax, ecx
+			if (id == B_LESSTHAN)
+				EMIT(buf, 0x0f, 0x9c, 0xc0);          // setl al
+			else
+				EMIT(buf, 0x0f, 0x94, 0xc0);          // sete al
+			EMIT(buf, 0x0f, 0xb6, 0xc0);              // movzx eax, al
+		}
+		return;
+	}
+
+	// Calls of lambdas pass the arguments as an array on the stack, first argument lowest, and go through
+	// the callee's code pointer so that lambdas compiled together can call each other
+	LispLambda callee = lisp_jit_callee(head)->data.l->lambda;
+	int pad = (buf->pushed + nargs) % 2;
+	if (pad) {
+		EMIT(buf, 0x48, 0x83, 0xec, 0x08);            // sub rsp, 8
+		++buf->pushed;
+	}
+	for (int i = nargs; i >= 1; --i) {
+		lisp_jit_compile(buf, lambda, lisp_list_at(expr, i));
+		lisp_jit_push(buf);
+	}
+	EMIT(buf, 0x48, 0x89, 0xe7);                      // mov rdi, rsp
+	EMIT(buf, 0x4c, 0x89, 0xe6);                      // mov rsi, r12
+	EMIT(buf, 0x48, 0xb8);                            // mov rax, imm64
+	void** slot = &callee->jit_code;
+	lisp_jit_emit(buf, (unsigned char*)&slot, 8);
+	EMIT(buf, 0xff, 0x10);                            // call [rax]
+	if (nargs + pad > 0) {
+		EMIT(buf, 0x48, 0x81, 0xc4);                  // add rsp, imm32
+		lisp_jit_emit32(buf, 8 * (nargs + pad));
+	}
+	buf->pushed -= nargs + pad;
+	EMIT(buf, 0x41, 0x83, 0x3c, 0x24, 0x00);          // cmp dword [r12], 0
+	EMIT(buf, 0x0f, 0x85);                            // jne bail
+	lisp_jit_emit_bail_target(buf);
+}
+
+// Generate the whole function for lambda with the given body into buf
+void lisp_jit_compile_function(struct LispJitBuffer_* buf, LispLambda lambda, LispObject body)
+{
+	EMIT(buf, 0x55);                                  // push rbp
+	EMIT(buf, 0x48, 0x89, 0xe5);                      // mov rbp, rsp
+	EMIT(buf, 0x53);                                  // push rbx
+	EMIT(buf, 0x41, 0x54);                            // push r12
+	EMIT(buf, 0x48, 0x89, 0xfb);                      // mov rbx, rdi
+	EMIT(buf, 0x49, 0x89, 0xf4);                      // mov r12, rsi
+	// Each native frame stands for one interpreter stack frame
+	EMIT(buf, 0x41, 0xff, 0x44, 0x24, 0x04);          // inc dword [r12 + 4]
+	EMIT(buf, 0x41, 0x8b, 0x44, 0x24, 0x04);          // mov eax, [r12 + 4]
+	EMIT(buf, 0x41, 0x3b, 0x44, 0x24, 0x08);          // cmp eax, [r12 + 8]
+	EMIT(buf, 0x0f, 0x8f);                            // jg bail
+	lisp_jit_emit_bail_target(buf);
+
+	lisp_jit_compile(buf, lambda, body);
+
+	EMIT(buf, 0x41, 0xff, 0x4c, 0x24, 0x04);          // dec dword [r12 + 4]
+	int epilogue = buf->size;
+	EMIT(buf, 0x48, 0x8d, 0x65, 0xf0);                // lea rsp, [rbp - 16]
+	EMIT(buf, 0x41, 0x5c);                            // pop r12
+	EMIT(buf, 0x5b);                                  // pop rbx
+	EMIT(buf, 0x5d);                                  // pop rbp
+	EMIT(buf, 0xc3);                                  // ret
+
+	int bail = buf->size;
+	EMIT(buf, 0x41, 0xc7, 0x04, 0x24, 0x01, 0x00, 0x00, 0x00); // mov dword [r12], 1
+	EMIT(buf, 0xe9);                                  // jmp epilogue
+	lisp_jit_emit32(buf, epilogue - (buf->size + 4));
+	for (int i = 0; i < buf->nbails; ++i)
+		lisp_jit_patch32(buf, buf->bails[i], bail - (buf->bails[i] + 4));
+}
+
+// Copy size bytes of code into fresh executable pages; NULL on error
+void* lisp_jit_map(const unsigned char* code, int size)
+{
+	void* pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pages == MAP_FAILED)
+		return NULL;
+	memcpy(pages, code, size);
+	if (mprotect(pages, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(pages, size);
+		return NULL;
+	}
+	return pages;
+}
+
+// Compile func and every lambda it calls that is not yet compiled; returns 1 on success
+int lisp_jit_compile_group(TinyLisp lisp, LispObject func)
+{
+	struct LispJitGroup_ group;
+	group.size = 0;
+	if (!lisp_jit_check_lambda(lisp, &group, func))
+		return 0;
+
+	for (int i = 0; i < group.size; ++i) {
+		struct LispJitBuffer_ buf = { NULL, 0, 0, 0, NULL, 0, 0, 0 };
+		lisp_jit_compile_function(&buf, group.lambdas[i], group.bodies[i]);
+		void* code = buf.failed ? NULL : lisp_jit_map(buf.data, buf.size);
+		free(buf.data);
+		free(buf.bails);
+		if (code == NULL) {
+			// Lambdas compiled so far may call ones which now never will be
+			for (int j = 0; j < i; ++j)
+				lisp_jit_free_code(group.lambdas[j]);
+			return 0;
+		}
+		group.lambdas[i]->jit_code = code;
+		group.lambdas[i]->jit_size = buf.size;
+		++lisp_stats.jit_compiles;
+	}
+	return 1;
+}
+
+int lisp_jit_run(TinyLisp lisp, LispObject func, LispStackFrame frame, LispObject* res)
+{
+	LispLambda lambda = func->data.l->lambda;
+	if (lambda->jit_calls < 0 || lambda->is_macro || lambda->arity < 0 || lambda->arity > LISP_JIT_MAX_ARGS)
+		return 0;
+	long long args[LISP_JIT_MAX_ARGS];
+	for (int i = 0; i < lambda->arity; ++i) {
+		LispObject val = frame->vals[lambda->slots[i]];
+		if (val->type != T_INTEGER)
+			return 0;
+		args[i] = lisp_integer_get(val);
+	}
+
+	if (lambda->jit_code == NULL) {
+		if (++lambda->jit_calls < LISP_JIT_THRESHOLD)
+			return 0;
+		if (!lisp_jit_compile_group(lisp, func)) {
+			lambda->jit_calls = -1;
+			return 0;
+		}
+	}
+
+	struct LispJitContext_ ctx;
+	ctx.bail = 0;
+	ctx.depth = 0;
+	ctx.limit = LISP_MAX_STACK_SIZE - lisp->stack->nframes;
+	int val = ((LispJitFunc)lambda->jit_code)(args, &ctx);
+	if (ctx.bail) {
+		// Nothing compiled has side effects, so the interpreter can simply start the call again
+		++lisp_stats.jit_bailouts;
+		return 0;
+	}
+	++lisp_stats.jit_calls;
+	*res = lisp_integer_new(val);
+	if (*res == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return 1;
+	}
+	return 1;
+}
+
+void lisp_jit_free_code(LispLambda lambda)
+{
+	if (lambda->jit_code == NULL)
+		return;
+	munmap(lambda->jit_code, lambda->jit_size);
+	lambda->jit_code = NULL;
+	lambda->jit_size = 0;
+	lambda->jit_calls = 0;
+}
+
+#else
+
+const int lisp_jit_supported = 0;
+
+int lisp_jit_run(TinyLisp lisp, LispObject func, LispStackFrame frame, LispObject* res)
+{
+	(void)lisp;
+	(void)func;
+	(void)frame;
+	(void)res;
+	return 0;
+}
+
+void lisp_jit_free_code(LispLambda lambda)
+{
+	(void)lambda;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef TINYLISP_JIT_H
+#define TINYLISP_JIT_H
+
+#include "tinylisp.h"
+
+// Number of calls with only integer arguments after which a lambda is compiled
+#define LISP_JIT_THRESHOLD 16
+// Largest number of parameters a compiled lambda may have
+#define LISP_JIT_MAX_ARGS 8
+
+// 1 if native code can be generated on this platform
+extern const int lisp_jit_supported;
+
+// Called with the frame of arguments bound for a call of the lambda func before it is pushed. If func
+// has been compiled, or is now hot enough to be, and every argument is an integer, runs the native code,
+// stores the result in res and returns 1. Returns 0 if the call should be interpreted instead, which is
+// also the case when the native code gives up because the call would overflow the stack.
+int lisp_jit_run(TinyLisp lisp, LispObject func, LispStackFrame frame, LispObject* res);
+// Release the native code compiled for lambda, if any
+void lisp_jit_free_code(LispLambda lambda);
+
+#endif
@@ -1,19 +1,71 @@
 ﻿#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "tinylisp.h"
 #include "parse.h"
 #include "eval.h"
+#include "writer.h"
+#include "image.h"
+#include "profile.h"
+#include "stats.h"
+#include "jit.h"
+#include "emit.h"
+#include "stream.h"
+#include "server.h"
+#include "prefork.h"
+#include "resume.h"
 
 #define BUFFER_SIZE 1024
 
+// Steps each form is evaluated for at a time with --slice, or 0 to evaluate forms in one go
+long long eval_slice = 0;
+
 void help()
 {
-	printf("usage: tinylisp [--help|-h] [--nobanner|-q] scriptfile\n");
+	printf("usage: tinylisp [--help|-h] [--nobanner|-q] [--image file] [--snapshot file] [--profile file] [--stats] [--no-optimize] [--jit] [--hash-cons] [--emit-c file] [--map func] [--serve path [--workers n] [--prefork n [--max-requests n] [--max-rss kb] [--timeout ms]]] [--max-steps n] [--max-time ms] [--max-memory kb] [--slice n] scriptfile\n");
+	printf("  --image file\tRestore the global definitions saved in an image before starting\n");
+	printf("  --snapshot file\tSave the global definitions to an image after running scriptfile\n");
+	printf("  --profile file\tReport time spent in each function on exit and write collapsed stacks to file\n");
+	printf("  --stats\tPrint the interpreter's instrumentation counters to stderr on exit\n");
+	printf("  --no-optimize\tLook up global names in function bodies on every call\n");
+	printf("  --jit\tCompile hot functions on integers to native code (x86-64 only)\n");
+	printf("  --hash-cons\tShare one object between equal lists, integers and symbols that are parsed or built by c\n");
+	printf("  --emit-c file\tTranslate scriptfile into a C program written to file instead of running it\n");
+	printf("  --map func\tRun scriptfile without printing its results, then print func applied to each line of stdin\n");
+	printf("  --serve path\tEvaluate requests sent to a Unix socket at path, in a session per connection starting from the image and scriptfile\n");
+	printf("  --workers n\tThreads serving connections for --serve (default 1)\n");
+	printf("  --prefork n\tEvaluate --serve requests in n processes forked after running scriptfile once\n");
+	printf("  --max-requests n\tReplace a --prefork worker after it has evaluated n requests\n");
+	printf("  --max-rss kb\tReplace a --prefork worker once its resident memory passes kb kilobytes\n");
+	printf("  --timeout ms\tKill and replace a --prefork worker whose request runs longer than ms milliseconds\n");
+	printf("  --max-steps n\tStop each evaluation with an error after n calls and loop iterations\n");
+	printf("  --max-time ms\tStop each evaluation with an error once it has run for ms milliseconds\n");
+	printf("  --max-memory kb\tStop each evaluation with an error once it holds kb more kilobytes than when it began\n");
+	printf("  --slice n\tEvaluate each form of scriptfile n steps at a time, suspending and resuming it in between\n");
 	printf("Builtin commands:\n");
 	printf("(c)onstruct\tTakes two arguments, a value and a list, and returns a new list obtained by adding the value at the front of the list.\n");
 }
 
-int read_file(char* filename)
+// Evaluate obj under the budget of lisp, in slices of eval_slice steps if set
+LispObject evaluate(TinyLisp lisp, LispObject obj)
+{
+	if (eval_slice <= 0) {
+		lisp_budget_start(lisp);
+		return lisp_evaluate(lisp, obj);
+	}
+	LispEval eval = lisp_eval_begin(lisp, obj);
+	if (eval == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	while (!lisp_eval_step(eval, eval_slice))
+		;
+	LispObject res = lisp_eval_result(eval);
+	lisp_eval_free(eval);
+	return res;
+}
+
+int read_file(TinyLisp lisp, char* filename, LispWriter out)
 {
 	FILE* input = NULL;
 	int err = fopen_s(&input, filename, "r");
@@ -22,26 +74,27 @@ int read_file(char* filename)
 		return -1;
 	}
 
-	TinyLisp lisp = lisp_new();
 	char buffer[BUFFER_SIZE];
 	int collect_len = 0;
 
 	for (;;) {
 		if (!fgets(buffer + collect_len, BUFFER_SIZE - collect_len, input))
-			return 1;
+			break;
 		collect_len = (int)strlen(buffer);
-		int pos = 0;
-		while (pos < collect_len) {
+		// Every form on the line is run, and text left after the last is a form continued on the next line
+		int pos = 0, start = 0;
+		while (start < collect_len) {
 			LispObject obj = lisp_parse(lisp, buffer, &pos);
 			if (obj != NULL) {
-				collect_len = 0;
-				LispObject eval = lisp_evaluate(lisp, obj);
+				start = pos;
+				LispObject eval = evaluate(lisp, obj);
 				if (eval != NULL) {
-					lisp_object_print(eval);
-					printf("\n");
+					lisp_object_write(out, eval);
+					lisp_writer_putc(out, '\n');
 					lisp_object_free(eval);
 				}
 				else {
+					lisp_writer_flush(out);
 					lisp_print_error(lisp);
 					lisp_clear_error(lisp);
 				}
@@ -50,24 +103,106 @@ int read_file(char* filename)
 			else {
 				if (lisp->err_code == E_UNEXPECTED_EOF) {
 					lisp_clear_error(lisp);
-					continue;
+					break;
 				}
 				else if (lisp->err_code == E_NO_INPUT) {
-					collect_len = 0;
+					start = collect_len;
 					lisp_clear_error(lisp);
-					continue;
+					break;
 				}
 				else {
+					lisp_writer_flush(out);
 					lisp_print_error(lisp);
+					fclose(input);
 					return lisp->err_code;
 				}
 			}
 		}
+		collect_len -= start;
+		memmove(buffer, buffer + start, collect_len + 1);
 	}
+	fclose(input);
+	lisp_writer_flush(out);
 	return 0;
 }
 
-int interact(int banner)
+// Discards what is written, so that the results of a script run before --map or --serve are not printed
+int null_sink(void* ctx, const char* data, int len)
+{
+	(void)ctx;
+	(void)data;
+	(void)len;
+	return 0;
+}
+
+// Evaluate the expression text to find the function and apply it to each line of stdin
+int map_input(TinyLisp lisp, char* text, LispWriter out)
+{
+	int pos = 0;
+	LispObject expr = lisp_parse(lisp, text, &pos);
+	lisp_budget_start(lisp);
+	LispObject func = expr != NULL ? lisp_evaluate(lisp, expr) : NULL;
+	if (expr != NULL)
+		lisp_object_free(expr);
+	if (func == NULL) {
+		lisp_print_error(lisp);
+		return lisp->err_code;
+	}
+	error_t err = lisp_stream_map(lisp, func, stdin, out);
+	lisp_object_free(func);
+	if (err != E_SUCCESS) {
+		lisp_error_set(lisp, err, "Could not read stdin");
+		lisp_print_error(lisp);
+	}
+	return err;
+}
+
+// Return the whole of the file as a malloced string, or NULL
+char* read_text(char* filename)
+{
+	FILE* input = NULL;
+	if (fopen_s(&input, filename, "rb") != 0)
+		return NULL;
+	char* text = NULL;
+	if (fseek(input, 0, SEEK_END) == 0) {
+		long size = ftell(input);
+		text = size >= 0 ? malloc(size + 1) : NULL;
+		if (text != NULL) {
+			rewind(input);
+			text[fread(text, 1, size, input)] = '\0';
+		}
+	}
+	fclose(input);
+	return text;
+}
+
+// Serve connections until stopped, each session restoring image and evaluating the text of filename
+int serve(TinyLisp lisp, char* path, int workers, char* image, char* filename)
+{
+	struct LispServerConfig_ config;
+	config.path = path;
+	config.workers = workers;
+	config.image = image;
+	config.prelude = NULL;
+	config.optimize = lisp->optimize;
+	config.jit = lisp->jit;
+	config.hash_cons = lisp->hash_cons;
+	config.budget = lisp->budget;
+	if (filename != NULL) {
+		config.prelude = read_text(filename);
+		if (config.prelude == NULL) {
+			printf("Could not open file %s\n", filename);
+			return E_IO_ERROR;
+		}
+	}
+	error_t err = lisp_server_run(&config, lisp);
+	if (err != E_SUCCESS)
+		lisp_print_error(lisp);
+	free(config.prelude);
+	return err;
+}
+
+int interact(TinyLisp lisp, int banner, LispWriter out)
 {
 	if (banner) {
 		printf(" _______ _____ __   _ __   __        _____ _______  _____\n");
@@ -76,7 +211,6 @@ int interact(int banner)
 		printf("             Version 0.1, Copyright (C) Dominic Price 2021\n\n");
 	}
 
-	TinyLisp lisp = lisp_new();
 	char buffer[BUFFER_SIZE];
 	int collect_len = 0;
 
@@ -85,15 +219,17 @@ int interact(int banner)
 		if (!fgets(buffer + collect_len, BUFFER_SIZE - collect_len, stdin))
 			return 1;
 		collect_len = (int)strlen(buffer);
-		int pos = 0;
-		while (pos < collect_len) {
+		// As in read_file; a line which cannot be parsed is dropped after reporting why
+		int pos = 0, start = 0;
+		while (start < collect_len) {
 			LispObject obj = lisp_parse(lisp, buffer, &pos);
 			if (obj != NULL) {
-				collect_len = 0;
-				LispObject eval = lisp_evaluate(lisp, obj);
+				start = pos;
+				LispObject eval = evaluate(lisp, obj);
 				if (eval != NULL) {
-					lisp_object_print(eval);
-					printf("\n");
+					lisp_object_write(out, eval);
+					lisp_writer_putc(out, '\n');
+					lisp_writer_flush(out);
 					lisp_object_free(eval);
 				}
 				else {
@@ -105,19 +241,16 @@ int interact(int banner)
 			else {
 				if (lisp->err_code == E_UNEXPECTED_EOF) {
 					lisp_clear_error(lisp);
-					continue;
-				}
-				else if (lisp->err_code == E_NO_INPUT) {
-					collect_len = 0;
-					lisp_clear_error(lisp);
-					continue;
+					break;
 				}
-				else {
+				start = collect_len;
+				if (lisp->err_code != E_NO_INPUT)
 					lisp_print_error(lisp);
-					lisp_clear_error(lisp);
-				}
+				lisp_clear_error(lisp);
 			}
 		}
+		collect_len -= start;
+		memmove(buffer, buffer + start, collect_len + 1);
 	}
 	return 0;
 }
@@ -126,6 +259,19 @@ int main(int argc, char** argv)
 {
 	int quiet = 0;
 	char* filename = NULL;
+	char* image = NULL;
+	char* snapshot = NULL;
+	char* profile = NULL;
+	int stats = 0;
+	int optimize = 1;
+	int jit = 0;
+	int hash_cons = 0;
+	char* emit = NULL;
+	char* map = NULL;
+	char* serve_path = NULL;
+	int workers = 1;
+	struct LispPreforkConfig_ prefork = { NULL, 0, 0, 0, 0 };
+	long long max_steps = 0, max_time = 0, max_memory = 0;
 	for (int i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
 			help();
@@ -134,13 +280,188 @@ int main(int argc, char** argv)
 		else if (strcmp(argv[i], "--nobanner") == 0 || strcmp(argv[i], "-q") == 0) {
 			quiet = 1;
 		}
+		else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+			image = argv[++i];
+		}
+		else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+			snapshot = argv[++i];
+		}
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+			profile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--stats") == 0) {
+			stats = 1;
+		}
+		else if (strcmp(argv[i], "--no-optimize") == 0) {
+			optimize = 0;
+		}
+		else if (strcmp(argv[i], "--jit") == 0) {
+			jit = 1;
+		}
+		else if (strcmp(argv[i], "--hash-cons") == 0) {
+			hash_cons = 1;
+		}
+		else if (strcmp(argv[i], "--emit-c") == 0 && i + 1 < argc) {
+			emit = argv[++i];
+		}
+		else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+			map = argv[++i];
+		}
+		else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+			serve_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+			workers = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--prefork") == 0 && i + 1 < argc) {
+			prefork.workers = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-requests") == 0 && i + 1 < argc) {
+			prefork.max_requests = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-rss") == 0 && i + 1 < argc) {
+			prefork.max_rss = atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+			prefork.timeout = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc) {
+			max_steps = atoll(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-time") == 0 && i + 1 < argc) {
+			max_time = atoll(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc) {
+			max_memory = atoll(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--slice") == 0 && i + 1 < argc) {
+			eval_slice = atoll(argv[++i]);
+		}
 		else {
 			filename = argv[i];
 		}
 	}
 
-	if (filename != NULL)
-		return read_file(filename);
-	else
-		return interact(!quiet);
+	if (snapshot != NULL && filename == NULL) {
+		printf("--snapshot requires a scriptfile\n");
+		return 1;
+	}
+	if (prefork.workers > 0 && serve_path == NULL) {
+		printf("--prefork requires --serve\n");
+		return 1;
+	}
+	// The profiler's state is shared by every thread that evaluates, so only one may
+	if (profile != NULL && serve_path != NULL && prefork.workers == 0 && workers > 1) {
+		printf("--profile cannot be used with more than one of --workers\n");
+		return 1;
+	}
+	if (emit != NULL && filename == NULL) {
+		printf("--emit-c requires a scriptfile\n");
+		return 1;
+	}
+
+	TinyLisp lisp = lisp_new();
+	LispWriter out = lisp_writer_new_file(stdout);
+	if (lisp == NULL || out == NULL) {
+		printf("Could not allocate interpreter\n");
+		return E_MEMORY_ERROR;
+	}
+	lisp->optimize = optimize;
+	lisp->jit = jit;
+	lisp->hash_cons = hash_cons;
+	lisp->budget.max_steps = max_steps;
+	lisp->budget.max_ns = max_time * 1000000;
+	lisp->budget.max_bytes = max_memory * 1024;
+	if (jit && !lisp_jit_supported)
+		fprintf(stderr, "--jit is not supported on this platform and is ignored\n");
+
+	if (image != NULL) {
+		error_t err = lisp_image_load(lisp, image);
+		if (err != E_SUCCESS) {
+			lisp_error_set(lisp, err, "Could not restore image %s", image);
+			lisp_print_error(lisp);
+			return err;
+		}
+	}
+
+	if (emit != NULL) {
+		FILE* output = NULL;
+		if (fopen_s(&output, emit, "w") != 0) {
+			printf("Could not open file %s\n", emit);
+			return E_IO_ERROR;
+		}
+		LispWriter code = lisp_writer_new_file(output);
+		error_t err = code != NULL ? lisp_emit_c(lisp, filename, code) : E_MEMORY_ERROR;
+		if (code != NULL)
+			lisp_writer_free(code);
+		fclose(output);
+		if (err != E_SUCCESS)
+			lisp_print_error(lisp);
+		lisp_writer_free(out);
+		lisp_free(lisp);
+		return err;
+	}
+
+	FILE* stacks = NULL;
+	if (profile != NULL) {
+		if (fopen_s(&stacks, profile, "w") != 0) {
+			printf("Could not open file %s\n", profile);
+			return E_IO_ERROR;
+		}
+		lisp_profile_start(LISP_PROFILE_INTERVAL);
+	}
+
+	int res;
+	if (map != NULL || serve_path != NULL) {
+		// The script is run here too so that its errors are reported before any input is taken
+		LispWriter discard = lisp_writer_new(null_sink, NULL);
+		res = discard == NULL ? E_MEMORY_ERROR : 0;
+		if (res == 0 && filename != NULL)
+			res = read_file(lisp, filename, discard);
+		if (discard != NULL)
+			lisp_writer_free(discard);
+		if (res == 0 && map != NULL) {
+			res = map_input(lisp, map, out);
+		}
+		else if (res == 0 && prefork.workers > 0) {
+			prefork.path = serve_path;
+			res = lisp_prefork_run(&prefork, lisp);
+			if (res != E_SUCCESS)
+				lisp_print_error(lisp);
+		}
+		else if (res == 0) {
+			res = serve(lisp, serve_path, workers, image, filename);
+		}
+	}
+	else if (filename != NULL) {
+		res = read_file(lisp, filename, out);
+	}
+	else {
+		res = interact(lisp, !quiet, out);
+	}
+	lisp_writer_free(out);
+
+	if (stacks != NULL) {
+		lisp_profile_stop(stderr, stacks);
+		fclose(stacks);
+	}
+	if (stats) {
+		fflush(stdout);
+		LispWriter err = lisp_writer_new_file(stderr);
+		if (err != NULL) {
+			lisp_stats_write(err);
+			lisp_writer_free(err);
+		}
+	}
+
+	if (res == 0 && snapshot != NULL) {
+		error_t err = lisp_image_save(lisp, snapshot);
+		if (err != E_SUCCESS) {
+			lisp_error_set(lisp, err, "Could not save image %s", snapshot);
+			lisp_print_error(lisp);
+			res = err;
+		}
+	}
+	lisp_free(lisp);
+	return res;
 }
\ No newline at end of file
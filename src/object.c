@@ -4,6 +4,18 @@
 #include <string.h>
 
 #include "object.h"
+#include "builtins.h"
+#include "stats.h"
+#include "jit.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 //#define DEBUG
 
@@ -21,7 +33,9 @@ struct type_desc_ typedesc[T_SIZE] = {
 	{ T_LIST, "list" },
 	{ T_INTEGER, "integer" },
 	{ T_SYMBOL, "symbol" },
-	{ T_BUILTIN, "builtin" }
+	{ T_BUILTIN, "builtin" },
+	{ T_MAP, "map" },
+	{ T_SEQ, "seq" }
 };
 
 LispObject lisp_object_new_(LispObjectType type)
@@ -32,6 +46,7 @@ LispObject lisp_object_new_(LispObjectType type)
 
 	obj->refcount = 1;
 	obj->type = type;
+	++lisp_stats.allocated[type];
 
 	return obj;
 }
@@ -39,7 +54,7 @@ LispObject lisp_object_new_(LispObjectType type)
 LispObject lisp_object_create_reference(LispObject other) {
 	if (other == NULL)
 		return NULL;
-	++other->refcount;
+	LISP_INCREF(other);
 	return other;
 }
 
@@ -59,6 +74,14 @@ void lisp_object_free(LispObject obj)
 	case T_BUILTIN:
 		lisp_builtin_free(obj);
 		break;
+	case T_MAP:
+		lisp_map_free(obj);
+		break;
+	case T_SEQ:
+		lisp_seq_free(obj);
+		break;
+	default:
+		break;
 	}
 }
 
@@ -66,6 +89,9 @@ int lisp_object_equal(LispObject lhs, LispObject rhs)
 {
 	VALIDATE_OBJECT(lhs);
 	VALIDATE_OBJECT(rhs);
+	// Shared objects, as made in the hash-consing mode, are equal without looking inside
+	if (lhs == rhs)
+		return 1;
 	if (lhs->type != rhs->type)
 		return 0;
 
@@ -82,6 +108,12 @@ int lisp_object_equal(LispObject lhs, LispObject rhs)
 	case T_BUILTIN:
 		return lisp_builtin_equal(lhs, rhs);
 		break;
+	case T_MAP:
+		return lisp_map_equal(lhs, rhs);
+		break;
+	case T_SEQ:
+		return lisp_seq_equal(lhs, rhs);
+		break;
 	default:
 		return 0;
 	}
@@ -107,11 +139,120 @@ int lisp_object_lessthan(LispObject lhs, LispObject rhs)
 	case T_BUILTIN:
 		return lisp_builtin_lessthan(lhs, rhs);
 		break;
+	case T_MAP:
+		return lisp_map_lessthan(lhs, rhs);
+		break;
+	default:
+		return 0;
+	}
+}
+
+unsigned int lisp_string_hash(const char* str, int len)
+{
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < len; ++i) {
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Spread the bits of val over the whole word, so that nearby integers land in different map positions
+unsigned int lisp_hash_mix(unsigned int val)
+{
+	val ^= val >> 16;
+	val *= 0x85ebca6bu;
+	val ^= val >> 13;
+	val *= 0xc2b2ae35u;
+	val ^= val >> 16;
+	return val;
+}
+
+unsigned int lisp_object_hash(LispObject obj)
+{
+	VALIDATE_OBJECT(obj);
+	switch (obj->type) {
+	case T_LIST: {
+		unsigned int hash = (unsigned int)lisp_list_size(obj);
+		for (int i = 0; i < lisp_list_size(obj); ++i)
+			hash = hash * 31u + lisp_object_hash(lisp_list_at(obj, i));
+		return lisp_hash_mix(hash ^ T_LIST);
+	}
+	case T_INTEGER:
+		return lisp_hash_mix((unsigned int)lisp_integer_get(obj) ^ T_INTEGER);
+	case T_SYMBOL:
+		return lisp_string_hash(obj->data.s->data, obj->data.s->size);
+	case T_BUILTIN: {
+		int id = lisp_builtin_id(lisp_builtin_get(obj));
+		return lisp_hash_mix((unsigned int)id ^ (T_BUILTIN << 16));
+	}
+	case T_MAP:
+		return lisp_map_hash(obj);
+	case T_SEQ:
+		return lisp_seq_hash(obj);
 	default:
 		return 0;
 	}
 }
 
+void lisp_seq_clear_caches(LispObject seq)
+{
+	lisp_object_clear_caches(seq->data.q->chunk);
+	LispSeqGen gen = seq->data.q->rest;
+	if (gen == NULL)
+		return;
+	if (gen->call != NULL)
+		lisp_object_clear_caches(gen->call);
+	if (gen->source != NULL)
+		lisp_object_clear_caches(gen->source);
+	if (gen->value != NULL)
+		lisp_object_clear_caches(gen->value);
+}
+
+error_t lisp_object_clear_caches_visit(void* ctx, LispObject key, LispObject val)
+{
+	(void)ctx;
+	lisp_object_clear_caches(key);
+	lisp_object_clear_caches(val);
+	return E_SUCCESS;
+}
+
+void lisp_object_clear_caches(LispObject obj)
+{
+	VALIDATE_OBJECT(obj);
+	if (obj->type == T_MAP)
+		lisp_map_visit(obj, lisp_object_clear_caches_visit, NULL);
+	if (obj->type == T_SEQ)
+		lisp_seq_clear_caches(obj);
+	if (obj->type != T_LIST)
+		return;
+	LispCallSite site = obj->data.l->site;
+	if (site != NULL && site->callee != NULL) {
+		LispObject callee = site->callee;
+		site->callee = NULL;
+		site->global = 0;
+		lisp_object_free(callee);
+	}
+	if (site != NULL && site->expansion != NULL) {
+		LispObject expansion = site->expansion;
+		site->expansion = NULL;
+		lisp_object_clear_caches(expansion);
+		lisp_object_free(expansion);
+	}
+	LispLambda lambda = obj->data.l->lambda;
+	// Native code was compiled from the optimized body and calls the lambdas it refers to
+	if (lambda != NULL)
+		lisp_jit_free_code(lambda);
+	if (lambda != NULL && lambda->body != NULL) {
+		LispObject body = lambda->body;
+		lambda->body = NULL;
+		lisp_object_clear_caches(body);
+		lisp_object_free(body);
+	}
+	for (int i = 0; i < lisp_list_size(obj); ++i)
+		lisp_object_clear_caches(lisp_list_at(obj, i));
+}
+
 int lisp_object_is_nil(LispObject obj)
 {
 	VALIDATE_OBJECT(obj);
@@ -122,28 +263,42 @@ int lisp_object_is_nil(LispObject obj)
 	return 0;
 }
 
+// Run a lisp_*_write function against a temporary writer on stdout, buffering on the stack since stdout
+// buffers too
+void lisp_print_with(error_t(*write)(LispWriter, LispObject), LispObject obj)
+{
+	char buffer[LISP_PRINT_BUFFER_SIZE];
+	struct LispWriter_ writer;
+	lisp_writer_init(&writer, lisp_writer_file_sink, stdout, buffer, sizeof(buffer));
+	write(&writer, obj);
+	lisp_writer_finish(&writer);
+}
+
 void lisp_object_print(LispObject obj)
+{
+	lisp_print_with(lisp_object_write, obj);
+}
+
+error_t lisp_object_write(LispWriter writer, LispObject obj)
 {
 	VALIDATE_OBJECT(obj);
-	if (obj == NULL) {
-		printf("NULL");
-		return;
-	}
+	if (obj == NULL)
+		return lisp_writer_puts(writer, "NULL");
 	switch (obj->type) {
 	case T_LIST:
-		lisp_list_print(obj);
-		break;
+		return lisp_list_write(writer, obj);
 	case T_INTEGER:
-		lisp_integer_print(obj);
-		break;
+		return lisp_integer_write(writer, obj);
 	case T_SYMBOL:
-		lisp_symbol_print(obj);
-		break;
+		return lisp_symbol_write(writer, obj);
 	case T_BUILTIN:
-		lisp_builtin_print(obj);
-		break;
+		return lisp_builtin_write(writer, obj);
+	case T_MAP:
+		return lisp_map_write(writer, obj);
+	case T_SEQ:
+		return lisp_seq_write(writer, obj);
 	default:
-		printf("Unknown type");
+		return lisp_writer_puts(writer, "Unknown type");
 	}
 }
 
@@ -161,8 +316,12 @@ LispObject lisp_list_new()
 
 	data->capacity = data->size = 0;
 	data->data = NULL;
+	data->lambda = NULL;
+	data->site = NULL;
+	data->owner = NULL;
 
 	list->data.l = data;
+	lisp_stats.data_bytes += sizeof(struct LispList_);
 	return list;
 }
 
@@ -179,6 +338,7 @@ LispObject lisp_list_new_from_args(int n, ...)
 
 	list->data.l->capacity = list->data.l->size = n;
 	list->data.l->data = data;
+	lisp_stats.data_bytes += sizeof(LispObject) * n;
 	
 	va_list args;
 	va_start(args, n);
@@ -194,49 +354,116 @@ LispObject lisp_list_new_from_args(int n, ...)
 LispObject lisp_list_copy(LispObject list)
 {
 	VALIDATE_OBJECT(list);
+	return lisp_list_copy_n(list, 0, lisp_list_size(list));
+}
+
+LispObject lisp_list_copy_n(LispObject list, int start, int end)
+{
+	VALIDATE_OBJECT(list);
+	int len = end - start;
+	LispObject* data = NULL;
+	if (len > 0) {
+		data = malloc(sizeof(LispObject) * len);
+		if (data == NULL)
+			return NULL;
+	}
 	LispObject res = lisp_list_new();
-	int len = lisp_list_size(list);
-	LispObject* data = malloc(sizeof(LispObject) * len);
-	if (data == NULL)
+	if (res == NULL) {
+		free(data);
 		return NULL;
+	}
 	for (int i = 0; i < len; ++i)
-		data[i] = lisp_object_create_reference(lisp_list_at(list, i));
+		data[i] = lisp_object_create_reference(lisp_list_at(list, start + i));
 	res->data.l->capacity = res->data.l->size = len;
 	res->data.l->data = data;
+	lisp_stats.data_bytes += sizeof(LispObject) * len;
+	++lisp_stats.list_copies;
+	lisp_stats.list_copy_bytes += sizeof(LispObject) * len;
 	return res;
 }
 
-LispObject lisp_list_copy_n(LispObject list, int start, int end)
+LispObject lisp_list_slice(LispObject list, int start, int end)
 {
 	VALIDATE_OBJECT(list);
 	LispObject res = lisp_list_new();
-	int len = end - start;
+	if (res == NULL || start == end)
+		return res;
+	// A slice of a slice shares the storage of the list that owns it
+	LispObject owner = list->data.l->owner != NULL ? list->data.l->owner : list;
+	res->data.l->data = list->data.l->data + start;
+	res->data.l->capacity = res->data.l->size = end - start;
+	res->data.l->owner = lisp_object_create_reference(owner);
+	return res;
+}
+
+// Give the slice list storage of its own, holding new references to its elements
+error_t lisp_list_own_data(LispObject list)
+{
+	int len = lisp_list_size(list);
 	LispObject* data = malloc(sizeof(LispObject) * len);
 	if (data == NULL)
-		return NULL;
+		return E_MEMORY_ERROR;
 	for (int i = 0; i < len; ++i)
-		data[i] = lisp_object_create_reference(lisp_list_at(list, start + i));
-	res->data.l->capacity = res->data.l->size = len;
-	res->data.l->data = data;
-	return res;
+		data[i] = lisp_object_create_reference(lisp_list_at(list, i));
+	lisp_object_free(list->data.l->owner);
+	list->data.l->owner = NULL;
+	list->data.l->data = data;
+	list->data.l->capacity = len;
+	lisp_stats.data_bytes += sizeof(LispObject) * len;
+	++lisp_stats.list_copies;
+	lisp_stats.list_copy_bytes += sizeof(LispObject) * len;
+	return E_SUCCESS;
 }
 
 void lisp_list_free(LispObject list)
 {
 	VALIDATE_OBJECT(list);
-	--list->refcount;
-	if (list->refcount != 0)
+	if (LISP_DECREF(list) > 0)
 		return;
 
-	for (int i = 0; i < lisp_list_size(list); ++i)
+	// The elements of a slice belong to its owner
+	LispObject owner = list->data.l->owner;
+	for (int i = 0; owner == NULL && i < lisp_list_size(list); ++i)
 		lisp_object_free(lisp_list_at(list, i));
+	LispLambda lambda = list->data.l->lambda;
+	if (lambda != NULL) {
+		if (lambda->body != NULL)
+			lisp_object_free(lambda->body);
+		free(lambda->name);
+		free(lambda->keys);
+		free(lambda->slots);
+		lisp_jit_free_code(lambda);
+		free(lambda);
+	}
+	LispCallSite site = list->data.l->site;
+	if (site != NULL) {
+		if (site->callee != NULL)
+			lisp_object_free(site->callee);
+		if (site->args != NULL)
+			lisp_object_free(site->args);
+		if (site->expansion != NULL)
+			lisp_object_free(site->expansion);
+		free(site);
+	}
+	if (owner != NULL) {
+		lisp_object_free(owner);
+	}
+	else {
+		free(list->data.l->data);
+		lisp_stats.data_bytes -= sizeof(LispObject) * lisp_list_capacity(list);
+	}
+	free(list->data.l);
+	lisp_stats.data_bytes -= sizeof(struct LispList_);
 	free(list);
+	++lisp_stats.freed[T_LIST];
 }
 
 int lisp_list_equal(LispObject lhs, LispObject rhs)
 {
 	VALIDATE_OBJECT(lhs);
 	VALIDATE_OBJECT(rhs);
+	if (lhs == rhs)
+		return 1;
 	int len = lisp_list_size(lhs);
 	if (len != lisp_list_size(rhs))
 		return 0;
@@ -286,18 +513,25 @@ error_t lisp_list_push(LispObject list, LispObject val)
 {
 	VALIDATE_OBJECT(list);
 	VALIDATE_OBJECT(val);
+	if (list->data.l->owner != NULL) {
+		error_t err = lisp_list_own_data(list);
+		if (err != E_SUCCESS)
+			return err;
+	}
 	if (lisp_list_capacity(list) == 0) {
 		LispObject* data = malloc(sizeof(LispObject));
 		if (data == NULL)
 			return E_MEMORY_ERROR;
 		++list->data.l->capacity;
 		list->data.l->data = data;
+		lisp_stats.data_bytes += sizeof(LispObject);
 	}
 	else if (lisp_list_size(list) == lisp_list_capacity(list)) {
 		int new_capacity = lisp_list_capacity(list) * 2;
 		LispObject* data = realloc(list->data.l->data, sizeof(LispObject) * new_capacity);
 		if (data == NULL)
 			return E_MEMORY_ERROR;
+		lisp_stats.data_bytes += sizeof(LispObject) * (new_capacity - lisp_list_capacity(list));
 		list->data.l->capacity = new_capacity;
 		list->data.l->data = data;
 	}
@@ -307,6 +541,25 @@ error_t lisp_list_push(LispObject list, LispObject val)
 	return E_SUCCESS;
 }
 
+error_t lisp_list_reserve(LispObject list, int capacity)
+{
+	VALIDATE_OBJECT(list);
+	if (list->data.l->owner != NULL) {
+		error_t err = lisp_list_own_data(list);
+		if (err != E_SUCCESS)
+			return err;
+	}
+	if (capacity <= lisp_list_capacity(list))
+		return E_SUCCESS;
+	LispObject* data = realloc(list->data.l->data, sizeof(LispObject) * capacity);
+	if (data == NULL)
+		return E_MEMORY_ERROR;
+	lisp_stats.data_bytes += sizeof(LispObject) * (capacity - lisp_list_capacity(list));
+	list->data.l->capacity = capacity;
+	list->data.l->data = data;
+	return E_SUCCESS;
+}
+
 LispObject lisp_list_concat(LispObject list, LispObject other)
 {
 	VALIDATE_OBJECT(list);
@@ -341,19 +594,285 @@ LispObject lisp_list_tail(LispObject list)
 	return lisp_list_copy_n(list, 1, len);
 }
 
-void lisp_list_print(LispObject list)
+// Stable LSD radix sort of the n integers in vals, a byte of their values at a time, using tmp
+void lisp_list_radix_sort(LispObject* vals, LispObject* tmp, int n)
+{
+	LispObject* src = vals;
+	LispObject* dst = tmp;
+	for (int shift = 0; shift < 32; shift += 8) {
+		// Flipping the sign bit orders negative numbers before positive ones
+		int offsets[257] = { 0 };
+		for (int i = 0; i < n; ++i)
+			++offsets[((((unsigned int)src[i]->data.i) ^ 0x80000000u) >> shift & 0xFF) + 1];
+		// A byte which is the same in every value leaves the order unchanged
+		int skip = 0;
+		for (int b = 1; b <= 256 && !skip; ++b)
+			skip = offsets[b] == n;
+		if (skip)
+			continue;
+		for (int b = 0; b < 256; ++b)
+			offsets[b + 1] += offsets[b];
+		for (int i = 0; i < n; ++i)
+			dst[offsets[(((unsigned int)src[i]->data.i) ^ 0x80000000u) >> shift & 0xFF]++] = src[i];
+		LispObject* swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != vals)
+		memcpy(vals, src, sizeof(LispObject) * n);
+}
+
+// Stable bottom up merge sort of the n objects in vals, using tmp; returns 0 if less abandoned it
+int lisp_list_merge_sort(LispObject* vals, LispObject* tmp, int n, LispCompare less, void* ctx)
+{
+	LispObject* src = vals;
+	LispObject* dst = tmp;
+	for (int width = 1; width < n; width *= 2) {
+		for (int lo = 0; lo < n; lo += 2 * width) {
+			int mid = lo + width < n ? lo + width : n;
+			int hi = lo + 2 * width < n ? lo + 2 * width : n;
+			int i = lo, j = mid, k = lo;
+			// Taking from the right only when it is strictly less keeps equal elements in order
+			while (i < mid && j < hi) {
+				int before = less(ctx, src[j], src[i]);
+				if (before < 0)
+					return 0;
+				dst[k++] = before ? src[j++] : src[i++];
+			}
+			while (i < mid)
+				dst[k++] = src[i++];
+			while (j < hi)
+				dst[k++] = src[j++];
+		}
+		LispObject* swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != vals)
+		memcpy(vals, src, sizeof(LispObject) * n);
+	return 1;
+}
+
+int lisp_list_sort_lessthan(void* ctx, LispObject lhs, LispObject rhs)
+{
+	(void)ctx;
+	return lisp_object_lessthan(lhs, rhs);
+}
+
+error_t lisp_list_sort(LispObject list, LispCompare less, void* ctx, LispObject* res)
 {
 	VALIDATE_OBJECT(list);
-	printf("(");
 	int len = lisp_list_size(list);
-	if (len > 0) {
-		for (int i = 0; i < len - 1; ++i) {
-			lisp_object_print(lisp_list_at(list, i));
-			printf(" ");
+	LispObject sorted = lisp_list_copy(list);
+	if (sorted == NULL)
+		return E_MEMORY_ERROR;
+	if (len < 2) {
+		*res = sorted;
+		return E_SUCCESS;
+	}
+	LispObject* tmp = malloc(sizeof(LispObject) * len);
+	if (tmp == NULL) {
+		lisp_list_free(sorted);
+		return E_MEMORY_ERROR;
+	}
+
+	LispObject* vals = sorted->data.l->data;
+	int integers = less == NULL;
+	for (int i = 0; i < len && integers; ++i)
+		integers = vals[i]->type == T_INTEGER;
+	int ok = 1;
+	if (integers)
+		lisp_list_radix_sort(vals, tmp, len);
+	else
+		ok = lisp_list_merge_sort(vals, tmp, len, less != NULL ? less : lisp_list_sort_lessthan, ctx);
+	free(tmp);
+	if (!ok) {
+		lisp_list_free(sorted);
+		return E_EVALUATION_ERROR;
+	}
+	*res = sorted;
+	return E_SUCCESS;
+}
+
+LispLambda lisp_list_lambda(LispObject list)
+{
+	VALIDATE_OBJECT(list);
+	if (list->data.l->lambda != NULL)
+		return list->data.l->lambda;
+	LispLambda lambda = malloc(sizeof(struct LispLambda_));
+	if (lambda == NULL)
+		return NULL;
+	lambda->name = NULL;
+	lambda->profile_id = -1;
+	lambda->body = NULL;
+	lambda->decoded = 0;
+	lambda->is_macro = 0;
+	lambda->expands = lambda->impure = 0;
+	lambda->arity = 0;
+	lambda->params = lambda->source = NULL;
+	lambda->keys = NULL;
+	lambda->slots = NULL;
+	lambda->jit_code = NULL;
+	lambda->jit_size = 0;
+	lambda->jit_calls = 0;
+	list->data.l->lambda = lambda;
+	return lambda;
+}
+
+error_t lisp_list_decode_lambda(LispObject list, LispLambda* res)
+{
+	VALIDATE_OBJECT(list);
+	LispLambda lambda = lisp_list_lambda(list);
+	if (lambda == NULL)
+		return E_MEMORY_ERROR;
+	if (lambda->decoded) {
+		*res = lambda;
+		return E_SUCCESS;
+	}
+
+	// An optional list of options as the first element signifies a macro, then comes a list of parameter
+	// names (or a symbol which will get assigned all the parameters in a list) followed by the body
+	int len = lisp_list_size(list);
+	if (len != 2 && len != 3)
+		return E_TYPE_ERROR;
+	int is_macro = len == 3;
+	int expands = 0, impure = 0;
+	if (is_macro) {
+		LispObject options = lisp_list_at(list, 0);
+		if (options->type != T_LIST)
+			return E_TYPE_ERROR;
+		for (int i = 0; i < lisp_list_size(options); ++i) {
+			LispObject option = lisp_list_at(options, i);
+			if (option->type != T_SYMBOL)
+				return E_TYPE_ERROR;
+			if (strcmp(lisp_symbol_get(option), "expand") == 0)
+				expands = 1;
+			else if (strcmp(lisp_symbol_get(option), "impure") == 0)
+				impure = 1;
+			else
+				return E_TYPE_ERROR;
+		}
+	}
+	LispObject params = lisp_list_at(list, is_macro ? 1 : 0);
+
+	int arity;
+	if (params->type == T_SYMBOL)
+		arity = -1;
+	else if (params->type == T_LIST)
+		arity = lisp_list_size(params);
+	else
+		return E_TYPE_ERROR;
+	int nkeys = arity < 0 ? 1 : arity;
+	char** keys = NULL;
+	int* slots = NULL;
+	if (nkeys > 0) {
+		keys = malloc(sizeof(char*) * nkeys);
+		slots = malloc(sizeof(int) * nkeys);
+		if (keys == NULL || slots == NULL) {
+			free(keys);
+			free(slots);
+			return E_MEMORY_ERROR;
+		}
+	}
+
+	// Insertion sort the names, keeping track of where each parameter ends up
+	for (int i = 0; i < nkeys; ++i) {
+		LispObject param = arity < 0 ? params : lisp_list_at(params, i);
+		if (param->type != T_SYMBOL) {
+			free(keys);
+			free(slots);
+			return E_TYPE_ERROR;
+		}
+		char* key = lisp_symbol_get(param);
+		int pos = i;
+		while (pos > 0 && strcmp(keys[pos - 1], key) > 0) {
+			keys[pos] = keys[pos - 1];
+			--pos;
 		}
-		lisp_object_print(lisp_list_at(list, len - 1));
+		if (pos > 0 && strcmp(keys[pos - 1], key) == 0) {
+			free(keys);
+			free(slots);
+			return E_NAME_ALREADY_SET;
+		}
+		keys[pos] = key;
+		for (int j = 0; j < i; ++j) {
+			if (slots[j] >= pos)
+				++slots[j];
+		}
+		slots[i] = pos;
+	}
+
+	lambda->is_macro = is_macro;
+	lambda->expands = expands;
+	lambda->impure = impure;
+	lambda->arity = arity;
+	lambda->params = params;
+	lambda->source = lisp_list_at(list, is_macro ? 2 : 1);
+	lambda->keys = keys;
+	lambda->slots = slots;
+	lambda->decoded = 1;
+	*res = lambda;
+	return E_SUCCESS;
+}
+
+LispCallSite lisp_list_callsite(LispObject list)
+{
+	VALIDATE_OBJECT(list);
+	if (list->data.l->site != NULL)
+		return list->data.l->site;
+	LispCallSite site = malloc(sizeof(struct LispCallSite_));
+	if (site == NULL)
+		return NULL;
+	site->callee = NULL;
+	site->global = 0;
+	site->builtin_id = -1;
+	site->args = NULL;
+	site->expansion = NULL;
+	site->operand_slots[0] = site->operand_slots[1] = -1;
+	site->int_misses = 0;
+	list->data.l->site = site;
+	return site;
+}
+
+error_t lisp_list_set_name(LispObject list, char* name)
+{
+	VALIDATE_OBJECT(list);
+	LispLambda lambda = lisp_list_lambda(list);
+	if (lambda == NULL)
+		return E_MEMORY_ERROR;
+	if (lambda->name != NULL)
+		return E_SUCCESS;
+	lambda->name = _strdup(name);
+	return lambda->name == NULL ? E_MEMORY_ERROR : E_SUCCESS;
+}
+
+char* lisp_list_get_name(LispObject list)
+{
+	VALIDATE_OBJECT(list);
+	if (list->data.l->lambda == NULL)
+		return NULL;
+	return list->data.l->lambda->name;
+}
+
+void lisp_list_print(LispObject list)
+{
+	lisp_print_with(lisp_list_write, list);
+}
+
+error_t lisp_list_write(LispWriter writer, LispObject list)
+{
+	VALIDATE_OBJECT(list);
+	error_t err = lisp_writer_putc(writer, '(');
+	int len = lisp_list_size(list);
+	for (int i = 0; i < len && err == E_SUCCESS; ++i) {
+		if (i > 0)
+			err = lisp_writer_putc(writer, ' ');
+		if (err == E_SUCCESS)
+			err = lisp_object_write(writer, lisp_list_at(list, i));
 	}
-	printf(")");
+	if (err != E_SUCCESS)
+		return err;
+	return lisp_writer_putc(writer, ')');
 }
 
 LispObject lisp_symbol_new(char* val)
@@ -384,18 +903,21 @@ LispObject lisp_symbol_new_n(char* val, int len)
 	data->data[len] = '\0';
 
 	symbol->data.s = data;
+	lisp_stats.data_bytes += sizeof(struct LispSymbol_) + len + 1;
 	return symbol;
 }
 
 void lisp_symbol_free(LispObject symbol)
 {
 	VALIDATE_OBJECT(symbol);
-	--symbol->refcount;
-	if (symbol->refcount > 0)
+	if (LISP_DECREF(symbol) > 0)
 		return;
 
+	lisp_stats.data_bytes -= sizeof(struct LispSymbol_) + symbol->data.s->size + 1;
 	free(symbol->data.s->data);
+	free(symbol->data.s);
 	free(symbol);
+	++lisp_stats.freed[T_SYMBOL];
 }
 
 int lisp_symbol_equal(LispObject lhs, LispObject rhs)
@@ -418,9 +940,14 @@ char* lisp_symbol_get(LispObject symbol)
 }
 
 void lisp_symbol_print(LispObject symbol)
+{
+	lisp_print_with(lisp_symbol_write, symbol);
+}
+
+error_t lisp_symbol_write(LispWriter writer, LispObject symbol)
 {
 	VALIDATE_OBJECT(symbol);
-	printf("%s", lisp_symbol_get(symbol));
+	return lisp_writer_write(writer, lisp_symbol_get(symbol), symbol->data.s->size);
 }
 
 LispObject lisp_integer_new(int val)
@@ -449,11 +976,11 @@ int lisp_integer_lessthan(LispObject lhs, LispObject rhs)
 void lisp_integer_free(LispObject integer)
 {
 	VALIDATE_OBJECT(integer);
-	--integer->refcount;
-	if (integer->refcount > 0)
+	if (LISP_DECREF(integer) > 0)
 		return;
 
 	free(integer);
+	++lisp_stats.freed[T_INTEGER];
 }
 
 int lisp_integer_get(LispObject integer)
@@ -463,9 +990,14 @@ int lisp_integer_get(LispObject integer)
 }
 
 void lisp_integer_print(LispObject integer)
+{
+	lisp_print_with(lisp_integer_write, integer);
+}
+
+error_t lisp_integer_write(LispWriter writer, LispObject integer)
 {
 	VALIDATE_OBJECT(integer);
-	printf("%d", lisp_integer_get(integer));
+	return lisp_writer_integer(writer, lisp_integer_get(integer));
 }
 
 LispObject lisp_builtin_new(LispBuiltin val)
@@ -478,11 +1010,11 @@ LispObject lisp_builtin_new(LispBuiltin val)
 void lisp_builtin_free(LispObject builtin)
 {
 	VALIDATE_OBJECT(builtin);
-	--builtin->refcount;
-	if (builtin->refcount > 0)
+	if (LISP_DECREF(builtin) > 0)
 		return;
 
 	free(builtin);
+	++lisp_stats.freed[T_BUILTIN];
 }
 
 int lisp_builtin_equal(LispObject lhs, LispObject rhs)
@@ -506,7 +1038,1145 @@ LispBuiltin lisp_builtin_get(LispObject builtin)
 }
 
 void lisp_builtin_print(LispObject builtin)
+{
+	lisp_print_with(lisp_builtin_write, builtin);
+}
+
+error_t lisp_builtin_write(LispWriter writer, LispObject builtin)
 {
 	VALIDATE_OBJECT(builtin);
-	printf("<builtin at 0x%p>", lisp_builtin_get(builtin));
-}
\ No newline at end of file
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "<builtin at 0x%p>", (void*)lisp_builtin_get(builtin));
+	return lisp_writer_puts(writer, buffer);
+}
+
+// Number of positions in a map node, one for each value of LISP_MAP_BITS bits of a hash
+#define LISP_MAP_WIDTH (1 << LISP_MAP_BITS)
+// Hashes have 32 bits, so the nodes at this shift and beyond hold keys whose hashes are equal
+#define LISP_MAP_MAX_SHIFT 32
+
+int lisp_map_popcount(unsigned int bits)
+{
+	bits = bits - ((bits >> 1) & 0x55555555u);
+	bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+	return (int)((((bits + (bits >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+}
+
+// The bit of a node's datamap and nodemap for the position of hash at the level starting at shift
+unsigned int lisp_map_bit(unsigned int hash, int shift)
+{
+	return 1u << ((hash >> shift) & (LISP_MAP_WIDTH - 1));
+}
+
+// Bytes taken by a node with count key/value pairs and nchildren children
+long long lisp_map_node_bytes(int count, int nchildren)
+{
+	return sizeof(struct LispMapNode_) + sizeof(LispObject) * 2 * count + sizeof(LispMapNode) * nchildren;
+}
+
+// malloc a node with room for count key/value pairs and nchildren children, which the caller fills in
+LispMapNode lisp_map_node_new(unsigned int datamap, unsigned int nodemap, int count, int nchildren)
+{
+	LispMapNode node = malloc(sizeof(struct LispMapNode_));
+	if (node == NULL)
+		return NULL;
+	node->refcount = 1;
+	node->datamap = datamap;
+	node->nodemap = nodemap;
+	node->count = count;
+	node->entries = count > 0 ? malloc(sizeof(LispObject) * 2 * count) : NULL;
+	node->children = nchildren > 0 ? malloc(sizeof(LispMapNode) * nchildren) : NULL;
+	if ((count > 0 && node->entries == NULL) || (nchildren > 0 && node->children == NULL)) {
+		free(node->entries);
+		free(node->children);
+		free(node);
+		return NULL;
+	}
+	lisp_stats.data_bytes += lisp_map_node_bytes(count, nchildren);
+	return node;
+}
+
+void lisp_map_node_free(LispMapNode node)
+{
+	if (LISP_DECREF(node) > 0)
+		return;
+	for (int i = 0; i < 2 * node->count; ++i)
+		lisp_object_free(node->entries[i]);
+	int nchildren = lisp_map_popcount(node->nodemap);
+	for (int i = 0; i < nchildren; ++i)
+		lisp_map_node_free(node->children[i]);
+	lisp_stats.data_bytes -= lisp_map_node_bytes(node->count, nchildren);
+	free(node->entries);
+	free(node->children);
+	free(node);
+}
+
+// Copy n key/value pairs from src to dst, taking new references to them
+void lisp_map_copy_entries(LispObject* dst, LispObject* src, int n)
+{
+	for (int i = 0; i < 2 * n; ++i)
+		dst[i] = lisp_object_create_reference(src[i]);
+}
+
+// Copy n children from src to dst, taking new references to them
+void lisp_map_copy_children(LispMapNode* dst, LispMapNode* src, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		dst[i] = src[i];
+		LISP_INCREF(dst[i]);
+	}
+}
+
+// Returns a borrowed reference to the value of key, whose hash is hash, in the trie below node
+LispObject lisp_map_node_find(LispMapNode node, LispObject key, unsigned int hash)
+{
+	for (int shift = 0; node != NULL; shift += LISP_MAP_BITS) {
+		if (shift >= LISP_MAP_MAX_SHIFT) {
+			for (int i = 0; i < node->count; ++i) {
+				if (lisp_object_equal(node->entries[2 * i], key))
+					return node->entries[2 * i + 1];
+			}
+			return NULL;
+		}
+		unsigned int bit = lisp_map_bit(hash, shift);
+		if (node->datamap & bit) {
+			int idx = lisp_map_popcount(node->datamap & (bit - 1));
+			return lisp_object_equal(node->entries[2 * idx], key) ? node->entries[2 * idx + 1] : NULL;
+		}
+		if ((node->nodemap & bit) == 0)
+			return NULL;
+		node = node->children[lisp_map_popcount(node->nodemap & (bit - 1))];
+	}
+	return NULL;
+}
+
+// Returns a new node holding the two pairs given, whose keys differ, at the level starting at shift
+LispMapNode lisp_map_node_merge(LispObject key1, LispObject val1, unsigned int hash1,
+	LispObject key2, LispObject val2, unsigned int hash2, int shift)
+{
+	if (shift >= LISP_MAP_MAX_SHIFT) {
+		LispMapNode node = lisp_map_node_new(0, 0, 2, 0);
+		if (node == NULL)
+			return NULL;
+		node->entries[0] = lisp_object_create_reference(key1);
+		node->entries[1] = lisp_object_create_reference(val1);
+		node->entries[2] = lisp_object_create_reference(key2);
+		node->entries[3] = lisp_object_create_reference(val2);
+		return node;
+	}
+	unsigned int bit1 = lisp_map_bit(hash1, shift);
+	unsigned int bit2 = lisp_map_bit(hash2, shift);
+	if (bit1 == bit2) {
+		LispMapNode child = lisp_map_node_merge(key1, val1, hash1, key2, val2, hash2, shift + LISP_MAP_BITS);
+		if (child == NULL)
+			return NULL;
+		LispMapNode node = lisp_map_node_new(0, bit1, 0, 1);
+		if (node == NULL) {
+			lisp_map_node_free(child);
+			return NULL;
+		}
+		node->children[0] = child;
+		return node;
+	}
+	LispMapNode node = lisp_map_node_new(bit1 | bit2, 0, 2, 0);
+	if (node == NULL)
+		return NULL;
+	int first = bit1 < bit2 ? 0 : 2;
+	node->entries[first] = lisp_object_create_reference(key1);
+	node->entries[first + 1] = lisp_object_create_reference(val1);
+	node->entries[2 - first] = lisp_object_create_reference(key2);
+	node->entries[3 - first] = lisp_object_create_reference(val2);
+	return node;
+}
+
+// Returns a new node like node but with the value of the pair at idx replaced by val
+LispMapNode lisp_map_node_set_value(LispMapNode node, int idx, LispObject val)
+{
+	int nchildren = lisp_map_popcount(node->nodemap);
+	LispMapNode res = lisp_map_node_new(node->datamap, node->nodemap, node->count, nchildren);
+	if (res == NULL)
+		return NULL;
+	lisp_map_copy_entries(res->entries, node->entries, node->count);
+	lisp_object_free(res->entries[2 * idx + 1]);
+	res->entries[2 * idx + 1] = lisp_object_create_reference(val);
+	lisp_map_copy_children(res->children, node->children, nchildren);
+	return res;
+}
+
+// Returns a new node like node but with the pair key, val inserted at idx and the datamap given
+LispMapNode lisp_map_node_insert(LispMapNode node, unsigned int datamap, int idx, LispObject key, LispObject val)
+{
+	int nchildren = lisp_map_popcount(node->nodemap);
+	LispMapNode res = lisp_map_node_new(datamap, node->nodemap, node->count + 1, nchildren);
+	if (res == NULL)
+		return NULL;
+	lisp_map_copy_entries(res->entries, node->entries, idx);
+	res->entries[2 * idx] = lisp_object_create_reference(key);
+	res->entries[2 * idx + 1] = lisp_object_create_reference(val);
+	lisp_map_copy_entries(res->entries + 2 * idx + 2, node->entries + 2 * idx, node->count - idx);
+	lisp_map_copy_children(res->children, node->children, nchildren);
+	return res;
+}
+
+// Returns a new node like node but without the pair at idx and with the datamap given
+LispMapNode lisp_map_node_remove(LispMapNode node, unsigned int datamap, int idx)
+{
+	int nchildren = lisp_map_popcount(node->nodemap);
+	LispMapNode res = lisp_map_node_new(datamap, node->nodemap, node->count - 1, nchildren);
+	if (res == NULL)
+		return NULL;
+	lisp_map_copy_entries(res->entries, node->entries, idx);
+	lisp_map_copy_entries(res->entries + 2 * idx, node->entries + 2 * idx + 2, node->count - idx - 1);
+	lisp_map_copy_children(res->children, node->children, nchildren);
+	return res;
+}
+
+// Returns a new node like node but with the child at cidx replaced by child, which it takes ownership of
+LispMapNode lisp_map_node_set_child(LispMapNode node, int cidx, LispMapNode child)
+{
+	int nchildren = lisp_map_popcount(node->nodemap);
+	LispMapNode res = lisp_map_node_new(node->datamap, node->nodemap, node->count, nchildren);
+	if (res == NULL) {
+		lisp_map_node_free(child);
+		return NULL;
+	}
+	lisp_map_copy_entries(res->entries, node->entries, node->count);
+	lisp_map_copy_children(res->children, node->children, nchildren);
+	lisp_map_node_free(res->children[cidx]);
+	res->children[cidx] = child;
+	return res;
+}
+
+// Returns a new node like node but with the pair at position bit moved down into child, which it takes
+// ownership of
+LispMapNode lisp_map_node_push_down(LispMapNode node, unsigned int bit, LispMapNode child)
+{
+	int nchildren = lisp_map_popcount(node->nodemap);
+	LispMapNode res = lisp_map_node_new(node->datamap & ~bit, node->nodemap | bit, node->count - 1, nchildren + 1);
+	if (res == NULL) {
+		lisp_map_node_free(child);
+		return NULL;
+	}
+	int idx = lisp_map_popcount(node->datamap & (bit - 1));
+	int cidx = lisp_map_popcount(node->nodemap & (bit - 1));
+	lisp_map_copy_entries(res->entries, node->entries, idx);
+	lisp_map_copy_entries(res->entries + 2 * idx, node->entries + 2 * idx + 2, node->count - idx - 1);
+	lisp_map_copy_children(res->children, node->children, cidx);
+	res->children[cidx] = child;
+	lisp_map_copy_children(res->children + cidx + 1, node->children + cidx, nchildren - cidx);
+	return res;
+}
+
+// Returns a new node like node but with the child at position bit replaced by its only pair
+LispMapNode lisp_map_node_pull_up(LispMapNode node, unsigned int bit, LispMapNode child)
+{
+	int nchildren = lisp_map_popcount(node->nodemap);
+	LispMapNode res = lisp_map_node_new(node->datamap | bit, node->nodemap & ~bit, node->count + 1, nchildren - 1);
+	if (res == NULL)
+		return NULL;
+	int idx = lisp_map_popcount(node->datamap & (bit - 1));
+	int cidx = lisp_map_popcount(node->nodemap & (bit - 1));
+	lisp_map_copy_entries(res->entries, node->entries, idx);
+	lisp_map_copy_entries(res->entries + 2 * idx, child->entries, 1);
+	lisp_map_copy_entries(res->entries + 2 * idx + 2, node->entries + 2 * idx, node->count - idx);
+	lisp_map_copy_children(res->children, node->children, cidx);
+	lisp_map_copy_children(res->children + cidx, node->children + cidx + 1, nchildren - cidx - 1);
+	return res;
+}
+
+// Returns a new node for the trie below node (which may be NULL) with key bound to val, setting *added
+// if key was not already present; NULL on error
+LispMapNode lisp_map_node_assoc(LispMapNode node, LispObject key, LispObject val, unsigned int hash, int shift, int* added)
+{
+	if (node == NULL) {
+		LispMapNode res = lisp_map_node_new(lisp_map_bit(hash, shift), 0, 1, 0);
+		if (res == NULL)
+			return NULL;
+		res->entries[0] = lisp_object_create_reference(key);
+		res->entries[1] = lisp_object_create_reference(val);
+		*added = 1;
+		return res;
+	}
+	if (shift >= LISP_MAP_MAX_SHIFT) {
+		for (int i = 0; i < node->count; ++i) {
+			if (lisp_object_equal(node->entries[2 * i], key))
+				return lisp_map_node_set_value(node, i, val);
+		}
+		*added = 1;
+		return lisp_map_node_insert(node, 0, node->count, key, val);
+	}
+
+	unsigned int bit = lisp_map_bit(hash, shift);
+	if (node->datamap & bit) {
+		int idx = lisp_map_popcount(node->datamap & (bit - 1));
+		LispObject other = node->entries[2 * idx];
+		if (lisp_object_equal(other, key))
+			return lisp_map_node_set_value(node, idx, val);
+		// Two keys share this position, so they move into a node of their own one level down
+		LispMapNode child = lisp_map_node_merge(other, node->entries[2 * idx + 1], lisp_object_hash(other),
+			key, val, hash, shift + LISP_MAP_BITS);
+		if (child == NULL)
+			return NULL;
+		*added = 1;
+		return lisp_map_node_push_down(node, bit, child);
+	}
+	if (node->nodemap & bit) {
+		int cidx = lisp_map_popcount(node->nodemap & (bit - 1));
+		LispMapNode child = lisp_map_node_assoc(node->children[cidx], key, val, hash, shift + LISP_MAP_BITS, added);
+		if (child == NULL)
+			return NULL;
+		return lisp_map_node_set_child(node, cidx, child);
+	}
+	*added = 1;
+	return lisp_map_node_insert(node, node->datamap | bit, lisp_map_popcount(node->datamap & (bit - 1)), key, val);
+}
+
+// Sets *res to a new reference to the trie below node without key, or NULL if that leaves it empty. A
+// child left with a single pair is replaced by the pair, keeping the trie as shallow as possible
+error_t lisp_map_node_dissoc(LispMapNode node, LispObject key, unsigned int hash, int shift, LispMapNode* res)
+{
+	if (shift >= LISP_MAP_MAX_SHIFT) {
+		for (int i = 0; i < node->count; ++i) {
+			if (lisp_object_equal(node->entries[2 * i], key)) {
+				*res = node->count == 1 ? NULL : lisp_map_node_remove(node, 0, i);
+				return node->count == 1 || *res != NULL ? E_SUCCESS : E_MEMORY_ERROR;
+			}
+		}
+		LISP_INCREF(node);
+		*res = node;
+		return E_SUCCESS;
+	}
+
+	unsigned int bit = lisp_map_bit(hash, shift);
+	if ((node->datamap & bit) && lisp_object_equal(node->entries[2 * lisp_map_popcount(node->datamap & (bit - 1))], key)) {
+		if (node->count == 1 && node->nodemap == 0) {
+			*res = NULL;
+			return E_SUCCESS;
+		}
+		*res = lisp_map_node_remove(node, node->datamap & ~bit, lisp_map_popcount(node->datamap & (bit - 1)));
+		return *res == NULL ? E_MEMORY_ERROR : E_SUCCESS;
+	}
+	if ((node->nodemap & bit) == 0) {
+		LISP_INCREF(node);
+		*res = node;
+		return E_SUCCESS;
+	}
+
+	int cidx = lisp_map_popcount(node->nodemap & (bit - 1));
+	LispMapNode child;
+	error_t err = lisp_map_node_dissoc(node->children[cidx], key, hash, shift + LISP_MAP_BITS, &child);
+	if (err != E_SUCCESS)
+		return err;
+	if (child == node->children[cidx]) {
+		lisp_map_node_free(child);
+		LISP_INCREF(node);
+		*res = node;
+		return E_SUCCESS;
+	}
+	// Children always hold at least two pairs, so the one removed cannot have left the child empty
+	if (child->count == 1 && child->nodemap == 0) {
+		if (node->count == 0 && lisp_map_popcount(node->nodemap) == 1 && shift > 0) {
+			// The pair moves further up still, through the parent
+			*res = child;
+			return E_SUCCESS;
+		}
+		*res = lisp_map_node_pull_up(node, bit, child);
+		lisp_map_node_free(child);
+		return *res == NULL ? E_MEMORY_ERROR : E_SUCCESS;
+	}
+	*res = lisp_map_node_set_child(node, cidx, child);
+	return *res == NULL ? E_MEMORY_ERROR : E_SUCCESS;
+}
+
+error_t lisp_map_node_visit(LispMapNode node, LispMapVisitor visit, void* ctx)
+{
+	for (int i = 0; i < node->count; ++i) {
+		error_t err = visit(ctx, node->entries[2 * i], node->entries[2 * i + 1]);
+		if (err != E_SUCCESS)
+			return err;
+	}
+	int nchildren = lisp_map_popcount(node->nodemap);
+	for (int i = 0; i < nchildren; ++i) {
+		error_t err = lisp_map_node_visit(node->children[i], visit, ctx);
+		if (err != E_SUCCESS)
+			return err;
+	}
+	return E_SUCCESS;
+}
+
+// malloc a new map object of size keys around root, taking ownership of it
+LispObject lisp_map_new_with(LispMapNode root, int size)
+{
+	LispObject map = lisp_object_new_(T_MAP);
+	if (map == NULL) {
+		if (root != NULL)
+			lisp_map_node_free(root);
+		return NULL;
+	}
+	LispMap data = malloc(sizeof(struct LispMap_));
+	if (data == NULL) {
+		if (root != NULL)
+			lisp_map_node_free(root);
+		free(map);
+		return NULL;
+	}
+	data->size = size;
+	data->root = root;
+	data->hashed = 0;
+	data->hash = 0;
+	map->data.m = data;
+	return map;
+}
+
+LispObject lisp_map_new()
+{
+	return lisp_map_new_with(NULL, 0);
+}
+
+void lisp_map_free(LispObject map)
+{
+	VALIDATE_OBJECT(map);
+	if (LISP_DECREF(map) > 0)
+		return;
+
+	if (map->data.m->root != NULL)
+		lisp_map_node_free(map->data.m->root);
+	free(map->data.m);
+	free(map);
+	++lisp_stats.freed[T_MAP];
+}
+
+int lisp_map_size(LispObject map)
+{
+	VALIDATE_OBJECT(map);
+	return map->data.m->size;
+}
+
+LispObject lisp_map_get(LispObject map, LispObject key)
+{
+	VALIDATE_OBJECT(map);
+	VALIDATE_OBJECT(key);
+	if (map->data.m->root == NULL)
+		return NULL;
+	return lisp_map_node_find(map->data.m->root, key, lisp_object_hash(key));
+}
+
+LispObject lisp_map_assoc(LispObject map, LispObject key, LispObject val)
+{
+	VALIDATE_OBJECT(map);
+	VALIDATE_OBJECT(key);
+	VALIDATE_OBJECT(val);
+	int added = 0;
+	LispMapNode root = lisp_map_node_assoc(map->data.m->root, key, val, lisp_object_hash(key), 0, &added);
+	if (root == NULL)
+		return NULL;
+	return lisp_map_new_with(root, map->data.m->size + added);
+}
+
+LispObject lisp_map_dissoc(LispObject map, LispObject key)
+{
+	VALIDATE_OBJECT(map);
+	VALIDATE_OBJECT(key);
+	LispMapNode old_root = map->data.m->root;
+	if (old_root == NULL)
+		return lisp_object_create_reference(map);
+	LispMapNode root;
+	if (lisp_map_node_dissoc(old_root, key, lisp_object_hash(key), 0, &root) != E_SUCCESS)
+		return NULL;
+	if (root == old_root) {
+		lisp_map_node_free(root);
+		return lisp_object_create_reference(map);
+	}
+	return lisp_map_new_with(root, map->data.m->size - 1);
+}
+
+error_t lisp_map_keys_visit(void* ctx, LispObject key, LispObject val)
+{
+	(void)val;
+	LispObject ref = lisp_object_create_reference(key);
+	error_t err = lisp_list_push((LispObject)ctx, ref);
+	if (err != E_SUCCESS)
+		lisp_object_free(ref);
+	return err;
+}
+
+LispObject lisp_map_keys(LispObject map)
+{
+	VALIDATE_OBJECT(map);
+	LispObject res = lisp_list_new();
+	if (res == NULL)
+		return NULL;
+	if (lisp_map_visit(map, lisp_map_keys_visit, res) != E_SUCCESS) {
+		lisp_list_free(res);
+		return NULL;
+	}
+	return res;
+}
+
+error_t lisp_map_visit(LispObject map, LispMapVisitor visit, void* ctx)
+{
+	VALIDATE_OBJECT(map);
+	if (map->data.m->root == NULL)
+		return E_SUCCESS;
+	return lisp_map_node_visit(map->data.m->root, visit, ctx);
+}
+
+// Fails the visit of the pairs of one map at the first which the other map, ctx, does not also hold
+error_t lisp_map_equal_visit(void* ctx, LispObject key, LispObject val)
+{
+	LispObject other = lisp_map_get((LispObject)ctx, key);
+	return other != NULL && lisp_object_equal(other, val) ? E_SUCCESS : E_INDEX_ERROR;
+}
+
+int lisp_map_equal(LispObject lhs, LispObject rhs)
+{
+	VALIDATE_OBJECT(lhs);
+	VALIDATE_OBJECT(rhs);
+	if (lhs == rhs)
+		return 1;
+	if (lisp_map_size(lhs) != lisp_map_size(rhs))
+		return 0;
+	if (lhs->data.m->hashed && rhs->data.m->hashed && lhs->data.m->hash != rhs->data.m->hash)
+		return 0;
+	return lisp_map_visit(lhs, lisp_map_equal_visit, rhs) == E_SUCCESS;
+}
+
+int lisp_map_lessthan(LispObject lhs, LispObject rhs)
+{
+	VALIDATE_OBJECT(lhs);
+	VALIDATE_OBJECT(rhs);
+	return lisp_map_size(lhs) < lisp_map_size(rhs);
+}
+
+error_t lisp_map_hash_visit(void* ctx, LispObject key, LispObject val)
+{
+	// Summing the hashes of the pairs makes the result independent of the order they are visited in
+	*(unsigned int*)ctx += lisp_hash_mix(lisp_object_hash(key) * 31u + lisp_object_hash(val));
+	return E_SUCCESS;
+}
+
+unsigned int lisp_map_hash(LispObject map)
+{
+	VALIDATE_OBJECT(map);
+	LispMap data = map->data.m;
+	if (!data->hashed) {
+		unsigned int hash = (unsigned int)data->size ^ (T_MAP << 16);
+		lisp_map_visit(map, lisp_map_hash_visit, &hash);
+		data->hash = hash;
+		data->hashed = 1;
+	}
+	return data->hash;
+}
+
+void lisp_map_print(LispObject map)
+{
+	lisp_print_with(lisp_map_write, map);
+}
+
+// Writes a space before every pair but the first, tracking that in the writer and flag passed as ctx
+struct LispMapWriteState_
+{
+	LispWriter writer;
+	int first;
+};
+
+error_t lisp_map_write_visit(void* ctx, LispObject key, LispObject val)
+{
+	struct LispMapWriteState_* state = ctx;
+	error_t err = state->first ? E_SUCCESS : lisp_writer_putc(state->writer, ' ');
+	state->first = 0;
+	if (err == E_SUCCESS)
+		err = lisp_object_write(state->writer, key);
+	if (err == E_SUCCESS)
+		err = lisp_writer_putc(state->writer, ' ');
+	if (err == E_SUCCESS)
+		err = lisp_object_write(state->writer, val);
+	return err;
+}
+
+error_t lisp_map_write(LispWriter writer, LispObject map)
+{
+	VALIDATE_OBJECT(map);
+	struct LispMapWriteState_ state = { writer, 1 };
+	error_t err = lisp_writer_putc(writer, '{');
+	if (err == E_SUCCESS)
+		err = lisp_map_visit(map, lisp_map_write_visit, &state);
+	if (err != E_SUCCESS)
+		return err;
+	return lisp_writer_putc(writer, '}');
+}
+
+#define LISP_BINARY_MAGIC "TLB\x01"
+#define LISP_BINARY_MAGIC_SIZE 4
+
+enum LispBinaryTag_
+{
+	BT_LIST,
+	BT_INTEGER,
+	BT_SYMBOL,
+	BT_BUILTIN,
+	BT_MAP
+};
+
+// Open-addressed table assigning each distinct symbol string an index in order of first appearance
+struct LispSymbolTable_
+{
+	int size, capacity;
+	LispObject* slots;
+	int* ids;
+	LispObject* symbols;
+};
+
+void lisp_symtab_free(struct LispSymbolTable_* table)
+{
+	free(table->slots);
+	free(table->ids);
+	free(table->symbols);
+}
+
+error_t lisp_symtab_grow(struct LispSymbolTable_* table)
+{
+	int new_capacity = table->capacity == 0 ? 64 : table->capacity * 2;
+	LispObject* slots = calloc(new_capacity, sizeof(LispObject));
+	int* ids = malloc(sizeof(int) * new_capacity);
+	LispObject* symbols = realloc(table->symbols, sizeof(LispObject) * new_capacity);
+	if (slots == NULL || ids == NULL || symbols == NULL) {
+		free(slots);
+		free(ids);
+		if (symbols != NULL)
+			table->symbols = symbols;
+		return E_MEMORY_ERROR;
+	}
+	table->symbols = symbols;
+	for (int i = 0; i < table->size; ++i) {
+		LispObject sym = symbols[i];
+		unsigned int pos = lisp_string_hash(sym->data.s->data, sym->data.s->size) & (new_capacity - 1);
+		while (slots[pos] != NULL)
+			pos = (pos + 1) & (new_capacity - 1);
+		slots[pos] = sym;
+		ids[pos] = i;
+	}
+	free(table->slots);
+	free(table->ids);
+	table->slots = slots;
+	table->ids = ids;
+	table->capacity = new_capacity;
+	return E_SUCCESS;
+}
+
+// Returns the index of symbol in the table, adding it if needed, or -1 if out of memory
+int lisp_symtab_intern(struct LispSymbolTable_* table, LispObject symbol)
+{
+	if (table->size * 2 >= table->capacity && lisp_symtab_grow(table) != E_SUCCESS)
+		return -1;
+	unsigned int mask = table->capacity - 1;
+	unsigned int pos = lisp_string_hash(symbol->data.s->data, symbol->data.s->size) & mask;
+	while (table->slots[pos] != NULL) {
+		if (lisp_symbol_equal(table->slots[pos], symbol))
+			return table->ids[pos];
+		pos = (pos + 1) & mask;
+	}
+	table->slots[pos] = symbol;
+	table->ids[pos] = table->size;
+	table->symbols[table->size] = symbol;
+	return table->size++;
+}
+
+error_t lisp_binary_collect_symbols(struct LispSymbolTable_* table, LispObject obj);
+
+error_t lisp_binary_collect_symbols_visit(void* ctx, LispObject key, LispObject val)
+{
+	error_t err = lisp_binary_collect_symbols(ctx, key);
+	if (err == E_SUCCESS)
+		err = lisp_binary_collect_symbols(ctx, val);
+	return err;
+}
+
+error_t lisp_binary_collect_symbols(struct LispSymbolTable_* table, LispObject obj)
+{
+	if (obj->type == T_MAP)
+		return lisp_map_visit(obj, lisp_binary_collect_symbols_visit, table);
+	if (obj->type == T_SYMBOL)
+		return lisp_symtab_intern(table, obj) < 0 ? E_MEMORY_ERROR : E_SUCCESS;
+	if (obj->type == T_LIST) {
+		int len = lisp_list_size(obj);
+		for (int i = 0; i < len; ++i) {
+			error_t err = lisp_binary_collect_symbols(table, lisp_list_at(obj, i));
+			if (err != E_SUCCESS)
+				return err;
+		}
+	}
+	return E_SUCCESS;
+}
+
+error_t lisp_binary_write_object(LispWriter writer, struct LispSymbolTable_* table, LispObject obj);
+
+// The writer and symbol table a map's pairs are written with
+struct LispBinaryMapState_
+{
+	LispWriter writer;
+	struct LispSymbolTable_* table;
+};
+
+error_t lisp_binary_write_map_visit(void* ctx, LispObject key, LispObject val)
+{
+	struct LispBinaryMapState_* state = ctx;
+	error_t err = lisp_binary_write_object(state->writer, state->table, key);
+	if (err == E_SUCCESS)
+		err = lisp_binary_write_object(state->writer, state->table, val);
+	return err;
+}
+
+error_t lisp_binary_write_object(LispWriter writer, struct LispSymbolTable_* table, LispObject obj)
+{
+	error_t err;
+	switch (obj->type) {
+	case T_LIST: {
+		int len = lisp_list_size(obj);
+		err = lisp_writer_putc(writer, BT_LIST);
+		if (err == E_SUCCESS)
+			err = lisp_writer_varint(writer, len);
+		for (int i = 0; i < len && err == E_SUCCESS; ++i)
+			err = lisp_binary_write_object(writer, table, lisp_list_at(obj, i));
+		return err;
+	}
+	case T_INTEGER: {
+		// Zigzag encode so that small negative numbers stay short
+		unsigned int val = (unsigned int)lisp_integer_get(obj);
+		err = lisp_writer_putc(writer, BT_INTEGER);
+		if (err == E_SUCCESS)
+			err = lisp_writer_varint(writer, (val << 1) ^ (0u - (val >> 31)));
+		return err;
+	}
+	case T_SYMBOL:
+		err = lisp_writer_putc(writer, BT_SYMBOL);
+		if (err == E_SUCCESS)
+			err = lisp_writer_varint(writer, lisp_symtab_intern(table, obj));
+		return err;
+	case T_BUILTIN: {
+		int id = lisp_builtin_id(lisp_builtin_get(obj));
+		if (id < 0)
+			return E_TYPE_ERROR;
+		err = lisp_writer_putc(writer, BT_BUILTIN);
+		if (err == E_SUCCESS)
+			err = lisp_writer_varint(writer, id);
+		return err;
+	}
+	case T_MAP: {
+		struct LispBinaryMapState_ state = { writer, table };
+		err = lisp_writer_putc(writer, BT_MAP);
+		if (err == E_SUCCESS)
+			err = lisp_writer_varint(writer, lisp_map_size(obj));
+		if (err == E_SUCCESS)
+			err = lisp_map_visit(obj, lisp_binary_write_map_visit, &state);
+		return err;
+	}
+	default:
+		return E_TYPE_ERROR;
+	}
+}
+
+error_t lisp_object_serialize(LispWriter writer, LispObject obj)
+{
+	VALIDATE_OBJECT(obj);
+	struct LispSymbolTable_ table = { 0, 0, NULL, NULL, NULL };
+	error_t err = lisp_binary_collect_symbols(&table, obj);
+	if (err == E_SUCCESS)
+		err = lisp_writer_write(writer, LISP_BINARY_MAGIC, LISP_BINARY_MAGIC_SIZE);
+	if (err == E_SUCCESS)
+		err = lisp_writer_varint(writer, table.size);
+	for (int i = 0; i < table.size && err == E_SUCCESS; ++i) {
+		LispSymbol sym = table.symbols[i]->data.s;
+		err = lisp_writer_varint(writer, sym->size);
+		if (err == E_SUCCESS)
+			err = lisp_writer_write(writer, sym->data, sym->size);
+	}
+	if (err == E_SUCCESS)
+		err = lisp_binary_write_object(writer, &table, obj);
+	lisp_symtab_free(&table);
+	return err;
+}
+
+struct LispBinaryReader_
+{
+	const unsigned char* data;
+	int len, pos;
+	int nsymbols;
+	LispObject* symbols;
+};
+
+error_t lisp_binary_read_varint(struct LispBinaryReader_* reader, unsigned int* res)
+{
+	unsigned int val = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (reader->pos == reader->len)
+			return E_FORMAT_ERROR;
+		unsigned char byte = reader->data[reader->pos++];
+		val |= (unsigned int)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			*res = val;
+			return E_SUCCESS;
+		}
+	}
+	return E_FORMAT_ERROR;
+}
+
+error_t lisp_binary_read_object(struct LispBinaryReader_* reader, LispObject* res)
+{
+	if (reader->pos == reader->len)
+		return E_FORMAT_ERROR;
+	unsigned char tag = reader->data[reader->pos++];
+	unsigned int val;
+	error_t err = lisp_binary_read_varint(reader, &val);
+	if (err != E_SUCCESS)
+		return err;
+
+	switch (tag) {
+	case BT_LIST: {
+		// Every element takes at least two bytes, which bounds the size of a corrupt header
+		if (val > (unsigned int)(reader->len - reader->pos) / 2)
+			return E_FORMAT_ERROR;
+		LispObject list = lisp_list_new();
+		if (list == NULL)
+			return E_MEMORY_ERROR;
+		if (val > 0) {
+			list->data.l->data = malloc(sizeof(LispObject) * val);
+			if (list->data.l->data == NULL) {
+				lisp_list_free(list);
+				return E_MEMORY_ERROR;
+			}
+			list->data.l->capacity = val;
+			lisp_stats.data_bytes += sizeof(LispObject) * val;
+		}
+		for (unsigned int i = 0; i < val; ++i) {
+			err = lisp_binary_read_object(reader, &list->data.l->data[i]);
+			if (err != E_SUCCESS) {
+				lisp_list_free(list);
+				return err;
+			}
+			++list->data.l->size;
+		}
+		*res = list;
+		return E_SUCCESS;
+	}
+	case BT_INTEGER:
+		*res = lisp_integer_new((int)((val >> 1) ^ (0u - (val & 1))));
+		return *res == NULL ? E_MEMORY_ERROR : E_SUCCESS;
+	case BT_SYMBOL:
+		if (val >= (unsigned int)reader->nsymbols)
+			return E_FORMAT_ERROR;
+		*res = lisp_object_create_reference(reader->symbols[val]);
+		return E_SUCCESS;
+	case BT_BUILTIN:
+		if (val >= B_SIZE)
+			return E_FORMAT_ERROR;
+		*res = lisp_builtin_new(builtindesc[val].func);
+		return *res == NULL ? E_MEMORY_ERROR : E_SUCCESS;
+	case BT_MAP: {
+		// Every pair takes at least four bytes
+		if (val > (unsigned int)(reader->len - reader->pos) / 4)
+			return E_FORMAT_ERROR;
+		LispObject map = lisp_map_new();
+		if (map == NULL)
+			return E_MEMORY_ERROR;
+		for (unsigned int i = 0; i < val; ++i) {
+			LispObject key, pair_val;
+			err = lisp_binary_read_object(reader, &key);
+			if (err != E_SUCCESS) {
+				lisp_map_free(map);
+				return err;
+			}
+			err = lisp_binary_read_object(reader, &pair_val);
+			if (err != E_SUCCESS) {
+				lisp_object_free(key);
+				lisp_map_free(map);
+				return err;
+			}
+			LispObject next = lisp_map_assoc(map, key, pair_val);
+			lisp_object_free(key);
+			lisp_object_free(pair_val);
+			lisp_map_free(map);
+			if (next == NULL)
+				return E_MEMORY_ERROR;
+			map = next;
+		}
+		*res = map;
+		return E_SUCCESS;
+	}
+	default:
+		return E_FORMAT_ERROR;
+	}
+}
+
+error_t lisp_object_deserialize(const unsigned char* data, int len, LispObject* res)
+{
+	if (len < LISP_BINARY_MAGIC_SIZE || memcmp(data, LISP_BINARY_MAGIC, LISP_BINARY_MAGIC_SIZE) != 0)
+		return E_FORMAT_ERROR;
+	struct LispBinaryReader_ reader = { data, len, LISP_BINARY_MAGIC_SIZE, 0, NULL };
+
+	unsigned int nsymbols;
+	error_t err = lisp_binary_read_varint(&reader, &nsymbols);
+	if (err != E_SUCCESS)
+		return err;
+	if (nsymbols > (unsigned int)(len - reader.pos))
+		return E_FORMAT_ERROR;
+
+	// Each distinct symbol is allocated once and shared by every reference to it
+	if (nsymbols > 0) {
+		reader.symbols = malloc(sizeof(LispObject) * nsymbols);
+		if (reader.symbols == NULL)
+			return E_MEMORY_ERROR;
+	}
+	for (; reader.nsymbols < (int)nsymbols; ++reader.nsymbols) {
+		unsigned int size;
+		err = lisp_binary_read_varint(&reader, &size);
+		if (err == E_SUCCESS && size > (unsigned int)(reader.len - reader.pos))
+			err = E_FORMAT_ERROR;
+		if (err != E_SUCCESS)
+			break;
+		LispObject sym = lisp_symbol_new_n((char*)reader.data + reader.pos, size);
+		if (sym == NULL) {
+			err = E_MEMORY_ERROR;
+			break;
+		}
+		reader.symbols[reader.nsymbols] = sym;
+		reader.pos += size;
+	}
+
+	if (err == E_SUCCESS)
+		err = lisp_binary_read_object(&reader, res);
+	for (int i = 0; i < reader.nsymbols; ++i)
+		lisp_symbol_free(reader.symbols[i]);
+	free(reader.symbols);
+	return err;
+}
+
+error_t lisp_object_dump_file(char* filename, LispObject obj)
+{
+	FILE* output = NULL;
+	if (fopen_s(&output, filename, "wb") != 0)
+		return E_IO_ERROR;
+	LispWriter writer = lisp_writer_new_file(output);
+	if (writer == NULL) {
+		fclose(output);
+		return E_MEMORY_ERROR;
+	}
+	error_t err = lisp_object_serialize(writer, obj);
+	if (err == E_SUCCESS)
+		err = lisp_writer_flush(writer);
+	lisp_writer_free(writer);
+	if (fclose(output) != 0 && err == E_SUCCESS)
+		err = E_IO_ERROR;
+	return err;
+}
+
+error_t lisp_object_load_file(char* filename, LispObject* res)
+{
+	error_t err;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return E_IO_ERROR;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || size.QuadPart > 0x7FFFFFFF) {
+		CloseHandle(file);
+		return size.QuadPart == 0 ? E_FORMAT_ERROR : E_IO_ERROR;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	const unsigned char* data = mapping == NULL ? NULL : MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL) {
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return E_IO_ERROR;
+	}
+	err = lisp_object_deserialize(data, (int)size.QuadPart, res);
+	UnmapViewOfFile(data);
+	CloseHandle(mapping);
+	CloseHandle(file);
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return E_IO_ERROR;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size > 0x7FFFFFFF) {
+		close(fd);
+		return E_IO_ERROR;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return E_FORMAT_ERROR;
+	}
+	const unsigned char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return E_IO_ERROR;
+	err = lisp_object_deserialize(data, (int)st.st_size, res);
+	munmap((void*)data, st.st_size);
+#endif
+	return err;
+}
+
+LispSeqGen lisp_seq_gen_new(int kind)
+{
+	LispSeqGen gen = malloc(sizeof(struct LispSeqGen_));
+	if (gen == NULL)
+		return NULL;
+	gen->refcount = 1;
+	gen->kind = kind;
+	gen->call = gen->source = gen->value = NULL;
+	gen->next = gen->end = gen->step = 0;
+	return gen;
+}
+
+LispSeqGen lisp_seq_gen_reference(LispSeqGen gen)
+{
+	if (gen != NULL)
+		LISP_INCREF(gen);
+	return gen;
+}
+
+void lisp_seq_gen_free(LispSeqGen gen)
+{
+	if (LISP_DECREF(gen) > 0)
+		return;
+	if (gen->call != NULL)
+		lisp_object_free(gen->call);
+	if (gen->source != NULL)
+		lisp_object_free(gen->source);
+	if (gen->value != NULL)
+		lisp_object_free(gen->value);
+	free(gen);
+}
+
+LispObject lisp_seq_new(LispObject chunk, int offset, LispSeqGen rest)
+{
+	VALIDATE_OBJECT(chunk);
+	LispObject seq = lisp_object_new_(T_SEQ);
+	LispSeq data = seq != NULL ? malloc(sizeof(struct LispSeq_)) : NULL;
+	if (data == NULL) {
+		free(seq);
+		lisp_object_free(chunk);
+		if (rest != NULL)
+			lisp_seq_gen_free(rest);
+		return NULL;
+	}
+	data->chunk = chunk;
+	data->offset = offset;
+	data->rest = rest;
+	seq->data.q = data;
+	return seq;
+}
+
+void lisp_seq_free(LispObject seq)
+{
+	VALIDATE_OBJECT(seq);
+	if (LISP_DECREF(seq) > 0)
+		return;
+
+	lisp_object_free(seq->data.q->chunk);
+	if (seq->data.q->rest != NULL)
+		lisp_seq_gen_free(seq->data.q->rest);
+	free(seq->data.q);
+	free(seq);
+	++lisp_stats.freed[T_SEQ];
+}
+
+LispObject lisp_seq_head(LispObject seq)
+{
+	VALIDATE_OBJECT(seq);
+	return lisp_list_at(seq->data.q->chunk, seq->data.q->offset);
+}
+
+int lisp_seq_window(LispObject seq)
+{
+	VALIDATE_OBJECT(seq);
+	return lisp_list_size(seq->data.q->chunk) - seq->data.q->offset;
+}
+
+int lisp_seq_equal(LispObject lhs, LispObject rhs)
+{
+	VALIDATE_OBJECT(lhs);
+	VALIDATE_OBJECT(rhs);
+	LispSeq l = lhs->data.q;
+	LispSeq r = rhs->data.q;
+	return l->chunk == r->chunk && l->offset == r->offset && l->rest == r->rest;
+}
+
+unsigned int lisp_seq_hash(LispObject seq)
+{
+	VALIDATE_OBJECT(seq);
+	return lisp_hash_mix((unsigned int)(size_t)seq->data.q->chunk ^ (unsigned int)seq->data.q->offset ^ (T_SEQ << 16));
+}
+
+void lisp_seq_print(LispObject seq)
+{
+	lisp_print_with(lisp_seq_write, seq);
+}
+
+error_t lisp_seq_write(LispWriter writer, LispObject seq)
+{
+	VALIDATE_OBJECT(seq);
+	LispSeq data = seq->data.q;
+	error_t err = lisp_writer_putc(writer, '(');
+	for (int i = data->offset; i < lisp_list_size(data->chunk) && err == E_SUCCESS; ++i) {
+		if (i > data->offset)
+			err = lisp_writer_putc(writer, ' ');
+		if (err == E_SUCCESS)
+			err = lisp_object_write(writer, lisp_list_at(data->chunk, i));
+	}
+	if (err == E_SUCCESS && data->rest != NULL)
+		err = lisp_writer_puts(writer, " ...");
+	if (err == E_SUCCESS)
+		err = lisp_writer_putc(writer, ')');
+	return err;
+}
+
+void lisp_map_node_freeze(LispMapNode node, int frozen)
+{
+	if (((node->refcount & LISP_REFCOUNT_FROZEN) != 0) == frozen)
+		return;
+	node->refcount ^= LISP_REFCOUNT_FROZEN;
+	for (int i = 0; i < node->count * 2; ++i)
+		lisp_object_freeze(node->entries[i], frozen);
+	int nchildren = lisp_map_popcount(node->nodemap);
+	for (int i = 0; i < nchildren; ++i)
+		lisp_map_node_freeze(node->children[i], frozen);
+}
+
+void lisp_seq_gen_freeze(LispSeqGen gen, int frozen)
+{
+	if (((gen->refcount & LISP_REFCOUNT_FROZEN) != 0) == frozen)
+		return;
+	gen->refcount ^= LISP_REFCOUNT_FROZEN;
+	if (gen->call != NULL)
+		lisp_object_freeze(gen->call, frozen);
+	if (gen->source != NULL)
+		lisp_object_freeze(gen->source, frozen);
+	if (gen->value != NULL)
+		lisp_object_freeze(gen->value, frozen);
+}
+
+void lisp_object_freeze(LispObject obj, int frozen)
+{
+	VALIDATE_OBJECT(obj);
+	// Everything a frozen object refers to is frozen already, and everything a thawed one refers to thawed
+	if (((obj->refcount & LISP_REFCOUNT_FROZEN) != 0) == frozen)
+		return;
+	obj->refcount ^= LISP_REFCOUNT_FROZEN;
+	if (obj->type == T_LIST && obj->data.l->owner != NULL) {
+		lisp_object_freeze(obj->data.l->owner, frozen);
+	}
+	else if (obj->type == T_LIST) {
+		for (int i = 0; i < lisp_list_size(obj); ++i)
+			lisp_object_freeze(lisp_list_at(obj, i), frozen);
+	}
+	else if (obj->type == T_MAP && obj->data.m->root != NULL) {
+		lisp_map_node_freeze(obj->data.m->root, frozen);
+	}
+	else if (obj->type == T_SEQ) {
+		lisp_object_freeze(obj->data.q->chunk, frozen);
+		if (obj->data.q->rest != NULL)
+			lisp_seq_gen_freeze(obj->data.q->rest, frozen);
+	}
+}
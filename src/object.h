@@ -2,12 +2,19 @@
 #define LISP_OBJECT_H
 
 #include "error.h"
+#include "writer.h"
 
 
 typedef struct TinyLisp_ *TinyLisp;
 typedef enum LispObjectType_ LispObjectType;
 typedef struct LispList_ *LispList;
+typedef struct LispLambda_ *LispLambda;
+typedef struct LispCallSite_ *LispCallSite;
 typedef struct LispSymbol_ *LispSymbol;
+typedef struct LispMap_ *LispMap;
+typedef struct LispMapNode_ *LispMapNode;
+typedef struct LispSeq_ *LispSeq;
+typedef struct LispSeqGen_ *LispSeqGen;
 typedef struct LispObject_ *LispObject;
 typedef struct LispStack_ *LispStack;
 typedef int LispInteger;
@@ -19,6 +26,8 @@ enum LispObjectType_
 	T_INTEGER,
 	T_SYMBOL,
 	T_BUILTIN,
+	T_MAP,
+	T_SEQ,
 	T_SIZE
 };
 
@@ -30,10 +39,61 @@ struct type_desc_
 
 extern struct type_desc_ typedesc[T_SIZE];
 
+// Information gathered about a list when it is bound to a name or called as a function
+struct LispLambda_
+{
+	char* name;
+	int profile_id;
+	// body with global references resolved, built on the first call; NULL until then
+	LispObject body;
+	// the fields below are filled in by lisp_list_decode_lambda the first time the list is called
+	int decoded;
+	int is_macro;
+	// set for macros whose result is evaluated in the caller's frame, and for those of them whose
+	// result may differ between calls from the same site
+	int expands, impure;
+	// number of parameters, or -1 if a single symbol is bound to the list of all the arguments
+	int arity;
+	// borrowed references to the parameter list and the body as written
+	LispObject params, source;
+	// parameter names in sorted order, shared by the stack frames of every call
+	char** keys;
+	// slots[i] is the position in keys of the i-th parameter
+	int* slots;
+	// native code compiled by the JIT and its size, NULL until then
+	void* jit_code;
+	int jit_size;
+	// calls seen with only integer arguments before compiling, or -1 if compiling failed
+	int jit_calls;
+};
+
+// Information a list remembers about the function it last called when evaluated as a call
+struct LispCallSite_
+{
+	// reference to the callee if it is a builtin or was found by looking the head symbol up in the global
+	// frame, which global says, otherwise NULL
+	LispObject callee;
+	int global;
+	// position of the callee in builtindesc if it is a builtin, otherwise -1
+	int builtin_id;
+	// the arguments as written, shared by every call of a builtin from this site; NULL until then
+	LispObject args;
+	// what the callee, a pure expanding macro, expanded to at this site; NULL until then
+	LispObject expansion;
+	// for calls of s, l and e: the slot of the local frame each symbol operand was last found in, or -1
+	int operand_slots[2];
+	// the number of calls of s, l and e from this site whose operands were not both integers
+	int int_misses;
+};
+
 struct LispList_
 {
 	int size, capacity;
 	LispObject* data;
+	LispLambda lambda;
+	LispCallSite site;
+	// the list whose storage data points into, if this list is a slice of it, otherwise NULL
+	LispObject owner;
 };
 
 struct LispSymbol_
@@ -42,6 +102,73 @@ struct LispSymbol_
 	char* data;
 };
 
+// Number of bits of a key's hash which pick its position at each level of a map node trie
+#define LISP_MAP_BITS 5
+
+// A node of the hash array mapped trie behind a map. Nodes are never modified once built, so maps which
+// differ by a few keys share all but the nodes on the paths to them.
+struct LispMapNode_
+{
+	int refcount;
+	// bit i of datamap is set if position i holds a key/value pair, of nodemap if it holds a child node;
+	// both are 0 in the nodes past the last level, which hold keys whose hashes are all equal
+	unsigned int datamap, nodemap;
+	// number of key/value pairs, stored in entries as key, value, key, value... in order of position
+	int count;
+	LispObject* entries;
+	// child nodes in order of position
+	LispMapNode* children;
+};
+
+struct LispMap_
+{
+	int size;
+	// root of the trie, NULL for the empty map
+	LispMapNode root;
+	// the hash of the whole map, computed the first time it is needed
+	int hashed;
+	unsigned int hash;
+};
+
+// Number of elements of a lazy sequence realized at a time
+#define LISP_SEQ_CHUNK 64
+
+enum LispSeqKind_
+{
+	SEQ_RANGE,
+	SEQ_ITERATE,
+	SEQ_MAP,
+	SEQ_FILTER,
+	SEQ_TAKE
+};
+
+// How to produce the elements of a lazy sequence which have not been realized yet. Generators are never
+// modified once built; realizing one produces the next chunk of elements and a new generator for the rest.
+struct LispSeqGen_
+{
+	int refcount;
+	int kind;
+	// iterate, map and filter: a call of their function made by lisp_evaluate_new_call
+	LispObject call;
+	// map, filter and take: the list or sequence the elements are drawn from
+	LispObject source;
+	// range: the next value, the end and the step; take: the number of elements left in next; iterate:
+	// 1 in next if value is the next element, 0 if the next element is the function applied to it, and
+	// the number of elements to realize in step, which doubles from 1 so that a few can be taken cheaply
+	LispInteger next, end, step;
+	LispObject value;
+};
+
+// A lazy sequence, which is never empty: a window of realized elements and a generator for the rest
+struct LispSeq_
+{
+	// list holding the realized elements from offset on, shared by the sequences stepping through it
+	LispObject chunk;
+	int offset;
+	// the elements after those in chunk, or NULL if there are none
+	LispSeqGen rest;
+};
+
 struct LispObject_
 {
 	union {
@@ -49,25 +176,57 @@ struct LispObject_
 		LispSymbol s;
 		LispInteger i;
 		LispBuiltin b;
+		LispMap m;
+		LispSeq q;
 	} data;
 	LispObjectType type;
 	int refcount;
 };
 
+// Objects, map nodes and sequence generators with this bit set in their refcount are frozen: their refcount
+// is left alone by LISP_INCREF and LISP_DECREF, so that the pages holding them stay shared with processes
+// forked after they were frozen, and they are never freed until thawed again
+#define LISP_REFCOUNT_FROZEN (1 << 30)
+#define LISP_INCREF(x) do { if (((x)->refcount & LISP_REFCOUNT_FROZEN) == 0) ++(x)->refcount; } while (0)
+// Decrease the refcount of x unless it is frozen, giving the references left
+#define LISP_DECREF(x) (((x)->refcount & LISP_REFCOUNT_FROZEN) != 0 ? LISP_REFCOUNT_FROZEN : --(x)->refcount)
+
 // malloc a new LispObject_ struct and initialise type and refcount. returns NULL on error.
 LispObject lisp_object_new_(LispObjectType type);
 // Increase refount of obj and return; never returns NULL
 LispObject lisp_object_create_reference(LispObject obj);
 // delegate to lisp_*_free based on type
 void lisp_object_free(LispObject obj);
+// Freeze obj and everything it refers to if frozen is 1, or thaw them if 0. Caches should be cleared first,
+// since those made while frozen would never be freed
+void lisp_object_freeze(LispObject obj, int frozen);
 // delegate to lisp_*_equal based on type, return 0 for different types
 int lisp_object_equal(LispObject lhs, LispObject rhs);
 // delegate to lisp_*_lessthan based on type, return 0 for different types
 int lisp_object_lessthan(LispObject lhs, LispObject rhs);
+// hash of the structure of obj; objects for which lisp_object_equal holds have equal hashes
+unsigned int lisp_object_hash(LispObject obj);
+// spread the bits of val over the whole word
+unsigned int lisp_hash_mix(unsigned int val);
+// release the optimized bodies and call sites cached on obj and the lists within it, breaking any reference
+// cycles through them
+void lisp_object_clear_caches(LispObject obj);
 // return 1 if object is an empty list of 0, else returns 0
 int lisp_object_is_nil(LispObject obj);
 // delegate to lisp_*_print based on type
 void lisp_object_print(LispObject obj);
+// delegate to lisp_*_write based on type
+error_t lisp_object_write(LispWriter writer, LispObject obj);
+
+// append obj to writer in the compact binary format: a magic number, a table of the distinct
+// symbols in obj, then obj itself encoded with varint integers and length-prefixed lists
+error_t lisp_object_serialize(LispWriter writer, LispObject obj);
+// decode an object from len bytes of data produced by lisp_object_serialize into res
+error_t lisp_object_deserialize(const unsigned char* data, int len, LispObject* res);
+// serialize obj into the file at filename
+error_t lisp_object_dump_file(char* filename, LispObject obj);
+// map the file at filename into memory and deserialize it into res
+error_t lisp_object_load_file(char* filename, LispObject* res);
 
 // malloc a new empty list
 LispObject lisp_list_new();
@@ -77,6 +236,9 @@ LispObject lisp_list_new_from_args(int nvals, ...);
 LispObject lisp_list_copy(LispObject list);
 // malloc a new list with new referencs to the objects in the sublist (start, end)
 LispObject lisp_list_copy_n(LispObject list, int start, int end);
+// malloc a new list of the elements of list from start up to end, sharing its storage instead of copying
+// it. The elements must not change afterwards, so list must not be pushed to again
+LispObject lisp_list_slice(LispObject list, int start, int end);
 // decrease refcount of list; if recount is then 0 then call lisp_object_free on all items and free memory for list
 void lisp_list_free(LispObject list);
 // compare element-wise for equality
@@ -89,16 +251,40 @@ int lisp_list_size(LispObject list);
 int lisp_list_capacity(LispObject list);
 // borrowed reference to the element at position n
 LispObject lisp_list_at(LispObject list, int n);
-// push an element to the end of the list modifying it; expands as needed
+// push an element to the end of the list modifying it; expands as needed, first copying the elements of
+// a slice into storage of its own
 error_t lisp_list_push(LispObject list, LispObject val);
+// make room for capacity elements in list without changing its size, so that pushing up to that many
+// does not reallocate
+error_t lisp_list_reserve(LispObject list, int capacity);
 // return a new list consisting of new references to the elements in list and other
 LispObject lisp_list_concat(LispObject list, LispObject other);
 // return a new reference to the element at the front of the list
 LispObject lisp_list_head(LispObject list);
 // return a new list containing new references to the elements in the sublist (1, ...)
 LispObject lisp_list_tail(LispObject list);
+// Returns 1 if lhs sorts before rhs, 0 if it does not, or -1 to abandon the sort
+typedef int(*LispCompare)(void* ctx, LispObject lhs, LispObject rhs);
+// set *res to a new list of the elements of list in order, keeping elements which are equal in their original
+// order. With less NULL they are ordered by lisp_object_lessthan, integers by value through a radix sort if
+// there are nothing but integers; otherwise by less, called with ctx. E_EVALUATION_ERROR if less abandons it
+error_t lisp_list_sort(LispObject list, LispCompare less, void* ctx, LispObject* res);
+// return the lambda information of list, creating it if needed; NULL on error
+LispLambda lisp_list_lambda(LispObject list);
+// decode the macro flag, parameters and body of list the first time it is called and return its lambda
+// information; E_TYPE_ERROR if it is not a function, E_NAME_ALREADY_SET if a parameter is repeated.
+// A macro's first element is a list of the options 'expand' and 'impure' (an empty list for neither)
+error_t lisp_list_decode_lambda(LispObject list, LispLambda* res);
+// return the call site information of list, creating it if needed; NULL on error
+LispCallSite lisp_list_callsite(LispObject list);
+// record name as the name of list if it does not already have one
+error_t lisp_list_set_name(LispObject list, char* name);
+// return the name list was first bound to, or NULL
+char* lisp_list_get_name(LispObject list);
 // print the list
 void lisp_list_print(LispObject list);
+// write the list to writer
+error_t lisp_list_write(LispWriter writer, LispObject list);
 
 // malloc a new symbol with value val
 LispObject lisp_symbol_new(char* val);
@@ -114,6 +300,8 @@ int lisp_symbol_lessthan(LispObject lhs, LispObject rhs);
 char* lisp_symbol_get(LispObject symbol);
 // print the symbol
 void lisp_symbol_print(LispObject symbol);
+// write the symbol to writer
+error_t lisp_symbol_write(LispWriter writer, LispObject symbol);
 
 // malloc a new integer with value val
 LispObject lisp_integer_new(int val);
@@ -127,6 +315,8 @@ int lisp_integer_lessthan(LispObject lhs, LispObject rhs);
 int lisp_integer_get(LispObject integer);
 // print the integer
 void lisp_integer_print(LispObject integer);
+// write the integer to writer
+error_t lisp_integer_write(LispWriter writer, LispObject integer);
 
 // malloc a new lispobject containing the builtin val
 LispObject lisp_builtin_new(LispBuiltin val);
@@ -140,5 +330,63 @@ LispBuiltin lisp_builtin_get(LispObject builtin);
 void lisp_builtin_free(LispObject builtin);
 // print the builtins address
 void lisp_builtin_print(LispObject builtin);
+// write the builtins address to writer
+error_t lisp_builtin_write(LispWriter writer, LispObject builtin);
+
+// Called with each key and value of a map, both borrowed; a result other than E_SUCCESS stops the visit
+typedef error_t(*LispMapVisitor)(void* ctx, LispObject key, LispObject val);
+
+// malloc a new empty map
+LispObject lisp_map_new();
+// decref map; if refcount is then 0 release its trie and free it
+void lisp_map_free(LispObject map);
+// number of keys in map
+int lisp_map_size(LispObject map);
+// borrowed reference to the value of key in map, or NULL if it has none
+LispObject lisp_map_get(LispObject map, LispObject key);
+// return a new map with the keys of map and key bound to val, sharing the unchanged parts of map; key
+// and val are borrowed. NULL on error
+LispObject lisp_map_assoc(LispObject map, LispObject key, LispObject val);
+// return a new map with the keys of map other than key, sharing the unchanged parts of map. NULL on error
+LispObject lisp_map_dissoc(LispObject map, LispObject key);
+// return a new list of the keys of map in the order they are stored
+LispObject lisp_map_keys(LispObject map);
+// call visit with each key and value of map, returning the first result other than E_SUCCESS
+error_t lisp_map_visit(LispObject map, LispMapVisitor visit, void* ctx);
+// compare as sets of key/value pairs
+int lisp_map_equal(LispObject lhs, LispObject rhs);
+// return 1 if lhs has fewer keys than rhs
+int lisp_map_lessthan(LispObject lhs, LispObject rhs);
+// hash of the key/value pairs of map, independent of the order they were added in
+unsigned int lisp_map_hash(LispObject map);
+// print the map
+void lisp_map_print(LispObject map);
+// write the map to writer as {key value key value ...}
+error_t lisp_map_write(LispWriter writer, LispObject map);
+
+// malloc a new generator of kind with no fields set; NULL on error
+LispSeqGen lisp_seq_gen_new(int kind);
+// return gen with its refcount increased
+LispSeqGen lisp_seq_gen_reference(LispSeqGen gen);
+// decref gen; if refcount is then 0 release what it refers to and free it
+void lisp_seq_gen_free(LispSeqGen gen);
+// malloc a new sequence of the elements of chunk from offset, which must not be past its end, followed by
+// those rest generates; takes ownership of chunk and rest (which may be NULL). NULL on error
+LispObject lisp_seq_new(LispObject chunk, int offset, LispSeqGen rest);
+// decref seq; if refcount is then 0 release its chunk and generator and free it
+void lisp_seq_free(LispObject seq);
+// borrowed reference to the first element of seq
+LispObject lisp_seq_head(LispObject seq);
+// number of realized elements of seq, at least 1
+int lisp_seq_window(LispObject seq);
+// sequences are only compared by identity, as comparing the rest would mean realizing it: equal if they are
+// at the same position of the same chunk with the same generator
+int lisp_seq_equal(LispObject lhs, LispObject rhs);
+// hash of the position of seq, consistent with lisp_seq_equal
+unsigned int lisp_seq_hash(LispObject seq);
+// print the sequence
+void lisp_seq_print(LispObject seq);
+// write the realized elements of seq to writer as a list, ending in ... if there are more to come
+error_t lisp_seq_write(LispWriter writer, LispObject seq);
 
 #endif
\ No newline at end of file
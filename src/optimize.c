@@ -0,0 +1,255 @@
+#include "optimize.h"
+#include "builtins.h"
+#include "eval.h"
+
+// Globals can never be rebound, so within a lambda body a name which is not one of the parameters and
+// which is already bound globally will always evaluate to the same object.
+
+// Returns 1 if the symbol sym is bound by the parameter list (or single parameter symbol) params
+int lisp_optimize_is_param(LispObject params, LispObject sym)
+{
+	if (params->type == T_SYMBOL)
+		return lisp_symbol_equal(params, sym);
+	if (params->type != T_LIST)
+		return 0;
+	for (int i = 0; i < lisp_list_size(params); ++i) {
+		LispObject param = lisp_list_at(params, i);
+		if (param->type == T_SYMBOL && lisp_symbol_equal(param, sym))
+			return 1;
+	}
+	return 0;
+}
+
+// Returns a borrowed reference to the global value sym will always evaluate to, or NULL if it is not known
+LispObject lisp_optimize_resolve(TinyLisp lisp, LispObject sym, LispObject params)
+{
+	if (lisp_optimize_is_param(params, sym))
+		return NULL;
+	return lisp_stackframe_find(lisp->stack->frames[0], lisp_symbol_get(sym));
+}
+
+// Returns 1 if calling callee evaluates each of its arguments as an expression in the caller's frame
+int lisp_optimize_is_eager(LispObject callee)
+{
+	if (callee->type == T_BUILTIN) {
+		int id = lisp_builtin_id(lisp_builtin_get(callee));
+		return id >= 0 && builtindesc[id].eager;
+	}
+	LispLambda lambda;
+	if (callee->type == T_LIST && lisp_list_decode_lambda(callee, &lambda) == E_SUCCESS)
+		return !lambda->is_macro;
+	return 0;
+}
+
+// Returns a new reference to an expression which evaluates to val
+LispObject lisp_optimize_constant(LispObject val)
+{
+	if (val->type == T_INTEGER || val->type == T_BUILTIN)
+		return lisp_object_create_reference(val);
+	LispObject quote_builtin = lisp_builtin_new(quote);
+	if (quote_builtin == NULL)
+		return NULL;
+	LispObject ref = lisp_object_create_reference(val);
+	LispObject res = lisp_list_new_from_args(2, quote_builtin, ref);
+	if (res == NULL) {
+		lisp_object_free(quote_builtin);
+		lisp_object_free(ref);
+	}
+	return res;
+}
+
+// Returns a borrowed reference to the value of expr if it is a constant left by lisp_optimize_constant
+// (or a literal integer or builtin), otherwise NULL
+LispObject lisp_optimize_constant_value(LispObject expr)
+{
+	if (expr->type == T_INTEGER || expr->type == T_BUILTIN)
+		return expr;
+	if (expr->type == T_LIST && lisp_list_size(expr) == 2) {
+		LispObject head = lisp_list_at(expr, 0);
+		if (head->type == T_BUILTIN && lisp_builtin_get(head) == quote)
+			return lisp_list_at(expr, 1);
+	}
+	return NULL;
+}
+
+// Takes ownership of the optimized call form of a builtin and returns it, or a new reference to an
+// equivalent expression if the call is of a pure builtin on constants or a ternary with a constant condition
+LispObject lisp_optimize_fold(TinyLisp lisp, LispObject form)
+{
+	int id = lisp_builtin_id(lisp_builtin_get(lisp_list_at(form, 0)));
+	int len = lisp_list_size(form);
+	if (id == B_TERNARY && len == 4) {
+		LispObject pred = lisp_optimize_constant_value(lisp_list_at(form, 1));
+		if (pred == NULL)
+			return form;
+		LispObject res = lisp_object_create_reference(lisp_list_at(form, lisp_object_is_nil(pred) ? 3 : 2));
+		lisp_object_free(form);
+		return res;
+	}
+	if (id < 0 || id == B_QUOTE || !builtindesc[id].pure)
+		return form;
+	for (int i = 1; i < len; ++i) {
+		if (lisp_optimize_constant_value(lisp_list_at(form, i)) == NULL)
+			return form;
+	}
+
+	// Calls which fail are left for the error to be raised if and when they are reached
+	LispObject val = lisp_evaluate(lisp, form);
+	if (val == NULL) {
+		lisp_clear_error(lisp);
+		return form;
+	}
+	LispObject res = lisp_optimize_constant(val);
+	lisp_object_free(val);
+	if (res == NULL)
+		return form;
+	lisp_object_free(form);
+	return res;
+}
+
+// Returns a new list of the parameters params followed by the names bound by the loop bindings
+LispObject lisp_optimize_loop_params(LispObject params, LispObject bindings)
+{
+	LispObject res = params->type == T_LIST ? lisp_list_copy(params) : lisp_list_new();
+	if (res == NULL)
+		return NULL;
+	if (params->type == T_SYMBOL && lisp_list_push(res, lisp_object_create_reference(params)) != E_SUCCESS) {
+		lisp_object_free(res);
+		return NULL;
+	}
+	for (int i = 0; i < lisp_list_size(bindings); ++i) {
+		if (lisp_list_push(res, lisp_object_create_reference(lisp_list_at(lisp_list_at(bindings, i), 0))) != E_SUCCESS) {
+			lisp_object_free(res);
+			return NULL;
+		}
+	}
+	return res;
+}
+
+// Optimize each form in forms from start onwards and push it to res; returns 0 on error
+int lisp_optimize_push_forms(TinyLisp lisp, LispObject res, LispObject forms, int start, LispObject params)
+{
+	for (int i = start; i < lisp_list_size(forms); ++i) {
+		LispObject val = lisp_optimize_form(lisp, lisp_list_at(forms, i), params);
+		if (val == NULL)
+			return 0;
+		if (lisp_list_push(res, val) != E_SUCCESS) {
+			lisp_object_free(val);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Returns a new reference to the loop form with its initial values optimized in the enclosing scope, and its
+// steps, condition and result with the loop variables bound as well
+LispObject lisp_optimize_loop(TinyLisp lisp, LispObject loop_builtin, LispObject form, LispObject params)
+{
+	LispObject bindings = lisp_list_at(form, 1);
+	LispObject inner = lisp_optimize_loop_params(params, bindings);
+	if (inner == NULL)
+		return NULL;
+	LispObject res = lisp_list_new_from_args(1, lisp_object_create_reference(loop_builtin));
+	LispObject new_bindings = lisp_list_new();
+	int ok = res != NULL && new_bindings != NULL;
+	for (int i = 0; ok && i < lisp_list_size(bindings); ++i) {
+		LispObject binding = lisp_list_at(bindings, i);
+		LispObject new_binding = lisp_list_new_from_args(1, lisp_object_create_reference(lisp_list_at(binding, 0)));
+		ok = new_binding != NULL && lisp_list_push(new_bindings, new_binding) == E_SUCCESS;
+		if (!ok) {
+			if (new_binding != NULL)
+				lisp_object_free(new_binding);
+			break;
+		}
+		LispObject init = lisp_optimize_form(lisp, lisp_list_at(binding, 1), params);
+		ok = init != NULL && lisp_list_push(new_binding, init) == E_SUCCESS;
+		if (!ok) {
+			if (init != NULL)
+				lisp_object_free(init);
+			break;
+		}
+		ok = lisp_optimize_push_forms(lisp, new_binding, binding, 2, inner);
+	}
+	if (ok) {
+		ok = lisp_list_push(res, new_bindings) == E_SUCCESS;
+		if (ok)
+			new_bindings = NULL;
+	}
+	ok = ok && lisp_optimize_push_forms(lisp, res, form, 2, inner);
+	if (new_bindings != NULL)
+		lisp_object_free(new_bindings);
+	lisp_object_free(inner);
+	if (!ok && res != NULL) {
+		lisp_object_free(res);
+		res = NULL;
+	}
+	return res;
+}
+
+LispObject lisp_optimize_form(TinyLisp lisp, LispObject form, LispObject params)
+{
+	if (form->type == T_SYMBOL) {
+		LispObject val = lisp_optimize_resolve(lisp, form, params);
+		if (val == NULL)
+			return lisp_object_create_reference(form);
+		return lisp_optimize_constant(val);
+	}
+	if (form->type != T_LIST || lisp_list_size(form) == 0)
+		return lisp_object_create_reference(form);
+
+	// The arguments are only expressions if the callee is known to evaluate them; those of macros, quote
+	// and anything which cannot be resolved now are left untouched
+	LispObject head = lisp_list_at(form, 0);
+	LispObject callee = NULL;
+	if (head->type == T_BUILTIN)
+		callee = head;
+	else if (head->type == T_SYMBOL)
+		callee = lisp_optimize_resolve(lisp, head, params);
+	int optimize_args = callee != NULL && lisp_optimize_is_eager(callee);
+	// The variables of a loop are locals within it, so its forms are optimized with them as parameters
+	if (callee != NULL && callee->type == T_BUILTIN && lisp_builtin_get(callee) == loop &&
+			lisp_list_size(form) == 4 && lisp_loop_bindings_valid(lisp_list_at(form, 1)))
+		return lisp_optimize_loop(lisp, callee, form, params);
+
+	LispObject res = lisp_list_new();
+	if (res == NULL)
+		return NULL;
+	int len = lisp_list_size(form);
+	for (int i = 0; i < len; ++i) {
+		LispObject arg = lisp_list_at(form, i);
+		LispObject val = (i == 0 || optimize_args) ? lisp_optimize_form(lisp, arg, params) : lisp_object_create_reference(arg);
+		if (val == NULL) {
+			lisp_object_free(res);
+			return NULL;
+		}
+		if (lisp_list_push(res, val) != E_SUCCESS) {
+			lisp_object_free(val);
+			lisp_object_free(res);
+			return NULL;
+		}
+	}
+	if (callee != NULL && callee->type == T_BUILTIN)
+		return lisp_optimize_fold(lisp, res);
+	return res;
+}
+
+void lisp_optimize_lambda(TinyLisp lisp, LispObject func)
+{
+	LispLambda lambda;
+	if (!lisp->optimize || lisp_list_decode_lambda(func, &lambda) != E_SUCCESS || lambda->body != NULL)
+		return;
+	lambda->body = lisp_optimize_form(lisp, lambda->source, lambda->params);
+}
+
+LispObject lisp_lambda_body(TinyLisp lisp, LispObject func)
+{
+	LispLambda lambda = func->data.l->lambda;
+	if (!lisp->optimize)
+		return lambda->source;
+	if (lambda->body == NULL) {
+		lambda->body = lisp_optimize_form(lisp, lambda->source, lambda->params);
+		if (lambda->body == NULL)
+			return lambda->source;
+	}
+	return lambda->body;
+}
@@ -0,0 +1,18 @@
+#ifndef TINYLISP_OPTIMIZE_H
+#define TINYLISP_OPTIMIZE_H
+
+#include "tinylisp.h"
+
+// Return a new reference to an equivalent of the expression form, evaluated with the parameters params
+// bound locally, in which every global name that is already bound is replaced by the object it is bound
+// to. Lists and symbols are wrapped in a call of the quote builtin; builtins are called directly.
+// Calls of pure builtins whose arguments are all constant are replaced by their result, and ternaries
+// with a constant condition by the branch taken. Returns NULL on error.
+LispObject lisp_optimize_form(TinyLisp lisp, LispObject form, LispObject params);
+// Build the optimized body of func now if it is a lambda or macro; anything else is left alone
+void lisp_optimize_lambda(TinyLisp lisp, LispObject func);
+// Return a borrowed reference to the body of the lambda or macro func, which must have been decoded by
+// lisp_list_decode_lambda, optimized on first use if lisp has optimization enabled
+LispObject lisp_lambda_body(TinyLisp lisp, LispObject func);
+
+#endif
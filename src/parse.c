@@ -1,12 +1,315 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "parse.h"
+#include "hashcons.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LISP_PARSE_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
-LispObject lisp_parse(TinyLisp lisp, char* line, int* pos)
+// Bytes of a text looked through for its terminating NUL before the first block is loaded from it; each look
+// further goes twice as far as the last
+#define LISP_PARSE_LOOKAHEAD 64
+
+// A text being parsed, and how much of it is known to be there, so that a block is only loaded if all of it is
+struct LispParseText_
 {
-	while (line[*pos] != '\0' && isspace(line[*pos]))
-		++(*pos);
+	char* line;
+	// bytes of line known to come before its terminating NUL or to be it, 1 once the NUL is among them, and
+	// how far to look for it next
+	int known, ended, lookahead;
+};
+
+// Number of ints a LispParseInts_ holds before it moves to the heap
+#define LISP_PARSE_INLINE 32
+
+// A growing array of ints, kept inline until it outgrows the space there
+struct LispParseInts_
+{
+	int* items;
+	int size, capacity;
+	int inline_items[LISP_PARSE_INLINE];
+};
+
+// The number of elements of every list in a form, found by a scan before it is parsed so that each list is
+// allocated at its final size
+struct LispParseSizes_
+{
+	// the sizes of the lists in the order they open
+	struct LispParseInts_ sizes;
+	// positions in sizes of the lists open at the point scanned, innermost last
+	struct LispParseInts_ open;
+	// position in sizes of the next list parsed
+	int next;
+};
+
+void lisp_parse_ints_init(struct LispParseInts_* ints)
+{
+	ints->items = ints->inline_items;
+	ints->size = 0;
+	ints->capacity = LISP_PARSE_INLINE;
+}
+
+error_t lisp_parse_ints_push(struct LispParseInts_* ints, int val)
+{
+	if (ints->size == ints->capacity) {
+		int* items;
+		if (ints->items == ints->inline_items) {
+			items = malloc(sizeof(int) * ints->capacity * 2);
+			if (items != NULL)
+				memcpy(items, ints->inline_items, sizeof(int) * ints->size);
+		}
+		else {
+			items = realloc(ints->items, sizeof(int) * ints->capacity * 2);
+		}
+		if (items == NULL)
+			return E_MEMORY_ERROR;
+		ints->items = items;
+		ints->capacity *= 2;
+	}
+	ints->items[ints->size++] = val;
+	return E_SUCCESS;
+}
+
+void lisp_parse_ints_free(struct LispParseInts_* ints)
+{
+	if (ints->items != ints->inline_items)
+		free(ints->items);
+}
+
+int lisp_parse_is_space(char c)
+{
+	return c == ' ' || (c >= 0x09 && c <= 0x0D);
+}
+
+// Atoms are made of the printable characters other than the brackets
+int lisp_parse_is_atom(char c)
+{
+	return c > 0x20 && c <= 0x7E && c != '(' && c != ')';
+}
+
+// Record a bracket or the first character of an atom, c, met by the scan of a form; sets *closed once the
+// list the form began with is closed
+error_t lisp_parse_count_token(struct LispParseSizes_* sizes, char c, int* closed)
+{
+	struct LispParseInts_* open = &sizes->open;
+	if (c == ')') {
+		if (open->size > 0)
+			--open->size;
+		*closed = open->size == 0;
+		return E_SUCCESS;
+	}
+	if (open->size > 0)
+		++sizes->sizes.items[open->items[open->size - 1]];
+	if (c == '(') {
+		error_t err = lisp_parse_ints_push(&sizes->sizes, 0);
+		if (err == E_SUCCESS)
+			err = lisp_parse_ints_push(open, sizes->sizes.size - 1);
+		return err;
+	}
+	return E_SUCCESS;
+}
+
+#ifdef LISP_PARSE_SSE2
+const int lisp_parse_vectorized = 1;
+
+// Bit masks of the bytes of a block by class, bit i standing for byte i
+struct LispParseBlock_
+{
+	unsigned int space, atom, open, close, end;
+};
+
+int lisp_parse_ctz(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// Return 1 if the 16 bytes of the text from at on are all part of it. memchr stops at the first NUL, so
+// looking for it never reads past the end of the text.
+int lisp_parse_whole(struct LispParseText_* text, int at)
+{
+	while (at + 16 > text->known && !text->ended) {
+		const char* nul = memchr(text->line + text->known, '\0', text->lookahead);
+		if (nul != NULL) {
+			text->known = (int)(nul - text->line) + 1;
+			text->ended = 1;
+		}
+		else {
+			text->known += text->lookahead;
+			text->lookahead *= 2;
+		}
+	}
+	return at + 16 <= text->known;
+}
+
+// Classify the 16 bytes of the text from at on, or the bytes up to its terminating NUL if it ends first
+struct LispParseBlock_ lisp_parse_classify(struct LispParseText_* text, int at)
+{
+	struct LispParseBlock_ res;
+	const char* block = text->line + at;
+	if (!lisp_parse_whole(text, at)) {
+		memset(&res, 0, sizeof(res));
+		for (int i = 0; i < 16; ++i) {
+			unsigned int bit = 1u << i;
+			char c = block[i];
+			if (c == '\0') {
+				res.end = bit;
+				break;
+			}
+			res.space |= lisp_parse_is_space(c) ? bit : 0;
+			res.atom |= lisp_parse_is_atom(c) ? bit : 0;
+			res.open |= c == '(' ? bit : 0;
+			res.close |= c == ')' ? bit : 0;
+		}
+		return res;
+	}
+	__m128i c = _mm_loadu_si128((const __m128i*)block);
+	// Bytes are compared unsigned by checking that the smaller of them and the top of the range is them
+	__m128i controls = _mm_sub_epi8(c, _mm_set1_epi8(0x09));
+	__m128i space = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+		_mm_cmpeq_epi8(_mm_min_epu8(controls, _mm_set1_epi8(0x0D - 0x09)), controls));
+	__m128i printable = _mm_sub_epi8(c, _mm_set1_epi8(0x21));
+	printable = _mm_cmpeq_epi8(_mm_min_epu8(printable, _mm_set1_epi8(0x7E - 0x21)), printable);
+	res.space = _mm_movemask_epi8(space);
+	res.open = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('(')));
+	res.close = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(')')));
+	res.atom = _mm_movemask_epi8(printable) & ~(res.open | res.close);
+	res.end = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_setzero_si128()));
+	return res;
+}
+
+int lisp_parse_skip_space(struct LispParseText_* text, int pos)
+{
+	if (!lisp_parse_is_space(text->line[pos]))
+		return pos;
+	for (;;) {
+		unsigned int stop = ~lisp_parse_classify(text, pos).space & 0xFFFF;
+		if (stop != 0)
+			return pos + lisp_parse_ctz(stop);
+		pos += 16;
+	}
+}
+
+int lisp_parse_atom_end(struct LispParseText_* text, int pos)
+{
+	for (;;) {
+		unsigned int stop = ~lisp_parse_classify(text, pos).atom & 0xFFFF;
+		if (stop != 0)
+			return pos + lisp_parse_ctz(stop);
+		pos += 16;
+	}
+}
+
+// Scan the form opening at line[pos] for the sizes of its lists, a block at a time: the brackets and the
+// first bytes of atoms are picked out of each block as a mask and visited in order
+error_t lisp_parse_count(struct LispParseText_* text, int pos, struct LispParseSizes_* sizes)
+{
+	// 1 if the byte before the block belongs to an atom
+	unsigned int carry = 0;
+	int closed = 0;
+	for (;;) {
+		struct LispParseBlock_ classes = lisp_parse_classify(text, pos);
+		unsigned int atom = classes.atom;
+		unsigned int tokens = (classes.open | classes.close | (atom & ~((atom << 1) | carry))) & 0xFFFF;
+		unsigned int end = classes.end;
+		carry = atom >> 15;
+		if (end != 0)
+			tokens &= (end & (0u - end)) - 1;
+		while (tokens != 0) {
+			error_t err = lisp_parse_count_token(sizes, text->line[pos + lisp_parse_ctz(tokens)], &closed);
+			if (err != E_SUCCESS || closed)
+				return err;
+			tokens &= tokens - 1;
+		}
+		if (end != 0)
+			return E_SUCCESS;
+		pos += 16;
+	}
+}
+#else
+const int lisp_parse_vectorized = 0;
+
+int lisp_parse_skip_space(struct LispParseText_* text, int pos)
+{
+	char* line = text->line;
+	while (lisp_parse_is_space(line[pos]))
+		++pos;
+	return pos;
+}
+
+int lisp_parse_atom_end(struct LispParseText_* text, int pos)
+{
+	char* line = text->line;
+	while (lisp_parse_is_atom(line[pos]))
+		++pos;
+	return pos;
+}
+
+error_t lisp_parse_count(struct LispParseText_* text, int pos, struct LispParseSizes_* sizes)
+{
+	char* line = text->line;
+	int closed = 0;
+	for (int prev_atom = 0; line[pos] != '\0'; ++pos) {
+		int atom = lisp_parse_is_atom(line[pos]);
+		if (line[pos] == '(' || line[pos] == ')' || (atom && !prev_atom)) {
+			error_t err = lisp_parse_count_token(sizes, line[pos], &closed);
+			if (err != E_SUCCESS || closed)
+				return err;
+		}
+		prev_atom = atom;
+	}
+	return E_SUCCESS;
+}
+#endif
+
+// Parse the integer or symbol at line[*pos]. The value of an integer is accumulated as its digits are
+// checked, wrapping around past the range of LispInteger.
+LispObject lisp_parse_atom(TinyLisp lisp, struct LispParseText_* text, int* pos)
+{
+	char* line = text->line;
+	int end = *pos;
+	unsigned int value = 0;
+	while (line[end] >= '0' && line[end] <= '9') {
+		value = value * 10 + (unsigned int)(line[end] - '0');
+		++end;
+	}
+
+	LispObject res;
+	if (end > *pos && !lisp_parse_is_atom(line[end])) {
+		res = lisp_integer_new((LispInteger)value);
+	}
+	else {
+		end = lisp_parse_atom_end(text, end);
+		if (end == *pos) {
+			lisp_error_set(lisp, E_SYNTAX_ERROR, "Unexpected character at %d", *pos);
+			return NULL;
+		}
+		res = lisp_symbol_new_n(line + *pos, end - *pos);
+	}
+	if (res == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	*pos = end;
+	return lisp_hashcons(lisp, res);
+}
+
+// Parse the form at line[*pos], allocating its lists at the sizes given if sizes is not NULL
+LispObject lisp_parse_form(TinyLisp lisp, struct LispParseText_* text, int* pos, struct LispParseSizes_* sizes)
+{
+	char* line = text->line;
+	*pos = lisp_parse_skip_space(text, *pos);
 
 	if (line[*pos] == '\0') {
 		lisp_error_set(lisp, E_NO_INPUT, NULL);
@@ -14,52 +317,75 @@ LispObject lisp_parse(TinyLisp lisp, char* line, int* pos)
 	}
 	else if (line[*pos] == '(') {
 		LispObject res = lisp_list_new();
+		if (res == NULL) {
+			lisp_error_set(lisp, E_MEMORY_ERROR, "Could not construct list");
+			return NULL;
+		}
+		if (sizes != NULL && sizes->next < sizes->sizes.size) {
+			int size = sizes->sizes.items[sizes->next++];
+			if (size > 0 && lisp_list_reserve(res, size) != E_SUCCESS) {
+				lisp_list_free(res);
+				lisp_error_set(lisp, E_MEMORY_ERROR, "Could not construct list");
+				return NULL;
+			}
+		}
 		++(*pos);
-		while (line[*pos] != '\0') {
-			if (isspace(line[*pos])) {
+		for (;;) {
+			*pos = lisp_parse_skip_space(text, *pos);
+			if (line[*pos] == '\0')
+				break;
+			if (line[*pos] == ')') {
 				++(*pos);
+				return lisp_hashcons(lisp, res);
 			}
-			else if (line[*pos] == ')') {
-				++(*pos);
-				return res;
+			LispObject val = lisp_parse_form(lisp, text, pos, sizes);
+			if (val == NULL) {
+				lisp_object_free(res);
+				return NULL;
 			}
-			else {
-				LispObject val = lisp_parse(lisp, line, pos);
-				if (val == NULL) {
-					lisp_object_free(res);
-					return NULL;
-				}
-				error_t err = lisp_list_push(res, val);
-				if (err != E_SUCCESS) {
-					lisp_list_free(res);
-					lisp_error_set(lisp, err, "Could not construct list");
-					return NULL;
-				}
+			error_t err = lisp_list_push(res, val);
+			if (err != E_SUCCESS) {
+				lisp_object_free(val);
+				lisp_list_free(res);
+				lisp_error_set(lisp, err, "Could not construct list");
+				return NULL;
 			}
 		}
 		lisp_list_free(res);
 		lisp_error_set(lisp, E_UNEXPECTED_EOF, NULL);
 		return NULL;
 	}
-	else if (line[0] == ')') {
+	else if (line[*pos] == ')') {
 		lisp_error_set(lisp, E_SYNTAX_ERROR, ") found with no bracket group to end");
 		return NULL;
 	}
 	else {
-		int is_number = 1;
-		int end = *pos;
-		while (line[end] > 0x20 && line[end] <= 0x7E && line[end] != '(' && line[end] != ')') {
-			if (line[end] < 0x30 || line[end] > 0x39)
-				is_number = 0;
-			++end;
-		}
-
-		LispObject res;
-		if (is_number)
-			res = lisp_integer_new(atoi(line + *pos));
-		else
-			res = lisp_symbol_new_n(line + *pos, end - *pos);
-		*pos = end;
-		return res;
+		return lisp_parse_atom(lisp, text, pos);
 	}
-}
\ No newline at end of file
+}
+
+LispObject lisp_parse(TinyLisp lisp, char* line, int* pos)
+{
+	struct LispParseText_ text;
+	text.line = line;
+	text.known = *pos;
+	text.ended = 0;
+	text.lookahead = LISP_PARSE_LOOKAHEAD;
+	*pos = lisp_parse_skip_space(&text, *pos);
+	if (line[*pos] != '(')
+		return lisp_parse_form(lisp, &text, pos, NULL);
+
+	struct LispParseSizes_ sizes;
+	lisp_parse_ints_init(&sizes.sizes);
+	lisp_parse_ints_init(&sizes.open);
+	sizes.next = 0;
+	LispObject res = NULL;
+	error_t err = lisp_parse_count(&text, *pos, &sizes);
+	if (err == E_SUCCESS)
+		res = lisp_parse_form(lisp, &text, pos, &sizes);
+	else
+		lisp_error_set(lisp, err, "Could not scan form");
+	lisp_parse_ints_free(&sizes.sizes);
+	lisp_parse_ints_free(&sizes.open);
+	return res;
+}
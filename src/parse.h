@@ -3,6 +3,13 @@
 
 #include "tinylisp.h"
 
+// Returns 1 if the parser classifies its input 16 bytes at a time with SSE2 rather than a byte at a time
+extern const int lisp_parse_vectorized;
+
+// Parse the form starting at or after line[*pos], advancing *pos past it. A list is scanned for the sizes of
+// the lists within it before they are built, so that each is allocated once. Returns NULL with an error set
+// on lisp if there is no form, it is incomplete or it holds a character the parser does not accept.
+// Nothing is read from line before line[*pos] or past its terminating NUL.
 LispObject lisp_parse(TinyLisp lisp, char* line, int* pos);
 
 #endif
\ No newline at end of file
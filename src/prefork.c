@@ -0,0 +1,732 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefork.h"
+#include "server.h"
+
+#ifdef __linux__
+#define LISP_PREFORK_FORK
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+#ifdef LISP_PREFORK_FORK
+const int lisp_prefork_supported = 1;
+
+// Responses from a worker have a byte after the frame header which is 1 if the worker leaves after it
+#define LISP_PREFORK_HEADER 5
+
+enum LispPreforkKind_
+{
+	PREFORK_CONNECTION,
+	PREFORK_WORKER,
+	// a connection closed while events for it may still be waiting in the batch being handled
+	PREFORK_CLOSED
+};
+
+typedef struct LispPrefork_ *LispPrefork;
+typedef struct LispPreforkWorker_ *LispPreforkWorker;
+typedef struct LispPreforkConnection_ *LispPreforkConnection;
+
+struct LispPreforkConnection_
+{
+	int kind;
+	int fd;
+	// requests received and not yet passed to a worker
+	char* input;
+	int len, capacity;
+	// responses not yet sent, of which the first sent bytes have been
+	LispWriter output;
+	int sent;
+	// 1 once the peer has stopped sending
+	int closed;
+	// the events the connection is registered for, 0 while its request waits for a worker or is evaluated
+	unsigned int events;
+	// the worker holding the connection's session until it closes, or NULL before its first request
+	LispPreforkWorker worker;
+	// 1 while the connection waits in the queue for a worker
+	int queued;
+	LispPreforkConnection prev, next, next_queued;
+};
+
+struct LispPreforkWorker_
+{
+	int kind;
+	// 0 if no process is running
+	pid_t pid;
+	// the write end of the pipe requests are sent on, -1 once closed, and the read end of the responses
+	int requests, responses;
+	// bytes of the response being received
+	char* input;
+	int len, capacity;
+	// the connection the worker keeps the session of, or NULL if it is idle
+	LispPreforkConnection conn;
+	// 1 while a request of the connection is being evaluated, until the deadline if it is not 0
+	int busy;
+	long long deadline;
+	int served;
+	// set once the worker has said it is leaving, or has been killed for running past the timeout
+	int retiring, timed_out;
+};
+
+struct LispPrefork_
+{
+	LispPreforkConfig config;
+	TinyLisp lisp;
+	// the listener is registered with a NULL pointer and the read end of the stop pipe with the pool
+	int epoll, listener, stop[2];
+	struct LispPreforkWorker_* workers;
+	LispPreforkConnection connections;
+	LispPreforkConnection queue_head, queue_tail;
+	// connections closed since the last batch of events, freed once it has been handled
+	LispPreforkConnection closing;
+};
+
+// Read or write exactly len bytes on the blocking fd; returns 0 on success
+int lisp_prefork_read_all(int fd, char* data, int len)
+{
+	while (len > 0) {
+		ssize_t n = read(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		data += n;
+		len -= (int)n;
+	}
+	return 0;
+}
+
+int lisp_prefork_write_all(int fd, const char* data, int len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		data += n;
+		len -= (int)n;
+	}
+	return 0;
+}
+
+// Resident set size of this process in kB, or 0 if it cannot be read
+long lisp_prefork_rss()
+{
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm == NULL)
+		return 0;
+	long size = 0, resident = 0;
+	if (fscanf(statm, "%ld %ld", &size, &resident) != 2)
+		resident = 0;
+	fclose(statm);
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Write the memory of worker, and how much of it is shared with the other processes, to stderr
+void lisp_prefork_report(LispPreforkWorker worker, const char* event)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", (int)worker->pid);
+	long rss = 0, pss = 0, shared = 0, private = 0;
+	FILE* smaps = fopen(path, "r");
+	if (smaps != NULL) {
+		char line[256];
+		long kb;
+		while (fgets(line, sizeof(line), smaps) != NULL) {
+			if (sscanf(line, "Rss: %ld", &kb) == 1)
+				rss = kb;
+			else if (sscanf(line, "Pss: %ld", &kb) == 1)
+				pss = kb;
+			else if (sscanf(line, "Shared_Clean: %ld", &kb) == 1 || sscanf(line, "Shared_Dirty: %ld", &kb) == 1)
+				shared += kb;
+			else if (sscanf(line, "Private_Clean: %ld", &kb) == 1 || sscanf(line, "Private_Dirty: %ld", &kb) == 1)
+				private += kb;
+		}
+		fclose(smaps);
+	}
+	fprintf(stderr, "worker %d %s after %d requests: rss %ld kB, shared %ld kB, private %ld kB, pss %ld kB\n",
+		(int)worker->pid, event, worker->served, rss, shared, private, pss);
+}
+
+// Evaluate the requests sent by the parent until told to leave or a limit is reached; never returns
+void lisp_prefork_worker_main(LispPrefork pool, LispPreforkWorker worker)
+{
+	LispPreforkConfig config = pool->config;
+	LispWriter out = lisp_writer_new(NULL, NULL);
+	char* request = NULL;
+	unsigned int capacity = 0;
+	int served = 0;
+	int leaving = 0;
+	while (out != NULL && !leaving) {
+		char header[4];
+		if (lisp_prefork_read_all(worker->requests, header, 4) != 0)
+			break;
+		unsigned int size = lisp_server_frame_size(header);
+		if (size > LISP_SERVER_MAX_FRAME)
+			break;
+		if (size + 1 > capacity) {
+			char* grown = realloc(request, size + 1);
+			if (grown == NULL)
+				break;
+			request = grown;
+			capacity = size + 1;
+		}
+		if (lisp_prefork_read_all(worker->requests, request, size) != 0)
+			break;
+		request[size] = '\0';
+		if (lisp_writer_write(out, "\0\0\0\0\0", LISP_PREFORK_HEADER) != E_SUCCESS)
+			break;
+		lisp_server_evaluate(pool->lisp, request, out);
+		++served;
+		leaving = (config->max_requests > 0 && served >= config->max_requests)
+			|| (config->max_rss > 0 && lisp_prefork_rss() > config->max_rss);
+		lisp_server_frame_header(out->data, (unsigned int)(out->size - LISP_PREFORK_HEADER));
+		out->data[4] = (char)leaving;
+		if (lisp_prefork_write_all(worker->responses, out->data, out->size) != 0)
+			break;
+		lisp_writer_clear(out);
+	}
+	// Stay until the parent has taken the memory report and closed the pipe
+	char c;
+	while (leaving && read(worker->requests, &c, 1) > 0)
+		continue;
+	_exit(0);
+}
+
+// Start a process for worker, forked from the pool's interpreter
+error_t lisp_prefork_spawn(LispPrefork pool, LispPreforkWorker worker)
+{
+	int requests[2], responses[2];
+	if (pipe(requests) != 0)
+		return E_IO_ERROR;
+	if (pipe(responses) != 0) {
+		close(requests[0]);
+		close(requests[1]);
+		return E_IO_ERROR;
+	}
+	// A signal arriving before the child has reset its handlers would only wake the parent's loop, so they
+	// are held back until it has
+	sigset_t signals, previous;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigprocmask(SIG_BLOCK, &signals, &previous);
+	pid_t pid = fork();
+	if (pid == 0) {
+		// Keep nothing of the parent's open but the worker's own ends of its pipes
+		close(requests[1]);
+		close(responses[0]);
+		close(pool->epoll);
+		close(pool->listener);
+		close(pool->stop[0]);
+		close(pool->stop[1]);
+		for (LispPreforkConnection conn = pool->connections; conn != NULL; conn = conn->next)
+			close(conn->fd);
+		for (int i = 0; i < pool->config->workers; ++i) {
+			if (pool->workers[i].pid != 0) {
+				close(pool->workers[i].responses);
+				if (pool->workers[i].requests >= 0)
+					close(pool->workers[i].requests);
+			}
+		}
+		// The parent stops the workers itself when interrupted
+		signal(SIGINT, SIG_IGN);
+		signal(SIGTERM, SIG_DFL);
+		sigprocmask(SIG_SETMASK, &previous, NULL);
+		worker->requests = requests[0];
+		worker->responses = responses[1];
+		lisp_prefork_worker_main(pool, worker);
+	}
+	sigprocmask(SIG_SETMASK, &previous, NULL);
+	close(requests[0]);
+	close(responses[1]);
+	if (pid < 0) {
+		close(requests[1]);
+		close(responses[0]);
+		return E_IO_ERROR;
+	}
+	worker->pid = pid;
+	worker->requests = requests[1];
+	worker->responses = responses[0];
+	worker->len = 0;
+	worker->conn = NULL;
+	worker->busy = 0;
+	worker->served = 0;
+	worker->retiring = worker->timed_out = 0;
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = worker;
+	if (lisp_server_set_flags(worker->responses) != E_SUCCESS
+		|| epoll_ctl(pool->epoll, EPOLL_CTL_ADD, worker->responses, &event) != 0) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		close(worker->requests);
+		close(worker->responses);
+		worker->pid = 0;
+		return E_IO_ERROR;
+	}
+	return E_SUCCESS;
+}
+
+// Return 1 if the connection has received the whole of its next request
+int lisp_prefork_has_request(LispPreforkConnection conn)
+{
+	return conn->len >= 4 && (unsigned int)(conn->len - 4) >= lisp_server_frame_size(conn->input);
+}
+
+// Have the worker leave, together with the session of its connection, once it has no request to answer;
+// it is replaced when its pipe reaches its end
+void lisp_prefork_retire(LispPreforkWorker worker)
+{
+	if (worker->conn != NULL) {
+		worker->conn->worker = NULL;
+		worker->conn = NULL;
+	}
+	worker->retiring = 1;
+	if (worker->pid == 0)
+		return;
+	if (worker->busy)
+		kill(worker->pid, SIGKILL);
+	else if (worker->requests >= 0) {
+		close(worker->requests);
+		worker->requests = -1;
+	}
+}
+
+void lisp_prefork_close(LispPrefork pool, LispPreforkConnection conn)
+{
+	// Nothing else may see what the connection defined, so its worker goes with it
+	if (conn->worker != NULL)
+		lisp_prefork_retire(conn->worker);
+	if (conn->queued) {
+		LispPreforkConnection prev = NULL;
+		for (LispPreforkConnection other = pool->queue_head; other != conn; other = other->next_queued)
+			prev = other;
+		if (prev != NULL)
+			prev->next_queued = conn->next_queued;
+		else
+			pool->queue_head = conn->next_queued;
+		if (pool->queue_tail == conn)
+			pool->queue_tail = prev;
+	}
+	if (conn->prev != NULL)
+		conn->prev->next = conn->next;
+	else
+		pool->connections = conn->next;
+	if (conn->next != NULL)
+		conn->next->prev = conn->prev;
+	// A worker being forked may hold a copy of the socket for a moment, which would keep it registered
+	if (conn->events != 0)
+		epoll_ctl(pool->epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	lisp_writer_free(conn->output);
+	free(conn->input);
+	conn->kind = PREFORK_CLOSED;
+	conn->next = pool->closing;
+	pool->closing = conn;
+}
+
+// Free the connections closed since the last batch of events
+void lisp_prefork_release(LispPrefork pool)
+{
+	while (pool->closing != NULL) {
+		LispPreforkConnection conn = pool->closing;
+		pool->closing = conn->next;
+		free(conn);
+	}
+}
+
+// Pass the connection's next request to its worker
+void lisp_prefork_send(LispPrefork pool, LispPreforkConnection conn)
+{
+	LispPreforkWorker worker = conn->worker;
+	int size = 4 + (int)lisp_server_frame_size(conn->input);
+	// A worker which has gone is noticed when its pipe reaches its end, and the request answered then
+	lisp_prefork_write_all(worker->requests, conn->input, size);
+	memmove(conn->input, conn->input + size, conn->len - size);
+	conn->len -= size;
+	worker->busy = 1;
+	worker->deadline = pool->config->timeout > 0 ? lisp_time_ns() + pool->config->timeout * 1000000LL : 0;
+}
+
+// Send what the connection has to send, pass its next request to its worker or queue it for one if it has
+// none yet, and wait for what it needs next
+void lisp_prefork_update(LispPrefork pool, LispPreforkConnection conn)
+{
+	LispWriter out = conn->output;
+	while (conn->sent < out->size) {
+		ssize_t n = send(conn->fd, out->data + conn->sent, out->size - conn->sent, MSG_NOSIGNAL);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (n < 0 && errno != EINTR) {
+			lisp_prefork_close(pool, conn);
+			return;
+		}
+		if (n > 0)
+			conn->sent += (int)n;
+	}
+	if (conn->sent == out->size) {
+		lisp_writer_clear(out);
+		conn->sent = 0;
+	}
+	if (conn->worker != NULL && !conn->worker->busy && lisp_prefork_has_request(conn))
+		lisp_prefork_send(pool, conn);
+	else if (conn->worker == NULL && !conn->queued && lisp_prefork_has_request(conn)) {
+		conn->queued = 1;
+		conn->next_queued = NULL;
+		if (pool->queue_tail != NULL)
+			pool->queue_tail->next_queued = conn;
+		else
+			pool->queue_head = conn;
+		pool->queue_tail = conn;
+	}
+	// Nothing more is read from a connection until its request has been answered and the answer sent
+	int waiting = conn->queued || (conn->worker != NULL && conn->worker->busy);
+	unsigned int events = out->size > 0 ? EPOLLOUT : waiting ? 0 : EPOLLIN;
+	if (events == EPOLLIN && conn->closed) {
+		lisp_prefork_close(pool, conn);
+		return;
+	}
+	if (events == conn->events)
+		return;
+	struct epoll_event event;
+	event.events = events;
+	event.data.ptr = conn;
+	int op = events == 0 ? EPOLL_CTL_DEL : conn->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+	if (epoll_ctl(pool->epoll, op, conn->fd, &event) != 0) {
+		lisp_prefork_close(pool, conn);
+		return;
+	}
+	conn->events = events;
+}
+
+// Append a response holding the error to the connection's output
+void lisp_prefork_fail(LispPrefork pool, LispPreforkConnection conn, char* message)
+{
+	LispWriter out = conn->output;
+	int start = out->size;
+	if (lisp_writer_write(out, "\0\0\0\0", 4) != E_SUCCESS)
+		return;
+	lisp_error_set(pool->lisp, E_EVALUATION_ERROR, message);
+	lisp_write_error(pool->lisp, out);
+	lisp_clear_error(pool->lisp);
+	lisp_server_frame_header(out->data + start, (unsigned int)(out->size - start - 4));
+}
+
+// Give the connections queued for a worker idle ones, keeping each for as long as the connection is open
+void lisp_prefork_dispatch(LispPrefork pool)
+{
+	int next = 0;
+	while (pool->queue_head != NULL) {
+		LispPreforkWorker worker = NULL;
+		for (; next < pool->config->workers && worker == NULL; ++next) {
+			LispPreforkWorker candidate = &pool->workers[next];
+			if (candidate->pid != 0 && candidate->conn == NULL && !candidate->retiring)
+				worker = candidate;
+		}
+		if (worker == NULL)
+			return;
+		LispPreforkConnection conn = pool->queue_head;
+		pool->queue_head = conn->next_queued;
+		if (pool->queue_head == NULL)
+			pool->queue_tail = NULL;
+		conn->queued = 0;
+		worker->conn = conn;
+		conn->worker = worker;
+		lisp_prefork_send(pool, conn);
+	}
+}
+
+// Reap a worker whose pipe has reached its end, answer the request it was evaluating and start another. Its
+// connection's next request goes to another worker, which starts without what the connection had defined.
+void lisp_prefork_replace(LispPrefork pool, LispPreforkWorker worker)
+{
+	waitpid(worker->pid, NULL, 0);
+	close(worker->responses);
+	if (worker->requests >= 0)
+		close(worker->requests);
+	worker->pid = 0;
+	LispPreforkConnection conn = worker->conn;
+	if (conn != NULL) {
+		worker->conn = NULL;
+		conn->worker = NULL;
+		if (worker->busy)
+			lisp_prefork_fail(pool, conn, worker->timed_out ? "Evaluation timed out" : "Worker exited during evaluation");
+		lisp_prefork_update(pool, conn);
+	}
+	if (lisp_prefork_spawn(pool, worker) != E_SUCCESS)
+		fprintf(stderr, "Could not start a worker: %s\n", strerror(errno));
+}
+
+void lisp_prefork_worker_event(LispPrefork pool, LispPreforkWorker worker)
+{
+	if (worker->capacity - worker->len < LISP_SERVER_READ_SIZE) {
+		int capacity = worker->capacity > 0 ? worker->capacity * 2 : LISP_SERVER_READ_SIZE * 2;
+		char* input = realloc(worker->input, capacity);
+		if (input == NULL) {
+			kill(worker->pid, SIGKILL);
+			return;
+		}
+		worker->input = input;
+		worker->capacity = capacity;
+	}
+	ssize_t n = read(worker->responses, worker->input + worker->len, worker->capacity - worker->len);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (n <= 0) {
+		lisp_prefork_replace(pool, worker);
+		return;
+	}
+	worker->len += (int)n;
+	if (worker->len < LISP_PREFORK_HEADER)
+		return;
+	unsigned int size = lisp_server_frame_size(worker->input);
+	if ((unsigned int)(worker->len - LISP_PREFORK_HEADER) < size)
+		return;
+	LispPreforkConnection conn = worker->conn;
+	worker->busy = 0;
+	worker->len = 0;
+	++worker->served;
+	// A worker past its limits takes its connection's session with it, so the connection is closed once
+	// the response has been sent, and the requests it sent after this one are not answered
+	if (worker->input[4]) {
+		lisp_prefork_report(worker, "retired");
+		lisp_prefork_retire(worker);
+		if (conn != NULL) {
+			conn->closed = 1;
+			conn->len = 0;
+		}
+	}
+	// The response is passed on with the worker's byte left out of its header
+	if (conn != NULL) {
+		if (lisp_writer_write(conn->output, worker->input, 4) == E_SUCCESS)
+			lisp_writer_write(conn->output, worker->input + LISP_PREFORK_HEADER, (int)size);
+		lisp_prefork_update(pool, conn);
+	}
+}
+
+void lisp_prefork_accept(LispPrefork pool)
+{
+	int fd = accept(pool->listener, NULL, NULL);
+	if (fd < 0)
+		return;
+	LispPreforkConnection conn = calloc(1, sizeof(struct LispPreforkConnection_));
+	if (conn == NULL || lisp_server_set_flags(fd) != E_SUCCESS) {
+		free(conn);
+		close(fd);
+		return;
+	}
+	conn->kind = PREFORK_CONNECTION;
+	conn->fd = fd;
+	conn->capacity = LISP_SERVER_READ_SIZE;
+	conn->input = malloc(conn->capacity);
+	conn->output = lisp_writer_new(NULL, NULL);
+	if (conn->input == NULL || conn->output == NULL) {
+		free(conn->input);
+		if (conn->output != NULL)
+			lisp_writer_free(conn->output);
+		free(conn);
+		close(fd);
+		return;
+	}
+	conn->next = pool->connections;
+	if (pool->connections != NULL)
+		pool->connections->prev = conn;
+	pool->connections = conn;
+	lisp_prefork_update(pool, conn);
+}
+
+void lisp_prefork_connection_event(LispPrefork pool, LispPreforkConnection conn, unsigned int events)
+{
+	if (events & EPOLLERR) {
+		lisp_prefork_close(pool, conn);
+		return;
+	}
+	if ((events & (EPOLLIN | EPOLLHUP)) && conn->events == EPOLLIN) {
+		if (conn->capacity - conn->len < LISP_SERVER_READ_SIZE) {
+			int capacity = conn->capacity * 2;
+			char* input = realloc(conn->input, capacity);
+			if (input == NULL) {
+				lisp_prefork_close(pool, conn);
+				return;
+			}
+			conn->input = input;
+			conn->capacity = capacity;
+		}
+		ssize_t n = read(conn->fd, conn->input + conn->len, conn->capacity - conn->len);
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			lisp_prefork_close(pool, conn);
+			return;
+		}
+		if (n == 0)
+			conn->closed = 1;
+		if (n > 0)
+			conn->len += (int)n;
+		if (conn->len >= 4 && lisp_server_frame_size(conn->input) > LISP_SERVER_MAX_FRAME) {
+			lisp_prefork_close(pool, conn);
+			return;
+		}
+	}
+	lisp_prefork_update(pool, conn);
+}
+
+// Milliseconds until the earliest deadline of a busy worker, or -1 if none has one
+int lisp_prefork_wait_time(LispPrefork pool)
+{
+	long long now = lisp_time_ns();
+	long long wait = -1;
+	for (int i = 0; i < pool->config->workers; ++i) {
+		LispPreforkWorker worker = &pool->workers[i];
+		if (!worker->busy || worker->deadline == 0 || worker->timed_out)
+			continue;
+		long long left = worker->deadline > now ? (worker->deadline - now) / 1000000 + 1 : 0;
+		if (wait < 0 || left < wait)
+			wait = left;
+	}
+	return (int)wait;
+}
+
+// Kill the workers which have run past their deadline; they are replaced when their pipes reach their end
+void lisp_prefork_expire(LispPrefork pool)
+{
+	long long now = lisp_time_ns();
+	for (int i = 0; i < pool->config->workers; ++i) {
+		LispPreforkWorker worker = &pool->workers[i];
+		if (worker->busy && worker->deadline != 0 && !worker->timed_out && now >= worker->deadline) {
+			worker->timed_out = 1;
+			kill(worker->pid, SIGKILL);
+		}
+	}
+}
+
+void lisp_prefork_loop(LispPrefork pool)
+{
+	struct epoll_event events[LISP_SERVER_EVENTS];
+	int stopping = 0;
+	while (!stopping) {
+		int n = epoll_wait(pool->epoll, events, LISP_SERVER_EVENTS, lisp_prefork_wait_time(pool));
+		if (n < 0 && errno != EINTR)
+			break;
+		for (int i = 0; i < n; ++i) {
+			void* ptr = events[i].data.ptr;
+			if (ptr == NULL)
+				lisp_prefork_accept(pool);
+			else if (ptr == pool)
+				stopping = 1;
+			else if (*(int*)ptr == PREFORK_WORKER)
+				lisp_prefork_worker_event(pool, ptr);
+			else if (*(int*)ptr == PREFORK_CONNECTION)
+				lisp_prefork_connection_event(pool, ptr, events[i].events);
+		}
+		lisp_prefork_release(pool);
+		lisp_prefork_expire(pool);
+		lisp_prefork_dispatch(pool);
+	}
+}
+
+// Set up the pool's listener, stop pipe and event loop; returns E_SUCCESS or E_IO_ERROR with lisp's error set
+error_t lisp_prefork_open(LispPrefork pool)
+{
+	if (pipe(pool->stop) != 0) {
+		pool->stop[0] = pool->stop[1] = -1;
+		lisp_error_set(pool->lisp, E_IO_ERROR, "Could not create a pipe: %s", strerror(errno));
+		return E_IO_ERROR;
+	}
+	pool->listener = lisp_server_listen(pool->config->path, pool->lisp);
+	if (pool->listener < 0)
+		return E_IO_ERROR;
+	pool->epoll = epoll_create1(0);
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	int err = pool->epoll < 0 || epoll_ctl(pool->epoll, EPOLL_CTL_ADD, pool->listener, &event) != 0;
+	event.data.ptr = pool;
+	if (err || epoll_ctl(pool->epoll, EPOLL_CTL_ADD, pool->stop[0], &event) != 0) {
+		lisp_error_set(pool->lisp, E_IO_ERROR, "Could not create an event loop: %s", strerror(errno));
+		return E_IO_ERROR;
+	}
+	return E_SUCCESS;
+}
+
+error_t lisp_prefork_run(LispPreforkConfig config, TinyLisp lisp)
+{
+	struct LispPrefork_ pool;
+	memset(&pool, 0, sizeof(pool));
+	pool.config = config;
+	pool.lisp = lisp;
+	pool.epoll = pool.listener = -1;
+	pool.workers = calloc(config->workers > 0 ? config->workers : 1, sizeof(struct LispPreforkWorker_));
+	if (pool.workers == NULL || config->workers < 1) {
+		free(pool.workers);
+		lisp_error_set(lisp, E_EVALUATION_ERROR, "Could not start %d workers", config->workers);
+		return E_EVALUATION_ERROR;
+	}
+	error_t res = lisp_prefork_open(&pool);
+	if (res == E_SUCCESS) {
+		// Nothing runs in this process once the workers start, so the frozen definitions stay as they are
+		lisp_stack_freeze(lisp->stack, 1);
+		lisp_server_catch_signals(pool.stop[1]);
+		for (int i = 0; i < config->workers; ++i) {
+			pool.workers[i].kind = PREFORK_WORKER;
+			pool.workers[i].requests = -1;
+			if (lisp_prefork_spawn(&pool, &pool.workers[i]) != E_SUCCESS)
+				fprintf(stderr, "Could not start a worker: %s\n", strerror(errno));
+		}
+		lisp_prefork_loop(&pool);
+		lisp_server_release_signals();
+		// Workers which are leaving already have been reported, or have been killed
+		for (int i = 0; i < config->workers; ++i) {
+			LispPreforkWorker worker = &pool.workers[i];
+			if (worker->pid != 0 && !worker->retiring && !worker->timed_out)
+				lisp_prefork_report(worker, "stopped");
+		}
+		for (int i = 0; i < config->workers; ++i) {
+			LispPreforkWorker worker = &pool.workers[i];
+			if (worker->pid == 0)
+				continue;
+			kill(worker->pid, SIGTERM);
+			waitpid(worker->pid, NULL, 0);
+			close(worker->responses);
+			if (worker->requests >= 0)
+				close(worker->requests);
+			worker->pid = 0;
+			worker->requests = -1;
+		}
+		lisp_stack_freeze(lisp->stack, 0);
+	}
+	while (pool.connections != NULL)
+		lisp_prefork_close(&pool, pool.connections);
+	lisp_prefork_release(&pool);
+	for (int i = 0; i < config->workers; ++i)
+		free(pool.workers[i].input);
+	free(pool.workers);
+	if (pool.epoll >= 0)
+		close(pool.epoll);
+	if (pool.listener >= 0) {
+		close(pool.listener);
+		unlink(config->path);
+	}
+	if (pool.stop[0] >= 0) {
+		close(pool.stop[0]);
+		close(pool.stop[1]);
+	}
+	return res;
+}
+#else
+const int lisp_prefork_supported = 0;
+
+error_t lisp_prefork_run(LispPreforkConfig config, TinyLisp lisp)
+{
+	(void)config;
+	lisp_error_set(lisp, E_IO_ERROR, "--prefork is not supported on this platform");
+	return E_IO_ERROR;
+}
+#endif
@@ -0,0 +1,38 @@
+#ifndef TINYLISP_PREFORK_H
+#define TINYLISP_PREFORK_H
+
+#include "tinylisp.h"
+
+typedef struct LispPreforkConfig_ *LispPreforkConfig;
+
+struct LispPreforkConfig_
+{
+	// path of the Unix domain socket to listen on
+	char* path;
+	// worker processes evaluating requests
+	int workers;
+	// requests a worker evaluates for its connection before both are closed, or 0 for no limit
+	int max_requests;
+	// resident set size in kB past which a worker and its connection are closed after a request, or 0 for no limit
+	long max_rss;
+	// milliseconds a request may run before its worker is killed and replaced, or 0 for no limit
+	int timeout;
+};
+
+// Returns 1 if lisp_prefork_run is available on this platform
+extern const int lisp_prefork_supported;
+
+// Serve the protocol of lisp_server_run on config->path, evaluating requests in worker processes forked from
+// lisp instead of in threads. The global definitions of lisp are frozen first, so that the workers share their
+// pages with this process and each other until they define something of their own. A connection is given an
+// idle worker with its first request and keeps it until it closes, when the worker is replaced, so that its
+// session is its worker's process and nothing it defines is seen by another connection. Requests are passed
+// to the worker over a pipe one at a time so that the responses stay in order. A worker which crashes or runs
+// past the timeout is replaced and the request answered with an error, and the connection goes on in another
+// worker without what it had defined; one past its limits is replaced after its response, and its connection
+// closed once that has been sent. The memory each worker shares is written to stderr when it is replaced for
+// its limits and when the pool stops on SIGINT or SIGTERM. Returns E_SUCCESS once stopped, or an error with a
+// message in lisp if the pool could not be set up.
+error_t lisp_prefork_run(LispPreforkConfig config, TinyLisp lisp);
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "tinylisp.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/time.h>
+#define LISP_PROFILE_SAMPLING
+#endif
+
+#define LISP_PROFILE_ANONYMOUS "<lambda>"
+#define LISP_PROFILE_ROOT "toplevel"
+
+struct LispProfileFunction_
+{
+	char* name;
+	long long calls;
+	long long self_ns, total_ns;
+	int active;
+};
+
+// A node in the tree of distinct call paths; node 0 is the root
+struct LispProfileNode_
+{
+	int function;
+	int parent, first_child, next_sibling;
+	long long samples;
+	long long self_ns;
+};
+
+struct LispProfileEntry_
+{
+	int function;
+	int node;
+	long long start;
+	long long child_ns;
+};
+
+int lisp_profile_enabled = 0;
+
+struct LispProfileFunction_* profile_functions = NULL;
+int profile_nfunctions = 0, profile_functions_capacity = 0;
+
+struct LispProfileNode_* profile_nodes = NULL;
+int profile_nnodes = 0, profile_nodes_capacity = 0;
+
+struct LispProfileEntry_* profile_shadow = NULL;
+int profile_shadow_depth = 0, profile_shadow_capacity = 0;
+int profile_dropped = 0;
+
+int profile_sampling = 0;
+long long profile_start_ns = 0;
+
+#ifdef LISP_PROFILE_SAMPLING
+volatile sig_atomic_t profile_pending_samples = 0;
+
+void lisp_profile_signal(int signum)
+{
+	(void)signum;
+	++profile_pending_samples;
+}
+#endif
+
+// Charge any timer ticks since the last check to the current call path
+void lisp_profile_take_samples()
+{
+#ifdef LISP_PROFILE_SAMPLING
+	if (profile_pending_samples != 0) {
+		int node = profile_shadow_depth == 0 ? 0 : profile_shadow[profile_shadow_depth - 1].node;
+		profile_nodes[node].samples += profile_pending_samples;
+		profile_pending_samples = 0;
+	}
+#endif
+}
+
+int lisp_profile_function_id(char* name)
+{
+	for (int i = 0; i < profile_nfunctions; ++i) {
+		if (strcmp(profile_functions[i].name, name) == 0)
+			return i;
+	}
+	if (profile_nfunctions == profile_functions_capacity) {
+		int new_capacity = profile_functions_capacity == 0 ? 64 : profile_functions_capacity * 2;
+		struct LispProfileFunction_* new_functions = realloc(profile_functions, sizeof(struct LispProfileFunction_) * new_capacity);
+		if (new_functions == NULL)
+			return -1;
+		profile_functions = new_functions;
+		profile_functions_capacity = new_capacity;
+	}
+	struct LispProfileFunction_* function = &profile_functions[profile_nfunctions];
+	function->name = _strdup(name);
+	if (function->name == NULL)
+		return -1;
+	function->calls = function->self_ns = function->total_ns = 0;
+	function->active = 0;
+	return profile_nfunctions++;
+}
+
+// Find or create the child of parent for function; returns -1 if out of memory
+int lisp_profile_child(int parent, int function)
+{
+	for (int child = profile_nodes[parent].first_child; child >= 0; child = profile_nodes[child].next_sibling) {
+		if (profile_nodes[child].function == function)
+			return child;
+	}
+	if (profile_nnodes == profile_nodes_capacity) {
+		int new_capacity = profile_nodes_capacity * 2;
+		struct LispProfileNode_* new_nodes = realloc(profile_nodes, sizeof(struct LispProfileNode_) * new_capacity);
+		if (new_nodes == NULL)
+			return -1;
+		profile_nodes = new_nodes;
+		profile_nodes_capacity = new_capacity;
+	}
+	struct LispProfileNode_* node = &profile_nodes[profile_nnodes];
+	node->function = function;
+	node->parent = parent;
+	node->first_child = -1;
+	node->next_sibling = profile_nodes[parent].first_child;
+	node->samples = node->self_ns = 0;
+	profile_nodes[parent].first_child = profile_nnodes;
+	return profile_nnodes++;
+}
+
+error_t lisp_profile_start(int interval_us)
+{
+	if (profile_nodes == NULL) {
+		profile_nodes = malloc(sizeof(struct LispProfileNode_) * 256);
+		if (profile_nodes == NULL)
+			return E_MEMORY_ERROR;
+		profile_nodes_capacity = 256;
+		profile_nodes[0].function = profile_nodes[0].parent = profile_nodes[0].first_child = profile_nodes[0].next_sibling = -1;
+		profile_nodes[0].samples = profile_nodes[0].self_ns = 0;
+		profile_nnodes = 1;
+	}
+	profile_shadow_depth = 0;
+	profile_start_ns = lisp_time_ns();
+	lisp_profile_enabled = 1;
+
+#ifdef LISP_PROFILE_SAMPLING
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = lisp_profile_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	struct itimerval timer;
+	timer.it_interval.tv_sec = interval_us / 1000000;
+	timer.it_interval.tv_usec = interval_us % 1000000;
+	timer.it_value = timer.it_interval;
+	profile_sampling = sigaction(SIGPROF, &action, NULL) == 0 && setitimer(ITIMER_PROF, &timer, NULL) == 0;
+#else
+	(void)interval_us;
+#endif
+	return E_SUCCESS;
+}
+
+void lisp_profile_enter(LispObject func)
+{
+	lisp_profile_take_samples();
+
+	if (profile_shadow_depth == profile_shadow_capacity) {
+		int new_capacity = profile_shadow_capacity == 0 ? 128 : profile_shadow_capacity * 2;
+		struct LispProfileEntry_* new_shadow = realloc(profile_shadow, sizeof(struct LispProfileEntry_) * new_capacity);
+		if (new_shadow == NULL) {
+			// Count the call so that the matching leave is still paired
+			++profile_dropped;
+			return;
+		}
+		profile_shadow = new_shadow;
+		profile_shadow_capacity = new_capacity;
+	}
+
+	LispLambda lambda = lisp_list_lambda(func);
+	if (lambda != NULL && lambda->profile_id < 0)
+		lambda->profile_id = lisp_profile_function_id(lambda->name != NULL ? lambda->name : LISP_PROFILE_ANONYMOUS);
+
+	// Calls which cannot be attributed are charged to their caller
+	int parent = profile_shadow_depth == 0 ? 0 : profile_shadow[profile_shadow_depth - 1].node;
+	struct LispProfileEntry_* entry = &profile_shadow[profile_shadow_depth++];
+	entry->function = lambda == NULL ? -1 : lambda->profile_id;
+	entry->node = entry->function < 0 ? parent : lisp_profile_child(parent, entry->function);
+	if (entry->node < 0) {
+		entry->function = -1;
+		entry->node = parent;
+	}
+	entry->child_ns = 0;
+	if (entry->function >= 0) {
+		++profile_functions[entry->function].calls;
+		++profile_functions[entry->function].active;
+	}
+	entry->start = lisp_time_ns();
+}
+
+void lisp_profile_leave()
+{
+	if (profile_dropped > 0) {
+		--profile_dropped;
+		return;
+	}
+	if (profile_shadow_depth == 0)
+		return;
+	long long now = lisp_time_ns();
+	lisp_profile_take_samples();
+
+	struct LispProfileEntry_* entry = &profile_shadow[--profile_shadow_depth];
+	long long elapsed = now - entry->start;
+	if (profile_shadow_depth > 0)
+		profile_shadow[profile_shadow_depth - 1].child_ns += elapsed;
+	if (entry->function < 0)
+		return;
+
+	// Recursive calls are only counted once towards inclusive time
+	struct LispProfileFunction_* function = &profile_functions[entry->function];
+	function->self_ns += elapsed - entry->child_ns;
+	if (--function->active == 0)
+		function->total_ns += elapsed;
+	profile_nodes[entry->node].self_ns += elapsed - entry->child_ns;
+}
+
+int lisp_profile_compare_self(const void* lhs, const void* rhs)
+{
+	long long l = profile_functions[*(const int*)lhs].self_ns;
+	long long r = profile_functions[*(const int*)rhs].self_ns;
+	return l < r ? 1 : (l > r ? -1 : 0);
+}
+
+void lisp_profile_write_path(FILE* stacks, int node)
+{
+	if (node == 0) {
+		fputs(LISP_PROFILE_ROOT, stacks);
+		return;
+	}
+	lisp_profile_write_path(stacks, profile_nodes[node].parent);
+	fputc(';', stacks);
+	fputs(profile_functions[profile_nodes[node].function].name, stacks);
+}
+
+void lisp_profile_stop(FILE* report, FILE* stacks)
+{
+	if (!lisp_profile_enabled)
+		return;
+#ifdef LISP_PROFILE_SAMPLING
+	if (profile_sampling) {
+		struct itimerval timer;
+		memset(&timer, 0, sizeof(timer));
+		setitimer(ITIMER_PROF, &timer, NULL);
+		signal(SIGPROF, SIG_DFL);
+	}
+#endif
+	profile_dropped = 0;
+	while (profile_shadow_depth > 0)
+		lisp_profile_leave();
+	lisp_profile_take_samples();
+	lisp_profile_enabled = 0;
+	long long wall_ns = lisp_time_ns() - profile_start_ns;
+
+	if (report != NULL) {
+		int* order = malloc(sizeof(int) * (profile_nfunctions > 0 ? profile_nfunctions : 1));
+		if (order != NULL) {
+			for (int i = 0; i < profile_nfunctions; ++i)
+				order[i] = i;
+			qsort(order, profile_nfunctions, sizeof(int), lisp_profile_compare_self);
+			fprintf(report, "%-32s %12s %12s %8s %12s %8s\n", "function", "calls", "self ms", "self %", "total ms", "total %");
+			for (int i = 0; i < profile_nfunctions; ++i) {
+				struct LispProfileFunction_* function = &profile_functions[order[i]];
+				fprintf(report, "%-32s %12lld %12.3f %7.2f%% %12.3f %7.2f%%\n", function->name, function->calls,
+					function->self_ns / 1e6, wall_ns > 0 ? 100.0 * function->self_ns / wall_ns : 0.0,
+					function->total_ns / 1e6, wall_ns > 0 ? 100.0 * function->total_ns / wall_ns : 0.0);
+			}
+			free(order);
+		}
+	}
+
+	if (stacks != NULL) {
+		// Without a sampling timer each path is weighted by its self time in microseconds instead
+		for (int i = 0; i < profile_nnodes; ++i) {
+			long long weight = profile_sampling ? profile_nodes[i].samples : profile_nodes[i].self_ns / 1000;
+			if (weight == 0)
+				continue;
+			lisp_profile_write_path(stacks, i);
+			fprintf(stacks, " %lld\n", weight);
+		}
+	}
+}
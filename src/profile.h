@@ -0,0 +1,25 @@
+#ifndef TINYLISP_PROFILE_H
+#define TINYLISP_PROFILE_H
+
+#include <stdio.h>
+
+#include "object.h"
+
+// Default period of the sampling timer in microseconds
+#define LISP_PROFILE_INTERVAL 1000
+
+// Non-zero while a profile is being collected; checked by lisp_evaluate before calling the hooks below
+extern int lisp_profile_enabled;
+
+// Start attributing calls and time to lambdas, sampling the shadow call stack every interval_us
+// microseconds where a profiling timer is available
+error_t lisp_profile_start(int interval_us);
+// Push func onto the shadow call stack
+void lisp_profile_enter(LispObject func);
+// Pop the innermost lambda from the shadow call stack
+void lisp_profile_leave();
+// Stop profiling. Writes calls, self and inclusive time per function to report and the sampled call
+// stacks to stacks in the collapsed format read by flamegraph.pl; either may be NULL
+void lisp_profile_stop(FILE* report, FILE* stacks);
+
+#endif
@@ -0,0 +1,171 @@
+#include <limits.h>
+#include <stdlib.h>
+
+#include "resume.h"
+#include "eval.h"
+#include "stats.h"
+
+#ifndef _WIN32
+#define LISP_EVAL_COROUTINE
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+struct LispEval_
+{
+	TinyLisp lisp;
+	LispObject expr;
+	// the value once finished, or NULL with the error set on lisp
+	LispObject result;
+	int started, finished;
+	// 1 while suspended in the middle of a step, which counts towards the next slice
+	int pending;
+	// 1 once the host has asked for the evaluation to unwind
+	int cancelled;
+#ifdef LISP_EVAL_COROUTINE
+	ucontext_t host, task;
+	// the mapping holding the evaluation's stack, below which is a guard page
+	char* stack;
+#endif
+};
+
+// The evaluation being stepped on this thread, or NULL
+LISP_THREAD_LOCAL LispEval lisp_eval_running = NULL;
+
+LispEval lisp_eval_begin(TinyLisp lisp, LispObject expr)
+{
+	LispEval eval = calloc(1, sizeof(struct LispEval_));
+	if (eval == NULL)
+		return NULL;
+	eval->lisp = lisp;
+	eval->expr = lisp_object_create_reference(expr);
+	return eval;
+}
+
+// Evaluate the expression of the running evaluation, returning to the host when done
+void lisp_eval_run()
+{
+	LispEval eval = lisp_eval_running;
+	eval->result = lisp_evaluate(eval->lisp, eval->expr);
+	eval->finished = 1;
+	eval->lisp->budget.slice_end = 0;
+}
+
+#ifdef LISP_EVAL_COROUTINE
+const int lisp_eval_resumable = 1;
+
+// Switch to the evaluation, starting it on a stack of its own the first time; returns when it finishes or
+// is suspended. Returns 0 if its stack could not be set up.
+int lisp_eval_switch(LispEval eval)
+{
+	if (eval->stack == NULL) {
+		long page = sysconf(_SC_PAGESIZE);
+		eval->stack = mmap(NULL, LISP_EVAL_STACK_SIZE + page, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (eval->stack == MAP_FAILED) {
+			eval->stack = NULL;
+			return 0;
+		}
+		// An evaluation which overflows its stack faults instead of writing over whatever lies below it
+		mprotect(eval->stack, page, PROT_NONE);
+		if (getcontext(&eval->task) != 0)
+			return 0;
+		eval->task.uc_stack.ss_sp = eval->stack + page;
+		eval->task.uc_stack.ss_size = LISP_EVAL_STACK_SIZE;
+		eval->task.uc_link = &eval->host;
+		makecontext(&eval->task, lisp_eval_run, 0);
+	}
+	return swapcontext(&eval->host, &eval->task) == 0;
+}
+
+int lisp_eval_yield(TinyLisp lisp)
+{
+	LispEval eval = lisp_eval_running;
+	eval->pending = 1;
+	// The host may run other evaluations on this thread before resuming this one
+	lisp_budget_suspend(lisp);
+	swapcontext(&eval->task, &eval->host);
+	lisp_budget_resume(lisp);
+	return eval->cancelled;
+}
+
+void lisp_eval_release_stack(LispEval eval)
+{
+	if (eval->stack != NULL)
+		munmap(eval->stack, LISP_EVAL_STACK_SIZE + sysconf(_SC_PAGESIZE));
+}
+#else
+const int lisp_eval_resumable = 0;
+
+int lisp_eval_switch(LispEval eval)
+{
+	(void)eval;
+	lisp_eval_run();
+	return 1;
+}
+
+int lisp_eval_yield(TinyLisp lisp)
+{
+	(void)lisp;
+	return 0;
+}
+
+void lisp_eval_release_stack(LispEval eval)
+{
+	(void)eval;
+}
+#endif
+
+int lisp_eval_step(LispEval eval, long long n)
+{
+	if (eval->finished)
+		return 1;
+	if (lisp_eval_running != NULL)
+		return 0;
+	struct LispBudget_* budget = &eval->lisp->budget;
+	if (n < 1)
+		n = 1;
+	if (!eval->started) {
+		eval->started = 1;
+		budget->slice_end = lisp_eval_resumable ? n : 0;
+		lisp_budget_start(eval->lisp);
+	}
+	else {
+		// The suspended step is taken first, and counts as one of the n; the budget is rescheduled with the
+		// new slice as the evaluation resumes
+		budget->slice_end = n > LLONG_MAX - budget->steps ? LLONG_MAX : budget->steps - eval->pending + n;
+	}
+	eval->pending = 0;
+	lisp_eval_running = eval;
+	int switched = lisp_eval_switch(eval);
+	lisp_eval_running = NULL;
+	if (!switched && !eval->finished) {
+		budget->slice_end = 0;
+		lisp_error_set(eval->lisp, E_MEMORY_ERROR, "Could not allocate a stack for the evaluation");
+		eval->finished = 1;
+	}
+	return eval->finished;
+}
+
+LispObject lisp_eval_result(LispEval eval)
+{
+	LispObject res = eval->result;
+	eval->result = NULL;
+	return res;
+}
+
+void lisp_eval_free(LispEval eval)
+{
+	if (eval->started && !eval->finished) {
+		eval->cancelled = 1;
+		while (!lisp_eval_step(eval, LLONG_MAX))
+			;
+		lisp_clear_error(eval->lisp);
+	}
+	if (eval->result != NULL)
+		lisp_object_free(eval->result);
+	lisp_object_free(eval->expr);
+	lisp_eval_release_stack(eval);
+	free(eval);
+}
@@ -0,0 +1,34 @@
+#ifndef TINYLISP_RESUME_H
+#define TINYLISP_RESUME_H
+
+#include "tinylisp.h"
+
+// Bytes of the stack each resumable evaluation runs on, which is only committed as it is touched
+#define LISP_EVAL_STACK_SIZE (1 << 20)
+
+typedef struct LispEval_ *LispEval;
+
+// Returns 1 if evaluations can be suspended on this platform; otherwise lisp_eval_step runs them to the end
+extern const int lisp_eval_resumable;
+
+// Begin evaluating expr in lisp, taking a new reference to it. Nothing is evaluated until lisp_eval_step.
+// The evaluation runs on a stack of its own, so the host can keep any number of them suspended at once,
+// each in a TinyLisp of its own. Returns NULL if out of memory.
+LispEval lisp_eval_begin(TinyLisp lisp, LispObject expr);
+// Run the evaluation for at most n steps of lisp's budget, the calls and loop iterations it counts, and
+// return 1 once it has finished or 0 if it was suspended with more to do. The budget's own limits are
+// checked as usual, with its deadline counting the time spent suspended. Must not be called from inside a
+// resumable evaluation, where it returns 0 without running anything.
+int lisp_eval_step(LispEval eval, long long n);
+// Return the value of the finished evaluation, which the caller then owns, or NULL with the error set on
+// its TinyLisp
+LispObject lisp_eval_result(LispEval eval);
+// Free the evaluation. One which has not finished is cancelled: it is resumed to unwind with an error,
+// releasing what it held.
+void lisp_eval_free(LispEval eval);
+
+// Called by lisp_budget_exceeded once the running evaluation has used its steps: suspend it until the host
+// steps it again. Returns 1 if it is being cancelled instead.
+int lisp_eval_yield(TinyLisp lisp);
+
+#endif
@@ -0,0 +1,366 @@
+#include "seq.h"
+#include "object.h"
+#include "eval.h"
+
+LispObject lisp_seq_realize(TinyLisp lisp, LispSeqGen gen);
+
+// Point *vals at the realized elements at the front of source, a list or sequence, and return their number
+int lisp_seq_source_window(LispObject source, LispObject** vals)
+{
+	if (source->type == T_SEQ) {
+		*vals = source->data.q->chunk->data.l->data + source->data.q->offset;
+		return lisp_seq_window(source);
+	}
+	int len = lisp_list_size(source);
+	*vals = source->data.l->data;
+	return len < LISP_SEQ_CHUNK ? len : LISP_SEQ_CHUNK;
+}
+
+// Return the list or sequence of the elements of source after its window, or NULL with an error set on lisp
+LispObject lisp_seq_source_rest(TinyLisp lisp, LispObject source)
+{
+	LispObject res;
+	if (source->type == T_SEQ) {
+		if (source->data.q->rest != NULL)
+			return lisp_seq_realize(lisp, source->data.q->rest);
+		res = lisp_list_new();
+	}
+	else {
+		LispObject* vals;
+		res = lisp_list_slice(source, lisp_seq_source_window(source, &vals), lisp_list_size(source));
+	}
+	if (res == NULL)
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	return res;
+}
+
+int lisp_seq_is_empty(LispObject source)
+{
+	return source->type == T_LIST && lisp_list_size(source) == 0;
+}
+
+// Push val to chunk, taking ownership of it; returns 0 with an error set on lisp if val is NULL or it fails
+int lisp_seq_push(TinyLisp lisp, LispObject chunk, LispObject val)
+{
+	if (val != NULL && lisp_list_push(chunk, val) == E_SUCCESS)
+		return 1;
+	if (val != NULL)
+		lisp_object_free(val);
+	lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	return 0;
+}
+
+// Set *next to a generator like gen drawing from rest, taking ownership of rest, or leave it NULL if rest is
+// empty; returns 0 with an error set on lisp on failure
+int lisp_seq_continue(TinyLisp lisp, LispSeqGen gen, LispObject rest, LispSeqGen* next)
+{
+	if (lisp_seq_is_empty(rest)) {
+		lisp_object_free(rest);
+		return 1;
+	}
+	*next = lisp_seq_gen_new(gen->kind);
+	if (*next == NULL) {
+		lisp_object_free(rest);
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return 0;
+	}
+	if (gen->call != NULL)
+		(*next)->call = lisp_object_create_reference(gen->call);
+	(*next)->source = rest;
+	return 1;
+}
+
+int lisp_seq_realize_range(TinyLisp lisp, LispSeqGen gen, LispObject chunk, LispSeqGen* next)
+{
+	// Counted in a wider type so that stepping past the largest integer ends the range
+	long long val = gen->next;
+	while (lisp_list_size(chunk) < LISP_SEQ_CHUNK && (gen->step > 0 ? val < gen->end : val > gen->end)) {
+		if (!lisp_seq_push(lisp, chunk, lisp_integer_new((LispInteger)val)))
+			return 0;
+		val += gen->step;
+	}
+	if (gen->step > 0 ? val >= gen->end : val <= gen->end)
+		return 1;
+	*next = lisp_seq_gen_new(SEQ_RANGE);
+	if (*next == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return 0;
+	}
+	(*next)->next = (LispInteger)val;
+	(*next)->end = gen->end;
+	(*next)->step = gen->step;
+	return 1;
+}
+
+int lisp_seq_realize_iterate(TinyLisp lisp, LispSeqGen gen, LispObject chunk, LispSeqGen* next)
+{
+	LispObject val = lisp_object_create_reference(gen->value);
+	int apply = !gen->next;
+	while (lisp_list_size(chunk) < gen->step) {
+		if (apply) {
+			LispObject res = lisp_evaluate_apply_values(lisp, gen->call, &val);
+			lisp_object_free(val);
+			if (res == NULL)
+				return 0;
+			val = res;
+		}
+		apply = 1;
+		if (!lisp_seq_push(lisp, chunk, lisp_object_create_reference(val))) {
+			lisp_object_free(val);
+			return 0;
+		}
+	}
+	// The last element is kept for the function to be applied to when the next chunk is realized
+	*next = lisp_seq_gen_new(SEQ_ITERATE);
+	if (*next == NULL) {
+		lisp_object_free(val);
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return 0;
+	}
+	(*next)->call = lisp_object_create_reference(gen->call);
+	(*next)->value = val;
+	(*next)->step = gen->step * 2 < LISP_SEQ_CHUNK ? gen->step * 2 : LISP_SEQ_CHUNK;
+	return 1;
+}
+
+int lisp_seq_realize_map(TinyLisp lisp, LispSeqGen gen, LispObject chunk, LispSeqGen* next)
+{
+	LispObject* vals;
+	int len = lisp_seq_source_window(gen->source, &vals);
+	for (int i = 0; i < len; ++i) {
+		LispObject res = lisp_evaluate_apply_values(lisp, gen->call, &vals[i]);
+		if (res == NULL || !lisp_seq_push(lisp, chunk, res))
+			return 0;
+	}
+	LispObject rest = lisp_seq_source_rest(lisp, gen->source);
+	return rest != NULL && lisp_seq_continue(lisp, gen, rest, next);
+}
+
+int lisp_seq_realize_filter(TinyLisp lisp, LispSeqGen gen, LispObject chunk, LispSeqGen* next)
+{
+	// Windows with nothing in them which passes are dropped until one has or the source runs out
+	LispObject source = lisp_object_create_reference(gen->source);
+	do {
+		LispObject* vals;
+		int len = lisp_seq_source_window(source, &vals);
+		for (int i = 0; i < len; ++i) {
+			LispObject res = lisp_evaluate_apply_values(lisp, gen->call, &vals[i]);
+			int keep = res != NULL && !lisp_object_is_nil(res);
+			if (res != NULL)
+				lisp_object_free(res);
+			if (res == NULL || (keep && !lisp_seq_push(lisp, chunk, lisp_object_create_reference(vals[i])))) {
+				lisp_object_free(source);
+				return 0;
+			}
+		}
+		LispObject rest = lisp_seq_source_rest(lisp, source);
+		lisp_object_free(source);
+		if (rest == NULL)
+			return 0;
+		source = rest;
+	} while (lisp_list_size(chunk) == 0 && !lisp_seq_is_empty(source));
+	return lisp_seq_continue(lisp, gen, source, next);
+}
+
+int lisp_seq_realize_take(TinyLisp lisp, LispSeqGen gen, LispObject chunk, LispSeqGen* next)
+{
+	LispObject* vals;
+	int len = lisp_seq_source_window(gen->source, &vals);
+	int count = gen->next < len ? gen->next : len;
+	for (int i = 0; i < count; ++i) {
+		if (!lisp_seq_push(lisp, chunk, lisp_object_create_reference(vals[i])))
+			return 0;
+	}
+	// The source is not stepped past the last element taken, as it may never end
+	if (count == gen->next)
+		return 1;
+	LispObject rest = lisp_seq_source_rest(lisp, gen->source);
+	if (rest == NULL || !lisp_seq_continue(lisp, gen, rest, next))
+		return 0;
+	if (*next != NULL)
+		(*next)->next = gen->next - count;
+	return 1;
+}
+
+// Return a sequence of the elements gen generates, or the empty list if there are none; NULL on error
+LispObject lisp_seq_realize(TinyLisp lisp, LispSeqGen gen)
+{
+	// Each chunk is a step, so that walking an endless sequence of values which are not computed by calls stops
+	if (LISP_BUDGET_STEP(lisp))
+		return NULL;
+	LispObject chunk = lisp_list_new();
+	if (chunk == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	LispSeqGen next = NULL;
+	int ok = 0;
+	switch (gen->kind) {
+	case SEQ_RANGE:
+		ok = lisp_seq_realize_range(lisp, gen, chunk, &next);
+		break;
+	case SEQ_ITERATE:
+		ok = lisp_seq_realize_iterate(lisp, gen, chunk, &next);
+		break;
+	case SEQ_MAP:
+		ok = lisp_seq_realize_map(lisp, gen, chunk, &next);
+		break;
+	case SEQ_FILTER:
+		ok = lisp_seq_realize_filter(lisp, gen, chunk, &next);
+		break;
+	case SEQ_TAKE:
+		ok = lisp_seq_realize_take(lisp, gen, chunk, &next);
+		break;
+	default:
+		lisp_error_set(lisp, E_TYPE_ERROR, "Unknown kind of sequence %d", gen->kind);
+		break;
+	}
+	if (!ok) {
+		if (next != NULL)
+			lisp_seq_gen_free(next);
+		lisp_object_free(chunk);
+		return NULL;
+	}
+	// A chunk with nothing in it is the empty list the sequence ends in
+	if (lisp_list_size(chunk) == 0)
+		return chunk;
+	LispObject res = lisp_seq_new(chunk, 0, next);
+	if (res == NULL)
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	return res;
+}
+
+// Realize the first chunk of gen, of which this takes ownership
+LispObject lisp_seq_start(TinyLisp lisp, LispSeqGen gen)
+{
+	LispObject res = lisp_seq_realize(lisp, gen);
+	lisp_seq_gen_free(gen);
+	return res;
+}
+
+// Return a new generator of kind calling func with one argument and drawing from source (unless it is NULL),
+// or NULL with an error set on lisp
+LispSeqGen lisp_seq_gen_calling(TinyLisp lisp, int kind, LispObject func, LispObject source)
+{
+	LispSeqGen gen = lisp_seq_gen_new(kind);
+	if (gen == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	if (source != NULL)
+		gen->source = lisp_object_create_reference(source);
+	gen->call = lisp_evaluate_new_call(func, 1);
+	if (gen->call == NULL) {
+		lisp_seq_gen_free(gen);
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	return gen;
+}
+
+LispObject lisp_seq_range(TinyLisp lisp, LispInteger start, LispInteger end, LispInteger step)
+{
+	if (step == 0) {
+		lisp_error_set(lisp, E_EVALUATION_ERROR, "The step of a range must not be 0");
+		return NULL;
+	}
+	LispSeqGen gen = lisp_seq_gen_new(SEQ_RANGE);
+	if (gen == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	gen->next = start;
+	gen->end = end;
+	gen->step = step;
+	return lisp_seq_start(lisp, gen);
+}
+
+LispObject lisp_seq_iterate(TinyLisp lisp, LispObject func, LispObject init)
+{
+	LispSeqGen gen = lisp_seq_gen_calling(lisp, SEQ_ITERATE, func, NULL);
+	if (gen == NULL)
+		return NULL;
+	gen->value = lisp_object_create_reference(init);
+	gen->next = 1;
+	gen->step = 1;
+	return lisp_seq_start(lisp, gen);
+}
+
+LispObject lisp_seq_map(TinyLisp lisp, LispObject func, LispObject source)
+{
+	if (lisp_seq_is_empty(source))
+		return lisp_object_create_reference(source);
+	LispSeqGen gen = lisp_seq_gen_calling(lisp, SEQ_MAP, func, source);
+	return gen != NULL ? lisp_seq_start(lisp, gen) : NULL;
+}
+
+LispObject lisp_seq_filter(TinyLisp lisp, LispObject func, LispObject source)
+{
+	if (lisp_seq_is_empty(source))
+		return lisp_object_create_reference(source);
+	LispSeqGen gen = lisp_seq_gen_calling(lisp, SEQ_FILTER, func, source);
+	return gen != NULL ? lisp_seq_start(lisp, gen) : NULL;
+}
+
+LispObject lisp_seq_take(TinyLisp lisp, int n, LispObject source)
+{
+	if (n <= 0 || lisp_seq_is_empty(source)) {
+		LispObject res = lisp_list_new();
+		if (res == NULL)
+			lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return res;
+	}
+	LispSeqGen gen = lisp_seq_gen_new(SEQ_TAKE);
+	if (gen == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	gen->source = lisp_object_create_reference(source);
+	gen->next = n;
+	return lisp_seq_start(lisp, gen);
+}
+
+LispObject lisp_seq_tail(TinyLisp lisp, LispObject seq)
+{
+	LispSeq data = seq->data.q;
+	LispObject res;
+	if (data->offset + 1 < lisp_list_size(data->chunk))
+		res = lisp_seq_new(lisp_object_create_reference(data->chunk), data->offset + 1, lisp_seq_gen_reference(data->rest));
+	else if (data->rest != NULL)
+		return lisp_seq_realize(lisp, data->rest);
+	else
+		res = lisp_list_new();
+	if (res == NULL)
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+	return res;
+}
+
+LispObject lisp_seq_collect(TinyLisp lisp, LispObject source)
+{
+	LispObject res = lisp_list_new();
+	if (res == NULL) {
+		lisp_error_set(lisp, E_MEMORY_ERROR, NULL);
+		return NULL;
+	}
+	source = lisp_object_create_reference(source);
+	while (!lisp_seq_is_empty(source)) {
+		LispObject* vals;
+		int len = lisp_seq_source_window(source, &vals);
+		for (int i = 0; i < len; ++i) {
+			if (!lisp_seq_push(lisp, res, lisp_object_create_reference(vals[i]))) {
+				lisp_object_free(source);
+				lisp_object_free(res);
+				return NULL;
+			}
+		}
+		LispObject rest = lisp_seq_source_rest(lisp, source);
+		lisp_object_free(source);
+		if (rest == NULL) {
+			lisp_object_free(res);
+			return NULL;
+		}
+		source = rest;
+	}
+	lisp_object_free(source);
+	return res;
+}
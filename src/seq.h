@@ -0,0 +1,28 @@
+#ifndef TINYLISP_SEQ_H
+#define TINYLISP_SEQ_H
+
+#include "tinylisp.h"
+
+// Lazy sequences are realized LISP_SEQ_CHUNK elements at a time. A sequence holds one chunk, and the elements
+// after it are only computed when the sequence is stepped past its end, so a pipeline of sequences which is
+// walked without holding on to its start only keeps a chunk of each stage in memory. The functions below
+// return a new sequence, or the empty list if there are no elements, or NULL with an error set on lisp.
+// Sources are borrowed and may be lists or sequences; functions are called with lisp_evaluate_apply_values.
+
+// The integers from start up to but not including end, or down to end if step is negative
+LispObject lisp_seq_range(TinyLisp lisp, LispInteger start, LispInteger end, LispInteger step);
+// The endless sequence init, (func init), (func (func init)) ..., realized 1, 2, 4 ... elements at a time up
+// to LISP_SEQ_CHUNK, so that taking the first few does not compute many more
+LispObject lisp_seq_iterate(TinyLisp lisp, LispObject func, LispObject init);
+// func applied to each element of source
+LispObject lisp_seq_map(TinyLisp lisp, LispObject func, LispObject source);
+// The elements of source for which func returns true
+LispObject lisp_seq_filter(TinyLisp lisp, LispObject func, LispObject source);
+// The first n elements of source, or all of them if it has fewer
+LispObject lisp_seq_take(TinyLisp lisp, int n, LispObject source);
+// The elements of seq after its first
+LispObject lisp_seq_tail(TinyLisp lisp, LispObject seq);
+// A new list of every element of source, which must end
+LispObject lisp_seq_collect(TinyLisp lisp, LispObject source);
+
+#endif
@@ -0,0 +1,466 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "server.h"
+#include "parse.h"
+#include "eval.h"
+#include "image.h"
+#include "stats.h"
+
+#ifdef __linux__
+#define LISP_SERVER_EPOLL
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+unsigned int lisp_server_frame_size(const char* header)
+{
+	const unsigned char* bytes = (const unsigned char*)header;
+	return ((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16) | ((unsigned int)bytes[2] << 8) | bytes[3];
+}
+
+void lisp_server_frame_header(char* header, unsigned int size)
+{
+	unsigned char* bytes = (unsigned char*)header;
+	bytes[0] = (unsigned char)(size >> 24);
+	bytes[1] = (unsigned char)(size >> 16);
+	bytes[2] = (unsigned char)(size >> 8);
+	bytes[3] = (unsigned char)size;
+}
+
+error_t lisp_server_evaluate(TinyLisp lisp, char* text, LispWriter out)
+{
+	int pos = 0;
+	for (;;) {
+		LispObject obj = lisp_parse(lisp, text, &pos);
+		if (obj == NULL) {
+			error_t err = lisp->err_code;
+			if (err != E_NO_INPUT)
+				lisp_write_error(lisp, out);
+			lisp_clear_error(lisp);
+			return err == E_NO_INPUT ? E_SUCCESS : err;
+		}
+		lisp_budget_start(lisp);
+		LispObject res = lisp_evaluate(lisp, obj);
+		lisp_object_free(obj);
+		if (res != NULL) {
+			lisp_object_write(out, res);
+			lisp_writer_putc(out, '\n');
+			lisp_object_free(res);
+		}
+		else {
+			lisp_write_error(lisp, out);
+			lisp_clear_error(lisp);
+		}
+	}
+}
+
+#ifdef LISP_SERVER_EPOLL
+const int lisp_server_supported = 1;
+
+typedef struct LispConnection_ *LispConnection;
+typedef struct LispWorker_ *LispWorker;
+
+struct LispConnection_
+{
+	int fd;
+	TinyLisp lisp;
+	// bytes received which do not yet make up a whole request, with room for a terminator after them
+	char* input;
+	int len, capacity;
+	// responses not yet sent, of which the first sent bytes have been
+	LispWriter output;
+	int sent;
+	// 1 once the peer has stopped sending; the connection is closed when its responses have been sent
+	int closed;
+	// the events the connection is registered for
+	unsigned int events;
+	LispConnection prev, next;
+};
+
+struct LispWorker_
+{
+	LispServerConfig config;
+	int epoll;
+	pthread_t thread;
+	int started;
+	// every open connection of this worker
+	LispConnection connections;
+	// the listening socket and the read end of the stop pipe, shared by every worker
+	int listener, stop;
+	// the counters of the worker's thread as it stopped, added to the main thread's once it is joined
+	struct LispStats_ stats;
+};
+
+// Written to by the signal handler to wake and stop every worker
+int lisp_server_stop_fd = -1;
+
+void lisp_server_signal(int sig)
+{
+	(void)sig;
+	char c = 0;
+	ssize_t n = write(lisp_server_stop_fd, &c, 1);
+	(void)n;
+}
+
+void lisp_server_catch_signals(int fd)
+{
+	lisp_server_stop_fd = fd;
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = lisp_server_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+}
+
+void lisp_server_release_signals()
+{
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	lisp_server_stop_fd = -1;
+}
+
+// Return a new connection for the accepted socket fd with its session's prelude evaluated, or NULL
+LispConnection lisp_connection_new(LispServerConfig config, int fd)
+{
+	LispConnection conn = calloc(1, sizeof(struct LispConnection_));
+	if (conn == NULL)
+		return NULL;
+	conn->fd = fd;
+	conn->capacity = LISP_SERVER_READ_SIZE;
+	conn->input = malloc(conn->capacity + 1);
+	conn->output = lisp_writer_new(NULL, NULL);
+	conn->lisp = lisp_new();
+	if (conn->input == NULL || conn->output == NULL || conn->lisp == NULL) {
+		free(conn->input);
+		if (conn->output != NULL)
+			lisp_writer_free(conn->output);
+		if (conn->lisp != NULL)
+			lisp_free(conn->lisp);
+		free(conn);
+		return NULL;
+	}
+	conn->lisp->optimize = config->optimize;
+	conn->lisp->jit = config->jit;
+	conn->lisp->hash_cons = config->hash_cons;
+	conn->lisp->budget = config->budget;
+	if (config->image != NULL && lisp_image_load(conn->lisp, config->image) != E_SUCCESS)
+		lisp_clear_error(conn->lisp);
+	if (config->prelude != NULL) {
+		lisp_server_evaluate(conn->lisp, config->prelude, conn->output);
+		lisp_writer_clear(conn->output);
+	}
+	return conn;
+}
+
+void lisp_connection_free(LispConnection conn)
+{
+	close(conn->fd);
+	lisp_free(conn->lisp);
+	lisp_writer_free(conn->output);
+	free(conn->input);
+	free(conn);
+}
+
+// Evaluate the terminated request and append the framed response to the connection's output
+error_t lisp_connection_respond(LispConnection conn, char* request)
+{
+	LispWriter out = conn->output;
+	int start = out->size;
+	error_t err = lisp_writer_write(out, "\0\0\0\0", 4);
+	if (err != E_SUCCESS)
+		return err;
+	lisp_server_evaluate(conn->lisp, request, out);
+	lisp_server_frame_header(out->data + start, (unsigned int)(out->size - start - 4));
+	return E_SUCCESS;
+}
+
+// Read what the peer has sent and respond to each whole request in it
+error_t lisp_connection_read(LispConnection conn)
+{
+	if (conn->capacity - conn->len < LISP_SERVER_READ_SIZE) {
+		int capacity = conn->capacity * 2;
+		char* input = realloc(conn->input, capacity + 1);
+		if (input == NULL)
+			return E_MEMORY_ERROR;
+		conn->input = input;
+		conn->capacity = capacity;
+	}
+	// One read per event, so that a peer which never stops sending does not keep the worker from the others
+	ssize_t n = read(conn->fd, conn->input + conn->len, conn->capacity - conn->len);
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? E_SUCCESS : E_IO_ERROR;
+	if (n == 0)
+		conn->closed = 1;
+	conn->len += (int)n;
+
+	int start = 0;
+	while (conn->len - start >= 4) {
+		unsigned int size = lisp_server_frame_size(conn->input + start);
+		if (size > LISP_SERVER_MAX_FRAME)
+			return E_FORMAT_ERROR;
+		if ((unsigned int)(conn->len - start - 4) < size)
+			break;
+		char* request = conn->input + start + 4;
+		char next = request[size];
+		request[size] = '\0';
+		error_t err = lisp_connection_respond(conn, request);
+		request[size] = next;
+		if (err != E_SUCCESS)
+			return err;
+		start += 4 + (int)size;
+	}
+	memmove(conn->input, conn->input + start, conn->len - start);
+	conn->len -= start;
+	return E_SUCCESS;
+}
+
+// Send as much of the connection's output as the socket takes
+error_t lisp_connection_write(LispConnection conn)
+{
+	LispWriter out = conn->output;
+	while (conn->sent < out->size) {
+		ssize_t n = send(conn->fd, out->data + conn->sent, out->size - conn->sent, MSG_NOSIGNAL);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (n < 0 && errno != EINTR)
+			return E_IO_ERROR;
+		if (n > 0)
+			conn->sent += (int)n;
+	}
+	if (conn->sent == out->size) {
+		lisp_writer_clear(out);
+		conn->sent = 0;
+	}
+	return E_SUCCESS;
+}
+
+error_t lisp_server_set_flags(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) != 0)
+		return E_IO_ERROR;
+	return E_SUCCESS;
+}
+
+void lisp_worker_close(LispWorker worker, LispConnection conn)
+{
+	if (conn->prev != NULL)
+		conn->prev->next = conn->next;
+	else
+		worker->connections = conn->next;
+	if (conn->next != NULL)
+		conn->next->prev = conn->prev;
+	lisp_connection_free(conn);
+}
+
+// Wait for the connection to be writable while it has output to send, and readable otherwise. Returns
+// E_IO_ERROR once the peer has stopped sending and everything has been sent
+error_t lisp_worker_watch(LispWorker worker, LispConnection conn)
+{
+	unsigned int events = conn->output->size > 0 ? EPOLLOUT : conn->closed ? 0 : EPOLLIN;
+	if (events == 0)
+		return E_IO_ERROR;
+	if (events == conn->events)
+		return E_SUCCESS;
+	struct epoll_event event;
+	event.events = events;
+	event.data.ptr = conn;
+	if (epoll_ctl(worker->epoll, conn->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, conn->fd, &event) != 0)
+		return E_IO_ERROR;
+	conn->events = events;
+	return E_SUCCESS;
+}
+
+void lisp_worker_accept(LispWorker worker)
+{
+	// One connection per event, leaving the rest to be woken for on other workers
+	int fd = accept(worker->listener, NULL, NULL);
+	if (fd < 0)
+		return;
+	if (lisp_server_set_flags(fd) != E_SUCCESS) {
+		close(fd);
+		return;
+	}
+	LispConnection conn = lisp_connection_new(worker->config, fd);
+	if (conn == NULL) {
+		close(fd);
+		return;
+	}
+	if (lisp_worker_watch(worker, conn) != E_SUCCESS) {
+		lisp_connection_free(conn);
+		return;
+	}
+	conn->next = worker->connections;
+	if (worker->connections != NULL)
+		worker->connections->prev = conn;
+	worker->connections = conn;
+}
+
+void lisp_worker_handle(LispWorker worker, LispConnection conn, unsigned int events)
+{
+	error_t err = events & EPOLLERR ? E_IO_ERROR : E_SUCCESS;
+	if (err == E_SUCCESS && (events & (EPOLLIN | EPOLLHUP)) && conn->events == EPOLLIN)
+		err = lisp_connection_read(conn);
+	if (err == E_SUCCESS)
+		err = lisp_connection_write(conn);
+	if (err == E_SUCCESS)
+		err = lisp_worker_watch(worker, conn);
+	if (err != E_SUCCESS)
+		lisp_worker_close(worker, conn);
+}
+
+// The event loop of a worker, run until the stop pipe becomes readable
+void* lisp_worker_run(void* arg)
+{
+	LispWorker worker = arg;
+	struct epoll_event events[LISP_SERVER_EVENTS];
+	int stopping = 0;
+	while (!stopping) {
+		int n = epoll_wait(worker->epoll, events, LISP_SERVER_EVENTS, -1);
+		if (n < 0 && errno != EINTR)
+			break;
+		for (int i = 0; i < n; ++i) {
+			if (events[i].data.ptr == worker)
+				stopping = 1;
+			else if (events[i].data.ptr == NULL)
+				lisp_worker_accept(worker);
+			else
+				lisp_worker_handle(worker, events[i].data.ptr, events[i].events);
+		}
+	}
+	while (worker->connections != NULL)
+		lisp_worker_close(worker, worker->connections);
+	worker->stats = lisp_stats;
+	return NULL;
+}
+
+// Register the listener and the stop pipe with a new epoll instance for worker
+error_t lisp_worker_init(LispWorker worker, LispServerConfig config, int listener, int stop)
+{
+	worker->config = config;
+	worker->listener = listener;
+	worker->stop = stop;
+	worker->epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (worker->epoll < 0)
+		return E_IO_ERROR;
+	struct epoll_event event;
+	// Only one of the workers waiting is woken for each connection
+	event.events = EPOLLIN | EPOLLEXCLUSIVE;
+	event.data.ptr = NULL;
+	if (epoll_ctl(worker->epoll, EPOLL_CTL_ADD, listener, &event) != 0)
+		return E_IO_ERROR;
+	event.events = EPOLLIN;
+	event.data.ptr = worker;
+	if (epoll_ctl(worker->epoll, EPOLL_CTL_ADD, stop, &event) != 0)
+		return E_IO_ERROR;
+	return E_SUCCESS;
+}
+
+int lisp_server_listen(char* path, TinyLisp err)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		lisp_error_set(err, E_IO_ERROR, "Socket path %s is too long", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	// A socket left behind by a server which did not stop cleanly is replaced
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || lisp_server_set_flags(fd) != E_SUCCESS || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+		|| listen(fd, LISP_SERVER_BACKLOG) != 0) {
+		lisp_error_set(err, E_IO_ERROR, "Could not listen on %s: %s", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+error_t lisp_server_run(LispServerConfig config, TinyLisp err)
+{
+	int nworkers = config->workers > 0 ? config->workers : 1;
+	LispWorker workers = calloc(nworkers, sizeof(struct LispWorker_));
+	if (workers == NULL) {
+		lisp_error_set(err, E_MEMORY_ERROR, NULL);
+		return E_MEMORY_ERROR;
+	}
+	int stop[2];
+	if (pipe(stop) != 0) {
+		free(workers);
+		lisp_error_set(err, E_IO_ERROR, "Could not create a pipe: %s", strerror(errno));
+		return E_IO_ERROR;
+	}
+	int listener = -1;
+	error_t res = lisp_server_set_flags(stop[0]) == E_SUCCESS && lisp_server_set_flags(stop[1]) == E_SUCCESS
+		? E_SUCCESS : E_IO_ERROR;
+	if (res != E_SUCCESS)
+		lisp_error_set(err, res, "Could not create a pipe: %s", strerror(errno));
+	else
+		listener = lisp_server_listen(config->path, err);
+	if (res == E_SUCCESS && listener < 0)
+		res = E_IO_ERROR;
+	for (int i = 0; i < nworkers; ++i)
+		workers[i].epoll = -1;
+	for (int i = 0; i < nworkers && res == E_SUCCESS; ++i) {
+		res = lisp_worker_init(&workers[i], config, listener, stop[0]);
+		if (res != E_SUCCESS)
+			lisp_error_set(err, res, "Could not create an event loop: %s", strerror(errno));
+	}
+
+	if (res == E_SUCCESS) {
+		lisp_server_catch_signals(stop[1]);
+		// A worker whose thread cannot be started leaves its connections to the others
+		for (int i = 1; i < nworkers; ++i) {
+			workers[i].started = pthread_create(&workers[i].thread, NULL, lisp_worker_run, &workers[i]) == 0;
+			if (!workers[i].started) {
+				close(workers[i].epoll);
+				workers[i].epoll = -1;
+			}
+		}
+		lisp_worker_run(&workers[0]);
+		for (int i = 1; i < nworkers; ++i) {
+			if (workers[i].started) {
+				pthread_join(workers[i].thread, NULL);
+				lisp_stats_add(&workers[i].stats);
+			}
+		}
+		lisp_server_release_signals();
+	}
+
+	for (int i = 0; i < nworkers; ++i) {
+		if (workers[i].epoll >= 0)
+			close(workers[i].epoll);
+	}
+	free(workers);
+	if (listener >= 0) {
+		close(listener);
+		unlink(config->path);
+	}
+	close(stop[0]);
+	close(stop[1]);
+	return res;
+}
+#else
+const int lisp_server_supported = 0;
+
+error_t lisp_server_run(LispServerConfig config, TinyLisp err)
+{
+	(void)config;
+	lisp_error_set(err, E_IO_ERROR, "--serve is not supported on this platform");
+	return E_IO_ERROR;
+}
+#endif
@@ -0,0 +1,58 @@
+#ifndef TINYLISP_SERVER_H
+#define TINYLISP_SERVER_H
+
+#include "tinylisp.h"
+
+// Requests and responses are framed by a 4 byte big-endian length followed by that many bytes of text.
+// Connections sending a longer request are closed.
+#define LISP_SERVER_MAX_FRAME (1 << 24)
+// Connections waiting to be accepted
+#define LISP_SERVER_BACKLOG 128
+// Events handled per wait of the event loop
+#define LISP_SERVER_EVENTS 64
+// Bytes read from a connection at a time
+#define LISP_SERVER_READ_SIZE 16384
+
+typedef struct LispServerConfig_ *LispServerConfig;
+
+struct LispServerConfig_
+{
+	// path of the Unix domain socket to listen on
+	char* path;
+	// threads each running an event loop, the first being the calling thread
+	int workers;
+	// image restored and then text evaluated in each new session before its first request, or NULL
+	char* image;
+	char* prelude;
+	// copied to each session's interpreter
+	int optimize, jit, hash_cons;
+	struct LispBudget_ budget;
+};
+
+// Returns 1 if lisp_server_run is available on this platform
+extern const int lisp_server_supported;
+
+// Return the length held in the 4 byte header of a frame
+unsigned int lisp_server_frame_size(const char* header);
+// Write the header of a frame of size bytes
+void lisp_server_frame_header(char* header, unsigned int size);
+// Evaluate each form of text in lisp under its budget, writing its result or error to out on a line of its own. Returns
+// E_SUCCESS, or the error which stopped text being parsed, which is also written.
+error_t lisp_server_evaluate(TinyLisp lisp, char* text, LispWriter out);
+// Listen on config->path until SIGINT or SIGTERM, giving each connection a TinyLisp session of its own which
+// evaluates each request it sends with lisp_server_evaluate and replies with what was written. Sessions stay
+// on the worker which accepted them, so a long evaluation only delays the connections of one worker.
+// Returns E_SUCCESS once stopped, or E_IO_ERROR with a message in err if the socket could not be set up.
+error_t lisp_server_run(LispServerConfig config, TinyLisp err);
+
+// Used by lisp_server_run and the pre-forked pool, where available:
+// Return a non-blocking socket listening on path, or -1 with an error set on err
+int lisp_server_listen(char* path, TinyLisp err);
+// Make fd non-blocking and not inherited by child processes
+error_t lisp_server_set_flags(int fd);
+// Make SIGINT and SIGTERM write to fd, which is watched by the event loops to stop, and ignore SIGPIPE
+void lisp_server_catch_signals(int fd);
+// Restore the default handling of SIGINT and SIGTERM
+void lisp_server_release_signals();
+
+#endif
@@ -4,24 +4,24 @@
 #include "error.h"
 #include "stack.h"
 #include "builtins.h"
+#include "stats.h"
 
-// Returns the highest position of k in keys for which k <= key
+// Returns the highest position of k in keys for which k <= key, or -1 if every k is greater than key
 int bfind_key(int n_keys, char** keys, char* key)
 {
 	int low = 0;
 	int high = n_keys;
-	int mid = n_keys / 2;
-	while (low != mid) {
+	while (low < high) {
+		int mid = (low + high) / 2;
 		int comp = strcmp(keys[mid], key);
 		if (comp == 0)
 			return mid;
 		if (comp < 0)
-			low = mid;
+			low = mid + 1;
 		else
 			high = mid;
-		mid = (high + low) / 2;
 	}
-	return mid;
+	return low - 1;
 }
 
 LispStackFrame lisp_stackframe_new()
@@ -32,18 +32,69 @@ LispStackFrame lisp_stackframe_new()
 	frame->size = frame->capacity = 0;
 	frame->keys = NULL;
 	frame->vals = NULL;
+	frame->owns_keys = 1;
+	return frame;
+}
+
+LispStackFrame lisp_stackframe_new_shared(int size, char** keys)
+{
+	LispStackFrame frame = malloc(sizeof(struct LispStackFrame_));
+	if (frame == NULL)
+		return NULL;
+	frame->vals = NULL;
+	if (size > 0) {
+		frame->vals = calloc(size, sizeof(LispObject));
+		if (frame->vals == NULL) {
+			free(frame);
+			return NULL;
+		}
+	}
+	frame->size = frame->capacity = size;
+	frame->keys = keys;
+	frame->owns_keys = 0;
 	return frame;
 }
 
 void lisp_stackframe_free(LispStackFrame frame)
 {
+	// Slots of shared frames are left NULL if filling them in failed part way through
 	for (int i = 0; i < frame->size; ++i) {
-		free(frame->keys[i]);
-		lisp_object_free(frame->vals[i]);
+		if (frame->owns_keys)
+			free(frame->keys[i]);
+		if (frame->vals[i] != NULL)
+			lisp_object_free(frame->vals[i]);
 	}
+	if (frame->owns_keys)
+		free(frame->keys);
+	free(frame->vals);
 	free(frame);
 }
 
+// Replace borrowed keys with copies owned by the frame
+error_t lisp_stackframe_own_keys(LispStackFrame frame)
+{
+	if (frame->owns_keys)
+		return E_SUCCESS;
+	char** keys = NULL;
+	if (frame->capacity > 0) {
+		keys = malloc(sizeof(char*) * frame->capacity);
+		if (keys == NULL)
+			return E_MEMORY_ERROR;
+	}
+	for (int i = 0; i < frame->size; ++i) {
+		keys[i] = _strdup(frame->keys[i]);
+		if (keys[i] == NULL) {
+			for (int j = 0; j < i; ++j)
+				free(keys[j]);
+			free(keys);
+			return E_MEMORY_ERROR;
+		}
+	}
+	frame->keys = keys;
+	frame->owns_keys = 1;
+	return E_SUCCESS;
+}
+
 error_t lisp_stackframe_grow(LispStackFrame frame)
 {
 	if (frame->capacity == 0) {
@@ -83,20 +134,28 @@ error_t lisp_stackframe_grow_if_full(LispStackFrame frame)
 	return E_SUCCESS;
 }
 
-LispObject lisp_stackframe_find(LispStackFrame frame, char* key)
+int lisp_stackframe_index(LispStackFrame frame, char* key)
 {
 	if (frame->size == 0)
-		return NULL;
+		return -1;
 
 	int pos = bfind_key(frame->size, frame->keys, key);
-	if (strcmp(frame->keys[pos], key) == 0)
-		return frame->vals[pos];
-	return NULL;
+	if (pos >= 0 && strcmp(frame->keys[pos], key) == 0)
+		return pos;
+	return -1;
+}
+
+LispObject lisp_stackframe_find(LispStackFrame frame, char* key)
+{
+	int pos = lisp_stackframe_index(frame, key);
+	return pos >= 0 ? frame->vals[pos] : NULL;
 }
 
 error_t lisp_stackframe_set(LispStackFrame frame, char* key, LispObject val)
 {
-	error_t err;
+	error_t err = lisp_stackframe_own_keys(frame);
+	if (err != E_SUCCESS)
+		return err;
 	if (frame->size == 0) {
 		err = lisp_stackframe_grow_if_full(frame);
 		if (err != E_SUCCESS)
@@ -110,7 +169,7 @@ error_t lisp_stackframe_set(LispStackFrame frame, char* key, LispObject val)
 	}
 
 	int pos = bfind_key(frame->size, frame->keys, key);
-	if (strcmp(frame->keys[pos], key) == 0) {
+	if (pos >= 0 && strcmp(frame->keys[pos], key) == 0) {
 		return E_NAME_ALREADY_SET;
 	}
 	else {
@@ -160,27 +219,36 @@ LispStack lisp_stack_new()
 
 	// Insert builtins to global namespace
 	LispStackFrame globals = stack->frames[0];
-	lisp_stackframe_set(globals, "c", lisp_builtin_new(construct));
-	lisp_stackframe_set(globals, "h", lisp_builtin_new(head));
-	lisp_stackframe_set(globals, "t", lisp_builtin_new(tail));
-	lisp_stackframe_set(globals, "s", lisp_builtin_new(subtract));
-	lisp_stackframe_set(globals, "l", lisp_builtin_new(lessthan));
-	lisp_stackframe_set(globals, "e", lisp_builtin_new(equal));
-	lisp_stackframe_set(globals, "v", lisp_builtin_new(eval));
-	lisp_stackframe_set(globals, "q", lisp_builtin_new(quote));
-	lisp_stackframe_set(globals, "i", lisp_builtin_new(ternary));
-	lisp_stackframe_set(globals, "d", lisp_builtin_new(def));
+	for (int i = 0; i < B_SIZE; ++i)
+		lisp_stackframe_set(globals, builtindesc[i].name, lisp_builtin_new(builtindesc[i].func));
 
 	return stack;
 }
 
 void lisp_stack_free(LispStack stack)
 {
-	for (int i = 0; i < stack->nframes; ++i)
-		free(stack->frames[i]);
+	// Optimized bodies refer to globals directly, so recursive functions would otherwise keep themselves alive
+	LispStackFrame globals = stack->frames[0];
+	if (globals != NULL) {
+		for (int i = 0; i < globals->size; ++i)
+			lisp_object_clear_caches(globals->vals[i]);
+	}
+	for (int i = 0; i < stack->nframes; ++i) {
+		if (stack->frames[i] != NULL)
+			lisp_stackframe_free(stack->frames[i]);
+	}
 	free(stack);
 }
 
+void lisp_stack_freeze(LispStack stack, int frozen)
+{
+	LispStackFrame globals = stack->frames[0];
+	for (int i = 0; frozen && i < globals->size; ++i)
+		lisp_object_clear_caches(globals->vals[i]);
+	for (int i = 0; i < globals->size; ++i)
+		lisp_object_freeze(globals->vals[i], frozen);
+}
+
 LispObject lisp_stack_find(LispStack stack, char* key)
 {
 	LispObject res = lisp_stackframe_find(stack->frames[stack->nframes - 1], key);
@@ -196,7 +264,16 @@ error_t lisp_stack_setlocal(LispStack stack, char* key, LispObject val)
 
 error_t lisp_stack_setglobal(LispStack stack, char* key,LispObject val)
 {
-	return lisp_stackframe_set(stack->frames[0], key, lisp_object_create_reference(val));
+	error_t err = lisp_stackframe_set(stack->frames[0], key, lisp_object_create_reference(val));
+	if (err != E_SUCCESS) {
+		(void)LISP_DECREF(val);
+		return err;
+	}
+	// Lists remember the first name they are bound to so that they can be identified when called;
+	// failing to record it only makes the list anonymous
+	if (val->type == T_LIST)
+		lisp_list_set_name(val, key);
+	return E_SUCCESS;
 }
 
 error_t lisp_stack_push(LispStack stack, LispStackFrame frame)
@@ -205,6 +282,9 @@ error_t lisp_stack_push(LispStack stack, LispStackFrame frame)
 		return E_STACK_OVERFLOW;
 	stack->frames[stack->nframes] = frame;
 	++stack->nframes;
+	++lisp_stats.frames_pushed;
+	if (stack->nframes > lisp_stats.max_depth)
+		lisp_stats.max_depth = stack->nframes;
 	return E_SUCCESS;
 }
 
@@ -216,6 +296,9 @@ error_t lisp_stack_push_empty(LispStack stack)
 	if (stack->frames[stack->nframes] == NULL)
 		return E_MEMORY_ERROR;
 	++stack->nframes;
+	++lisp_stats.frames_pushed;
+	if (stack->nframes > lisp_stats.max_depth)
+		lisp_stats.max_depth = stack->nframes;
 	return E_SUCCESS;
 }
 
@@ -13,10 +13,16 @@ struct LispStackFrame_
 	int size, capacity;
 	char** keys;
 	LispObject* vals;
+	// 0 if keys is borrowed from a lambda, in which case it is copied before the frame is modified
+	int owns_keys;
 };
 
 LispStackFrame lisp_stackframe_new();
+// malloc a frame of size empty slots using the sorted array keys, which must outlive the frame
+LispStackFrame lisp_stackframe_new_shared(int size, char** keys);
 void lisp_stackframe_free(LispStackFrame frame);
+// Returns the slot of frame holding key, or -1
+int lisp_stackframe_index(LispStackFrame frame, char* key);
 LispObject lisp_stackframe_find(LispStackFrame frame, char* key);
 error_t lisp_stackframe_set(LispStackFrame frame, char* key, LispObject val);
 void lisp_stackframe_print(LispStackFrame frame);
@@ -35,5 +41,7 @@ error_t lisp_stack_setglobal(LispStack stack, char* key, LispObject val);
 error_t lisp_stack_push(LispStack stack, LispStackFrame frame);
 error_t lisp_stack_push_empty(LispStack stack);
 void lisp_stack_pop(LispStack stack);
+// Freeze the global definitions, clearing their caches first, if frozen is 1; thaw them if it is 0
+void lisp_stack_freeze(LispStack stack, int frozen);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include <limits.h>
+#include <string.h>
+
+#include "stats.h"
+
+LISP_THREAD_LOCAL struct LispStats_ lisp_stats;
+
+void lisp_stats_reset()
+{
+	memset(&lisp_stats, 0, sizeof(lisp_stats));
+}
+
+void lisp_stats_add(struct LispStats_* other)
+{
+	for (int i = 0; i < T_SIZE; ++i) {
+		lisp_stats.evaluations[i] += other->evaluations[i];
+		lisp_stats.allocated[i] += other->allocated[i];
+		lisp_stats.freed[i] += other->freed[i];
+	}
+	for (int i = 0; i < B_SIZE; ++i)
+		lisp_stats.builtin_calls[i] += other->builtin_calls[i];
+	lisp_stats.data_bytes += other->data_bytes;
+	lisp_stats.frames_pushed += other->frames_pushed;
+	if (other->max_depth > lisp_stats.max_depth)
+		lisp_stats.max_depth = other->max_depth;
+	lisp_stats.list_copies += other->list_copies;
+	lisp_stats.list_copy_bytes += other->list_copy_bytes;
+	lisp_stats.expansions += other->expansions;
+	lisp_stats.expansion_hits += other->expansion_hits;
+	lisp_stats.jit_compiles += other->jit_compiles;
+	lisp_stats.jit_calls += other->jit_calls;
+	lisp_stats.jit_bailouts += other->jit_bailouts;
+	lisp_stats.int_inline += other->int_inline;
+	lisp_stats.int_misses += other->int_misses;
+	lisp_stats.hashcons_hits += other->hashcons_hits;
+}
+
+long long lisp_stats_live_bytes()
+{
+	long long objects = 0;
+	for (int i = 0; i < T_SIZE; ++i)
+		objects += lisp_stats.allocated[i] - lisp_stats.freed[i];
+	return objects * (long long)sizeof(struct LispObject_) + lisp_stats.data_bytes;
+}
+
+// Returns the list (name value), clamping value to the range of an integer
+LispObject lisp_stats_entry(char* name, long long value)
+{
+	LispObject key = lisp_symbol_new(name);
+	LispObject val = lisp_integer_new(value > INT_MAX ? INT_MAX : (int)value);
+	if (key == NULL || val == NULL) {
+		if (key != NULL)
+			lisp_object_free(key);
+		if (val != NULL)
+			lisp_object_free(val);
+		return NULL;
+	}
+	LispObject entry = lisp_list_new_from_args(2, key, val);
+	if (entry == NULL) {
+		lisp_object_free(key);
+		lisp_object_free(val);
+	}
+	return entry;
+}
+
+// Pushes entry to list, taking ownership of it; returns 0 if entry is NULL or cannot be pushed
+int lisp_stats_push(LispObject list, LispObject entry)
+{
+	if (entry == NULL)
+		return 0;
+	if (lisp_list_push(list, entry) != E_SUCCESS) {
+		lisp_object_free(entry);
+		return 0;
+	}
+	return 1;
+}
+
+// Returns the list (name (key value) ...) with a key for each type
+LispObject lisp_stats_by_type(char* name, long long* counts)
+{
+	LispObject group = lisp_list_new();
+	if (group == NULL)
+		return NULL;
+	int ok = lisp_stats_push(group, lisp_symbol_new(name));
+	for (int i = 0; i < T_SIZE && ok; ++i)
+		ok = lisp_stats_push(group, lisp_stats_entry(typedesc[i].name, counts[i]));
+	if (!ok) {
+		lisp_object_free(group);
+		return NULL;
+	}
+	return group;
+}
+
+LispObject lisp_stats_list()
+{
+	LispObject res = lisp_list_new();
+	if (res == NULL)
+		return NULL;
+
+	LispObject builtins = lisp_list_new();
+	int ok = builtins != NULL && lisp_stats_push(builtins, lisp_symbol_new("builtins"));
+	for (int i = 0; i < B_SIZE && ok; ++i)
+		ok = lisp_stats_push(builtins, lisp_stats_entry(builtindesc[i].name, lisp_stats.builtin_calls[i]));
+	if (!ok && builtins != NULL) {
+		lisp_object_free(builtins);
+		builtins = NULL;
+	}
+
+	ok = lisp_stats_push(res, lisp_stats_by_type("evaluations", lisp_stats.evaluations))
+		&& lisp_stats_push(res, builtins)
+		&& lisp_stats_push(res, lisp_stats_entry("frames", lisp_stats.frames_pushed))
+		&& lisp_stats_push(res, lisp_stats_entry("max-depth", lisp_stats.max_depth))
+		&& lisp_stats_push(res, lisp_stats_by_type("allocated", lisp_stats.allocated))
+		&& lisp_stats_push(res, lisp_stats_by_type("freed", lisp_stats.freed))
+		&& lisp_stats_push(res, lisp_stats_entry("live-bytes", lisp_stats_live_bytes()))
+		&& lisp_stats_push(res, lisp_stats_entry("list-copies", lisp_stats.list_copies))
+		&& lisp_stats_push(res, lisp_stats_entry("list-copy-bytes", lisp_stats.list_copy_bytes))
+		&& lisp_stats_push(res, lisp_stats_entry("expansions", lisp_stats.expansions))
+		&& lisp_stats_push(res, lisp_stats_entry("expansion-hits", lisp_stats.expansion_hits))
+		&& lisp_stats_push(res, lisp_stats_entry("jit-compiles", lisp_stats.jit_compiles))
+		&& lisp_stats_push(res, lisp_stats_entry("jit-calls", lisp_stats.jit_calls))
+		&& lisp_stats_push(res, lisp_stats_entry("jit-bailouts", lisp_stats.jit_bailouts))
+		&& lisp_stats_push(res, lisp_stats_entry("int-inline", lisp_stats.int_inline))
+		&& lisp_stats_push(res, lisp_stats_entry("int-misses", lisp_stats.int_misses))
+		&& lisp_stats_push(res, lisp_stats_entry("hash-cons-hits", lisp_stats.hashcons_hits));
+	if (!ok) {
+		lisp_object_free(res);
+		return NULL;
+	}
+	return res;
+}
+
+error_t lisp_stats_write(LispWriter writer)
+{
+	LispObject stats = lisp_stats_list();
+	if (stats == NULL)
+		return E_MEMORY_ERROR;
+	error_t err = E_SUCCESS;
+	for (int i = 0; i < lisp_list_size(stats) && err == E_SUCCESS; ++i) {
+		err = lisp_object_write(writer, lisp_list_at(stats, i));
+		if (err == E_SUCCESS)
+			err = lisp_writer_putc(writer, '\n');
+	}
+	lisp_object_free(stats);
+	return err;
+}
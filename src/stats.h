@@ -0,0 +1,52 @@
+#ifndef TINYLISP_STATS_H
+#define TINYLISP_STATS_H
+
+#include "object.h"
+#include "builtins.h"
+
+// Counters updated unconditionally on the interpreter's hot paths
+struct LispStats_
+{
+	long long evaluations[T_SIZE];
+	long long builtin_calls[B_SIZE];
+	long long frames_pushed;
+	int max_depth;
+	long long allocated[T_SIZE];
+	long long freed[T_SIZE];
+	// bytes held by list storage, symbol text and map nodes, besides the objects counted above
+	long long data_bytes;
+	long long list_copies;
+	long long list_copy_bytes;
+	long long expansions;
+	long long expansion_hits;
+	long long jit_compiles;
+	long long jit_calls;
+	long long jit_bailouts;
+	long long int_inline;
+	long long int_misses;
+	// objects made by the parser and c which were replaced by an equal one already shared
+	long long hashcons_hits;
+};
+
+// Each thread keeps its own counters, so that a thread parsing input alongside the interpreter does not race
+// with it; the thread's counters are added to the interpreter's with lisp_stats_add when it finishes
+#ifdef _MSC_VER
+#define LISP_THREAD_LOCAL __declspec(thread)
+#else
+#define LISP_THREAD_LOCAL _Thread_local
+#endif
+
+extern LISP_THREAD_LOCAL struct LispStats_ lisp_stats;
+
+// Zero every counter
+void lisp_stats_reset();
+// Add the counters of other, taken from another thread, to those of this thread
+void lisp_stats_add(struct LispStats_* other);
+// Bytes held by the objects allocated and not yet freed on this thread
+long long lisp_stats_live_bytes();
+// Return the counters as a list of (name value) and (name (key value) ...) entries
+LispObject lisp_stats_list();
+// Write each entry of lisp_stats_list to writer on its own line
+error_t lisp_stats_write(LispWriter writer);
+
+#endif
@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "stream.h"
+#include "parse.h"
+#include "eval.h"
+#include "stats.h"
+
+#ifndef _WIN32
+#define LISP_STREAM_THREADED
+#include <pthread.h>
+#endif
+
+typedef struct LispStreamBatch_ *LispStreamBatch;
+typedef struct LispStream_ *LispStream;
+
+struct LispStreamBatch_
+{
+	int size;
+	LispObject records[LISP_STREAM_BATCH];
+};
+
+struct LispStream_
+{
+	// the interpreter side: the call of the function records are passed to, and where results go
+	TinyLisp lisp;
+	LispObject call;
+	LispWriter out;
+	// the reader side: the input, where parse errors are recorded, the counters of the reader thread and
+	// the error which stopped it
+	FILE* input;
+	struct TinyLisp_ errors;
+	struct LispStats_ reader_stats;
+	error_t err;
+#ifdef LISP_STREAM_THREADED
+	// batches parsed and waiting for the interpreter, oldest at head
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	LispStreamBatch queue[LISP_STREAM_QUEUE];
+	int head, count, done;
+	// 0 if the reader could not be started on a thread of its own
+	int threaded;
+#endif
+};
+
+// Call the function with each record of batch and write the results, then free the batch
+void lisp_stream_apply(LispStream stream, LispStreamBatch batch)
+{
+	TinyLisp lisp = stream->lisp;
+	for (int i = 0; i < batch->size; ++i) {
+		lisp_budget_start(lisp);
+		LispObject res = lisp_evaluate_apply_values(lisp, stream->call, &batch->records[i]);
+		if (res != NULL) {
+			lisp_object_write(stream->out, res);
+			lisp_writer_putc(stream->out, '\n');
+			lisp_object_free(res);
+		}
+		else {
+			lisp_writer_flush(stream->out);
+			lisp_print_error(lisp);
+			lisp_clear_error(lisp);
+		}
+		lisp_object_free(batch->records[i]);
+	}
+	free(batch);
+}
+
+// Hand a full batch to the interpreter, waiting for room in the queue if it is full
+void lisp_stream_emit(LispStream stream, LispStreamBatch batch)
+{
+#ifdef LISP_STREAM_THREADED
+	if (!stream->threaded) {
+		lisp_stream_apply(stream, batch);
+		return;
+	}
+	pthread_mutex_lock(&stream->lock);
+	while (stream->count == LISP_STREAM_QUEUE)
+		pthread_cond_wait(&stream->changed, &stream->lock);
+	stream->queue[(stream->head + stream->count) % LISP_STREAM_QUEUE] = batch;
+	++stream->count;
+	pthread_cond_broadcast(&stream->changed);
+	pthread_mutex_unlock(&stream->lock);
+#else
+	lisp_stream_apply(stream, batch);
+#endif
+}
+
+// Return the record for the len characters of line, which is overwritten; NULL if out of memory
+LispObject lisp_stream_parse_line(LispStream stream, char* line, int len)
+{
+	if (len > 0 && line[len - 1] == '\r')
+		--len;
+	line[len] = '\0';
+	LispObject first = NULL;
+	LispObject list = NULL;
+	int pos = 0;
+	int raw = 0;
+	for (;;) {
+		LispObject obj = lisp_parse(&stream->errors, line, &pos);
+		if (obj == NULL) {
+			raw = stream->errors.err_code != E_NO_INPUT;
+			lisp_clear_error(&stream->errors);
+			break;
+		}
+		if (first == NULL) {
+			first = obj;
+			continue;
+		}
+		if (list == NULL) {
+			list = lisp_list_new_from_args(1, first);
+			if (list == NULL) {
+				lisp_object_free(obj);
+				break;
+			}
+		}
+		if (lisp_list_push(list, obj) != E_SUCCESS) {
+			lisp_object_free(obj);
+			lisp_object_free(list);
+			return NULL;
+		}
+	}
+	if (first != NULL && list == NULL && !raw)
+		return first;
+	if (list != NULL && !raw)
+		return list;
+	if (list != NULL)
+		lisp_object_free(list);
+	else if (first != NULL)
+		lisp_object_free(first);
+	return raw ? lisp_symbol_new_n(line, len) : lisp_list_new();
+}
+
+// Read the whole input, parsing each line into a record and emitting them a batch at a time
+void lisp_stream_read(LispStream stream)
+{
+	int capacity = LISP_STREAM_BLOCK;
+	char* buffer = malloc(capacity + 1);
+	LispStreamBatch batch = malloc(sizeof(struct LispStreamBatch_));
+	if (buffer == NULL || batch == NULL) {
+		free(buffer);
+		free(batch);
+		stream->err = E_MEMORY_ERROR;
+		return;
+	}
+	batch->size = 0;
+	int len = 0;
+	int eof = 0;
+	while (!eof && stream->err == E_SUCCESS) {
+		// A line longer than the buffer doubles it
+		if (len == capacity) {
+			char* grown = realloc(buffer, capacity * 2 + 1);
+			if (grown == NULL) {
+				stream->err = E_MEMORY_ERROR;
+				break;
+			}
+			buffer = grown;
+			capacity *= 2;
+		}
+		size_t n = fread(buffer + len, 1, capacity - len, stream->input);
+		if (n == 0) {
+			if (ferror(stream->input))
+				stream->err = E_IO_ERROR;
+			eof = 1;
+		}
+		len += (int)n;
+		int start = 0;
+		while (stream->err == E_SUCCESS && start < len) {
+			char* newline = memchr(buffer + start, '\n', len - start);
+			// The last line may have no newline after it
+			if (newline == NULL && !eof)
+				break;
+			int end = newline != NULL ? (int)(newline - buffer) : len;
+			LispObject record = lisp_stream_parse_line(stream, buffer + start, end - start);
+			if (record == NULL) {
+				stream->err = E_MEMORY_ERROR;
+				break;
+			}
+			batch->records[batch->size++] = record;
+			if (batch->size == LISP_STREAM_BATCH) {
+				lisp_stream_emit(stream, batch);
+				batch = malloc(sizeof(struct LispStreamBatch_));
+				if (batch == NULL) {
+					stream->err = E_MEMORY_ERROR;
+					break;
+				}
+				batch->size = 0;
+			}
+			start = end + 1;
+		}
+		if (start < len)
+			memmove(buffer, buffer + start, len - start);
+		len = start < len ? len - start : 0;
+	}
+	if (batch != NULL && batch->size > 0)
+		lisp_stream_emit(stream, batch);
+	else
+		free(batch);
+	free(buffer);
+}
+
+#ifdef LISP_STREAM_THREADED
+void* lisp_stream_reader(void* arg)
+{
+	LispStream stream = arg;
+	lisp_stream_read(stream);
+	stream->reader_stats = lisp_stats;
+	pthread_mutex_lock(&stream->lock);
+	stream->done = 1;
+	pthread_cond_broadcast(&stream->changed);
+	pthread_mutex_unlock(&stream->lock);
+	return NULL;
+}
+
+// Apply the batches the reader thread emits until it has finished and they have all been applied
+error_t lisp_stream_run(LispStream stream)
+{
+	pthread_mutex_init(&stream->lock, NULL);
+	pthread_cond_init(&stream->changed, NULL);
+	stream->head = stream->count = stream->done = 0;
+	pthread_t reader;
+	// Without a thread the input is read on this one instead, applying each batch as it is emitted
+	stream->threaded = 1;
+	if (pthread_create(&reader, NULL, lisp_stream_reader, stream) != 0) {
+		stream->threaded = 0;
+		lisp_stream_read(stream);
+		stream->done = 1;
+	}
+	for (;;) {
+		pthread_mutex_lock(&stream->lock);
+		while (stream->count == 0 && !stream->done)
+			pthread_cond_wait(&stream->changed, &stream->lock);
+		if (stream->count == 0) {
+			pthread_mutex_unlock(&stream->lock);
+			break;
+		}
+		LispStreamBatch batch = stream->queue[stream->head];
+		stream->head = (stream->head + 1) % LISP_STREAM_QUEUE;
+		--stream->count;
+		pthread_cond_broadcast(&stream->changed);
+		pthread_mutex_unlock(&stream->lock);
+		lisp_stream_apply(stream, batch);
+	}
+	if (stream->threaded) {
+		pthread_join(reader, NULL);
+		lisp_stats_add(&stream->reader_stats);
+	}
+	pthread_cond_destroy(&stream->changed);
+	pthread_mutex_destroy(&stream->lock);
+	return stream->err;
+}
+#else
+error_t lisp_stream_run(LispStream stream)
+{
+	lisp_stream_read(stream);
+	return stream->err;
+}
+#endif
+
+error_t lisp_stream_map(TinyLisp lisp, LispObject func, FILE* input, LispWriter out)
+{
+	LispStream stream = calloc(1, sizeof(struct LispStream_));
+	if (stream == NULL)
+		return E_MEMORY_ERROR;
+	stream->lisp = lisp;
+	stream->out = out;
+	stream->input = input;
+	stream->err = E_SUCCESS;
+	stream->call = lisp_evaluate_new_call(func, 1);
+	if (stream->call == NULL) {
+		free(stream);
+		return E_MEMORY_ERROR;
+	}
+	error_t err = lisp_stream_run(stream);
+	lisp_writer_flush(out);
+	lisp_object_free(stream->call);
+	free(stream);
+	return err;
+}
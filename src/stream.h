@@ -0,0 +1,22 @@
+#ifndef TINYLISP_STREAM_H
+#define TINYLISP_STREAM_H
+
+#include <stdio.h>
+
+#include "tinylisp.h"
+#include "writer.h"
+
+// Bytes read from the input at a time, and so the longest line read without growing the buffer
+#define LISP_STREAM_BLOCK (1 << 16)
+// Records handed from the reader to the interpreter at a time, and batches of them waiting at most
+#define LISP_STREAM_BATCH 4096
+#define LISP_STREAM_QUEUE 4
+
+// Read input line by line and write the result of calling func with each line to out, one per line, or the
+// error the call raised. A line holding a single form is passed as that form, unevaluated; one holding
+// several is passed as a list of them, and one which cannot be parsed as a symbol holding the whole line.
+// Where threads are available the input is read and parsed on a separate thread while func runs.
+// Returns E_SUCCESS, or the error which stopped the input being read.
+error_t lisp_stream_map(TinyLisp lisp, LispObject func, FILE* input, LispWriter out);
+
+#endif
@@ -1,8 +1,19 @@
 ﻿#include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <string.h>
 
 #include "tinylisp.h"
+#include "stats.h"
+#include "resume.h"
+#include "hashcons.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 TinyLisp lisp_new()
 {
@@ -11,6 +22,12 @@ TinyLisp lisp_new()
 		return NULL;
 	lisp->err_code = E_SUCCESS;
 	lisp->err_msg[0] = '\0';
+	lisp->optimize = 1;
+	lisp->jit = 0;
+	lisp->hash_cons = 0;
+	lisp->conses = NULL;
+	memset(&lisp->budget, 0, sizeof(lisp->budget));
+	lisp->budget.countdown = lisp->budget.interval = LLONG_MAX;
 	lisp->stack = lisp_stack_new();
 	if (lisp->stack == NULL) {
 		free(lisp);
@@ -21,7 +38,9 @@ TinyLisp lisp_new()
 
 void lisp_free(TinyLisp lisp)
 {
-	free(lisp->stack);
+	lisp_stack_free(lisp->stack);
+	if (lisp->conses != NULL)
+		lisp_conses_free(lisp->conses);
 	free(lisp);
 }
 
@@ -40,6 +59,20 @@ void lisp_print_error(TinyLisp lisp)
 		printf(": %s\n", lisp->err_msg);
 }
 
+error_t lisp_write_error(TinyLisp lisp, LispWriter writer)
+{
+	lisp_writer_puts(writer, "Error ");
+	lisp_writer_integer(writer, lisp->err_code);
+	lisp_writer_puts(writer, " (");
+	lisp_writer_puts(writer, errordesc[lisp->err_code].message);
+	lisp_writer_putc(writer, ')');
+	if (lisp->err_msg[0] != '\0') {
+		lisp_writer_puts(writer, ": ");
+		lisp_writer_puts(writer, lisp->err_msg);
+	}
+	return lisp_writer_putc(writer, '\n');
+}
+
 void lisp_error_set(TinyLisp lisp, error_t err_code, char* format, ...)
 {
 	lisp->err_code = err_code;
@@ -52,4 +85,104 @@ void lisp_error_set(TinyLisp lisp, error_t err_code, char* format, ...)
 		vsnprintf_s(lisp->err_msg, LISP_MAX_ERR_MSG_SIZE, LISP_MAX_ERR_MSG_SIZE, format, args);
 		va_end(args);
 	}
-}
\ No newline at end of file
+}
+
+long long lisp_time_ns()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (long long)(counter.QuadPart / frequency.QuadPart) * 1000000000LL
+		+ (long long)(counter.QuadPart % frequency.QuadPart) * 1000000000LL / frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+// Set the steps until the limits are next checked: never if there are none, and no later than the step
+// past max_steps or slice_end
+void lisp_budget_schedule(struct LispBudget_* budget)
+{
+	long long interval = LLONG_MAX;
+	if (budget->max_ns > 0 || budget->max_bytes > 0)
+		interval = LISP_BUDGET_INTERVAL;
+	if (budget->max_steps > 0 && budget->max_steps - budget->steps < interval - 1)
+		interval = budget->max_steps - budget->steps + 1;
+	if (budget->slice_end > 0 && budget->slice_end - budget->steps < interval - 1)
+		interval = budget->slice_end - budget->steps + 1;
+	budget->countdown = budget->interval = interval;
+}
+
+void lisp_budget_start(TinyLisp lisp)
+{
+	struct LispBudget_* budget = &lisp->budget;
+	budget->steps = 0;
+	budget->exceeded = BUDGET_RUNNING;
+	budget->deadline = budget->max_ns > 0 ? lisp_time_ns() + budget->max_ns : 0;
+	budget->base_bytes = budget->max_bytes > 0 ? lisp_stats_live_bytes() : 0;
+	budget->held_bytes = 0;
+	lisp_budget_schedule(budget);
+}
+
+void lisp_budget_suspend(TinyLisp lisp)
+{
+	struct LispBudget_* budget = &lisp->budget;
+	if (budget->max_bytes > 0)
+		budget->held_bytes += lisp_stats_live_bytes() - budget->base_bytes;
+}
+
+void lisp_budget_resume(TinyLisp lisp)
+{
+	struct LispBudget_* budget = &lisp->budget;
+	if (budget->max_bytes > 0)
+		budget->base_bytes = lisp_stats_live_bytes();
+}
+
+long long lisp_budget_bytes(TinyLisp lisp)
+{
+	struct LispBudget_* budget = &lisp->budget;
+	return budget->held_bytes + lisp_stats_live_bytes() - budget->base_bytes;
+}
+
+int lisp_budget_exceeded(TinyLisp lisp)
+{
+	struct LispBudget_* budget = &lisp->budget;
+	if (budget->exceeded == BUDGET_RUNNING) {
+		budget->steps += budget->interval - budget->countdown;
+		if (budget->slice_end > 0 && budget->steps > budget->slice_end && lisp_eval_yield(lisp))
+			budget->exceeded = BUDGET_CANCELLED;
+		else if (budget->max_steps > 0 && budget->steps > budget->max_steps)
+			budget->exceeded = BUDGET_STEPS;
+		else if (budget->max_ns > 0 && lisp_time_ns() >= budget->deadline)
+			budget->exceeded = BUDGET_TIME;
+		else if (budget->max_bytes > 0 && lisp_budget_bytes(lisp) > budget->max_bytes)
+			budget->exceeded = BUDGET_MEMORY;
+		if (budget->exceeded == BUDGET_RUNNING) {
+			lisp_budget_schedule(budget);
+			return 0;
+		}
+		// Every later step checks again, so that the evaluation stops even where an error is caught
+		budget->countdown = budget->interval = 0;
+	}
+	switch (budget->exceeded) {
+	case BUDGET_STEPS:
+		lisp_error_set(lisp, E_BUDGET_EXCEEDED, "Evaluation took more than %lld steps", budget->max_steps);
+		break;
+	case BUDGET_TIME:
+		lisp_error_set(lisp, E_BUDGET_EXCEEDED, "Evaluation took more than %lld ms", budget->max_ns / 1000000);
+		break;
+	case BUDGET_MEMORY:
+		lisp_error_set(lisp, E_BUDGET_EXCEEDED, "Evaluation held more than %lld bytes", budget->max_bytes);
+		break;
+	case BUDGET_CANCELLED:
+	default:
+		lisp_error_set(lisp, E_EVALUATION_ERROR, "Evaluation cancelled");
+		break;
+	}
+	return 1;
+}
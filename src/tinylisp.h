@@ -7,20 +7,86 @@
 
 #define LISP_MAX_ERR_MSG_SIZE 1024
 
+// Steps evaluated between checks of a budget's time and memory limits
+#define LISP_BUDGET_INTERVAL 1024
+
 typedef struct TinyLisp_ *TinyLisp;
+typedef struct LispConses_ *LispConses;
+
+// Why an evaluation under a budget was stopped
+enum LispBudgetStop_
+{
+	BUDGET_RUNNING,
+	BUDGET_STEPS,
+	BUDGET_TIME,
+	BUDGET_MEMORY,
+	// the host freed the suspended evaluation, which fails with E_EVALUATION_ERROR rather than
+	// E_BUDGET_EXCEEDED as no limit was passed
+	BUDGET_CANCELLED
+};
+
+// Limits on each evaluation begun with lisp_budget_start, which fails with E_BUDGET_EXCEEDED once it passes
+// one, or suspends it once it reaches slice_end. A step is a call of a function or an iteration of a loop or sequence; live bytes are those held by
+// objects the evaluation itself allocated and has not freed, counted from the thread's live bytes over the
+// spans in which it runs, so that other evaluations on the same thread in between are not counted.
+struct LispBudget_
+{
+	// 0 for no limit
+	long long max_steps, max_ns, max_bytes;
+	// steps left before the limits are next checked, counting down from interval
+	long long countdown, interval;
+	// steps taken up to the last check
+	long long steps;
+	// when the evaluation must finish
+	long long deadline;
+	// the thread's live bytes when the evaluation began or last resumed running, and the net bytes it
+	// allocated while running before then
+	long long base_bytes, held_bytes;
+	// set once a limit has been passed or the evaluation cancelled, failing every later step of it: with
+	// E_BUDGET_EXCEEDED for a limit and E_EVALUATION_ERROR once cancelled
+	enum LispBudgetStop_ exceeded;
+	// the step after which the resumable evaluation running in this interpreter is suspended, or 0
+	long long slice_end;
+};
 
 struct TinyLisp_
 {
 	error_t err_code;
 	char err_msg[LISP_MAX_ERR_MSG_SIZE];
 	LispStack stack;
+	// resolve global names and fold constants in lambda bodies
+	int optimize;
+	// compile hot integer-only lambdas to native code; requires optimize
+	int jit;
+	// share structurally equal lists, integers and symbols made by the parser and c; see lisp_hashcons
+	int hash_cons;
+	// the table of shared objects, created when first needed
+	LispConses conses;
+	struct LispBudget_ budget;
 };
 
 TinyLisp lisp_new();
 void lisp_free(TinyLisp lisp);
 void lisp_clear_error(TinyLisp lisp);
 void lisp_print_error(TinyLisp lisp);
+// Write the error in the form lisp_print_error prints it
+error_t lisp_write_error(TinyLisp lisp, LispWriter writer);
 void lisp_error_set(TinyLisp lisp, error_t err_code, char* format, ...);
+// Monotonic clock in nanoseconds
+long long lisp_time_ns();
+// Begin an evaluation under the limits of lisp->budget
+void lisp_budget_start(TinyLisp lisp);
+// Account for an evaluation under a budget giving up its thread to other work, and taking it back, so that
+// what is allocated in between is not counted against it
+void lisp_budget_suspend(TinyLisp lisp);
+void lisp_budget_resume(TinyLisp lisp);
+// The live bytes the evaluation running in lisp holds
+long long lisp_budget_bytes(TinyLisp lisp);
+// Check the limits once countdown runs out; returns 1 with an error set on lisp if one has been passed
+int lisp_budget_exceeded(TinyLisp lisp);
+// Count a step against the budget of lisp, which is only checked every so many steps. Evaluates to 1, with
+// an error set, if the evaluation must stop.
+#define LISP_BUDGET_STEP(lisp) (--(lisp)->budget.countdown <= 0 && lisp_budget_exceeded(lisp))
 
 
 
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "writer.h"
+
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+int lisp_writer_file_sink(void* ctx, const char* data, int len)
+{
+	return fwrite(data, sizeof(char), len, (FILE*)ctx) == (size_t)len ? 0 : -1;
+}
+
+LispWriter lisp_writer_new(LispWriterSink sink, void* ctx)
+{
+	LispWriter writer = malloc(sizeof(struct LispWriter_));
+	if (writer == NULL)
+		return NULL;
+	writer->size = writer->capacity = 0;
+	writer->data = NULL;
+	writer->sink = sink;
+	writer->ctx = ctx;
+	writer->owned = 1;
+	return writer;
+}
+
+void lisp_writer_init(LispWriter writer, LispWriterSink sink, void* ctx, char* buffer, int capacity)
+{
+	writer->size = 0;
+	writer->capacity = capacity;
+	writer->data = buffer;
+	writer->sink = sink;
+	writer->ctx = ctx;
+	writer->owned = 0;
+}
+
+LispWriter lisp_writer_new_file(FILE* file)
+{
+	return lisp_writer_new(lisp_writer_file_sink, file);
+}
+
+void lisp_writer_free(LispWriter writer)
+{
+	lisp_writer_finish(writer);
+	free(writer);
+}
+
+void lisp_writer_finish(LispWriter writer)
+{
+	lisp_writer_flush(writer);
+	if (writer->owned)
+		free(writer->data);
+	writer->data = NULL;
+	writer->size = writer->capacity = 0;
+}
+
+error_t lisp_writer_flush(LispWriter writer)
+{
+	if (writer->sink == NULL || writer->size == 0)
+		return E_SUCCESS;
+	int err = writer->sink(writer->ctx, writer->data, writer->size);
+	writer->size = 0;
+	return err == 0 ? E_SUCCESS : E_IO_ERROR;
+}
+
+void lisp_writer_clear(LispWriter writer)
+{
+	writer->size = 0;
+}
+
+// Make room for at least n more bytes, flushing to the sink first if there is one
+error_t lisp_writer_reserve(LispWriter writer, int n)
+{
+	if (writer->size + n <= writer->capacity)
+		return E_SUCCESS;
+	if (writer->sink != NULL) {
+		error_t err = lisp_writer_flush(writer);
+		if (err != E_SUCCESS)
+			return err;
+		if (n <= writer->capacity)
+			return E_SUCCESS;
+	}
+	int new_capacity = writer->capacity == 0 ? LISP_WRITER_BLOCK_SIZE : writer->capacity;
+	while (new_capacity < writer->size + n)
+		new_capacity *= 2;
+	char* data;
+	if (writer->owned) {
+		data = realloc(writer->data, new_capacity);
+	}
+	else {
+		// Leave the lent buffer to its owner
+		data = malloc(new_capacity);
+		if (data != NULL)
+			memcpy(data, writer->data, writer->size);
+	}
+	if (data == NULL)
+		return E_MEMORY_ERROR;
+	writer->data = data;
+	writer->owned = 1;
+	writer->capacity = new_capacity;
+	return E_SUCCESS;
+}
+
+error_t lisp_writer_write(LispWriter writer, const char* data, int len)
+{
+	if (writer->sink != NULL && (len >= LISP_WRITER_BLOCK_SIZE || (!writer->owned && len >= writer->capacity))) {
+		// Too big to be worth buffering, so pass it straight through
+		error_t err = lisp_writer_flush(writer);
+		if (err != E_SUCCESS)
+			return err;
+		return writer->sink(writer->ctx, data, len) == 0 ? E_SUCCESS : E_IO_ERROR;
+	}
+	error_t err = lisp_writer_reserve(writer, len);
+	if (err != E_SUCCESS)
+		return err;
+	memcpy(writer->data + writer->size, data, len);
+	writer->size += len;
+	return E_SUCCESS;
+}
+
+error_t lisp_writer_putc(LispWriter writer, char c)
+{
+	if (writer->size == writer->capacity) {
+		error_t err = lisp_writer_reserve(writer, 1);
+		if (err != E_SUCCESS)
+			return err;
+	}
+	writer->data[writer->size++] = c;
+	return E_SUCCESS;
+}
+
+error_t lisp_writer_puts(LispWriter writer, const char* str)
+{
+	return lisp_writer_write(writer, str, (int)strlen(str));
+}
+
+error_t lisp_writer_integer(LispWriter writer, int val)
+{
+	// Fill a scratch buffer from the right two digits at a time
+	char buffer[16];
+	char* end = buffer + sizeof(buffer);
+	char* p = end;
+	unsigned int u = val < 0 ? 0u - (unsigned int)val : (unsigned int)val;
+	while (u >= 100) {
+		unsigned int idx = (u % 100) * 2;
+		u /= 100;
+		*--p = digit_pairs[idx + 1];
+		*--p = digit_pairs[idx];
+	}
+	if (u >= 10) {
+		*--p = digit_pairs[u * 2 + 1];
+		*--p = digit_pairs[u * 2];
+	}
+	else {
+		*--p = (char)('0' + u);
+	}
+	if (val < 0)
+		*--p = '-';
+	return lisp_writer_write(writer, p, (int)(end - p));
+}
+
+error_t lisp_writer_varint(LispWriter writer, unsigned int val)
+{
+	char buffer[5];
+	int len = 0;
+	while (val >= 0x80) {
+		buffer[len++] = (char)(val | 0x80);
+		val >>= 7;
+	}
+	buffer[len++] = (char)val;
+	return lisp_writer_write(writer, buffer, len);
+}
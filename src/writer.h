@@ -0,0 +1,55 @@
+#ifndef TINYLISP_WRITER_H
+#define TINYLISP_WRITER_H
+
+#include <stdio.h>
+
+#include "error.h"
+
+// Number of bytes buffered before a writer with a sink hands them on
+#define LISP_WRITER_BLOCK_SIZE 65536
+// Bytes of stack buffer used by the lisp_*_print functions
+#define LISP_PRINT_BUFFER_SIZE 1024
+
+typedef struct LispWriter_ *LispWriter;
+// Receives a block of len bytes; returns 0 on success
+typedef int(*LispWriterSink)(void* ctx, const char* data, int len);
+
+struct LispWriter_
+{
+	int size, capacity;
+	char* data;
+	LispWriterSink sink;
+	void* ctx;
+	// whether data was malloc'd by the writer rather than lent by its caller
+	int owned;
+};
+
+// Sink which writes to the FILE* passed as ctx
+int lisp_writer_file_sink(void* ctx, const char* data, int len);
+// malloc a new writer; if sink is NULL the buffer grows without bound and is never flushed
+LispWriter lisp_writer_new(LispWriterSink sink, void* ctx);
+// malloc a new writer which flushes to file in blocks of LISP_WRITER_BLOCK_SIZE
+LispWriter lisp_writer_new_file(FILE* file);
+// Set up a writer in the caller's storage which buffers in the caller's buffer of capacity bytes, moving
+// to a malloc'd one only if a single write needs more; release it with lisp_writer_finish
+void lisp_writer_init(LispWriter writer, LispWriterSink sink, void* ctx, char* buffer, int capacity);
+// flush any remaining output and free the writer
+void lisp_writer_free(LispWriter writer);
+// flush any remaining output and free any buffer malloc'd by a writer set up with lisp_writer_init
+void lisp_writer_finish(LispWriter writer);
+// hand the buffered bytes to the sink; a no-op for writers without one
+error_t lisp_writer_flush(LispWriter writer);
+// discard the buffered bytes without flushing them
+void lisp_writer_clear(LispWriter writer);
+// append len bytes of data
+error_t lisp_writer_write(LispWriter writer, const char* data, int len);
+// append a single character
+error_t lisp_writer_putc(LispWriter writer, char c);
+// append a nul-terminated string
+error_t lisp_writer_puts(LispWriter writer, const char* str);
+// append the decimal representation of val
+error_t lisp_writer_integer(LispWriter writer, int val);
+// append val as an LEB128 varint of one to five bytes
+error_t lisp_writer_varint(LispWriter writer, unsigned int val);
+
+#endif
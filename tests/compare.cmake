@@ -0,0 +1,31 @@
+# Runs the interpreter on SCRIPT and checks that its output matches EXPECTED,
+# ignoring trailing whitespace. ARGS is a space separated list of extra options, and INPUT a file to read
+# stdin from.
+#
+# cmake -DINTERPRETER=<path> [-DARGS=<options>] [-DINPUT=<file>] -DSCRIPT=<file.tl> -DEXPECTED=<file.out> -P compare.cmake
+
+separate_arguments(ARGS)
+set(input_args)
+if (INPUT)
+	set(input_args INPUT_FILE ${INPUT})
+endif()
+execute_process(
+	COMMAND ${INTERPRETER} ${ARGS} ${SCRIPT}
+	${input_args}
+	OUTPUT_VARIABLE actual
+	ERROR_VARIABLE errors
+	RESULT_VARIABLE result
+)
+file(READ ${EXPECTED} expected)
+
+string(REGEX REPLACE "[ \t\r\n]+$" "" actual "${actual}")
+string(REGEX REPLACE "[ \t\r\n]+$" "" expected "${expected}")
+string(REPLACE "\r\n" "\n" actual "${actual}")
+string(REPLACE "\r\n" "\n" expected "${expected}")
+
+if (NOT actual STREQUAL expected)
+	message(FATAL_ERROR "Output of ${SCRIPT} did not match ${EXPECTED}\n--- expected\n${expected}\n--- actual\n${actual}\n${errors}")
+endif()
+if (NOT result EQUAL 0)
+	message(FATAL_ERROR "${SCRIPT} exited with ${result}\n${errors}")
+endif()
@@ -0,0 +1,68 @@
+// Steps resumable evaluations under memory budgets in turns on one thread, as an event loop host would,
+// and checks that each is charged only for what it holds itself. Exits with 0 if every check passes.
+#include <stdio.h>
+
+#include "tinylisp.h"
+#include "parse.h"
+#include "resume.h"
+
+// Build lists of 2000 and 8000 integers, holding each until the evaluation finishes; alone, the first
+// holds about 48 kB and the second about 190 kB
+#define RESUME_SMALL "(loop ((i 0 (s i (s 0 1))) (xs () (c i xs))) (l i 2000) (len xs))"
+#define RESUME_LARGE "(loop ((i 0 (s i (s 0 1))) (xs () (c i xs))) (l i 8000) (len xs))"
+// The memory budget of every evaluation, which one small evaluation fits in but two together do not
+#define RESUME_MAX_BYTES (64 * 1024)
+// Steps each evaluation runs for before the next one's turn
+#define RESUME_SLICE 50
+
+int failures = 0;
+
+// Step an evaluation of each of the n texts in turn, each in an interpreter of its own, until all have
+// finished; the i-th must succeed if ok[i] and be stopped by its budget otherwise
+void run(char* name, char** texts, int* ok, int n)
+{
+	TinyLisp lisps[2];
+	LispEval evals[2];
+	for (int i = 0; i < n; ++i) {
+		lisps[i] = lisp_new();
+		lisps[i]->budget.max_bytes = RESUME_MAX_BYTES;
+		int pos = 0;
+		LispObject expr = lisp_parse(lisps[i], texts[i], &pos);
+		evals[i] = lisp_eval_begin(lisps[i], expr);
+		lisp_object_free(expr);
+	}
+	int running = n;
+	while (running > 0) {
+		running = 0;
+		for (int i = 0; i < n; ++i)
+			running += !lisp_eval_step(evals[i], RESUME_SLICE);
+	}
+	for (int i = 0; i < n; ++i) {
+		LispObject res = lisp_eval_result(evals[i]);
+		if (res != NULL && !ok[i]) {
+			printf("%s: evaluation %d was not stopped by its budget\n", name, i);
+			++failures;
+		}
+		else if (res == NULL && (ok[i] || lisps[i]->err_code != E_BUDGET_EXCEEDED)) {
+			printf("%s: evaluation %d failed: ", name, i);
+			lisp_print_error(lisps[i]);
+			++failures;
+		}
+		if (res != NULL)
+			lisp_object_free(res);
+		lisp_eval_free(evals[i]);
+		lisp_free(lisps[i]);
+	}
+}
+
+int main(void)
+{
+	char* small_pair[] = { RESUME_SMALL, RESUME_SMALL };
+	char* mixed_pair[] = { RESUME_LARGE, RESUME_SMALL };
+	int both[] = { 1, 1 };
+	int second[] = { 0, 1 };
+	run("alone", small_pair, both, 1);
+	run("interleaved", small_pair, both, 2);
+	run("over budget", mixed_pair, second, 2);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Starts tinylisp --serve on a temporary socket with the options and script, sends it each line of stdin on
+# one connection, then checks that a definition made there is not seen on a new one, and stops the server.
+#
+# sh serve.sh <tinylisp> <tinylisp_load> [options...] <script> < requests
+
+tinylisp=$1
+load=$2
+shift 2
+dir=$(mktemp -d) || exit 1
+"$tinylisp" --serve "$dir/serve.sock" "$@" 2>/dev/null &
+server=$!
+"$load" "$dir/serve.sock"
+status=$?
+echo "x" | "$load" "$dir/serve.sock" || status=1
+kill $server
+wait $server || status=1
+rmdir "$dir" || status=1
+exit $status